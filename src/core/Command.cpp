@@ -732,7 +732,15 @@ void UpdateEntryCommand::Doit(const CUUID &entry_uuid,
 {
   ItemListIter pos = m_pcomInt->Find(entry_uuid);
   if (pos != m_pcomInt->GetEntryEndIter()) {
-    if (ftype != CItemData::PASSWORD)
+    if (ftype == CItemData::GROUP) {
+      const StringX sxOldGroup = pos->second.GetGroup();
+      pos->second.SetFieldValue(ftype, value);
+      m_pcomInt->UpdateGroupTree(entry_uuid, sxOldGroup, value);
+    } else if (ftype == CItemData::URL) {
+      const StringX sxOldURL = pos->second.GetURL();
+      pos->second.SetFieldValue(ftype, value);
+      m_pcomInt->UpdateURLIndex(entry_uuid, sxOldURL, value);
+    } else if (ftype != CItemData::PASSWORD)
       pos->second.SetFieldValue(ftype, value);
     else {
       if (efn == UpdateGUICommand::WN_EXECUTE_REDO) {
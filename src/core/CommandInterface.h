@@ -98,6 +98,11 @@ class CommandInterface {
                                  const StringX &value) = 0;
   virtual void RemoveExpiryEntry(const CItemData &ci) = 0;
 
+  virtual void UpdateGroupTree(const pws_os::CUUID &uuid, const StringX &sxOldGroup,
+                               const StringX &sxNewGroup) = 0;
+  virtual void UpdateURLIndex(const pws_os::CUUID &uuid, const StringX &sxOldURL,
+                              const StringX &sxNewURL) = 0;
+
   virtual const PSWDPolicyMap &GetPasswordPolicies() = 0;
   virtual bool SetPasswordPolicies(const PSWDPolicyMap &MapPSWDPLC) = 0;
   virtual bool AddPolicy(const StringX &sxPolicyName, const PWPolicy &st_pp,
@@ -0,0 +1,311 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+// file CoreAudit.cpp
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------
+// Password audit - PWScore member functions
+//
+// Each password is decrypted in turn, scored, and reduced to an HMAC
+// keyed with a random per-audit key, after which the plaintext is
+// discarded. Reuse is found by grouping equal HMACs in a hash table, so
+// the whole audit is O(N), and no collection of plaintext passwords (or
+// of unkeyed hashes of them) ever exists.
+//
+// Entries are split into contiguous ranges, one per thread. An entry is
+// only ever accessed by the thread that owns its range, as decrypting a
+// field lazily creates the entry's cipher object.
+//-----------------------------------------------------------------
+#include "PWScore.h"
+#include "PWCharPool.h"
+#include "PWSprefs.h"
+#include "PWSrand.h"
+#include "core.h"
+#include "Util.h"
+#include "Report.h"
+#include "sha256.h"
+#include "hmac.h"
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+
+  struct AuditDigest {
+    unsigned char d[SHA256::HASHLEN];
+    bool operator==(const AuditDigest &that) const
+    {return memcmp(d, that.d, sizeof(d)) == 0;}
+  };
+
+  struct AuditDigestHash {
+    // Digests are keyed HMACs, hence uniformly distributed
+    size_t operator()(const AuditDigest &ad) const
+    {size_t h; memcpy(&h, ad.d, sizeof(h)); return h;}
+  };
+
+  struct AuditItem {
+    const CItemData *pci;
+    const PWPolicy *pPolicy; // NULL if entry has its own policy
+  };
+
+  struct AuditRecord {
+    AuditDigest digest;
+    st_AuditPassword ap;
+  };
+
+  // Stop at the first problem, as we only report conformance
+  bool ConformsToPolicy(const StringX &sxPassword, const PWPolicy &pwp)
+  {
+    if (pwp.flags == 0)
+      return true; // nothing to conform to
+
+    if (sxPassword.length() < size_t(pwp.length))
+      return false;
+
+    if (pwp.flags & PWPolicy::UseHexDigits) {
+      return sxPassword.find_first_not_of(_T("0123456789abcdefABCDEF")) ==
+               StringX::npos;
+    }
+
+    int numLower(0), numUpper(0), numDigits(0), numSymbols(0);
+    for (size_t i = 0; i < sxPassword.length(); i++) {
+      const charT c = sxPassword[i];
+      if (_istlower(c)) numLower++;
+      else if (_istupper(c)) numUpper++;
+      else if (_istdigit(c)) numDigits++;
+      else if (pwp.symbols.empty() || pwp.symbols.find(c) != StringX::npos)
+        numSymbols++;
+      else
+        return false; // symbol not in policy's set
+    }
+
+    const struct {int num; uint16 flag; int minlength;} tests[] = {
+      {numLower, PWPolicy::UseLowercase, pwp.lowerminlength},
+      {numUpper, PWPolicy::UseUppercase, pwp.upperminlength},
+      {numDigits, PWPolicy::UseDigits, pwp.digitminlength},
+      {numSymbols, PWPolicy::UseSymbols, pwp.symbolminlength},
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+      if (pwp.flags & tests[i].flag) {
+        if (tests[i].num < tests[i].minlength)
+          return false;
+      } else if (tests[i].num > 0)
+        return false;
+    }
+    return true;
+  }
+
+  void AuditRange(const vector<AuditItem> &vItems, size_t begin, size_t end,
+                  const st_AuditOptions &st_ao, const unsigned char *key,
+                  vector<AuditRecord> &vRecords)
+  {
+    HMAC_SHA256 hmac(key, SHA256::HASHLEN); // keyed once, reused per digest
+    StringX sxError;
+
+    auto digest = [&hmac](const StringX &sxPassword, AuditDigest &ad) {
+      hmac.Update(reinterpret_cast<const unsigned char *>(sxPassword.data()),
+                  static_cast<unsigned long>(sxPassword.length() * sizeof(charT)));
+      hmac.Final(ad.d);
+    };
+
+    for (size_t i = begin; i < end; i++) {
+      const CItemData &ci = *vItems[i].pci;
+
+      AuditRecord rec;
+      rec.ap.uuid = ci.GetUUID();
+      {
+        const StringX sxPassword = ci.GetPassword();
+        rec.ap.dEntropy = CPasswordCharPool::EstimateEntropy(sxPassword);
+        rec.ap.bWeak = rec.ap.dEntropy < st_ao.dMinEntropy ||
+                       !CPasswordCharPool::CheckPassword(sxPassword, sxError);
+        if (vItems[i].pPolicy != NULL) {
+          rec.ap.bConforms = ConformsToPolicy(sxPassword, *vItems[i].pPolicy);
+        } else {
+          PWPolicy pwp;
+          ci.GetPWPolicy(pwp);
+          rec.ap.bConforms = ConformsToPolicy(sxPassword, pwp);
+        }
+        digest(sxPassword, rec.digest);
+      }
+      vRecords.push_back(rec);
+
+      if (st_ao.bIncludeHistory && ci.IsPasswordHistorySet()) {
+        const size_t num = ci.GetPWHistoryCount();
+        for (size_t ih = 0; ih < num; ih++) {
+          AuditRecord hrec;
+          hrec.ap.uuid = rec.ap.uuid;
+          hrec.ap.iHistory = static_cast<int>(ih);
+          digest(ci.GetPWHistoryPassword(ih), hrec.digest);
+          vRecords.push_back(hrec);
+        }
+      }
+    }
+  }
+} // anonymous namespace
+
+void PWScore::AuditPasswords(const st_AuditOptions &st_ao, st_AuditResults &st_ar,
+                             CReport *pRpt) const
+{
+  st_ar = st_AuditResults();
+
+  // Resolve policies here, as named ones need m_MapPSWDPLC & preferences.
+  // Entries with no policy, the default policy's name, or an unknown
+  // name are held to the default policy.
+  const PWPolicy defaultPolicy = PWSprefs::GetInstance()->GetDefaultPolicy();
+
+  vector<AuditItem> vItems;
+  vItems.reserve(m_pwlist.size());
+  for (auto iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++) {
+    const CItemData &ci = iter->second;
+    if (ci.IsDependent())
+      continue; // no password of their own
+
+    AuditItem item = {&ci, &defaultPolicy};
+    if (ci.IsPolicyNameSet()) {
+      PSWDPolicyMapCIter pol_iter = m_MapPSWDPLC.find(ci.GetPolicyName());
+      if (pol_iter != m_MapPSWDPLC.end())
+        item.pPolicy = &pol_iter->second;
+    } else if (ci.IsPasswordPolicySet()) {
+      item.pPolicy = NULL;
+    }
+    vItems.push_back(item);
+  }
+  st_ar.numEntries = vItems.size();
+
+  unsigned char key[SHA256::HASHLEN];
+  PWSrand::GetInstance()->GetRandomData(key, sizeof(key));
+
+  // Not worth a thread for fewer than this many entries
+  const size_t MinPerThread = 64;
+  size_t numThreads = st_ao.nThreads != 0 ? st_ao.nThreads :
+                                            thread::hardware_concurrency();
+  numThreads = max(size_t(1), min(numThreads, vItems.size() / MinPerThread));
+
+  vector<vector<AuditRecord> > vvRecords(numThreads);
+  vector<thread> vThreads;
+  const size_t perThread = (vItems.size() + numThreads - 1) / numThreads;
+  for (size_t t = 1; t < numThreads; t++) {
+    const size_t begin = min(t * perThread, vItems.size());
+    const size_t end = min(begin + perThread, vItems.size());
+    vThreads.push_back(thread(AuditRange, cref(vItems), begin, end, cref(st_ao),
+                              key, ref(vvRecords[t])));
+  }
+  AuditRange(vItems, 0, min(perThread, vItems.size()), st_ao, key, vvRecords[0]);
+  for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+    iter->join();
+
+  trashMemory(key, sizeof(key));
+
+  // Merge: flag weak & non-conforming, cluster by digest
+  unordered_map<AuditDigest, vector<st_AuditPassword>, AuditDigestHash> mapClusters;
+  for (auto vr_iter = vvRecords.begin(); vr_iter != vvRecords.end(); vr_iter++) {
+    for (auto iter = vr_iter->begin(); iter != vr_iter->end(); iter++) {
+      const st_AuditPassword &ap = iter->ap;
+      st_ar.numPasswords++;
+      if (ap.iHistory < 0) {
+        if (ap.bWeak)
+          st_ar.numWeak++;
+        if (!ap.bConforms)
+          st_ar.numNonConforming++;
+        if (ap.bWeak || !ap.bConforms)
+          st_ar.vFlagged.push_back(ap);
+      }
+      mapClusters[iter->digest].push_back(ap);
+    }
+  }
+
+  for (auto iter = mapClusters.begin(); iter != mapClusters.end(); iter++) {
+    const vector<st_AuditPassword> &vap = iter->second;
+    const size_t numCurrent = count_if(vap.begin(), vap.end(),
+                                       [](const st_AuditPassword &ap) {return ap.iHistory < 0;});
+    // A history password on its own is uninteresting, as is an entry's
+    // current password being in its history (can't tell reuse from a
+    // change that was undone)
+    if (numCurrent == 0 || vap.size() < 2)
+      continue;
+    bool bSeveralEntries = false;
+    for (size_t i = 1; i < vap.size() && !bSeveralEntries; i++)
+      bSeveralEntries = vap[i].uuid != vap[0].uuid;
+    if (!bSeveralEntries)
+      continue;
+    st_ar.numReused += numCurrent;
+    st_ar.vReused.push_back(vap);
+  }
+
+  if (pRpt == NULL)
+    return;
+
+  // Report in a stable order, i.e., by group/title/user
+  auto gtu_less = [this](const st_AuditPassword &a, const st_AuditPassword &b) {
+    const CItemData &ca = Find(a.uuid)->second, &cb = Find(b.uuid)->second;
+    if (ca.GetGroup() != cb.GetGroup()) return ca.GetGroup() < cb.GetGroup();
+    if (ca.GetTitle() != cb.GetTitle()) return ca.GetTitle() < cb.GetTitle();
+    if (ca.GetUser() != cb.GetUser()) return ca.GetUser() < cb.GetUser();
+    return a.iHistory < b.iHistory;
+  };
+  auto write_entry = [this, pRpt](const st_AuditPassword &ap, const stringT &sxExtra) {
+    const CItemData &ci = Find(ap.uuid)->second;
+    stringT cs_line;
+    Format(cs_line, IDSC_VALIDATE_ENTRY, ci.GetGroup().c_str(),
+           ci.GetTitle().c_str(), ci.GetUser().c_str(), sxExtra.c_str());
+    pRpt->WriteLine(cs_line);
+  };
+
+  stringT cs_text;
+  Format(cs_text, IDSC_AUDIT_SUMMARY, int(st_ar.numPasswords), int(st_ar.numEntries),
+         int(st_ar.numWeak), int(st_ar.numNonConforming), int(st_ar.numReused));
+  pRpt->WriteLine(cs_text);
+
+  vector<st_AuditPassword> vap(st_ar.vFlagged);
+  sort(vap.begin(), vap.end(), gtu_less);
+  if (st_ar.numWeak != 0) {
+    pRpt->WriteLine();
+    LoadAString(cs_text, IDSC_AUDIT_WEAK);
+    pRpt->WriteLine(cs_text);
+    for (auto iter = vap.begin(); iter != vap.end(); iter++) {
+      if (iter->bWeak) {
+        Format(cs_text, IDSC_AUDIT_ENTROPY, int(iter->dEntropy));
+        write_entry(*iter, cs_text);
+      }
+    }
+  }
+  if (st_ar.numNonConforming != 0) {
+    pRpt->WriteLine();
+    LoadAString(cs_text, IDSC_AUDIT_NONCONFORMING);
+    pRpt->WriteLine(cs_text);
+    for (auto iter = vap.begin(); iter != vap.end(); iter++) {
+      if (!iter->bConforms)
+        write_entry(*iter, _T(""));
+    }
+  }
+
+  if (!st_ar.vReused.empty()) {
+    vector<vector<st_AuditPassword> > vvap(st_ar.vReused);
+    for (auto iter = vvap.begin(); iter != vvap.end(); iter++)
+      sort(iter->begin(), iter->end(), gtu_less);
+    sort(vvap.begin(), vvap.end(),
+         [&gtu_less](const vector<st_AuditPassword> &a, const vector<st_AuditPassword> &b)
+         {return gtu_less(a.front(), b.front());});
+
+    stringT cs_history;
+    LoadAString(cs_history, IDSC_AUDIT_HISTORY);
+    LoadAString(cs_text, IDSC_AUDIT_REUSED);
+    for (auto vv_iter = vvap.begin(); vv_iter != vvap.end(); vv_iter++) {
+      pRpt->WriteLine();
+      pRpt->WriteLine(cs_text);
+      for (auto iter = vv_iter->begin(); iter != vv_iter->end(); iter++)
+        write_entry(*iter, iter->iHistory < 0 ? _T("") : cs_history);
+    }
+  }
+}
@@ -12,9 +12,6 @@
 #include "ItemData.h"
 #include "os/funcwrap.h"
 
-#include <functional>
-#include <algorithm>
-
 using namespace std;
 
 ExpPWEntry::ExpPWEntry(const CItemData &ci)
@@ -44,23 +41,36 @@ void ExpiredList::Add(const CItemData &ci)
   // that doesn't have an expiration date - check!
   time_t tttXTime;
   ci.GetXTime(tttXTime);
-  if (tttXTime != time_t(0))
-    push_back(ExpPWEntry(ci));
+  if (tttXTime == time_t(0))
+    return;
+
+  const ExpPWEntry ee(ci);
+  Remove(ee.uuid); // at most one entry per UUID
+  m_byUUID[ee.uuid] = m_byTime.insert(make_pair(ee.expirytttXTime, ee.uuid));
 }
 
-void ExpiredList::Remove(const CItemData &ci)
+void ExpiredList::Remove(const pws_os::CUUID &uuid)
 {
-  ExpiredList::iterator iter = std::find_if(begin(), end(),
-                                            std::bind2nd(std::equal_to<pws_os::CUUID>(),
-                                                         ci.GetUUID()));
-  if (iter != end())
-    erase(iter);
+  auto iter = m_byUUID.find(uuid);
+  if (iter != m_byUUID.end()) {
+    m_byTime.erase(iter->second);
+    m_byUUID.erase(iter);
+  }
 }
 
-ExpiredList ExpiredList::GetExpired(const int &idays)
+bool ExpiredList::SetExpiryTime(const pws_os::CUUID &uuid, time_t tttXTime)
+{
+  auto iter = m_byUUID.find(uuid);
+  if (iter == m_byUUID.end())
+    return false;
+
+  m_byTime.erase(iter->second);
+  iter->second = m_byTime.insert(make_pair(tttXTime, uuid));
+  return true;
+}
+
+time_t ExpiredList::GetExpiryLimit(const int &idays)
 {
-  ExpiredList retval;
-  ExpiredList::iterator iter;
   struct tm st;
 
   time_t now, exptime=time_t(-1);
@@ -76,11 +86,25 @@ ExpiredList ExpiredList::GetExpired(const int &idays)
 
   if (exptime == time_t(-1))
     exptime = now;
+  return exptime;
+}
 
-  for (iter = begin(); iter != end(); iter++) {
-    if (iter->expirytttXTime < exptime) {
-      retval.push_back(*iter);
-    }
-  }
+ExpPWEntryList ExpiredList::GetExpired(const int &idays) const
+{
+  return GetExpiringBefore(GetExpiryLimit(idays));
+}
+
+ExpPWEntryList ExpiredList::GetExpiringBefore(time_t tttLimit) const
+{
+  ExpPWEntryList retval;
+  const ByTime::const_iterator limit = m_byTime.lower_bound(tttLimit);
+  for (ByTime::const_iterator iter = m_byTime.begin(); iter != limit; iter++)
+    retval.push_back(ExpPWEntry(iter->second, iter->first));
   return retval;
 }
+
+time_t ExpiredList::GetNextExpiry(time_t tttFrom) const
+{
+  const ByTime::const_iterator iter = m_byTime.lower_bound(tttFrom);
+  return iter != m_byTime.end() ? iter->first : time_t(0);
+}
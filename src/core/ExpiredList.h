@@ -16,9 +16,11 @@
 #include "ItemData.h"
 
 #include <vector>
+#include <map>
 
 struct ExpPWEntry {
   ExpPWEntry(const CItemData &ci);
+  ExpPWEntry(const pws_os::CUUID &u, time_t t) : uuid(u), expirytttXTime(t) {}
   ExpPWEntry(const ExpPWEntry &ee) : uuid(ee.uuid), expirytttXTime(ee.expirytttXTime) {}
   ExpPWEntry &operator=(const ExpPWEntry &that) {
     if (this != &that) {
@@ -33,13 +35,41 @@ struct ExpPWEntry {
   time_t expirytttXTime;
 };
 
-class ExpiredList: public std::vector<ExpPWEntry>
+typedef std::vector<ExpPWEntry> ExpPWEntryList;
+
+// Entries with an expiry date, ordered by expiry time, with an index by
+// UUID so that updates are O(log N), and queries only visit the entries
+// they return.
+class ExpiredList
 {
 public:
   void Add(const CItemData &ci);
   void Update(const CItemData &ci) {Remove(ci); Add(ci);}
-  void Remove(const CItemData &ci);
-  ExpiredList GetExpired(const int &idays); // return a subset
+  void Remove(const CItemData &ci) {Remove(ci.GetUUID());}
+  void Remove(const pws_os::CUUID &uuid);
+  // Returns false if uuid's not in the list
+  bool SetExpiryTime(const pws_os::CUUID &uuid, time_t tttXTime);
+
+  void clear() {m_byTime.clear(); m_byUUID.clear();}
+  size_t size() const {return m_byUUID.size();}
+  bool empty() const {return m_byUUID.empty();}
+
+  // Entries expiring within idays days from now (or expired), soonest first
+  ExpPWEntryList GetExpired(const int &idays) const;
+  // Entries expiring before tttLimit, soonest first
+  ExpPWEntryList GetExpiringBefore(time_t tttLimit) const;
+  // Earliest expiry time not before tttFrom, or 0 if none, e.g.,
+  // GetNextExpiry(GetExpiryLimit(idays)) - idays days is when the next
+  // entry will join GetExpired(idays)
+  time_t GetNextExpiry(time_t tttFrom = 0) const;
+
+  // Now + idays days, as used by GetExpired
+  static time_t GetExpiryLimit(const int &idays);
+
+private:
+  typedef std::multimap<time_t, pws_os::CUUID> ByTime;
+  ByTime m_byTime;
+  std::map<pws_os::CUUID, ByTime::iterator> m_byUUID;
 };
 
 #endif /* __EXPIREDLIST_H */
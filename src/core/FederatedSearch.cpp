@@ -0,0 +1,186 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+// file FederatedSearch.cpp
+//-----------------------------------------------------------------------------
+
+#include "FederatedSearch.h"
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+  // Runs fn(i) for each i in [0, n) on up to nThreads threads (0 = one per
+  // processor), each thread taking the next i as soon as it's free. The
+  // calling thread is one of them.
+  void ForEach(size_t n, const function<void(size_t)> &fn, unsigned nThreads)
+  {
+    size_t numThreads = nThreads != 0 ? nThreads : thread::hardware_concurrency();
+    numThreads = max(size_t(1), min(numThreads, n));
+
+    atomic<size_t> next(0);
+    auto Worker = [&next, n, &fn]() {
+      for (size_t i = next++; i < n; i = next++)
+        fn(i);
+    };
+
+    vector<thread> vThreads;
+    for (size_t t = 1; t < numThreads; t++)
+      vThreads.push_back(thread(Worker));
+    Worker();
+    for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+      iter->join();
+  }
+
+  // Text fields searched by Find(), as in the UI's search bar
+  const CItemData::FieldType SearchFields[] = {
+    CItemData::GROUP, CItemData::TITLE, CItemData::USER,
+    CItemData::PASSWORD, CItemData::NOTES, CItemData::URL,
+    CItemData::EMAIL, CItemData::RUNCMD, CItemData::AUTOTYPE,
+  };
+
+  st_FederatedMatch MakeMatch(size_t iDB, const CItemData &ci,
+                              CItemData::FieldType ft)
+  {
+    st_FederatedMatch fm;
+    fm.iDB = iDB;
+    fm.uuid = ci.GetUUID();
+    fm.group = ci.GetGroup();
+    fm.title = ci.GetTitle();
+    fm.user = ci.GetUser();
+    fm.ft = ft;
+    return fm;
+  }
+}
+
+FederatedSearch::FederatedSearch()
+{
+}
+
+FederatedSearch::~FederatedSearch()
+{
+  Close();
+}
+
+size_t FederatedSearch::Open(const vector<st_FederatedDB> &vDBs,
+                             vector<int> &vStatus, unsigned nThreads)
+{
+  Close();
+
+  // Cores are created here, as the first one initialises static data
+  m_vNames.reserve(vDBs.size());
+  m_vCores.reserve(vDBs.size());
+  for (auto iter = vDBs.begin(); iter != vDBs.end(); iter++) {
+    m_vNames.push_back(iter->filename);
+    m_vCores.push_back(new PWSAuxCore);
+  }
+
+  vStatus.assign(vDBs.size(), PWScore::FAILURE);
+  ForEach(vDBs.size(), [this, &vDBs, &vStatus](size_t i) {
+      vStatus[i] = m_vCores[i]->ReadFile(vDBs[i].filename, vDBs[i].passkey);
+    }, nThreads);
+
+  size_t numRead(0);
+  for (size_t i = 0; i < m_vCores.size(); i++) {
+    if (vStatus[i] == PWScore::SUCCESS) {
+      numRead++;
+    } else {
+      delete m_vCores[i];
+      m_vCores[i] = NULL;
+    }
+  }
+  return numRead;
+}
+
+void FederatedSearch::Close()
+{
+  for (auto iter = m_vCores.begin(); iter != m_vCores.end(); iter++)
+    delete *iter;
+  m_vCores.clear();
+  m_vNames.clear();
+}
+
+size_t FederatedSearch::Find(const StringX &sxText,
+                             const CItemData::FieldBits &bsFields,
+                             bool bCaseSensitive, const Callback &cb,
+                             unsigned nThreads)
+{
+  if (sxText.empty())
+    return 0;
+
+  StringX sxFind(sxText);
+  if (!bCaseSensitive)
+    ToLower(sxFind);
+
+  mutex cb_mutex;
+  size_t numMatches(0);
+
+  ForEach(m_vCores.size(), [&](size_t iDB) {
+      PWSAuxCore *pcore = m_vCores[iDB];
+      if (pcore == NULL)
+        return;
+
+      vector<st_FederatedMatch> vMatches;
+      for (auto iter = pcore->GetEntryIter(); iter != pcore->GetEntryEndIter(); iter++) {
+        const CItemData &ci = iter->second;
+        for (size_t i = 0; i < NumberOf(SearchFields); i++) {
+          const CItemData::FieldType ft = SearchFields[i];
+          if (!bsFields.test(ft))
+            continue;
+          StringX sxValue = ci.GetFieldValue(ft);
+          if (!bCaseSensitive)
+            ToLower(sxValue);
+          if (sxValue.find(sxFind) != StringX::npos) {
+            vMatches.push_back(MakeMatch(iDB, ci, ft));
+            break;
+          }
+        }
+      }
+
+      if (!vMatches.empty()) {
+        lock_guard<mutex> lock(cb_mutex);
+        numMatches += vMatches.size();
+        cb(vMatches);
+      }
+    }, nThreads);
+
+  return numMatches;
+}
+
+size_t FederatedSearch::Find(PWSFilterManager &fm, const Callback &cb,
+                             unsigned nThreads)
+{
+  mutex cb_mutex;
+  size_t numMatches(0);
+
+  // PassesFiltering doesn't change fm, so all threads can share it
+  ForEach(m_vCores.size(), [&](size_t iDB) {
+      PWSAuxCore *pcore = m_vCores[iDB];
+      if (pcore == NULL)
+        return;
+
+      vector<st_FederatedMatch> vMatches;
+      for (auto iter = pcore->GetEntryIter(); iter != pcore->GetEntryEndIter(); iter++) {
+        const CItemData &ci = iter->second;
+        if (fm.PassesFiltering(ci, *pcore))
+          vMatches.push_back(MakeMatch(iDB, ci, CItemData::END));
+      }
+
+      if (!vMatches.empty()) {
+        lock_guard<mutex> lock(cb_mutex);
+        numMatches += vMatches.size();
+        cb(vMatches);
+      }
+    }, nThreads);
+
+  return numMatches;
+}
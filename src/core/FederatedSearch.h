@@ -0,0 +1,90 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// FederatedSearch.h
+//-----------------------------------------------------------------------------
+
+#ifndef __FEDERATEDSEARCH_H
+#define __FEDERATEDSEARCH_H
+
+#include "PWScore.h"
+#include "PWSFilters.h"
+#include "StringX.h"
+#include "os/UUID.h"
+
+#include <vector>
+#include <functional>
+
+// Search several databases at once, e.g., "which of our team safes
+// has the entry for host X?"
+//
+// Each database is read into its own PWSAuxCore, several at a time so
+// that the key stretching of one overlaps with that of the others. A
+// query is then run over all of them on a pool of threads. A database is
+// only ever accessed by one thread at a time, since decrypting a field
+// lazily creates the entry's cipher object (and filters may follow an
+// alias to its base entry).
+
+struct st_FederatedDB {
+  st_FederatedDB() {}
+  st_FederatedDB(const StringX &fn, const StringX &pk)
+    : filename(fn), passkey(pk) {}
+
+  StringX filename;
+  StringX passkey;
+};
+
+struct st_FederatedMatch {
+  st_FederatedMatch() : iDB(0), ft(CItemData::END) {}
+
+  size_t iDB; // index into the databases passed to Open()
+  pws_os::CUUID uuid;
+  StringX group, title, user;
+  CItemData::FieldType ft; // first field that matched, END for a filter
+};
+
+class FederatedSearch
+{
+public:
+  // Called with each database's matches, in entry order, as soon as
+  // that database has been searched. Calls are never concurrent, but
+  // are made on the search's threads, and databases finish in no
+  // particular order.
+  typedef std::function<void(const std::vector<st_FederatedMatch> &)> Callback;
+
+  FederatedSearch();
+  ~FederatedSearch();
+
+  // Reads each database, nThreads at a time (0 = one per processor).
+  // vStatus gets each database's PWScore::ReadFile status. Databases that
+  // couldn't be read are skipped by Find(). Returns number read.
+  size_t Open(const std::vector<st_FederatedDB> &vDBs,
+              std::vector<int> &vStatus, unsigned nThreads = 0);
+  void Close();
+
+  size_t GetNumDBs() const {return m_vCores.size();}
+  const StringX &GetDBName(size_t iDB) const {return m_vNames[iDB];}
+  // NULL if database couldn't be read
+  PWSAuxCore *GetCore(size_t iDB) const {return m_vCores[iDB];}
+
+  // Entries with sxText in any of bsFields (group, title, user, password,
+  // notes, URL, email, run command & autotype are searched).
+  // Returns total number of matches.
+  size_t Find(const StringX &sxText, const CItemData::FieldBits &bsFields,
+              bool bCaseSensitive, const Callback &cb, unsigned nThreads = 0);
+  // Entries passing fm's current filter
+  size_t Find(PWSFilterManager &fm, const Callback &cb, unsigned nThreads = 0);
+
+private:
+  FederatedSearch(const FederatedSearch &); // Do not implement
+  FederatedSearch &operator=(const FederatedSearch &); // Do not implement
+
+  std::vector<StringX> m_vNames;
+  std::vector<PWSAuxCore *> m_vCores;
+};
+
+#endif /* __FEDERATEDSEARCH_H */
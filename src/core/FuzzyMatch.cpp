@@ -0,0 +1,220 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// FuzzyMatch.cpp : implementation file
+//
+
+#include "FuzzyMatch.h"
+#include "os/debug.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+  bool IsWordChar(TCHAR c)
+  {
+    // Anything beyond ASCII is taken as a letter
+    return (c >= _T('a') && c <= _T('z')) || (c >= _T('A') && c <= _T('Z')) ||
+      (c >= _T('0') && c <= _T('9')) || static_cast<unsigned int>(c) >= 0x80;
+  }
+
+  // Start of a word: "Bank" in "My Bank" or "MyBank", "bank" in "my_bank"
+  bool IsBoundary(const StringX &sx, size_t i)
+  {
+    if (i == 0 || !IsWordChar(sx[i - 1]))
+      return true;
+    return sx[i - 1] >= _T('a') && sx[i - 1] <= _T('z') &&
+      sx[i] >= _T('A') && sx[i] <= _T('Z');
+  }
+}
+
+TCHAR FuzzyMatcher::Fold(TCHAR c)
+{
+  const unsigned int u = static_cast<unsigned int>(c);
+  if (u < 0x80)
+    return (u >= 'A' && u <= 'Z') ? static_cast<TCHAR>(u + 0x20) : c;
+
+  unsigned int retval = u;
+  if (u < 0x100) { // Latin-1
+    if (u >= 0xC0 && u <= 0xDE && u != 0xD7)
+      retval = u + 0x20;
+    else if (u == 0xB5) // micro sign
+      retval = 0x3BC;
+  } else if (u < 0x180) { // Latin Extended-A: upper case, then lower
+    if ((u <= 0x12F) || (u >= 0x132 && u <= 0x137) || (u >= 0x14A && u <= 0x177))
+      retval = u | 1;
+    else if ((u >= 0x139 && u <= 0x148) || (u >= 0x179 && u <= 0x17E))
+      retval = (u & 1) ? u + 1 : u;
+    else if (u == 0x178)
+      retval = 0xFF;
+    else if (u == 0x17F) // long s
+      retval = 's';
+  } else if (u >= 0x386 && u <= 0x3AB) { // Greek
+    if (u >= 0x391 && u != 0x3A2)
+      retval = u + 0x20;
+    else if (u == 0x386)
+      retval = 0x3AC;
+    else if (u >= 0x388 && u <= 0x38A)
+      retval = u + 0x25;
+    else if (u == 0x38C)
+      retval = 0x3CC;
+    else if (u == 0x38E || u == 0x38F)
+      retval = u + 0x3F;
+  } else if (u == 0x3C2) { // final sigma
+    retval = 0x3C3;
+  } else if (u >= 0x400 && u <= 0x42F) { // Cyrillic
+    retval = (u < 0x410) ? u + 0x50 : u + 0x20;
+  }
+  return static_cast<TCHAR>(retval);
+}
+
+FuzzyMatcher::FuzzyMatcher(const StringX &sxPattern)
+  : m_pattern(sxPattern), m_maxEdits(0), m_len(0)
+{
+  for (auto iter = m_pattern.begin(); iter != m_pattern.end(); iter++)
+    *iter = Fold(*iter);
+
+  memset(m_peqASCII, 0, sizeof(m_peqASCII));
+  m_len = min(m_pattern.length(), size_t(MAX_PATTERN));
+  m_maxEdits = static_cast<unsigned int>(m_len / 4);
+  for (size_t i = 0; i < m_len; i++) {
+    const TCHAR c = m_pattern[i];
+    const Mask bit = Mask(1) << i;
+    if (static_cast<unsigned int>(c) < 0x80) {
+      m_peqASCII[static_cast<unsigned int>(c)] |= bit;
+    } else {
+      auto iter = find_if(m_peqOther.begin(), m_peqOther.end(),
+                          [c](const pair<TCHAR, Mask> &p) {return p.first == c;});
+      if (iter != m_peqOther.end())
+        iter->second |= bit;
+      else
+        m_peqOther.push_back(make_pair(c, bit));
+    }
+  }
+}
+
+FuzzyMatcher::Mask FuzzyMatcher::Peq(TCHAR c) const
+{
+  if (static_cast<unsigned int>(c) < 0x80)
+    return m_peqASCII[static_cast<unsigned int>(c)];
+  // A pattern has few distinct non-ASCII characters, if any
+  for (auto iter = m_peqOther.begin(); iter != m_peqOther.end(); iter++)
+    if (iter->first == c)
+      return iter->second;
+  return 0;
+}
+
+unsigned int FuzzyMatcher::Distance(const StringX &sxText) const
+{
+  size_t end;
+  return Distance(sxText, end);
+}
+
+unsigned int FuzzyMatcher::Distance(const StringX &sxText, size_t &end) const
+{
+  end = StringX::npos;
+  if (m_len == 0)
+    return 0;
+
+  // Column by column of the edit distance matrix, pattern down the rows,
+  // with a first row of 0s so that a match may start anywhere in the text.
+  // Bit i of VP/VN is set if row i+1's value is one more/less than row i's,
+  // and the value of the last row is tracked in 'score'.
+  const Mask last = Mask(1) << (m_len - 1);
+  Mask VP = (m_len == MAX_PATTERN) ? ~Mask(0) : (last << 1) - 1;
+  Mask VN = 0, D0 = 0, PrevEq = 0;
+  unsigned int score = static_cast<unsigned int>(m_len), best = score;
+
+  for (size_t i = 0; i < sxText.length(); i++) {
+    const Mask Eq = Peq(Fold(sxText[i]));
+    // Hyyrö's term for a transposition of this character and the last one
+    const Mask TR = (((~D0) & Eq) << 1) & PrevEq;
+    D0 = (((Eq & VP) + VP) ^ VP) | Eq | VN | TR;
+    Mask HP = VN | ~(D0 | VP);
+    Mask HN = VP & D0;
+    if (HP & last)
+      score++;
+    else if (HN & last)
+      score--;
+    HP <<= 1;
+    HN <<= 1;
+    VP = HN | ~(D0 | HP);
+    VN = HP & D0;
+    PrevEq = Eq;
+    if (score < best) {
+      best = score;
+      end = i;
+    }
+  }
+  return best;
+}
+
+unsigned int FuzzyMatcher::ScoreFrom(const StringX &sxText, size_t start) const
+{
+  int score = 0;
+  size_t p = 0;
+  bool bPrevMatched = false, bInGap = false;
+  for (size_t i = start; i < sxText.length() && p < m_pattern.length(); i++) {
+    if (Fold(sxText[i]) == m_pattern[p]) {
+      score += SCORE_MATCH;
+      if (bPrevMatched)
+        score += BONUS_CONSECUTIVE;
+      if (IsBoundary(sxText, i))
+        score += BONUS_BOUNDARY;
+      if (i == 0)
+        score += BONUS_FIRST;
+      p++;
+      bPrevMatched = true;
+      bInGap = false;
+    } else if (p > 0) {
+      score -= bInGap ? PENALTY_GAP : PENALTY_GAP_START;
+      bPrevMatched = false;
+      bInGap = true;
+    }
+  }
+  ASSERT(p == m_pattern.length());
+  return score > 0 ? static_cast<unsigned int>(score) : 1;
+}
+
+unsigned int FuzzyMatcher::Score(const StringX &sxText) const
+{
+  const size_t m = m_pattern.length(), n = sxText.length();
+  if (m == 0 || n == 0)
+    return 0;
+
+  unsigned int retval = 0;
+
+  // As a subsequence: find where the first one ends, then the shortest
+  // one ending there, by going back from its end
+  size_t p = 0, end = 0;
+  for (size_t i = 0; i < n; i++)
+    if (Fold(sxText[i]) == m_pattern[p] && ++p == m) {
+      end = i;
+      break;
+    }
+  if (p == m) {
+    size_t start = end;
+    for (;; start--)
+      if (Fold(sxText[start]) == m_pattern[p - 1] && --p == 0)
+        break;
+    retval = ScoreFrom(sxText, start);
+  }
+
+  // As a substring, possibly with typos. A subsequence found above may
+  // well be scattered, whereas an exact substring scores best.
+  const unsigned int d = Distance(sxText, end);
+  if (d == 0 && m == m_len) {
+    retval = max(retval, ScoreFrom(sxText, end + 1 - m));
+  } else if (d <= m_maxEdits) {
+    const int score = int(m_len) * SCORE_MATCH + int(m_len - 1) * BONUS_CONSECUTIVE -
+      int(d) * PENALTY_EDIT;
+    retval = max(retval, score > 0 ? static_cast<unsigned int>(score) : 1U);
+  }
+  return retval;
+}
@@ -0,0 +1,86 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// FuzzyMatch.h
+//-----------------------------------------------------------------------------
+// Typo-tolerant matching of a search pattern against entry fields, so that
+// entries can be found, best first, when a plain substring search finds
+// nothing (see PWScore::FuzzyFind).
+//
+// A text matches if either:
+// - the pattern's characters all appear in it, in order (a subsequence, as
+//   in fuzzy finders: "gml" matches "Gmail"). Consecutive characters and
+//   characters at the start of words score higher, gaps lower; or
+// - some substring of it is within k edits of the pattern, an edit being the
+//   insertion, deletion or substitution of a character, or the transposition
+//   of two adjacent ones ("gmial" matches "Gmail"). k is a quarter of the
+//   pattern's length, so patterns of under 4 characters must match as
+//   subsequences. The distance is computed in one pass over the text with
+//   Myers' bit-parallel algorithm, as extended for transpositions by Hyyrö.
+//   Only the first 64 characters of a longer pattern are considered for this.
+//
+// Characters are compared case folded, independently of the locale: ASCII,
+// Latin-1, Latin Extended-A, Greek and Cyrillic letters are folded. Folding
+// is one to one, so that, e.g., "ß" doesn't match "ss".
+//
+// A FuzzyMatcher doesn't change once constructed, so threads can share one.
+//-----------------------------------------------------------------------------
+
+#ifndef __FUZZYMATCH_H
+#define __FUZZYMATCH_H
+
+#include "StringX.h"
+
+#include <vector>
+#include <utility>
+
+class FuzzyMatcher
+{
+public:
+  // Components of Score()
+  enum {SCORE_MATCH = 16, BONUS_CONSECUTIVE = 8, BONUS_BOUNDARY = 8,
+        BONUS_FIRST = 8, PENALTY_GAP_START = 3, PENALTY_GAP = 1,
+        PENALTY_EDIT = 24};
+  enum {MAX_PATTERN = 64};
+
+  explicit FuzzyMatcher(const StringX &sxPattern);
+
+  bool IsEmpty() const {return m_pattern.empty();}
+  // Number of edits allowed by Score()
+  unsigned int GetMaxEdits() const {return m_maxEdits;}
+
+  // 0 if sxText doesn't match, else the higher the better
+  unsigned int Score(const StringX &sxText) const;
+
+  // Fewest edits turning the pattern (truncated to MAX_PATTERN) into some
+  // substring of sxText
+  unsigned int Distance(const StringX &sxText) const;
+
+  static TCHAR Fold(TCHAR c);
+
+private:
+  typedef unsigned long long Mask; // one bit per pattern character
+
+  Mask Peq(TCHAR c) const;
+  // Fewest edits, as Distance(), and where the first substring with that
+  // many ends
+  unsigned int Distance(const StringX &sxText, size_t &end) const;
+  // Scores the subsequence matched from start onwards
+  unsigned int ScoreFrom(const StringX &sxText, size_t start) const;
+
+  StringX m_pattern; // folded
+  unsigned int m_maxEdits;
+  size_t m_len; // characters in masks, i.e., min(pattern length, MAX_PATTERN)
+  Mask m_peqASCII[128];
+  std::vector<std::pair<TCHAR, Mask> > m_peqOther;
+};
+
+#endif /* __FUZZYMATCH_H */
+//-----------------------------------------------------------------------------
+// Local variables:
+// mode: c++
+// End:
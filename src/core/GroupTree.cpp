@@ -0,0 +1,268 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// GroupTree.cpp : implementation file
+//
+
+#include "GroupTree.h"
+#include "os/debug.h"
+
+#include <map>
+#include <set>
+#include <algorithm>
+
+using namespace std;
+using pws_os::CUUID;
+
+struct GroupTree::Node {
+  Node(Node *parent, const StringX &name)
+    : pParent(parent), sxName(name), nEntries(0), bEmptyGroup(false) {}
+  ~Node()
+  {
+    for (auto iter = children.begin(); iter != children.end(); iter++)
+      delete iter->second;
+  }
+
+  bool IsUnused() const
+  {return entries.empty() && children.empty() && !bEmptyGroup;}
+
+  Node *pParent;
+  StringX sxName; // last component of path only
+  map<StringX, Node *> children;
+  set<CUUID> entries; // directly in this group
+  size_t nEntries; // in this group and all its subgroups
+  bool bEmptyGroup;
+};
+
+GroupTree::GroupTree()
+  : m_pRoot(new Node(NULL, StringX())), m_numGroups(0)
+{
+}
+
+GroupTree::~GroupTree()
+{
+  delete m_pRoot;
+}
+
+void GroupTree::Clear()
+{
+  delete m_pRoot;
+  m_pRoot = new Node(NULL, StringX());
+  m_numGroups = 0;
+}
+
+GroupTree::Node *GroupTree::FindNode(const StringX &sxGroup) const
+{
+  Node *pNode = m_pRoot;
+  if (sxGroup.empty())
+    return pNode;
+
+  StringX::size_type start = 0;
+  for (;;) {
+    const StringX::size_type dot = sxGroup.find(_T('.'), start);
+    const StringX sxToken = sxGroup.substr(start,
+                                  dot == StringX::npos ? StringX::npos : dot - start);
+    auto iter = pNode->children.find(sxToken);
+    if (iter == pNode->children.end())
+      return NULL;
+    pNode = iter->second;
+    if (dot == StringX::npos)
+      break;
+    start = dot + 1;
+  }
+  return pNode;
+}
+
+GroupTree::Node *GroupTree::FindOrAddNode(const StringX &sxGroup)
+{
+  Node *pNode = m_pRoot;
+  if (sxGroup.empty())
+    return pNode;
+
+  StringX::size_type start = 0;
+  for (;;) {
+    const StringX::size_type dot = sxGroup.find(_T('.'), start);
+    const StringX sxToken = sxGroup.substr(start,
+                                  dot == StringX::npos ? StringX::npos : dot - start);
+    auto iter = pNode->children.find(sxToken);
+    if (iter == pNode->children.end()) {
+      Node *pChild = new Node(pNode, sxToken);
+      pNode->children.insert(make_pair(sxToken, pChild));
+      m_numGroups++;
+      pNode = pChild;
+    } else
+      pNode = iter->second;
+    if (dot == StringX::npos)
+      break;
+    start = dot + 1;
+  }
+  return pNode;
+}
+
+void GroupTree::Prune(Node *pNode)
+{
+  while (pNode != m_pRoot && pNode->IsUnused()) {
+    Node *pParent = pNode->pParent;
+    pParent->children.erase(pNode->sxName);
+    delete pNode;
+    m_numGroups--;
+    pNode = pParent;
+  }
+}
+
+void GroupTree::AddEntry(const StringX &sxGroup, const CUUID &uuid)
+{
+  Node *pNode = FindOrAddNode(sxGroup);
+  if (!pNode->entries.insert(uuid).second) {
+    ASSERT(0); // already there
+    return;
+  }
+  for (; pNode != NULL; pNode = pNode->pParent)
+    pNode->nEntries++;
+}
+
+void GroupTree::RemoveEntry(const StringX &sxGroup, const CUUID &uuid)
+{
+  Node *pNode = FindNode(sxGroup);
+  if (pNode == NULL || pNode->entries.erase(uuid) == 0) {
+    ASSERT(0); // wasn't there
+    return;
+  }
+  for (Node *p = pNode; p != NULL; p = p->pParent)
+    p->nEntries--;
+  Prune(pNode);
+}
+
+void GroupTree::MoveEntry(const StringX &sxOldGroup, const StringX &sxNewGroup,
+                          const CUUID &uuid)
+{
+  if (sxOldGroup != sxNewGroup) {
+    // Add first, so that common ancestors aren't pruned & recreated
+    AddEntry(sxNewGroup, uuid);
+    RemoveEntry(sxOldGroup, uuid);
+  }
+}
+
+size_t GroupTree::ClearEmptyFlags(Node *pNode)
+{
+  // Post-order, so that a node emptied of children can itself be removed
+  size_t numRemoved(0);
+  for (auto iter = pNode->children.begin(); iter != pNode->children.end();) {
+    Node *pChild = iter->second;
+    numRemoved += ClearEmptyFlags(pChild);
+    pChild->bEmptyGroup = false;
+    if (pChild->IsUnused()) {
+      delete pChild;
+      iter = pNode->children.erase(iter);
+      numRemoved++;
+    } else
+      iter++;
+  }
+  return numRemoved;
+}
+
+void GroupTree::SetEmptyGroups(const vector<StringX> &vEmptyGroups)
+{
+  m_numGroups -= ClearEmptyFlags(m_pRoot);
+
+  for (auto iter = vEmptyGroups.begin(); iter != vEmptyGroups.end(); iter++)
+    AddEmptyGroup(*iter);
+}
+
+void GroupTree::AddEmptyGroup(const StringX &sxGroup)
+{
+  if (!sxGroup.empty()) // root can't be an empty group
+    FindOrAddNode(sxGroup)->bEmptyGroup = true;
+}
+
+void GroupTree::RemoveEmptyGroup(const StringX &sxGroup)
+{
+  Node *pNode = FindNode(sxGroup);
+  if (pNode != NULL && pNode->bEmptyGroup) {
+    pNode->bEmptyGroup = false;
+    Prune(pNode);
+  }
+}
+
+bool GroupTree::IsEmptyGroup(const StringX &sxGroup) const
+{
+  const Node *pNode = FindNode(sxGroup);
+  return pNode != NULL && pNode->bEmptyGroup;
+}
+
+bool GroupTree::GroupExists(const StringX &sxGroup) const
+{
+  return !sxGroup.empty() && FindNode(sxGroup) != NULL;
+}
+
+size_t GroupTree::GetNumEntries(const StringX &sxGroup, bool bIncludeSubgroups) const
+{
+  const Node *pNode = FindNode(sxGroup);
+  if (pNode == NULL)
+    return 0;
+  return bIncludeSubgroups ? pNode->nEntries : pNode->entries.size();
+}
+
+void GroupTree::GetAllGroups(vector<stringT> &vGroups) const
+{
+  vGroups.clear();
+  vGroups.reserve(m_numGroups);
+
+  // Iterative walk, carrying each node's path
+  vector<pair<const Node *, StringX> > vStack;
+  for (auto iter = m_pRoot->children.begin(); iter != m_pRoot->children.end(); iter++)
+    vStack.push_back(make_pair(iter->second, iter->first));
+
+  while (!vStack.empty()) {
+    const Node *pNode = vStack.back().first;
+    const StringX sxPath = vStack.back().second;
+    vStack.pop_back();
+    vGroups.push_back(sxPath.c_str());
+    for (auto iter = pNode->children.begin(); iter != pNode->children.end(); iter++)
+      vStack.push_back(make_pair(iter->second, sxPath + _T(".") + iter->first));
+  }
+  ASSERT(vGroups.size() == m_numGroups);
+
+  // Callers expect plain string order, which isn't the tree's order
+  // (e.g., "a b" < "a.b")
+  sort(vGroups.begin(), vGroups.end());
+}
+
+void GroupTree::GetSubgroups(const StringX &sxGroup, vector<StringX> &vSubgroups) const
+{
+  vSubgroups.clear();
+  const Node *pNode = FindNode(sxGroup);
+  if (pNode == NULL)
+    return;
+  for (auto iter = pNode->children.begin(); iter != pNode->children.end(); iter++)
+    vSubgroups.push_back(iter->first);
+}
+
+void GroupTree::GetEntries(const StringX &sxGroup, bool bIncludeSubgroups,
+                           UUIDVector &vEntries) const
+{
+  vEntries.clear();
+  const Node *pNode = FindNode(sxGroup);
+  if (pNode == NULL)
+    return;
+
+  if (!bIncludeSubgroups) {
+    vEntries.assign(pNode->entries.begin(), pNode->entries.end());
+    return;
+  }
+
+  vEntries.reserve(pNode->nEntries);
+  vector<const Node *> vStack(1, pNode);
+  while (!vStack.empty()) {
+    const Node *p = vStack.back();
+    vStack.pop_back();
+    vEntries.insert(vEntries.end(), p->entries.begin(), p->entries.end());
+    for (auto iter = p->children.begin(); iter != p->children.end(); iter++)
+      vStack.push_back(iter->second);
+  }
+  ASSERT(vEntries.size() == pNode->nEntries);
+}
@@ -0,0 +1,85 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// GroupTree.h
+//-----------------------------------------------------------------------------
+// Index of the group hierarchy, maintained incrementally by PWScore as
+// entries are added, deleted or moved between groups, and as empty groups
+// are added or removed.
+//
+// Each node corresponds to one group path ("A", "A.B", ...), the root being
+// the "no group" level. Nodes hold the UUIDs of the entries directly in
+// that group, a count of all entries in the subtree, and whether the group
+// is one of the database's explicitly empty groups. A node exists as long
+// as any of these is non-trivial, so the set of nodes is exactly the set
+// of group prefixes that PWScore::GetAllGroups reports.
+//
+// Paths are split on '.' exactly as elsewhere in the core, i.e., "a..b"
+// has the components "a", "" and "b".
+//-----------------------------------------------------------------------------
+
+#ifndef __GROUPTREE_H
+#define __GROUPTREE_H
+
+#include "StringX.h"
+#include "os/UUID.h"
+
+#include <vector>
+
+class GroupTree
+{
+public:
+  GroupTree();
+  ~GroupTree();
+
+  void Clear();
+
+  // Entries - sxGroup is the entry's full group path, empty for root
+  void AddEntry(const StringX &sxGroup, const pws_os::CUUID &uuid);
+  void RemoveEntry(const StringX &sxGroup, const pws_os::CUUID &uuid);
+  void MoveEntry(const StringX &sxOldGroup, const StringX &sxNewGroup,
+                 const pws_os::CUUID &uuid);
+
+  // Empty groups, as stored in the database header
+  void SetEmptyGroups(const std::vector<StringX> &vEmptyGroups);
+  void AddEmptyGroup(const StringX &sxGroup);
+  void RemoveEmptyGroup(const StringX &sxGroup);
+  bool IsEmptyGroup(const StringX &sxGroup) const;
+
+  // Queries
+  bool GroupExists(const StringX &sxGroup) const;
+  size_t GetNumGroups() const {return m_numGroups;}
+  size_t GetNumEntries(const StringX &sxGroup, bool bIncludeSubgroups = true) const;
+
+  // All group paths, sorted
+  void GetAllGroups(std::vector<stringT> &vGroups) const;
+  // Names (not paths) of the immediate subgroups of sxGroup, sorted
+  void GetSubgroups(const StringX &sxGroup, std::vector<StringX> &vSubgroups) const;
+  // Entries in sxGroup and, optionally, in all its subgroups
+  void GetEntries(const StringX &sxGroup, bool bIncludeSubgroups,
+                  UUIDVector &vEntries) const;
+
+private:
+  GroupTree(const GroupTree &); // Do not implement
+  GroupTree &operator=(const GroupTree &); // Do not implement
+
+  struct Node;
+
+  Node *FindNode(const StringX &sxGroup) const;
+  Node *FindOrAddNode(const StringX &sxGroup);
+  void Prune(Node *pNode); // remove node & ancestors if no longer needed
+  size_t ClearEmptyFlags(Node *pNode); // returns number of nodes removed
+
+  Node *m_pRoot;
+  size_t m_numGroups; // all nodes except root
+};
+
+#endif /* __GROUPTREE_H */
+//-----------------------------------------------------------------------------
+// Local variables:
+// mode: c++
+// End:
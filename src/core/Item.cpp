@@ -16,6 +16,7 @@
 #include "Util.h"
 #include "os/env.h"
 
+#include <cstring>
 #include <vector>
 
 CItem::CItem()
@@ -51,9 +52,12 @@ CItem& CItem::operator=(const CItem &that)
     delete m_display_info;
     m_display_info = that.m_display_info == NULL ?
       NULL : that.m_display_info->clone();
-    memcpy(m_key, that.m_key, sizeof(m_key));
-    delete m_blowfish;
-    m_blowfish = nullptr;
+    // Our cipher's only of use if it's for the same key
+    if (memcmp(m_key, that.m_key, sizeof(m_key)) != 0) {
+      memcpy(m_key, that.m_key, sizeof(m_key));
+      delete m_blowfish;
+      m_blowfish = nullptr;
+    }
   }
   return *this;
 }
@@ -129,6 +133,23 @@ size_t CItem::GetSize() const
   return length;
 }
 
+void CItem::HashFields(SHA256 &hash) const
+{
+  // Fields are encrypted with m_key, so it's part of what they mean
+  hash.Update(m_key, sizeof(m_key));
+  for (FieldConstIter fiter = m_fields.begin(); fiter != m_fields.end(); fiter++)
+    fiter->second.Hash(hash);
+  for (auto ufiter = m_URFL.begin(); ufiter != m_URFL.end(); ufiter++)
+    ufiter->Hash(hash);
+}
+
+void CItem::GetFingerprint(unsigned char digest[SHA256::HASHLEN]) const
+{
+  SHA256 hash;
+  HashFields(hash);
+  hash.Final(digest);
+}
+
 BlowFish *CItem::MakeBlowFish() const
 {
   // Creating a BlowFish object's relatively expensive, so we use
@@ -195,36 +216,55 @@ void CItem::SetField(int ft, const StringX &value)
     m_fields.erase(ft);
 }
 
-static bool pull_string(StringX &str,
-                        const unsigned char *data, size_t len)
+void CItem::SetField(CItemField &field, const StringX &value)
 {
-  /**
-   * cp_acp is used to force reading data as non-utf8 encoded
-   * This is for databases that were incorrectly written, e.g., 3.05.02
-   * PWS_CP_ACP is either set externally or via the --CP_ACP argv
-   *
-   * We use a static variable purely for efficiency, as this won't change
-   * over the course of the program.
-   */
+  field.Set(value, MakeBlowFish());
+}
 
+/**
+ * cp_acp is used to force reading data as non-utf8 encoded
+ * This is for databases that were incorrectly written, e.g., 3.05.02
+ * PWS_CP_ACP is either set externally or via the --CP_ACP argv
+ *
+ * We use a static variable purely for efficiency, as this won't change
+ * over the course of the program.
+ */
+static bool use_cp_acp()
+{
   static int cp_acp = -1;
   if (cp_acp == -1) {
     cp_acp = pws_os::getenv("PWS_CP_ACP", false).empty() ? 0 : 1;
   }
-  CUTF8Conv utf8conv(cp_acp != 0);
-  std::vector<unsigned char> v(data, (data + len));
-  v.push_back(0); // null terminate for FromUTF8.
-  bool utf8status = utf8conv.FromUTF8(&v[0], len, str);
+  return cp_acp != 0;
+}
+
+static bool pull_string(StringX &str,
+                        const unsigned char *data, size_t len)
+{
+  CUTF8Conv utf8conv(use_cp_acp());
+  bool utf8status = utf8conv.FromUTF8(data, len, str);
   if (!utf8status) {
     pws_os::Trace(_T("Item.cpp: pull_string(): FromUTF8 failed!\n"));
   }
-  trashMemory(&v[0], len);
   return utf8status;
 }
 
 bool CItem::SetTextField(int ft, const unsigned char *value,
                          size_t length)
 {
+  // Text is held as UTF-8, so well-formed data is stored as read
+  // (up to the first NUL, if any, as FromUTF8 would)
+  if (!use_cp_acp()) {
+    const void *nul = length > 0 ? memchr(value, 0, length) : NULL;
+    if (nul != NULL)
+      length = static_cast<const unsigned char *>(nul) - value;
+    size_t wcLen;
+    if (CUTF8Conv::Decode(value, length, NULL, wcLen)) {
+      SetField(ft, value, length);
+      return true;
+    }
+  }
+
   StringX str;
   if (pull_string(str, value, length)) {
     SetField(ft, str);
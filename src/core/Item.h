@@ -14,6 +14,7 @@
 #include "ItemField.h"
 #include "Util.h"
 #include "StringX.h"
+#include "sha256.h"
 
 #include <vector>
 #include <string>
@@ -105,6 +106,7 @@ public:
     ATTIV = 0x72,
     CONTENT = 0x73,
     CONTENTHMAC = 0x74,
+    CONTENTCOMP = 0x75,
     LAST_ATT,
     UNKNOWN_TESTING = 0xdf, // for testing forward compatability (unknown field handling)
     END = 0xff,
@@ -150,6 +152,11 @@ public:
   size_t GetSize() const;
   void GetSize(size_t &isize) const {isize = GetSize();}
 
+  // A digest of the item as held in memory: equal for copies, different
+  // once any field's changed. Cheap, as nothing's decrypted. Used to find
+  // records that haven't changed since they were read (PWSfileV4 chunks).
+  virtual void GetFingerprint(unsigned char digest[SHA256::HASHLEN]) const;
+
 protected:
   typedef std::map<int, CItemField> FieldMap;
   typedef FieldMap::const_iterator FieldConstIter;
@@ -162,6 +169,7 @@ protected:
 
   void SetField(int ft, const unsigned char *value, size_t length);
   void SetField(int ft, const StringX &value);
+  void SetField(CItemField &field, const StringX &value); // for fields not in m_fields
   bool SetTextField(int ft, const unsigned char *value, size_t length);
   bool SetTimeField(int ft, const unsigned char *value, size_t length);
 
@@ -182,6 +190,8 @@ protected:
   bool IsItemAttField(unsigned char type) const
   {return type >= START_ATT && type < LAST_ATT;}
 
+  void HashFields(SHA256 &hash) const; // for GetFingerprint
+
 private:
   // Helper function for operator==
   bool CompareFields(const CItemField &fthis,
@@ -15,12 +15,14 @@
 #include "PWSfile.h"
 #include "PWSfileV4.h"
 #include "PWScore.h"
+#include "PWSCompress.h"
+#include "PWSprefs.h"
+#include "hmac.h"
 
 #include "os/typedefs.h"
 #include "os/pws_tchar.h"
 #include "os/file.h"
 #include "os/media.h"
-#include "os/utf8conv.h"
 #include "os/dir.h"
 
 #include <sys/types.h>
@@ -29,6 +31,10 @@
 using namespace std;
 using pws_os::CUUID;
 
+// The CONTENTCOMP field's value: the compression method, followed by the
+// uncompressed length if (and only if) the content is compressed
+static const size_t COMPLEN = 1 + sizeof(int32);
+
 //-----------------------------------------------------------------------------
 // Constructors
 
@@ -154,13 +160,58 @@ bool CItemAtt::GetContent(unsigned char *content, size_t csize) const
 {
   ASSERT(content != NULL);
 
-  if (!HasContent() || csize < GetContentSize())
+  if (!HasContent() || IsContentCompressed() || csize < GetContentSize())
     return false;
 
   GetField(m_fields.find(CONTENT)->second, content, csize);
   return true;
 }
 
+void CItemAtt::SetCompression(unsigned char method)
+{
+  // Content we couldn't decompress is written back as it was read
+  if (IsContentCompressed())
+    return;
+
+  if (method == PWSCompress::NONE)
+    ClearField(CONTENTCOMP);
+  else
+    CItem::SetField(CONTENTCOMP, &method, sizeof(method));
+}
+
+unsigned char CItemAtt::GetCompression() const
+{
+  FieldConstIter fiter = m_fields.find(CONTENTCOMP);
+  if (fiter == m_fields.end())
+    return PWSCompress::NONE;
+
+  unsigned char value[COMPLEN + BlowFish::BLOCKSIZE];
+  size_t length = sizeof(value);
+  CItem::GetField(fiter->second, value, length);
+  const unsigned char retval = value[0];
+  trashMemory(value, sizeof(value));
+  return retval;
+}
+
+bool CItemAtt::IsContentCompressed() const
+{
+  FieldConstIter fiter = m_fields.find(CONTENTCOMP);
+  return fiter != m_fields.end() && fiter->second.GetLength() == COMPLEN;
+}
+
+void CItemAtt::HashContent(HMAC_BASE &hmac) const
+{
+  FieldConstIter fiter = m_fields.find(CONTENT);
+  if (fiter == m_fields.end())
+    return;
+  size_t length = fiter->second.GetLength() + BlowFish::BLOCKSIZE;
+  unsigned char *content = new unsigned char[length];
+  CItem::GetField(fiter->second, content, length);
+  hmac.Update(content, static_cast<unsigned long>(length));
+  trashMemory(content, length);
+  delete[] content;
+}
+
 int CItemAtt::Import(const stringT &fname)
 {
   stringT spath, sdrive, sdir, sfname, sextn;
@@ -193,6 +244,11 @@ int CItemAtt::Import(const stringT &fname)
   }
 
   SetField(CONTENT, data, flen);
+  if (PWSprefs::GetInstance()->GetPref(PWSprefs::CompressAttachments) &&
+      PWSCompress::CanCompress(PWSCompress::ZLIB))
+    SetCompression(PWSCompress::ZLIB);
+  else
+    SetCompression(PWSCompress::NONE);
 
   // derive the file's path and name
   pws_os::splitpath(fname, sdrive, sdir, sfname, sextn);
@@ -228,7 +284,7 @@ int CItemAtt::Export(const stringT &fname) const
   ASSERT(!fname.empty());
   ASSERT(IsFieldSet(CONTENT));
   // fail safely @runtime:
-  if (!IsFieldSet(CONTENT))
+  if (!IsFieldSet(CONTENT) || IsContentCompressed())
     return PWScore::FAILURE;
 
   const CItemField &field = m_fields.find(CONTENT)->second;
@@ -328,6 +384,9 @@ int CItemAtt::Read(PWSfile *in)
   size_t content_len = 0;
   unsigned char expected_digest[SHA256::HASHLEN] = {0};
 
+  unsigned char comp[COMPLEN] = {0}; // CONTENTCOMP, if any
+  size_t comp_len = 0;
+
   unsigned char *utf8 = NULL;
   size_t utf8Len = 0;
 
@@ -390,14 +449,24 @@ int CItemAtt::Read(PWSfile *in)
         ASSERT(in4 != NULL);
         size_t nread = in4->ReadContent(&fish, IV, content, content_len);
         // nread should be content_len rounded up to nearest BS:
-        ASSERT(nread == (content_len/BS + 1)*BS);
-        if (nread != (content_len/BS + 1)*BS) {
+        ASSERT(nread == ((content_len + BS - 1)/BS)*BS);
+        if (nread != ((content_len + BS - 1)/BS)*BS) {
           status = PWSfile::READ_FAIL;
           goto exit;
         }
         gotContent = true;
         break;
       }
+      case CONTENTCOMP: {
+        // Precedes the content, so that it's known before it's needed
+        ASSERT(!gotContent && comp_len == 0);
+        ASSERT(utf8Len == 1 || utf8Len == COMPLEN);
+        if (gotContent || comp_len != 0 || (utf8Len != 1 && utf8Len != COMPLEN))
+          goto exit;
+        comp_len = utf8Len;
+        memcpy(comp, utf8, utf8Len);
+        break;
+      }
       case CONTENTHMAC: {
         ASSERT(!gotHMAC);
         ASSERT(utf8Len == SHA256::HASHLEN);
@@ -437,11 +506,37 @@ int CItemAtt::Read(PWSfile *in)
     hmac.Final(calculated_digest);
 
     if (memcmp(expected_digest, calculated_digest,
-               sizeof(calculated_digest)) == 0) {
+               sizeof(calculated_digest)) != 0) {
+      status = PWSfile::BAD_DIGEST;
+    } else if (comp_len != COMPLEN) { // stored as is
       SetField(CONTENT, content, content_len);
+      if (comp_len != 0)
+        SetCompression(comp[0]);
       status = PWSfile::SUCCESS;
+    } else if (PWSCompress::IsSupported(comp[0])) {
+      // The length's from the file, check it before allocating
+      const size_t plain_len = static_cast<uint32>(getInt32(comp + 1));
+      if (plain_len / PWSCompress::MAX_RATIO > content_len) {
+        status = PWSfile::READ_FAIL;
+      } else {
+        unsigned char *plain = new unsigned char[plain_len];
+        if (PWSCompress::Decompress(comp[0], content, content_len,
+                                    plain, plain_len)) {
+          SetField(CONTENT, plain, plain_len);
+          SetCompression(comp[0]);
+          status = PWSfile::SUCCESS;
+        } else {
+          status = PWSfile::READ_FAIL;
+        }
+        trashMemory(plain, plain_len);
+        delete[] plain;
+      }
     } else {
-      status = PWSfile::BAD_DIGEST;
+      // Unknown method, or built without it: keep the content as read,
+      // so that it isn't lost when the database is saved
+      SetField(CONTENT, content, content_len);
+      CItem::SetField(CONTENTCOMP, comp, comp_len);
+      status = PWSfile::SUCCESS;
     }
   } else {
     status = PWSfile::READ_FAIL;
@@ -460,6 +555,8 @@ int CItemAtt::Read(PWSfile *in)
 
 size_t CItemAtt::WriteIfSet(FieldType ft, PWSfile *out, bool isUTF8) const
 {
+  // Text fields are already held as UTF-8, so all fields are
+  // written as they are, bar trailing NULs
   FieldConstIter fiter = m_fields.find(ft);
   size_t retval = 0;
   if (fiter != m_fields.end()) {
@@ -468,27 +565,12 @@ size_t CItemAtt::WriteIfSet(FieldType ft, PWSfile *out, bool isUTF8) const
     size_t flength = field.GetLength() + BlowFish::BLOCKSIZE;
     unsigned char *pdata = new unsigned char[flength];
     CItem::GetField(field, pdata, flength);
-    if (isUTF8) {
-      wchar_t *wpdata = reinterpret_cast<wchar_t *>(pdata);
-      size_t srclen = field.GetLength()/sizeof(TCHAR);
-      wpdata[srclen] = 0;
-      size_t dstlen = pws_os::wcstombs(NULL, 0, wpdata, srclen);
-      ASSERT(dstlen > 0);
-
-      char *dst = new char[dstlen+1];
-      dstlen = pws_os::wcstombs(dst, dstlen, wpdata, srclen);
-      ASSERT(dstlen != size_t(-1));
-
-      //[BR1150, BR1167]: Discard the terminating NULLs in text fields
-      if (dstlen && !dst[dstlen-1])
+    size_t dstlen = field.GetLength();
+    //[BR1150, BR1167]: Discard the terminating NULLs in text fields
+    if (isUTF8)
+      while (dstlen > 0 && pdata[dstlen - 1] == 0)
         dstlen--;
-
-      retval = out->WriteField(static_cast<unsigned char>(ft), reinterpret_cast<unsigned char *>(dst), dstlen);
-      trashMemory(dst, dstlen);
-      delete[] dst;
-    } else {
-      retval = out->WriteField(static_cast<unsigned char>(ft), pdata, field.GetLength());
-    }
+    retval = out->WriteField(static_cast<unsigned char>(ft), pdata, dstlen);
     trashMemory(pdata, flength);
     delete[] pdata;
   }
@@ -524,7 +606,33 @@ int CItemAtt::Write(PWSfile *out) const
     size_t clength = fiter->second.GetLength() + BlowFish::BLOCKSIZE;
     unsigned char *content = new unsigned char[clength];
     CItem::GetField(fiter->second, content, clength);
-    out4->WriteContentFields(content, clength);
+
+    // Compressed if asked for and worthwhile. The method's recorded
+    // regardless, the uncompressed length only if it's been done.
+    unsigned char comp[COMPLEN + BlowFish::BLOCKSIZE];
+    size_t comp_len = 0;
+    unsigned char *zcontent = NULL;
+    size_t zlength = 0;
+    if (IsContentCompressed()) {
+      comp_len = sizeof(comp);
+      CItem::GetField(m_fields.find(CONTENTCOMP)->second, comp, comp_len);
+    } else if ((comp[0] = GetCompression()) != PWSCompress::NONE) {
+      comp_len = 1;
+      if (PWSCompress::IsCompressible(GetMediaType()) &&
+          PWSCompress::Compress(comp[0], content, clength, zcontent, zlength)) {
+        putInt32(comp + 1, static_cast<int32>(clength));
+        comp_len = COMPLEN;
+      }
+    }
+    if (comp_len != 0)
+      out->WriteField(CONTENTCOMP, comp, comp_len);
+
+    if (zcontent != NULL) {
+      out4->WriteContentFields(zcontent, zlength);
+      trashMemory(zcontent, zlength);
+      delete[] zcontent;
+    } else
+      out4->WriteContentFields(content, clength);
     trashMemory(content, clength);
     delete[] content;
   }
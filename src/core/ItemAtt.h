@@ -34,6 +34,7 @@
 
 class BlowFish;
 class PWSfile;
+class HMAC_BASE;
 
 class CItemAtt : public CItem
 {
@@ -77,6 +78,18 @@ public:
   size_t GetContentSize() const; // size needed for GetContent (!= len due to block cipher)
   bool GetContent(unsigned char *content, size_t csize) const;
 
+  // How the content's compressed on file (PWSCompress::Method, V4 only).
+  // This is a preference: content that isn't worth compressing (see
+  // PWSCompress::IsCompressible) is stored as is. In memory, the content's
+  // always uncompressed, unless by a method this build doesn't know.
+  // Import() sets it as per the CompressAttachments preference.
+  void SetCompression(unsigned char method);
+  unsigned char GetCompression() const;
+  bool IsContentCompressed() const; // couldn't decompress, kept as read
+
+  // Update()s hmac with the content as stored in memory
+  void HashContent(HMAC_BASE &hmac) const;
+
   time_t GetCTime(time_t &t) const;
 
   StringX GetTime(int whichtime, PWSUtil::TMC result_format) const;
@@ -111,6 +124,7 @@ public:
   unsigned GetRefcount() const {return m_refcount;}
   void IncRefcount() {m_refcount++;}
   void DecRefcount() {ASSERT(m_refcount > 0); m_refcount--;}
+  void SetRefcount(unsigned refcount) {m_refcount = refcount;}
 
   CItemAtt& operator=(const CItemAtt& second);
 
@@ -25,7 +25,6 @@
 #include "os/typedefs.h"
 #include "os/pws_tchar.h"
 #include "os/mem.h"
-#include "os/utf8conv.h"
 
 #include <time.h>
 #include <sstream>
@@ -43,7 +42,8 @@ CItemData::CItemData()
 }
 
 CItemData::CItemData(const CItemData &that) :
-  CItem(that), m_entrytype(that.m_entrytype), m_entrystatus(that.m_entrystatus)
+  CItem(that), m_entrytype(that.m_entrytype), m_entrystatus(that.m_entrystatus),
+  m_PWHist(that.m_PWHist)
 {
 }
 
@@ -57,6 +57,7 @@ CItemData& CItemData::operator=(const CItemData &that)
     CItem::operator=(that);
     m_entrytype = that.m_entrytype;
     m_entrystatus = that.m_entrystatus;
+    m_PWHist = that.m_PWHist;
   }
   return *this;
 }
@@ -66,13 +67,68 @@ void CItemData::Clear()
   CItem::Clear();
   m_entrytype = ET_NORMAL;
   m_entrystatus = ES_CLEAN;
+  m_PWHist = PWHistData();
 }
 
 bool CItemData::operator==(const CItemData &that) const
 {
-  return (m_entrytype == that.m_entrytype &&
-          m_entrystatus == that.m_entrystatus &&
-          CItem::operator==(that));
+  if (m_entrytype != that.m_entrytype ||
+      m_entrystatus != that.m_entrystatus ||
+      !CItem::operator==(that))
+    return false;
+
+  // Parsed password history isn't in m_fields
+  if (m_PWHist.bSet != that.m_PWHist.bSet)
+    return false;
+  if (!m_PWHist.bSet)
+    return true;
+  if (m_PWHist.bStatus != that.m_PWHist.bStatus ||
+      m_PWHist.max != that.m_PWHist.max ||
+      m_PWHist.entries.size() != that.m_PWHist.entries.size())
+    return false;
+  for (size_t i = 0; i < m_PWHist.entries.size(); i++) {
+    const auto &ethis = m_PWHist.entries[i];
+    const auto &ethat = that.m_PWHist.entries[i];
+    if (ethis.first != ethat.first ||
+        ethis.second.GetLength() != ethat.second.GetLength() ||
+        GetField(ethis.second) != that.GetField(ethat.second))
+      return false;
+  }
+  return true;
+}
+
+void CItemData::GetFingerprint(unsigned char digest[SHA256::HASHLEN]) const
+{
+  SHA256 hash;
+  HashFields(hash);
+
+  // Write() also depends on whether we're a dependent, and on the
+  // parsed password history, which isn't in m_fields
+  unsigned char buf[sizeof(int32) + 3];
+  buf[0] = static_cast<unsigned char>(IsAlias() ? 1 : (IsShortcut() ? 2 : 0));
+  buf[1] = static_cast<unsigned char>(m_PWHist.bSet);
+  buf[2] = static_cast<unsigned char>(m_PWHist.bStatus);
+  putInt32(buf + 3, static_cast<int32>(m_PWHist.max));
+  hash.Update(buf, sizeof(buf));
+  for (auto iter = m_PWHist.entries.begin(); iter != m_PWHist.entries.end(); iter++) {
+    putInt32(buf, static_cast<int32>(iter->first));
+    hash.Update(buf, sizeof(int32));
+    iter->second.Hash(hash);
+  }
+  hash.Final(digest);
+}
+
+size_t CItemData::GetSize() const
+{
+  size_t length = CItem::GetSize();
+
+  if (m_PWHist.bSet) {
+    // Count it as the PWHIST string it replaces
+    length += 5 + 12 * m_PWHist.entries.size();
+    for (auto iter = m_PWHist.entries.begin(); iter != m_PWHist.entries.end(); iter++)
+      length += iter->second.GetLength();
+  }
+  return length;
 }
 
 void CItemData::ParseSpecialPasswords()
@@ -209,6 +265,8 @@ int CItemData::Read(PWSfile *in)
 
 size_t CItemData::WriteIfSet(FieldType ft, PWSfile *out, bool isUTF8) const
 {
+  // Text fields are already held as UTF-8, so all fields are
+  // written as they are, bar trailing NULs
   FieldConstIter fiter = m_fields.find(ft);
   size_t retval = 0;
   if (fiter != m_fields.end()) {
@@ -217,24 +275,12 @@ size_t CItemData::WriteIfSet(FieldType ft, PWSfile *out, bool isUTF8) const
     size_t flength = field.GetLength() + BlowFish::BLOCKSIZE;
     unsigned char *pdata = new unsigned char[flength];
     CItem::GetField(field, pdata, flength);
-    if (isUTF8) {
-      wchar_t *wpdata = reinterpret_cast<wchar_t *>(pdata);
-      size_t srclen = field.GetLength()/sizeof(TCHAR);
-      wpdata[srclen] = 0;
-      size_t dstlen = pws_os::wcstombs(NULL, 0, wpdata, srclen);
-      ASSERT(dstlen > 0);
-      char *dst = new char[dstlen+1];
-      dstlen = pws_os::wcstombs(dst, dstlen, wpdata, srclen);
-      ASSERT(dstlen != size_t(-1));
-      //[BR1150, BR1167]: Discard the terminating NULLs in text fields
-      if (dstlen && !dst[dstlen-1])
+    size_t dstlen = field.GetLength();
+    //[BR1150, BR1167]: Discard the terminating NULLs in text fields
+    if (isUTF8)
+      while (dstlen > 0 && pdata[dstlen - 1] == 0)
         dstlen--;
-      retval = out->WriteField(static_cast<unsigned char>(ft), reinterpret_cast<unsigned char *>(dst), dstlen);
-      trashMemory(dst, dstlen);
-      delete[] dst;
-    } else {
-      retval = out->WriteField(static_cast<unsigned char>(ft), pdata, field.GetLength());
-    }
+    retval = out->WriteField(static_cast<unsigned char>(ft), pdata, dstlen);
     trashMemory(pdata, flength);
     delete[] pdata;
   }
@@ -253,8 +299,12 @@ int CItemData::WriteCommon(PWSfile *out) const
   const FieldType TimeFields[] = {ATIME, CTIME, XTIME, PMTIME, RMTIME,
                                   END};
 
-  for (i = 0; TextFields[i] != END; i++)
-    WriteIfSet(TextFields[i], out, true);
+  for (i = 0; TextFields[i] != END; i++) {
+    if (TextFields[i] == PWHIST && m_PWHist.bSet)
+      out->WriteField(PWHIST, MakePWHistory());
+    else
+      WriteIfSet(TextFields[i], out, true);
+  }
 
   for (i = 0; TimeFields[i] != END; i++) {
     time_t t = 0;
@@ -709,12 +759,151 @@ StringX CItemData::GetKBShortcut() const
 
 StringX CItemData::GetPWHistory() const
 {
+  if (m_PWHist.bSet)
+    return MakePWHistory();
+
   StringX ret = GetField(PWHIST);
   if (ret == _T("0") || ret == _T("00000"))
     ret = _T("");
   return ret;
 }
 
+bool CItemData::GetPWHistoryStatus() const
+{
+  if (m_PWHist.bSet)
+    return m_PWHist.bStatus;
+
+  size_t pwh_max, num_err;
+  PWHistList pwhistlist;
+  return GetPWHistoryList(pwh_max, num_err, pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+}
+
+size_t CItemData::GetPWHistoryMax() const
+{
+  if (m_PWHist.bSet)
+    return m_PWHist.max;
+
+  size_t pwh_max, num_err;
+  PWHistList pwhistlist;
+  GetPWHistoryList(pwh_max, num_err, pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+  return pwh_max;
+}
+
+size_t CItemData::GetPWHistoryCount() const
+{
+  if (m_PWHist.bSet)
+    return m_PWHist.entries.size();
+
+  size_t pwh_max, num_err;
+  PWHistList pwhistlist;
+  GetPWHistoryList(pwh_max, num_err, pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+  return pwhistlist.size();
+}
+
+bool CItemData::GetPWHistoryList(size_t &pwh_max, size_t &num_err,
+                                 PWHistList &pwhl, PWSUtil::TMC time_format) const
+{
+  if (!m_PWHist.bSet)
+    return CreatePWHistoryList(GetPWHistory(), pwh_max, num_err,
+                               pwhl, time_format);
+
+  pwh_max = m_PWHist.max;
+  num_err = 0;
+  pwhl.clear();
+  pwhl.reserve(m_PWHist.entries.size());
+  for (auto iter = m_PWHist.entries.begin(); iter != m_PWHist.entries.end(); iter++) {
+    PWHistEntry pwh_ent;
+    pwh_ent.changetttdate = iter->first;
+    pwh_ent.changedate = PWSUtil::ConvertToDateTimeString(iter->first, time_format);
+    if (pwh_ent.changedate.empty()) {
+      //                       1234567890123456789
+      pwh_ent.changedate = _T("1970-01-01 00:00:00");
+    }
+    pwh_ent.password = GetField(iter->second);
+    pwhl.push_back(pwh_ent);
+  }
+  return m_PWHist.bStatus;
+}
+
+StringX CItemData::GetPWHistoryPassword(size_t i) const
+{
+  if (m_PWHist.bSet)
+    return i < m_PWHist.entries.size() ? GetField(m_PWHist.entries[i].second) : StringX();
+
+  size_t pwh_max, num_err;
+  PWHistList pwhistlist;
+  GetPWHistoryList(pwh_max, num_err, pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+  return i < pwhistlist.size() ? pwhistlist[i].password : StringX();
+}
+
+static bool GetHex(const StringX &str, size_t offset, size_t len,
+                   unsigned long &value)
+{
+  value = 0;
+  for (size_t i = offset; i < offset + len; i++) {
+    const charT c = str[i];
+    if (c >= charT('0') && c <= charT('9'))
+      value = (value << 4) | static_cast<unsigned long>(c - charT('0'));
+    else if (c >= charT('a') && c <= charT('f'))
+      value = (value << 4) | static_cast<unsigned long>(c - charT('a') + 10);
+    else
+      return false; // including upper case, which we'd not write back as such
+  }
+  return true;
+}
+
+bool CItemData::ParsePWHistory(const StringX &pwh)
+{
+  // Only accept exactly what MakePWHistory() generates, so that the string
+  // is written back unchanged. Anything else is kept as a plain field.
+  m_PWHist = PWHistData();
+
+  const size_t len = pwh.length();
+  unsigned long pwh_max, num;
+  if (len < 5 || (pwh[0] != charT('0') && pwh[0] != charT('1')) ||
+      !GetHex(pwh, 1, 2, pwh_max) || !GetHex(pwh, 3, 2, num))
+    return false;
+
+  PWHistData phd;
+  phd.bStatus = pwh[0] == charT('1');
+  phd.max = pwh_max;
+  phd.entries.reserve(num);
+
+  size_t offset = 5;
+  for (unsigned long i = 0; i < num; i++) {
+    unsigned long t, pwlen;
+    if (offset + 12 > len ||
+        !GetHex(pwh, offset, 8, t) || !GetHex(pwh, offset + 8, 4, pwlen) ||
+        pwlen == 0 || offset + 12 + pwlen > len)
+      return false;
+    phd.entries.push_back(std::make_pair(static_cast<time_t>(t), CItemField(PWHIST)));
+    CItem::SetField(phd.entries.back().second, pwh.substr(offset + 12, pwlen));
+    offset += 12 + pwlen;
+  }
+  if (offset != len)
+    return false;
+
+  phd.bSet = true;
+  std::swap(m_PWHist, phd);
+  return true;
+}
+
+StringX CItemData::MakePWHistory() const
+{
+  ASSERT(m_PWHist.bSet);
+  StringX retval = MakePWHistoryHeader(m_PWHist.bStatus, m_PWHist.max,
+                                       m_PWHist.entries.size());
+  StringX buffer;
+  for (auto iter = m_PWHist.entries.begin(); iter != m_PWHist.entries.end(); iter++) {
+    const StringX password = GetField(iter->second);
+    Format(buffer, L"%08x%04x", static_cast<unsigned int>(iter->first),
+           static_cast<unsigned int>(password.length()));
+    retval += buffer;
+    retval += password;
+  }
+  return retval;
+}
+
 StringX CItemData::GetPlaintext(const TCHAR &separator,
                                 const FieldBits &bsFields,
                                 const TCHAR &delimiter,
@@ -753,8 +942,8 @@ StringX CItemData::GetPlaintext(const TCHAR &separator,
     size_t pwh_max, num_err;
     PWHistList pwhistlist;
 
-    pwh_status = CreatePWHistoryList(GetPWHistory(), pwh_max, num_err,
-                                     pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+    pwh_status = GetPWHistoryList(pwh_max, num_err,
+                                  pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
 
     //  Build export string
     history = MakePWHistoryHeader(pwh_status, pwh_max, pwhistlist.size());
@@ -1044,8 +1233,8 @@ string CItemData::GetXML(unsigned id, const FieldBits &bsExport,
   if (bsExport.test(CItemData::PWHIST)) {
     size_t pwh_max, num_err;
     PWHistList pwhistlist;
-    bool pwh_status = CreatePWHistoryList(GetPWHistory(), pwh_max, num_err,
-                                          pwhistlist, PWSUtil::TMC_XML);
+    bool pwh_status = GetPWHistoryList(pwh_max, num_err,
+                                       pwhistlist, PWSUtil::TMC_XML);
     oss << dec;
     if (pwh_status || pwh_max > 0 || !pwhistlist.empty()) {
       oss << "\t\t<pwhistory>" << endl;
@@ -1233,24 +1422,36 @@ void CItemData::UpdatePassword(const StringX &password)
 
 void CItemData::UpdatePasswordHistory()
 {
-  PWHistList pwhistlist;
+  PWHistList pwhistlist; // only used for malformed history
   size_t pwh_max;
   bool saving;
-  const StringX pwh_str = GetPWHistory();
-  if (pwh_str.empty()) {
-    // If GetPWHistory() is empty, use preference values!
+  if (m_PWHist.bSet) {
+    saving = m_PWHist.bStatus;
+    pwh_max = m_PWHist.max;
+  } else if (!IsFieldSet(PWHIST)) {
+    // If no history, use preference values!
     const PWSprefs *prefs = PWSprefs::GetInstance();
     saving = prefs->GetPref(PWSprefs::SavePasswordHistory);
     pwh_max = prefs->GetPref(PWSprefs::NumPWHistoryDefault);
   } else {
     size_t num_err;
-    saving = CreatePWHistoryList(pwh_str, pwh_max, num_err,
+    saving = CreatePWHistoryList(GetPWHistory(), pwh_max, num_err,
                                  pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
   }
   if (!saving)
     return;
 
-  size_t num = pwhistlist.size();
+  if (!m_PWHist.bSet) {
+    // Start from whatever could be parsed
+    CItem::ClearField(PWHIST);
+    for (auto iter = pwhistlist.begin(); iter != pwhistlist.end(); iter++) {
+      m_PWHist.entries.push_back(std::make_pair(iter->changetttdate, CItemField(PWHIST)));
+      CItem::SetField(m_PWHist.entries.back().second, iter->password);
+    }
+    m_PWHist.bSet = true;
+  }
+  m_PWHist.bStatus = true;
+  m_PWHist.max = pwh_max;
 
   time_t t;
   GetPMTime(t); // get mod time of last password
@@ -1258,47 +1459,14 @@ void CItemData::UpdatePasswordHistory()
   if (!t) // if never set - try creation date
     GetCTime(t);
 
-  PWHistEntry pwh_ent;
-  pwh_ent.password = GetPassword();
-  pwh_ent.changetttdate = t;
-  pwh_ent.changedate =
-    PWSUtil::ConvertToDateTimeString(t, PWSUtil::TMC_EXPORT_IMPORT);
-
-  if (pwh_ent.changedate.empty()) {
-    StringX unk;
-    LoadAString(unk, IDSC_UNKNOWN);
-    pwh_ent.changedate = unk;
-  }
-
-  // Now add the latest
-  pwhistlist.push_back(pwh_ent);
-
-  // Increment count
-  num++;
+  // Now add the latest - no need to touch the others
+  m_PWHist.entries.push_back(std::make_pair(t, CItemField(PWHIST)));
+  CItem::SetField(m_PWHist.entries.back().second, GetPassword());
 
   // Too many? remove the excess
-  if (num > pwh_max) {
-    PWHistList hl(pwhistlist.begin() + (num - pwh_max),
-                  pwhistlist.end());
-    ASSERT(hl.size() == pwh_max);
-    pwhistlist = hl;
-    num = pwh_max;
-  }
-
-  // Now create string version!
-  StringX new_PWHistory, buffer;
-
-  Format(new_PWHistory, L"1%02x%02x", pwh_max, num);
-
-  PWHistList::iterator iter;
-  for (iter = pwhistlist.begin(); iter != pwhistlist.end(); iter++) {
-    Format(buffer, L"%08x%04x%ls",
-           static_cast<long>(iter->changetttdate), iter->password.length(),
-           iter->password.c_str());
-    new_PWHistory += buffer;
-    buffer = _T("");
-  }
-  SetPWHistory(new_PWHistory);
+  if (m_PWHist.entries.size() > pwh_max)
+    m_PWHist.entries.erase(m_PWHist.entries.begin(),
+                           m_PWHist.entries.begin() + (m_PWHist.entries.size() - pwh_max));
 }
 
 void CItemData::SetNotes(const StringX &notes, TCHAR delimiter)
@@ -1402,7 +1570,43 @@ void CItemData::SetPWHistory(const StringX &PWHistory)
   StringX pwh = PWHistory;
   if (pwh == _T("0") || pwh == _T("00000"))
     pwh = _T("");
-  CItem::SetField(PWHIST, pwh);
+  if (ParsePWHistory(pwh))
+    CItem::ClearField(PWHIST);
+  else
+    CItem::SetField(PWHIST, pwh);
+}
+
+void CItemData::SetPWHistoryStatus(bool bStatus)
+{
+  if (m_PWHist.bSet) {
+    m_PWHist.bStatus = bStatus;
+    if (!bStatus && m_PWHist.max == 0 && m_PWHist.entries.empty())
+      m_PWHist = PWHistData(); // "00000" is the same as none
+  } else {
+    StringX pwh = GetPWHistory();
+    if (pwh.length() >= 5) {
+      pwh[0] = bStatus ? charT('1') : charT('0');
+      SetPWHistory(pwh);
+    }
+  }
+}
+
+void CItemData::SetPWHistoryMax(size_t pwh_max)
+{
+  ASSERT(pwh_max <= 255);
+  if (m_PWHist.bSet) {
+    m_PWHist.max = pwh_max;
+    if (!m_PWHist.bStatus && pwh_max == 0 && m_PWHist.entries.empty())
+      m_PWHist = PWHistData();
+  } else {
+    StringX pwh = GetPWHistory();
+    if (pwh.length() >= 5) {
+      StringX sxMax;
+      Format(sxMax, L"%02x", static_cast<unsigned int>(pwh_max));
+      pwh.replace(1, 2, sxMax);
+      SetPWHistory(pwh);
+    }
+  }
 }
 
 void CItemData::SetPWPolicy(const PWPolicy &pwp)
@@ -1528,13 +1732,15 @@ void CItemData::SetFieldValue(FieldType ft, const StringX &value)
     case PASSWORD:   /* 06 */
     case URL:        /* 0d */
     case AUTOTYPE:   /* 0e */
-    case PWHIST:     /* 0f */
     case EMAIL:      /* 14 */
     case RUNCMD:     /* 12 */
     case SYMBOLS:    /* 16 */
     case POLICYNAME: /* 18 */
       CItem::SetField(ft, value);
       break;
+    case PWHIST:     /* 0f */
+      SetPWHistory(value);
+      break;
     case CTIME:      /* 07 */
     case PMTIME:     /* 08 */
     case ATIME:      /* 09 */
@@ -1571,14 +1777,27 @@ void CItemData::SetFieldValue(FieldType ft, const StringX &value)
 bool CItemData::ValidatePWHistory()
 {
   // Return true if valid
-  if (!IsPasswordHistorySet())
-    return true; // empty is a kind of valid
+  StringX sxFixed;
+  if (CheckPWHistory(sxFixed))
+    return true;
+
+  if (GetPWHistory() != sxFixed)
+    SetPWHistory(sxFixed);
+
+  return false;
+}
+
+bool CItemData::CheckPWHistory(StringX &sxFixed) const
+{
+  // Return true if valid, else the history to replace it with.
+  // Doesn't change the entry, so can be called from any thread.
+  sxFixed = _T("");
+  if (!IsPasswordHistorySet() || m_PWHist.bSet)
+    return true; // empty is a kind of valid, and parsed is well-formed
 
   const StringX pwh = GetPWHistory();
-  if (pwh.length() < 5) { // not empty, but too short.
-    SetPWHistory(_T(""));
+  if (pwh.length() < 5) // not empty, but too short.
     return false;
-  }
 
   size_t pwh_max, num_err;
   PWHistList pwhistlist;
@@ -1589,10 +1808,8 @@ bool CItemData::ValidatePWHistory()
 
   size_t listnum = pwhistlist.size();
 
-  if (pwh_max == 0 && listnum == 0) {
-    SetPWHistory(_T(""));
+  if (pwh_max == 0 && listnum == 0)
     return false;
-  }
 
   if (listnum > pwh_max)
     pwh_max = listnum;
@@ -1610,9 +1827,7 @@ bool CItemData::ValidatePWHistory()
       sxBuffer = _T("");
   }
 
-  if (pwh != sxNewHistory)
-    SetPWHistory(sxNewHistory);
-
+  sxFixed = sxNewHistory;
   return false;
 }
 
@@ -1623,6 +1838,30 @@ bool CItemData::Matches(const stringT &stValue, int iObject,
 
   StringX sx_Object;
   FieldType ft = static_cast<FieldType>(iObject);
+
+  // Text fields are held as UTF-8: try to decide without converting
+  if (ft != GROUPTITLE &&
+      iFunction != PWSMatch::MR_PRESENT && iFunction != PWSMatch::MR_NOTPRESENT) {
+    size_t valueLen = CUTF8Conv::MaxUTF8Len(stValue.length());
+    std::vector<unsigned char> value(valueLen + 1);
+    std::vector<unsigned char> object(BlowFish::BLOCKSIZE);
+    size_t objectLen = 0;
+    FieldConstIter fiter = m_fields.find(ft);
+    if (fiter != m_fields.end()) {
+      objectLen = fiter->second.GetLength() + BlowFish::BLOCKSIZE;
+      object.resize(objectLen);
+      CItem::GetField(fiter->second, &object[0], objectLen);
+    }
+    bool bMatch(false), bDecided(false);
+    if (CUTF8Conv::Encode(stValue.data(), stValue.length(), &value[0], valueLen))
+      bDecided = PWSMatch::MatchUTF8(&value[0], valueLen, &object[0], objectLen,
+                                     iFunction, bMatch);
+    trashMemory(&value[0], value.size());
+    trashMemory(&object[0], object.size());
+    if (bDecided)
+      return bMatch;
+  }
+
   switch(ft) {
     case GROUP:
     case TITLE:
@@ -1663,7 +1902,7 @@ bool CItemData::Matches(int num1, int num2, int iObject,
       GetXTimeInt(iValue);
       break;
     case ENTRYSIZE:
-      GetSize(reinterpret_cast<size_t &>(iValue));
+      iValue = static_cast<int>(GetSize());
       break;
     case PASSWORDLEN:
       iValue = GetPasswordLength();
@@ -1908,13 +2147,16 @@ bool CItemData::SetField(unsigned char type, const unsigned char *data, size_t l
     case POLICY:
     case URL:
     case AUTOTYPE:
-    case PWHIST:
     case RUNCMD:
     case EMAIL:
     case SYMBOLS:
     case POLICYNAME:
       if (!SetTextField(ft, data, len)) return false;
       break;
+    case PWHIST:
+      if (!SetTextField(ft, data, len)) return false;
+      SetPWHistory(GetField(PWHIST)); // keep it parsed if well-formed
+      break;
     case CTIME:
     case PMTIME:
     case ATIME:
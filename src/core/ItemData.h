@@ -16,6 +16,7 @@
 #include "Item.h"
 #include "PWSprefs.h"
 #include "PWPolicy.h"
+#include "PWHistory.h"
 #include "os/UUID.h"
 #include "StringX.h"
 
@@ -132,6 +133,16 @@ public:
   int32 GetXTimeInt(int32 &xint) const; // V30
   StringX GetXTimeInt() const; // V30
   StringX GetPWHistory() const;  // V30
+  // Well-formed password history is kept parsed (see SetPWHistory), so the
+  // following don't need to decrypt and re-parse the PWHIST string:
+  bool GetPWHistoryStatus() const;
+  size_t GetPWHistoryMax() const;
+  size_t GetPWHistoryCount() const;
+  // Same results as CreatePWHistoryList(GetPWHistory(), ...)
+  bool GetPWHistoryList(size_t &pwh_max, size_t &num_err, PWHistList &pwhl,
+                        PWSUtil::TMC time_format) const;
+  // Just the i'th (oldest first) password in the history, i < GetPWHistoryCount()
+  StringX GetPWHistoryPassword(size_t i) const;
   void GetPWPolicy(PWPolicy &pwp) const;
   StringX GetPWPolicy() const {return GetField(POLICY);}
   StringX GetRunCommand() const {return GetField(RUNCMD);}
@@ -191,6 +202,8 @@ public:
   void SetXTimeInt(int32 xint); // V30
   bool SetXTimeInt(const stringT &xint_str); // V30
   void SetPWHistory(const StringX &PWHistory);  // V30
+  void SetPWHistoryStatus(bool bStatus);
+  void SetPWHistoryMax(size_t pwh_max);
   void SetPWPolicy(const PWPolicy &pwp);
   bool SetPWPolicy(const stringT &cs_pwp);
   void SetRunCommand(const StringX &sx_RunCommand) {CItem::SetField(RUNCMD, sx_RunCommand);}
@@ -215,8 +228,17 @@ public:
   bool operator==(const CItemData &that) const;
   bool operator!=(const CItemData &that) const {return !operator==(that);}
 
+  virtual void GetFingerprint(unsigned char digest[SHA256::HASHLEN]) const;
+
+  // Hide CItem's, to account for the parsed password history
+  size_t GetSize() const;
+  void GetSize(size_t &isize) const {isize = GetSize();}
+
   // Check record for correct password history
   bool ValidatePWHistory(); // return true if OK, false if there's a problem
+  // As above, but only reports the fix: if false is returned, the history
+  // should be set to sxFixed (unless it's already that)
+  bool CheckPWHistory(StringX &sxFixed) const;
 
   bool IsExpired() const;
   bool WillExpire(const int numdays) const;
@@ -247,7 +269,7 @@ public:
   bool IsExpiryDateSet() const             { return IsFieldSet(XTIME);     }
   bool IsRecordModificationTimeSet() const { return IsFieldSet(RMTIME);    }
   bool IsAutoTypeSet() const               { return IsFieldSet(AUTOTYPE);  }
-  bool IsPasswordHistorySet() const        { return IsFieldSet(PWHIST);    }
+  bool IsPasswordHistorySet() const        { return m_PWHist.bSet || IsFieldSet(PWHIST); }
   bool IsPasswordPolicySet() const         { return IsFieldSet(POLICY);    }
   bool IsPasswordExpiryIntervalSet() const { return IsFieldSet(XTIME_INT); }
   bool IsDCASet() const                    { return IsFieldSet(DCA);       }
@@ -299,6 +321,21 @@ private:
   EntryType m_entrytype;
   EntryStatus m_entrystatus;
 
+  // Parsed password history. If bSet is false, the history (if any) is the
+  // PWHIST field as-is, since it's malformed - see ValidatePWHistory().
+  // Passwords are encrypted individually, as any other field.
+  struct PWHistData {
+    PWHistData() : bSet(false), bStatus(false), max(0) {}
+    bool bSet;
+    bool bStatus;
+    size_t max;
+    std::vector<std::pair<time_t, CItemField> > entries; // oldest first
+  };
+  PWHistData m_PWHist;
+
+  bool ParsePWHistory(const StringX &pwh); // false if malformed
+  StringX MakePWHistory() const; // inverse of ParsePWHistory
+
   // move from pre-2.0 name to post-2.0 title+user
   void SplitName(const StringX &name,
                  StringX &title, StringX &username);
@@ -11,11 +11,38 @@
 #include <math.h>
 
 #include "ItemField.h"
+#include "UTF8Conv.h"
 #include "Util.h"
 #include "Fish.h"
 #include "PWSrand.h"
+#include "sha256.h"
 #include "os/funcwrap.h"
 
+namespace {
+  // Replaces what CUTF8Conv::Encode() rejects (unpaired surrogates,
+  // values past U+10FFFF) with U+FFFD
+  StringX Encodable(const StringX &value)
+  {
+    StringX retval;
+    retval.reserve(value.length());
+    for (size_t i = 0; i < value.length(); i++) {
+      const ulong32 c = sizeof(wchar_t) == 2 ?
+        static_cast<unsigned short>(value[i]) : static_cast<ulong32>(value[i]);
+      if (sizeof(wchar_t) == 2 && c >= 0xd800 && c <= 0xdbff &&
+          i + 1 < value.length() &&
+          static_cast<unsigned short>(value[i + 1]) >= 0xdc00 &&
+          static_cast<unsigned short>(value[i + 1]) <= 0xdfff) {
+        retval += value[i++];
+        retval += value[i];
+      } else if ((c >= 0xd800 && c <= 0xdfff) || c > 0x10ffff)
+        retval += wchar_t(0xfffd);
+      else
+        retval += value[i];
+    }
+    return retval;
+  }
+}
+
 //Returns the number of bytes of 8 byte blocks needed to store 'size' bytes
 size_t CItemField::GetBlockSize(size_t size) const
 {
@@ -60,6 +87,16 @@ void CItemField::Empty()
   }
 }
 
+void CItemField::Hash(SHA256 &hash) const
+{
+  unsigned char buf[sizeof(int32) + 1];
+  buf[0] = m_Type;
+  putInt32(buf + 1, static_cast<int32>(m_Length));
+  hash.Update(buf, sizeof(buf));
+  if (m_Length > 0)
+    hash.Update(m_Data, GetBlockSize(m_Length));
+}
+
 void CItemField::Set(const unsigned char* value, size_t length,
                      const Fish *bf, unsigned char type)
 {
@@ -99,10 +136,19 @@ void CItemField::Set(const unsigned char* value, size_t length,
 
 void CItemField::Set(const StringX &value, const Fish *bf, unsigned char type)
 {
-  const LPCTSTR plainstr = value.c_str();
+  // Text is kept as UTF-8, as on file, rather than as wchar_t's:
+  // for ASCII, that's a quarter of the memory and cipher work
+  size_t utf8Len = CUTF8Conv::MaxUTF8Len(value.length());
+  unsigned char *utf8 = new unsigned char[utf8Len + 1];
+  if (!CUTF8Conv::Encode(value.data(), value.length(), utf8, utf8Len)) {
+    pws_os::Trace0(_T("CItemField::Set: replacing unencodable characters\n"));
+    const StringX sx = Encodable(value);
+    VERIFY(CUTF8Conv::Encode(sx.data(), sx.length(), utf8, utf8Len));
+  }
 
-  Set(reinterpret_cast<const unsigned char *>(plainstr),
-      value.length() * sizeof(*plainstr), bf, type);
+  Set(utf8, utf8Len, bf, type);
+  trashMemory(utf8, utf8Len);
+  delete[] utf8;
 }
 
 void CItemField::Get(unsigned char *value, size_t &length, const Fish *bf) const
@@ -140,23 +186,27 @@ void CItemField::Get(StringX &value, const Fish *bf) const
 {
   // Sanity check: length is 0 iff data ptr is NULL
   ASSERT((m_Length == 0 && m_Data == NULL) ||
-         (m_Length > 0 && m_Data != NULL && m_Length % sizeof(TCHAR) == 0));
+         (m_Length > 0 && m_Data != NULL));
 
   if (m_Length == 0) {
     value = _T("");
   } else { // we have data to decrypt
     size_t BlockLength = GetBlockSize(m_Length);
     unsigned char *tempmem = new unsigned char[BlockLength];
-    TCHAR *pt = reinterpret_cast<TCHAR *>(tempmem);
     size_t x;
 
     // decrypt block by block
     for (x = 0; x < BlockLength; x += 8)
       bf->Decrypt(m_Data + x, tempmem + x);
 
-    // copy to value TCHAR by TCHAR
-    for (x = 0; x < m_Length/sizeof(TCHAR); x++)
-      value += pt[x];
+    // UTF-8 never needs more wchar_t's than bytes
+    value.resize(m_Length);
+    size_t wcLen;
+    if (!CUTF8Conv::Decode(tempmem, m_Length, &value[0], wcLen)) {
+      ASSERT(0); // Set() only stores valid UTF-8
+      wcLen = 0;
+    }
+    value.resize(wcLen);
 
     trashMemory(tempmem, BlockLength);
     delete [] tempmem;
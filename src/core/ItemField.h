@@ -22,6 +22,7 @@
 */
 
 class Fish;
+class SHA256;
 
 class CItemField
 {
@@ -43,6 +44,8 @@ public:
   size_t GetSize() const {return GetBlockSize(m_Length);}
   bool IsEmpty() const {return m_Length == 0;}
   void Empty();
+  // Feeds the encrypted value to hash, for CItem::GetFingerprint()
+  void Hash(SHA256 &hash) const;
 
 private:
   //Number of 8 byte blocks needed for size
@@ -16,6 +16,76 @@
 #include "os/pws_tchar.h"
 
 #include <time.h>
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+  bool IsASCII(const unsigned char *s, size_t len)
+  {
+    for (size_t i = 0; i < len; i++)
+      if (s[i] >= 0x80)
+        return false;
+    return true;
+  }
+
+  inline unsigned char ASCIILower(unsigned char c)
+  {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+  }
+}
+
+bool PWSMatch::MatchUTF8(const unsigned char *value, size_t valueLen,
+                         const unsigned char *object, size_t objectLen,
+                         int iFunction, bool &bMatch)
+{
+  // Byte comparisons of well-formed UTF-8 match whole characters only,
+  // so these agree with Match() when case sensitive. Case folding is
+  // only done here for ASCII.
+  const bool bCase = iFunction < 0;
+  if (!bCase && !(IsASCII(value, valueLen) && IsASCII(object, objectLen)))
+    return false;
+
+  auto eq = [bCase](unsigned char a, unsigned char b)
+    {return bCase ? a == b : ASCIILower(a) == ASCIILower(b);};
+  const unsigned char *vEnd = value + valueLen, *oEnd = object + objectLen;
+
+  switch (iFunction) {
+    case -MR_EQUALS:
+    case  MR_EQUALS:
+    case -MR_NOTEQUAL:
+    case  MR_NOTEQUAL:
+      bMatch = objectLen == valueLen && std::equal(value, vEnd, object, eq);
+      if (abs(iFunction) == MR_NOTEQUAL)
+        bMatch = !bMatch;
+      return true;
+    case -MR_BEGINS:
+    case  MR_BEGINS:
+    case -MR_NOTBEGIN:
+    case  MR_NOTBEGIN:
+      bMatch = objectLen >= valueLen && std::equal(value, vEnd, object, eq);
+      if (abs(iFunction) == MR_NOTBEGIN)
+        bMatch = !bMatch;
+      return true;
+    case -MR_ENDS:
+    case  MR_ENDS:
+    case -MR_NOTEND:
+    case  MR_NOTEND:
+      bMatch = objectLen > valueLen && std::equal(value, vEnd, oEnd - valueLen, eq);
+      if (abs(iFunction) == MR_NOTEND)
+        bMatch = !bMatch;
+      return true;
+    case -MR_CONTAINS:
+    case  MR_CONTAINS:
+    case -MR_NOTCONTAIN:
+    case  MR_NOTCONTAIN:
+      bMatch = valueLen == 0 || std::search(object, oEnd, value, vEnd, eq) != oEnd;
+      if (abs(iFunction) == MR_NOTCONTAIN)
+        bMatch = !bMatch;
+      return true;
+    default:
+      return false;
+  }
+}
 
 bool PWSMatch::Match(const StringX &stValue, StringX sx_Object,
                      const int &iFunction)
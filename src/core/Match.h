@@ -56,6 +56,14 @@ namespace PWSMatch {
 
   // Generalised checking
   bool Match(const StringX &stValue, StringX sx_Object, const int &iFunction);
+  // Same, on UTF-8 (e.g., a text field as held in memory), for the rules
+  // that can be decided without converting to StringX: [NOT]EQUAL,
+  // [NOT]BEGIN(S), [NOT]END(S), [NOT]CONTAIN(S) - case sensitive, or
+  // case insensitive with both strings in ASCII. Returns false if it
+  // can't decide, leaving bMatch unchanged.
+  bool MatchUTF8(const unsigned char *value, size_t valueLen,
+                 const unsigned char *object, size_t objectLen,
+                 int iFunction, bool &bMatch);
 
   template<typename T> bool Match(T v1, T v2, T value, int iFunction)
   {
@@ -20,6 +20,8 @@
 
 #include <string>
 #include <vector>
+#include <cmath>
+#include <climits>
 
 using namespace std;
 
@@ -202,19 +204,78 @@ charT CPasswordCharPool::GetRandomChar(CPasswordCharPool::CharType t, unsigned i
   return retval;
 }
 
-charT CPasswordCharPool::GetRandomChar(CPasswordCharPool::CharType t) const
+charT CPasswordCharPool::GetRandomChar(CPasswordCharPool::CharType t,
+                                        RandomSource &rs) const
 {
-  PWSrand *ri = PWSrand::GetInstance();
-  uint r = ri->RangeRand(static_cast<uint>(m_lengths[t]));
+  uint r = rs.RangeRand(m_lengths[t]);
   return GetRandomChar(t, r);
 }
 
+CPasswordCharPool::RandomSource::RandomSource(size_t bufsize)
+  : m_buf(bufsize), m_next(bufsize)
+{
+}
+
+CPasswordCharPool::RandomSource::~RandomSource()
+{
+  if (!m_buf.empty())
+    trashMemory(&m_buf[0], m_buf.size() * sizeof(m_buf[0]));
+}
+
+unsigned int CPasswordCharPool::RandomSource::RandUInt()
+{
+  if (m_buf.empty())
+    return PWSrand::GetInstance()->RandUInt();
+
+  if (m_next == m_buf.size()) {
+    PWSrand::GetInstance()->GetRandomData(&m_buf[0],
+                                          static_cast<unsigned long>(m_buf.size() * sizeof(m_buf[0])));
+    m_next = 0;
+  }
+  return m_buf[m_next++];
+}
+
+unsigned int CPasswordCharPool::RandomSource::RangeRand(size_t len)
+{
+  // As PWSrand::RangeRand: reject the top (UINT_MAX + 1) % len values
+  // to avoid modulo bias
+  if (len != 0) {
+    unsigned int r;
+    const size_t ceil = UINT_MAX - (UINT_MAX % len) - 1;
+    while ((r = RandUInt()) > ceil)
+      ;
+    return static_cast<unsigned int>(r % len);
+  } else
+    return 0;
+}
+
 struct RandomWrapper {
+  RandomWrapper(CPasswordCharPool::RandomSource &rs) : m_rs(rs) {}
   unsigned int operator()(unsigned int i)
-  {return PWSrand::GetInstance()->RangeRand(i);}
+  {return m_rs.RangeRand(i);}
+private:
+  RandomWrapper &operator=(const RandomWrapper &); // Do not implement
+  CPasswordCharPool::RandomSource &m_rs;
 };
 
 StringX CPasswordCharPool::MakePassword() const
+{
+  RandomSource rs;
+  return MakePassword(rs);
+}
+
+void CPasswordCharPool::MakePasswords(size_t count, vector<StringX> &vPasswords) const
+{
+  // Enough random words for a few passwords at a time
+  RandomSource rs(max(size_t(256), size_t(m_pwlen) * (NUMTYPES + 2) * 4));
+
+  vPasswords.clear();
+  vPasswords.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    vPasswords.push_back(MakePassword(rs));
+}
+
+StringX CPasswordCharPool::MakePassword(RandomSource &rs) const
 {
   // We don't care if the policy is inconsistent e.g. 
   // number of lower case chars > 1 + make pronounceable
@@ -230,23 +291,23 @@ StringX CPasswordCharPool::MakePassword() const
 
   // pronounceable and hex passwords are handled separately:
   if (m_pronounceable)
-    return MakePronounceable();
+    return MakePronounceable(rs);
   if (m_usehexdigits)
-    return MakeHex();
+    return MakeHex(rs);
 
   vector<typeFreq_s> typeFreqs;
 
   if (m_uselowercase)
-    typeFreqs.push_back(typeFreq_s(this, LOWERCASE, m_numlowercase));
+    typeFreqs.push_back(typeFreq_s(this, LOWERCASE, m_numlowercase, rs));
 
   if (m_useuppercase)
-    typeFreqs.push_back(typeFreq_s(this, UPPERCASE, m_numuppercase));
+    typeFreqs.push_back(typeFreq_s(this, UPPERCASE, m_numuppercase, rs));
 
   if (m_usedigits)
-    typeFreqs.push_back(typeFreq_s(this, DIGIT, m_numdigits));
+    typeFreqs.push_back(typeFreq_s(this, DIGIT, m_numdigits, rs));
 
   if (m_usesymbols)
-    typeFreqs.push_back(typeFreq_s(this, SYMBOL, m_numsymbols));
+    typeFreqs.push_back(typeFreq_s(this, SYMBOL, m_numsymbols, rs));
 
   // Sort requested char type in decreasing order
   // of requested (at least) frequency:
@@ -271,7 +332,7 @@ StringX CPasswordCharPool::MakePassword() const
 
   // Now fill in the rest
   while (temp.length() != m_pwlen) {
-    uint i = PWSrand::GetInstance()->RangeRand(typeFreqs.size());
+    uint i = rs.RangeRand(typeFreqs.size());
     if (!typeFreqs[i].vchars.empty()) {
       temp.push_back(typeFreqs[i].vchars.back());
       typeFreqs[i].vchars.pop_back();
@@ -283,7 +344,7 @@ StringX CPasswordCharPool::MakePassword() const
  do_shuffle:
   // If 'at least' values were non-zero, we have some unwanted order,
   // se we mix things up a bit:
-  RandomWrapper rnw;
+  RandomWrapper rnw(rs);
   random_shuffle(temp.begin(), temp.end(), rnw);
 
   ASSERT(temp.length() == size_t(m_pwlen));
@@ -330,7 +391,8 @@ private:
 };
 
 static void leet_replace(stringT &password, unsigned int i,
-                         bool usedigits, bool usesymbols)
+                         bool usedigits, bool usesymbols,
+                         CPasswordCharPool::RandomSource &rs)
 {
   ASSERT(i < password.size());
   ASSERT(usedigits || usesymbols);
@@ -339,25 +401,55 @@ static void leet_replace(stringT &password, unsigned int i,
   charT symsub = usesymbols ? leets[password[i] - charT('a')].sym : 0;
 
   // if both substitutions possible, select one randomly
-  if (digsub != 0 && symsub != 0 && PWSrand::GetInstance()->RandUInt() % 2)
+  if (digsub != 0 && symsub != 0 && rs.RandUInt() % 2)
     digsub = 0;
   password[i] = (digsub != 0) ? digsub : symsub;
   ASSERT(password[i] != 0);
 }
 
-StringX CPasswordCharPool::MakePronounceable() const
+namespace {
+  // Cumulative frequencies from trigram.h, so that MakePronounceable can
+  // choose with a binary search instead of summing frequencies each time
+  struct TrigramCDF {
+    TrigramCDF()
+    {
+      long sum = 0;
+      for (int c1 = 0; c1 < 26; c1++)
+        for (int c2 = 0; c2 < 26; c2++) {
+          long sum3 = 0;
+          for (int c3 = 0; c3 < 26; c3++) {
+            sum += tris[c1][c2][c3];
+            sum3 += tris[c1][c2][c3];
+            all[(c1 * 26 + c2) * 26 + c3] = sum;
+            next[c1][c2][c3] = sum3;
+          }
+        }
+      ASSERT(sum == sigma);
+    }
+
+    long all[26 * 26 * 26]; // over all trigrams, in order
+    long next[26][26][26]; // over c3, for given c1, c2
+  };
+
+  const TrigramCDF &GetTrigramCDF()
+  {
+    static const TrigramCDF cdf;
+    return cdf;
+  }
+} // anonymous namespace
+
+StringX CPasswordCharPool::MakePronounceable(RandomSource &rs) const
 {
   /**
    * Following based on gpw.C from
    * http://www.multicians.org/thvv/tvvtools.html
    * Thanks to Tom Van Vleck, Morrie Gasser, and Dan Edwards.
    */
-  charT c1, c2, c3;  /* array indices */
+  const TrigramCDF &cdf = GetTrigramCDF();
+  int c1, c2, c3;    /* array indices */
   long sumfreq;      /* total frequencies[c1][c2][*] */
-  long ranno;        /* random number in [0,sumfreq] */
-  long sum;          /* running total of frequencies */
+  long ranno;        /* random number in [0,sumfreq) */
   uint nchar;        /* number of chars in password so far */
-  PWSrand *pwsrnd = PWSrand::GetInstance();
   stringT password(m_pwlen, 0);
 
   /* Pick a random starting point. */
@@ -366,31 +458,18 @@ StringX CPasswordCharPool::MakePronounceable() const
      for the general population.  For example, this code happily
      generates "mmitify" even though no word in my dictionary
      begins with mmi. So what.) */
-  sumfreq = sigma;  // sigma calculated by loadtris
-  ranno = static_cast<long>(pwsrnd->RangeRand(sumfreq+1)); // Weight by sum of frequencies
-  sum = 0;
-  for (c1 = 0; c1 < 26; c1++) {
-    for (c2 = 0; c2 < 26; c2++) {
-      for (c3 = 0; c3 < 26; c3++) {
-        sum += tris[int(c1)][int(c2)][int(c3)];
-        if (sum > ranno) { // Pick first value
-          password[0] = charT('a') + c1;
-          password[1] = charT('a') + c2;
-          password[2] = charT('a') + c3;
-          c1 = c2 = c3 = 26; // Break all loops.
-        } // if sum
-      } // for c3
-    } // for c2
-  } // for c1
+  ranno = static_cast<long>(rs.RangeRand(sigma)); // Weight by sum of frequencies
+  const int tri = static_cast<int>(upper_bound(cdf.all, cdf.all + 26 * 26 * 26, ranno) - cdf.all);
+  password[0] = charT('a') + tri / (26 * 26);
+  password[1] = charT('a') + (tri / 26) % 26;
+  password[2] = charT('a') + tri % 26;
 
   /* Do a random walk. */
   nchar = 3;  // We have three chars so far.
   while (nchar < m_pwlen) {
     c1 = password[nchar-2] - charT('a'); // Take the last 2 chars
     c2 = password[nchar-1] - charT('a'); // .. and find the next one.
-    sumfreq = 0;
-    for (c3 = 0; c3 < 26; c3++)
-      sumfreq += tris[int(c1)][int(c2)][int(c3)];
+    sumfreq = cdf.next[c1][c2][25];
     /* Note that sum < duos[c1][c2] because
        duos counts all digraphs, not just those
        in a trigraph. We want sum. */
@@ -398,15 +477,10 @@ StringX CPasswordCharPool::MakePronounceable() const
       break;  // Break while nchar loop & print what we have.
     }
     /* Choose a continuation. */
-    ranno = static_cast<long>(pwsrnd->RangeRand(sumfreq+1)); // Weight by sum of frequencies
-    sum = 0;
-    for (c3 = 0; c3 < 26; c3++) {
-      sum += tris[int(c1)][int(c2)][int(c3)];
-      if (sum > ranno) {
-        password[nchar++] = charT('a') + c3;
-        c3 = 26;  // Break the for c3 loop.
-      }
-    } // for c3
+    ranno = static_cast<long>(rs.RangeRand(sumfreq)); // Weight by sum of frequencies
+    c3 = static_cast<int>(upper_bound(cdf.next[c1][c2], cdf.next[c1][c2] + 26, ranno) -
+                          cdf.next[c1][c2]);
+    password[nchar++] = charT('a') + c3;
   } // while nchar
   /*
    * password now has an all-lowercase pronounceable password
@@ -423,12 +497,12 @@ StringX CPasswordCharPool::MakePronounceable() const
     for_each(password.begin(), password.end(), fill_sc);
     if (!sc.empty()) {
       // choose how many to replace (not too many, but at least one)
-      unsigned int rn = pwsrnd->RangeRand(sc.size() - 1)/2 + 1;
+      unsigned int rn = rs.RangeRand(sc.size() - 1)/2 + 1;
       // replace some of them
-      RandomWrapper rnw;
+      RandomWrapper rnw(rs);
       random_shuffle(sc.begin(), sc.end(), rnw);
       for (unsigned int i = 0; i < rn; i++)
-        leet_replace(password, sc[i], m_usedigits, m_usesymbols);
+        leet_replace(password, sc[i], m_usedigits, m_usesymbols, rs);
     }
   }
   // case
@@ -442,18 +516,18 @@ StringX CPasswordCharPool::MakePronounceable() const
     }
   else if (m_uselowercase && m_useuppercase) // mixed case
     for (i = 0; i < m_pwlen; i++) {
-      if (_istalpha(password[i]) && pwsrnd->RandUInt() % 2)
+      if (_istalpha(password[i]) && rs.RandUInt() % 2)
         password[i] = static_cast<charT>(_totupper(password[i]));
     }
 
   return password.c_str();
 }
 
-StringX CPasswordCharPool::MakeHex() const
+StringX CPasswordCharPool::MakeHex(RandomSource &rs) const
 {
   StringX password = _T("");
   for (uint i = 0; i < m_pwlen; i++) {
-      unsigned int rand = PWSrand::GetInstance()->RangeRand(static_cast<unsigned int>(m_sumlengths));
+      unsigned int rand = rs.RangeRand(m_lengths[HEXDIGIT]);
       charT ch = GetRandomChar(HEXDIGIT, rand);
       password += ch;
   }
@@ -505,3 +579,45 @@ bool CPasswordCharPool::CheckPassword(const StringX &pwd, StringX &error)
     return false;
   }
 }
+
+double CPasswordCharPool::EstimateEntropy(const StringX &pwd)
+{
+  /**
+   * Size of the character pool the password appears to be drawn from,
+   * based on the character types present, times the number of characters.
+   * A character that repeats its predecessor, or continues a sequence
+   * ("abc", "321"), only counts for one bit, so that "aaaaaaaaaaaa" and
+   * "123456789012" don't look strong.
+   * This is an upper bound: dictionary words aren't detected.
+   */
+  const size_t length = pwd.length();
+  if (length == 0)
+    return 0.0;
+
+  bool has_uc = false, has_lc = false, has_digit = false;
+  bool has_symbol = false, has_other = false;
+
+  for (size_t i = 0; i < length; i++) {
+    const charT c = pwd[i];
+    if (c >= charT('a') && c <= charT('z')) has_lc = true;
+    else if (c >= charT('A') && c <= charT('Z')) has_uc = true;
+    else if (c >= charT('0') && c <= charT('9')) has_digit = true;
+    else if (c > charT(' ') && c < charT(0x7f)) has_symbol = true;
+    else has_other = true; // space, control or non-ASCII
+  }
+
+  size_t poolsize = 0;
+  if (has_lc) poolsize += 26;
+  if (has_uc) poolsize += 26;
+  if (has_digit) poolsize += 10;
+  if (has_symbol) poolsize += 32; // printable ASCII punctuation
+  if (has_other) poolsize += 100; // arbitrary, but generous
+  const double bits_per_char = std::log(double(poolsize)) / std::log(2.0);
+
+  double bits = bits_per_char; // first character
+  for (size_t i = 1; i < length; i++) {
+    const int delta = int(pwd[i]) - int(pwd[i - 1]);
+    bits += (delta >= -1 && delta <= 1) ? 1.0 : bits_per_char;
+  }
+  return bits;
+}
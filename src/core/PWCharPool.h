@@ -16,6 +16,7 @@
 #include "PWPolicy.h"
 
 #include <algorithm>
+#include <vector>
 
 /*
  * This class is used to create a random password based on the policy
@@ -28,8 +29,13 @@
  * CPasswordCharPool pwgen(policy);
  * StringX pwd = pwgen.MakePassword();
  *
+ * MakePasswords() is for generating many passwords from the same policy:
+ * the character sets are only set up once, and random data is drawn from
+ * PWSrand in bulk rather than a few bytes at a time.
+ *
  * CheckPassword() is used to verify the strength of existing passwords,
  * i.e., the password used to protect the database.
+ * EstimateEntropy() gives a rough strength estimate, in bits, for auditing.
  */
 
 class CPasswordCharPool
@@ -37,24 +43,43 @@ class CPasswordCharPool
 public:
   CPasswordCharPool(const PWPolicy &policy);
   StringX MakePassword() const;
+  void MakePasswords(size_t count, std::vector<StringX> &vPasswords) const;
 
   ~CPasswordCharPool();
 
   static bool CheckPassword(const StringX &pwd, StringX &error);
+  static double EstimateEntropy(const StringX &pwd);
   static stringT GetDefaultSymbols();
   static stringT GetEasyVisionSymbols() {return easyvision_symbol_chars;}
   static stringT GetPronounceableSymbols() {return pronounceable_symbol_chars;}
   static void ResetDefaultSymbols(); // reset the preference string
 
+  // Random numbers for the Make* functions: straight from PWSrand, or,
+  // if bufsize != 0, from a buffer refilled from PWSrand bufsize words
+  // at a time.
+  class RandomSource {
+  public:
+    RandomSource(size_t bufsize = 0);
+    ~RandomSource();
+    unsigned int RandUInt();
+    unsigned int RangeRand(size_t len); // unbiased, in [0, len)
+  private:
+    RandomSource(const RandomSource &); // Do not implement
+    RandomSource &operator=(const RandomSource &); // Do not implement
+    std::vector<uint32> m_buf;
+    size_t m_next;
+  };
+
 private:
   enum CharType {LOWERCASE = 0, UPPERCASE = 1,
                  DIGIT = 2, SYMBOL = 3, HEXDIGIT = 4, NUMTYPES = 5};
   // select a chartype with weighted probability
   CharType GetRandomCharType(unsigned int rand) const;
   charT GetRandomChar(CharType t, unsigned int rand) const;
-  charT GetRandomChar(CharType t) const;
-  StringX MakePronounceable() const;
-  StringX MakeHex() const;
+  charT GetRandomChar(CharType t, RandomSource &rs) const;
+  StringX MakePassword(RandomSource &rs) const;
+  StringX MakePronounceable(RandomSource &rs) const;
+  StringX MakeHex(RandomSource &rs) const;
 
   // here are all the character types, in both full and "easyvision" versions
   static const charT std_lowercase_chars[];
@@ -108,11 +133,12 @@ private:
   struct typeFreq_s {
     uint numchars;
     StringX vchars;
-  typeFreq_s(const CPasswordCharPool *parent, CharType ct, uint nc)
+  typeFreq_s(const CPasswordCharPool *parent, CharType ct, uint nc,
+             RandomSource &rs)
   : numchars(nc) {
     vchars.resize(parent->m_pwlen);
     std::generate(vchars.begin(), vchars.end(),
-                  [this, parent, ct] () {return parent->GetRandomChar(ct);});
+                  [parent, ct, &rs] () {return parent->GetRandomChar(ct, rs);});
   }
   };
 
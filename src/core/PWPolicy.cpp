@@ -137,6 +137,16 @@ StringX PWPolicy::MakeRandomPassword() const
   return pwchars.MakePassword();
 }
 
+void PWPolicy::MakeRandomPasswords(size_t count, std::vector<StringX> &vPasswords) const
+{
+  PWPolicy pol(*this);
+  if (flags == 0)
+    pol = PWSprefs::GetInstance()->GetDefaultPolicy();
+
+  CPasswordCharPool pwchars(pol);
+  pwchars.MakePasswords(count, vPasswords);
+}
+
 static stringT PolValueString(int flag, bool override, int count)
 {
   // helper function for Policy2Table
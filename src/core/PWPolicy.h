@@ -13,6 +13,8 @@
 
 #include "StringX.h"
 
+#include <vector>
+
 // Password Policy related stuff
 enum {DEFAULT_POLICY = 0, NAMED_POLICY, SPECIFIC_POLICY};
 enum {DEFAULT_SYMBOLS = 0, OWN_SYMBOLS = 1}; // TBD - try to eliminate, as this should be implicit
@@ -101,6 +103,9 @@ struct PWPolicy {
   // with arguments matching 'this' policy, or,
   // preference-defined policy if this->flags == 0
   StringX MakeRandomPassword() const;
+  // As MakeRandomPassword, count times, but much cheaper than calling it
+  // count times
+  void MakeRandomPasswords(size_t count, std::vector<StringX> &vPasswords) const;
 
   // "User friendly" Display of a policy
   StringX GetDisplayString();
@@ -0,0 +1,498 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+/*
+ * Implementation of attachment content compression, see PWSCompress.h
+ */
+
+#include "PWSCompress.h"
+#include "Util.h"
+
+#include "os/debug.h"
+#include "os/pws_tchar.h"
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#endif
+
+#include <cstring>
+
+namespace {
+  // Media types whose content is compressed already. Types are as
+  // reported by pws_os::GetMediaType(), which may be "unknown".
+  const TCHAR *const CompressedTypes[] = {
+    _T("audio/"), _T("video/"),
+    _T("image/gif"), _T("image/jpeg"), _T("image/png"), _T("image/webp"),
+    _T("application/zip"), _T("application/gzip"), _T("application/x-gzip"),
+    _T("application/x-bzip2"), _T("application/x-xz"), _T("application/x-lzma"),
+    _T("application/x-7z-compressed"), _T("application/x-rar"),
+    _T("application/vnd.rar"), _T("application/zstd"),
+    _T("application/java-archive"), _T("application/epub+zip"),
+    // zip files by another name:
+    _T("application/vnd.openxmlformats-officedocument."),
+    _T("application/vnd.oasis.opendocument."),
+  };
+  // ...though these are worth trying
+  const TCHAR *const UncompressedTypes[] = {
+    _T("audio/x-wav"), _T("audio/wav"),
+  };
+
+  bool HasPrefix(const StringX &s, const TCHAR *prefix)
+  {
+    return s.compare(0, _tcslen(prefix), prefix) == 0;
+  }
+
+#ifndef NO_ZLIB
+  // For text, level 1's output is about a tenth larger than that of the
+  // default level (6), in less than half the time (pwsbench
+  // --attcontent=text --compress)
+  const int ZLIB_LEVEL = 1;
+  const size_t SAMPLE_LEN = 16384;
+
+  // zlib's buffers hold plaintext, so they're trashed when freed. Each
+  // allocation is prefixed by its size, as zfree isn't told.
+  voidpf ZAlloc(voidpf, uInt items, uInt size)
+  {
+    const size_t len = size_t(items) * size;
+    unsigned char *p = new unsigned char[sizeof(size_t) + len];
+    memcpy(p, &len, sizeof(size_t));
+    return p + sizeof(size_t);
+  }
+
+  void ZFree(voidpf, voidpf address)
+  {
+    unsigned char *p = static_cast<unsigned char *>(address) - sizeof(size_t);
+    size_t len;
+    memcpy(&len, p, sizeof(size_t));
+    trashMemory(p, sizeof(size_t) + len);
+    delete[] p;
+  }
+#endif
+
+  // A decoder for zlib streams (RFC 1950 & 1951) after Mark Adler's
+  // puff.c, so that what's compressed on one platform can be read on
+  // all of them, zlib or not. It's slower than zlib's inflate(), which
+  // is used when there.
+  const int MAXBITS = 15;    // longest code
+  const int MAXLCODES = 286; // literal/length codes
+  const int MAXDCODES = 30;  // distance codes
+  const int FIXLCODES = 288; // literal/length codes of a fixed block
+
+  struct Huffman {
+    short count[MAXBITS + 1]; // codes of each length
+    short symbol[FIXLCODES];  // symbols, ordered by code
+  };
+
+  class Inflater
+  {
+  public:
+    Inflater(const unsigned char *in, size_t inLen,
+             unsigned char *out, size_t outLen)
+      : m_in(in), m_inLen(inLen), m_inPos(0),
+        m_out(out), m_outLen(outLen), m_outPos(0),
+        m_bitBuf(0), m_bitCnt(0), m_bEOF(false) {}
+    bool Inflate();
+
+  private:
+    unsigned Bits(int need);
+    int Decode(const Huffman &h);
+    static int Construct(Huffman &h, const short *length, int n);
+    bool Stored();
+    bool Fixed();
+    bool Dynamic();
+    bool Codes(const Huffman &lencode, const Huffman &distcode);
+    ulong32 Adler32() const;
+
+    const unsigned char *m_in;
+    const size_t m_inLen;
+    size_t m_inPos;
+    unsigned char *m_out;
+    const size_t m_outLen;
+    size_t m_outPos;
+    unsigned long m_bitBuf;
+    int m_bitCnt;
+    bool m_bEOF; // ran out of input
+  };
+
+  // Next need bits of input, least significant first
+  unsigned Inflater::Bits(int need)
+  {
+    unsigned long val = m_bitBuf;
+    while (m_bitCnt < need) {
+      if (m_inPos == m_inLen) {
+        m_bEOF = true;
+        return 0;
+      }
+      val |= static_cast<unsigned long>(m_in[m_inPos++]) << m_bitCnt;
+      m_bitCnt += 8;
+    }
+    m_bitBuf = val >> need;
+    m_bitCnt -= need;
+    return static_cast<unsigned>(val & ((1UL << need) - 1));
+  }
+
+  // Next symbol coded by h, or -1 if there's none
+  int Inflater::Decode(const Huffman &h)
+  {
+    int code = 0, first = 0, index = 0;
+    for (int len = 1; len <= MAXBITS; len++) {
+      code |= Bits(1);
+      if (m_bEOF)
+        return -1;
+      const int count = h.count[len];
+      if (code - count < first)
+        return h.symbol[index + (code - first)];
+      index += count;
+      first = (first + count) << 1;
+      code <<= 1;
+    }
+    return -1;
+  }
+
+  // Builds h from the code lengths of n symbols. Returns 0 for a
+  // complete code, > 0 for an incomplete one, < 0 if oversubscribed.
+  int Inflater::Construct(Huffman &h, const short *length, int n)
+  {
+    int len;
+    for (len = 0; len <= MAXBITS; len++)
+      h.count[len] = 0;
+    for (int symbol = 0; symbol < n; symbol++)
+      h.count[length[symbol]]++;
+    if (h.count[0] == n)
+      return 0;
+
+    int left = 1;
+    for (len = 1; len <= MAXBITS; len++) {
+      left <<= 1;
+      left -= h.count[len];
+      if (left < 0)
+        return left;
+    }
+
+    short offs[MAXBITS + 1];
+    offs[1] = 0;
+    for (len = 1; len < MAXBITS; len++)
+      offs[len + 1] = static_cast<short>(offs[len] + h.count[len]);
+    for (int symbol = 0; symbol < n; symbol++)
+      if (length[symbol] != 0)
+        h.symbol[offs[length[symbol]]++] = static_cast<short>(symbol);
+    return left;
+  }
+
+  bool Inflater::Stored()
+  {
+    // Starts at a byte boundary, what's left of the current byte's unused
+    m_bitBuf = 0;
+    m_bitCnt = 0;
+    if (m_inLen - m_inPos < 4)
+      return false;
+    const unsigned len = m_in[m_inPos] | (m_in[m_inPos + 1] << 8);
+    if (m_in[m_inPos + 2] != (~len & 0xff) ||
+        m_in[m_inPos + 3] != ((~len >> 8) & 0xff))
+      return false;
+    m_inPos += 4;
+    if (m_inLen - m_inPos < len || m_outLen - m_outPos < len)
+      return false;
+    memcpy(m_out + m_outPos, m_in + m_inPos, len);
+    m_inPos += len;
+    m_outPos += len;
+    return true;
+  }
+
+  bool Inflater::Codes(const Huffman &lencode, const Huffman &distcode)
+  {
+    static const short lbase[29] = {
+      3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+      35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const short lext[29] = {
+      0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+      3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const short dbase[30] = {
+      1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+      8193, 12289, 16385, 24577};
+    static const short dext[30] = {
+      0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+      7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    for (;;) {
+      int symbol = Decode(lencode);
+      if (symbol < 0)
+        return false;
+      if (symbol < 256) { // literal
+        if (m_outPos == m_outLen)
+          return false;
+        m_out[m_outPos++] = static_cast<unsigned char>(symbol);
+      } else if (symbol == 256) { // end of block
+        return true;
+      } else { // length & distance back
+        symbol -= 257;
+        if (symbol >= 29)
+          return false;
+        size_t len = lbase[symbol] + Bits(lext[symbol]);
+        symbol = Decode(distcode);
+        if (symbol < 0 || symbol >= 30)
+          return false;
+        const size_t dist = dbase[symbol] + Bits(dext[symbol]);
+        if (m_bEOF || dist > m_outPos || len > m_outLen - m_outPos)
+          return false;
+        for (; len > 0; len--, m_outPos++)
+          m_out[m_outPos] = m_out[m_outPos - dist];
+      }
+    }
+  }
+
+  bool Inflater::Fixed()
+  {
+    Huffman lencode, distcode;
+    short lengths[FIXLCODES];
+    int symbol;
+    for (symbol = 0; symbol < 144; symbol++)
+      lengths[symbol] = 8;
+    for (; symbol < 256; symbol++)
+      lengths[symbol] = 9;
+    for (; symbol < 280; symbol++)
+      lengths[symbol] = 7;
+    for (; symbol < FIXLCODES; symbol++)
+      lengths[symbol] = 8;
+    Construct(lencode, lengths, FIXLCODES);
+    for (symbol = 0; symbol < MAXDCODES; symbol++)
+      lengths[symbol] = 5;
+    Construct(distcode, lengths, MAXDCODES);
+    return Codes(lencode, distcode);
+  }
+
+  bool Inflater::Dynamic()
+  {
+    static const short order[19] = {
+      16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    const int nlen = Bits(5) + 257;
+    const int ndist = Bits(5) + 1;
+    const int ncode = Bits(4) + 4;
+    if (m_bEOF || nlen > MAXLCODES || ndist > MAXDCODES)
+      return false;
+
+    // Code lengths of the code lengths...
+    short lengths[MAXLCODES + MAXDCODES];
+    int index;
+    for (index = 0; index < ncode; index++)
+      lengths[order[index]] = static_cast<short>(Bits(3));
+    for (; index < 19; index++)
+      lengths[order[index]] = 0;
+    Huffman lencode, distcode;
+    if (m_bEOF || Construct(lencode, lengths, 19) != 0)
+      return false;
+
+    // ...then the literal/length & distance code lengths
+    for (index = 0; index < nlen + ndist; ) {
+      int symbol = Decode(lencode);
+      if (symbol < 0)
+        return false;
+      if (symbol < 16) {
+        lengths[index++] = static_cast<short>(symbol);
+      } else {
+        short len = 0;
+        if (symbol == 16) { // repeat the last
+          if (index == 0)
+            return false;
+          len = lengths[index - 1];
+          symbol = 3 + Bits(2);
+        } else if (symbol == 17) // repeat zero
+          symbol = 3 + Bits(3);
+        else
+          symbol = 11 + Bits(7);
+        if (m_bEOF || index + symbol > nlen + ndist)
+          return false;
+        while (symbol-- > 0)
+          lengths[index++] = len;
+      }
+    }
+    if (lengths[256] == 0) // no end of block
+      return false;
+
+    // Incomplete codes are only allowed for a single length
+    int err = Construct(lencode, lengths, nlen);
+    if (err < 0 || (err > 0 && nlen - lencode.count[0] != 1))
+      return false;
+    err = Construct(distcode, lengths + nlen, ndist);
+    if (err < 0 || (err > 0 && ndist - distcode.count[0] != 1))
+      return false;
+    return Codes(lencode, distcode);
+  }
+
+  ulong32 Inflater::Adler32() const
+  {
+    const ulong32 BASE = 65521;
+    ulong32 a = 1, b = 0;
+    for (size_t i = 0; i < m_outPos; ) {
+      // at most 5552 bytes before b can overflow
+      const size_t n = (m_outPos - i < 5552) ? m_outPos - i : 5552;
+      for (size_t j = 0; j < n; j++, i++) {
+        a += m_out[i];
+        b += a;
+      }
+      a %= BASE;
+      b %= BASE;
+    }
+    return (b << 16) | a;
+  }
+
+  bool Inflater::Inflate()
+  {
+    // zlib header: deflate, window of up to 32K, no preset dictionary
+    if (m_inLen < 6)
+      return false;
+    const unsigned cmf = m_in[0], flg = m_in[1];
+    if ((cmf & 0x0f) != 8 || (cmf >> 4) > 7 ||
+        (cmf * 256 + flg) % 31 != 0 || (flg & 0x20) != 0)
+      return false;
+    m_inPos = 2;
+
+    unsigned last;
+    do {
+      last = Bits(1);
+      const unsigned type = Bits(2);
+      if (m_bEOF)
+        return false;
+      bool ok;
+      switch (type) {
+      case 0: ok = Stored(); break;
+      case 1: ok = Fixed(); break;
+      case 2: ok = Dynamic(); break;
+      default: ok = false; break;
+      }
+      if (!ok)
+        return false;
+    } while (last == 0);
+
+    // Adler-32 of the data follows, from the next byte on
+    if (m_outPos != m_outLen || m_inLen - m_inPos < 4)
+      return false;
+    const ulong32 adler = (ulong32(m_in[m_inPos]) << 24) |
+      (ulong32(m_in[m_inPos + 1]) << 16) | (ulong32(m_in[m_inPos + 2]) << 8) |
+      ulong32(m_in[m_inPos + 3]);
+    return adler == Adler32();
+  }
+}
+
+bool PWSCompress::IsSupported(unsigned char method)
+{
+  return method == ZLIB;
+}
+
+bool PWSCompress::CanCompress(unsigned char method)
+{
+#ifndef NO_ZLIB
+  return method == ZLIB;
+#else
+  UNREFERENCED_PARAMETER(method);
+  return false;
+#endif
+}
+
+bool PWSCompress::IsCompressible(const StringX &mediaType)
+{
+  for (size_t i = 0; i < sizeof(UncompressedTypes) / sizeof(UncompressedTypes[0]); i++)
+    if (HasPrefix(mediaType, UncompressedTypes[i]))
+      return true;
+  for (size_t i = 0; i < sizeof(CompressedTypes) / sizeof(CompressedTypes[0]); i++)
+    if (HasPrefix(mediaType, CompressedTypes[i]))
+      return false;
+  return true;
+}
+
+bool PWSCompress::Compress(unsigned char method, const unsigned char *in, size_t inLen,
+                           unsigned char *&out, size_t &outLen)
+{
+  out = NULL;
+  outLen = 0;
+#ifndef NO_ZLIB
+  // Less than 1/16 saved isn't worth the time it'll take to decompress
+  const size_t maxLen = inLen - inLen / 16;
+  if (method != ZLIB || inLen == 0 || uLong(inLen) != inLen)
+    return false;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  zs.zalloc = ZAlloc;
+  zs.zfree = ZFree;
+  if (deflateInit(&zs, ZLIB_LEVEL) != Z_OK)
+    return false;
+
+  const size_t bufLen = deflateBound(&zs, uLong(inLen)) + 16; // + sync flush
+  unsigned char *buf = new unsigned char[bufLen];
+  zs.next_in = const_cast<unsigned char *>(in);
+  zs.next_out = buf;
+  zs.avail_out = uInt(bufLen);
+
+  // Don't bother with the rest if the start of a large attachment
+  // doesn't compress (e.g., an unrecognized compressed format)
+  int zstatus = Z_OK;
+  if (inLen > 2 * SAMPLE_LEN) {
+    zs.avail_in = uInt(SAMPLE_LEN);
+    zstatus = deflate(&zs, Z_SYNC_FLUSH);
+    if (zstatus == Z_OK && zs.total_out >= SAMPLE_LEN - SAMPLE_LEN / 16)
+      zstatus = Z_DATA_ERROR;
+  }
+  if (zstatus == Z_OK) {
+    zs.avail_in = uInt(inLen - zs.total_in);
+    zstatus = deflate(&zs, Z_FINISH);
+  }
+  deflateEnd(&zs);
+
+  // Copied to a buffer of the right size, so that the caller can trash it
+  if (zstatus == Z_STREAM_END && zs.total_out < maxLen) {
+    outLen = zs.total_out;
+    out = new unsigned char[outLen];
+    memcpy(out, buf, outLen);
+  }
+  trashMemory(buf, bufLen);
+  delete[] buf;
+  return out != NULL;
+#else
+  UNREFERENCED_PARAMETER(method);
+  UNREFERENCED_PARAMETER(in);
+  UNREFERENCED_PARAMETER(inLen);
+  return false;
+#endif
+}
+
+bool PWSCompress::Decompress(unsigned char method, const unsigned char *in, size_t inLen,
+                             unsigned char *out, size_t outLen)
+{
+  if (method != ZLIB)
+    return false;
+#ifndef NO_ZLIB
+  if (uLong(inLen) != inLen || uLong(outLen) != outLen)
+    return false;
+
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  zs.zalloc = ZAlloc;
+  zs.zfree = ZFree;
+  if (inflateInit(&zs) != Z_OK)
+    return false;
+
+  zs.next_in = const_cast<unsigned char *>(in);
+  zs.avail_in = uInt(inLen);
+  zs.next_out = out;
+  zs.avail_out = uInt(outLen);
+  const int zstatus = inflate(&zs, Z_FINISH);
+  inflateEnd(&zs);
+  return zstatus == Z_STREAM_END && zs.total_out == outLen;
+#else
+  return Inflate(in, inLen, out, outLen);
+#endif
+}
+
+bool PWSCompress::Inflate(const unsigned char *in, size_t inLen,
+                          unsigned char *out, size_t outLen)
+{
+  return Inflater(in, inLen, out, outLen).Inflate();
+}
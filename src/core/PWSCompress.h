@@ -0,0 +1,55 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+/*
+ * Compression of attachment content before it's encrypted (V4 only,
+ * see the ContentCompression field in formatV4.txt).
+ * zlib is used unless built with NO_ZLIB, in which case nothing's
+ * compressed, though compressed content is still read, by a built-in
+ * decoder.
+ */
+
+#ifndef __PWSCOMPRESS_H
+#define __PWSCOMPRESS_H
+
+#include "StringX.h"
+
+namespace PWSCompress {
+  // Values are those of the ContentCompression field, don't change!
+  enum Method {NONE = 0, ZLIB = 1};
+
+  // No method expands its input by more than this (deflate's limit is
+  // 1032:1), so a larger uncompressed length on file is corrupt
+  enum {MAX_RATIO = 1032};
+
+  // Whether content compressed by method can be read, and written
+  bool IsSupported(unsigned char method);
+  bool CanCompress(unsigned char method);
+
+  // Media types whose content is compressed already (images, audio,
+  // video, archives...), so that compressing it again isn't worth trying
+  bool IsCompressible(const StringX &mediaType);
+
+  // On success, out is allocated with new[] and holds outLen bytes.
+  // Returns false if compressing doesn't save enough to be worthwhile.
+  // Everything that held the uncompressed data is trashed when freed.
+  bool Compress(unsigned char method, const unsigned char *in, size_t inLen,
+                unsigned char *&out, size_t &outLen);
+
+  // outLen is the uncompressed length, as recorded on compression. False
+  // if the data doesn't decompress to exactly that many bytes.
+  bool Decompress(unsigned char method, const unsigned char *in, size_t inLen,
+                  unsigned char *out, size_t outLen);
+
+  // Decompresses a zlib stream without zlib, as Decompress does when
+  // built with NO_ZLIB
+  bool Inflate(const unsigned char *in, size_t inLen,
+               unsigned char *out, size_t outLen);
+}
+
+#endif /* __PWSCOMPRESS_H */
@@ -1269,14 +1269,15 @@ bool PWSFilterManager::PassesPWHFiltering(const CItemData *pci) const
   bool bValue(false);
   int iValue(0);
 
-  size_t pwh_max, err_num;
+  // Counts are cheap, the old passwords themselves are only
+  // decrypted if a test needs them
+  const bool status = pci->GetPWHistoryStatus();
+  const size_t pwh_max = pci->GetPWHistoryMax();
+  const size_t pwh_num = pci->GetPWHistoryCount();
   PWHistList pwhistlist;
+  bool bHaveList(false);
 
-  bool status = CreatePWHistoryList(pci->GetPWHistory(),
-                                    pwh_max, err_num,
-                                    pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
-
-  bPresent = pwh_max > 0 || !pwhistlist.empty();
+  bPresent = pwh_max > 0 || pwh_num > 0;
 
   for (auto group_iter = m_vHflgroups.begin();
        group_iter != m_vHflgroups.end(); group_iter++) {
@@ -1302,11 +1303,11 @@ bool PWSFilterManager::PassesPWHFiltering(const CItemData *pci) const
           mt = PWSMatch::MT_BOOL;
           break;
         case HT_ACTIVE:
-          bValue = status == TRUE;
+          bValue = status;
           mt = PWSMatch::MT_BOOL;
           break;
         case HT_NUM:
-          iValue = (int)pwhistlist.size();
+          iValue = (int)pwh_num;
           mt = PWSMatch::MT_INTEGER;
           break;
         case HT_MAX:
@@ -1323,6 +1324,12 @@ bool PWSFilterManager::PassesPWHFiltering(const CItemData *pci) const
           ASSERT(0);
       }
 
+      if ((mt == PWSMatch::MT_STRING || mt == PWSMatch::MT_DATE) && !bHaveList) {
+        size_t max, err_num;
+        pci->GetPWHistoryList(max, err_num, pwhistlist, PWSUtil::TMC_EXPORT_IMPORT);
+        bHaveList = true;
+      }
+
       const int ifunction = (int)st_fldata.rule;
       switch (mt) {
         case PWSMatch::MT_STRING:
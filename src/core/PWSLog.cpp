@@ -41,6 +41,7 @@ void PWSLog::Add(const stringT &sLogRecord)
   PWSUtil::GetTimeStamp(sTimeStamp);
 
   // m_log preloaded, so pop_fornt is always valid (see GetLog).
+  std::lock_guard<std::mutex> lock(m_mutex);
   m_log.pop_front();
   m_log.push_back(sTimeStamp + sb + sLogRecord);
 }
@@ -53,6 +54,8 @@ stringT PWSLog::DumpLog()
   // Start with header for Userstream
   stLog << sHeader;
 
+  std::lock_guard<std::mutex> lock(m_mutex);
+
   // Then total number of records
   stLog << m_log.size() << _T(" ");
 
@@ -12,6 +12,7 @@
 #include "../os/typedefs.h"
 
 #include <deque>
+#include <mutex>
 
 class PWSLog
 {
@@ -28,6 +29,7 @@ public:
 private:
   static PWSLog *self;
   std::deque<stringT> m_log;
+  std::mutex m_mutex; // databases may be read on several threads at once
 };
 
 #endif /* _PWSLOG_H */
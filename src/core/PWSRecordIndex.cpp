@@ -0,0 +1,209 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+// file PWSRecordIndex.cpp
+//-----------------------------------------------------------------------------
+
+#include "PWSRecordIndex.h"
+#include "PWSfileV4.h"
+#include "UTF8Conv.h"
+
+#include "os/debug.h"
+#include "os/logit.h"
+
+using namespace std;
+using pws_os::CUUID;
+
+PWSRecordIndex::PWSRecordIndex()
+  : m_version(PWSfile::UNKNOWN_VERSION), m_pfile(NULL),
+    m_verifyStatus(PWSfile::FAILURE), m_bStopVerify(false)
+{
+}
+
+PWSRecordIndex::~PWSRecordIndex()
+{
+  Close();
+}
+
+int PWSRecordIndex::Open(const StringX &filename, const StringX &passkey)
+{
+  PWS_LOGIT;
+
+  Close();
+
+  int status;
+  m_version = PWSfile::UNKNOWN_VERSION;
+  PWSfile *pf = PWSfile::MakePWSfile(filename, passkey, m_version,
+                                     PWSfile::Read, status);
+  if (status != PWSfile::SUCCESS) {
+    delete pf;
+    return status;
+  }
+  if (m_version != PWSfile::V30 && m_version != PWSfile::V40) {
+    delete pf;
+    return PWSfile::UNSUPPORTED_VERSION;
+  }
+
+  status = pf->Open(passkey);
+  if (status != PWSfile::SUCCESS) {
+    delete pf;
+    return status;
+  }
+
+  // A chunked V4 file's records aren't where SkimRecord looks for them.
+  // PWScore::ReadFile decrypts its chunks in parallel anyway.
+  PWSfileV4 *pv4 = dynamic_cast<PWSfileV4 *>(pf);
+  if (pv4 != NULL && pv4->IsChunked()) {
+    pf->Close();
+    delete pf;
+    return PWSfile::UNSUPPORTED_VERSION;
+  }
+
+  m_filename = filename;
+  m_hdr = pf->GetHeader();
+  if (pf->GetEmptyGroups() != NULL)
+    m_vEmptyGroups = *pf->GetEmptyGroups();
+
+  // The digest check reads the whole file again, so get it going now,
+  // on a reader of its own that starts where pf's records do
+  m_verifyStatus = VERIFY_PENDING;
+  m_bStopVerify = false;
+  m_verifier = thread(&PWSRecordIndex::Verify, this, pf->Duplicate());
+
+  // Aliases and shortcuts keep their own UUID in a field of their own
+  CItemData::FieldBits bsFields;
+  bsFields.set(CItemData::UUID);
+  bsFields.set(CItemData::ALIASUUID);
+  bsFields.set(CItemData::SHORTCUTUUID);
+  bsFields.set(CItemData::GROUP);
+  bsFields.set(CItemData::TITLE);
+  bsFields.set(CItemData::USER);
+
+  CUTF8Conv conv;
+  st_IndexEntry entry;
+  const PWSfile::FieldCallback SetIndexField =
+    [&conv, &entry](unsigned char type, const unsigned char *data, size_t len) {
+      switch (type) {
+        case CItemData::UUID:
+        case CItemData::ALIASUUID:
+        case CItemData::SHORTCUTUUID:
+          if (len == sizeof(uuid_array_t))
+            entry.uuid = CUUID(*reinterpret_cast<const uuid_array_t *>(data));
+          break;
+        case CItemData::GROUP:
+          conv.FromUTF8(data, len, entry.group);
+          break;
+        case CItemData::TITLE:
+          conv.FromUTF8(data, len, entry.title);
+          break;
+        case CItemData::USER:
+          conv.FromUTF8(data, len, entry.user);
+          break;
+        default:
+          break;
+      }
+    };
+
+  for (;;) {
+    entry = st_IndexEntry();
+    entry.pos = pf->GetRecordPos();
+    status = pf->SkimRecord(bsFields, SetIndexField);
+    if (status != PWSfile::SUCCESS)
+      break;
+    m_uuidMap.insert(make_pair(entry.uuid, m_vEntries.size()));
+    m_vEntries.push_back(entry);
+  }
+
+  // WRONG_RECORD means we've reached V4 attachments, which aren't indexed
+  if (status != PWSfile::END_OF_FILE && status != PWSfile::WRONG_RECORD) {
+    pf->Close();
+    delete pf;
+    Close();
+    return status;
+  }
+
+  lock_guard<mutex> lock(m_mutex);
+  m_pfile = pf;
+  return PWSfile::SUCCESS;
+}
+
+void PWSRecordIndex::Close()
+{
+  if (m_verifier.joinable()) {
+    m_bStopVerify = true;
+    m_verifier.join();
+  }
+
+  {
+    lock_guard<mutex> lock(m_mutex);
+    if (m_pfile != NULL) {
+      // Digest is checked by Verify(), and ReadEntry messes it up anyway
+      m_pfile->Close();
+      delete m_pfile;
+      m_pfile = NULL;
+    }
+  }
+
+  m_filename.clear();
+  m_version = PWSfile::UNKNOWN_VERSION;
+  m_hdr = PWSfileHeader();
+  m_vEmptyGroups.clear();
+  m_vEntries.clear();
+  m_uuidMap.clear();
+  m_verifyStatus = PWSfile::FAILURE;
+}
+
+bool PWSRecordIndex::Find(const CUUID &uuid, size_t &i) const
+{
+  auto iter = m_uuidMap.find(uuid);
+  if (iter == m_uuidMap.end())
+    return false;
+  i = iter->second;
+  return true;
+}
+
+int PWSRecordIndex::ReadEntry(size_t i, CItemData &ci)
+{
+  ASSERT(i < m_vEntries.size());
+  lock_guard<mutex> lock(m_mutex);
+  if (m_pfile == NULL || i >= m_vEntries.size())
+    return PWSfile::FAILURE;
+
+  m_pfile->SetRecordPos(m_vEntries[i].pos);
+  return m_pfile->ReadRecord(ci);
+}
+
+int PWSRecordIndex::WaitForVerify()
+{
+  if (m_verifier.joinable())
+    m_verifier.join();
+  return m_verifyStatus;
+}
+
+void PWSRecordIndex::Verify(PWSfile *pf)
+{
+  // Same checks as PWScore::ReadFile, without decrypting into entries.
+  // Uses a PWSfile of its own, so that ReadEntry isn't held up.
+  int status = (pf != NULL) ? PWSfile::SUCCESS : PWSfile::CANT_OPEN_FILE;
+  if (status == PWSfile::SUCCESS) {
+    do {
+      status = pf->SkipRecord();
+    } while (status == PWSfile::SUCCESS && !m_bStopVerify);
+
+    if (status == PWSfile::END_OF_FILE) {
+      status = pf->Close(); // checks the digest
+    } else {
+      pf->Close();
+      if (status == PWSfile::SUCCESS) // stopped
+        status = PWSfile::FAILURE;
+    }
+  }
+  delete pf;
+
+  m_verifyStatus = status;
+}
@@ -0,0 +1,96 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// PWSRecordIndex.h
+//-----------------------------------------------------------------------------
+
+#ifndef __PWSRECORDINDEX_H
+#define __PWSRECORDINDEX_H
+
+#include "PWSfile.h"
+#include "ItemData.h"
+#include "StringX.h"
+#include "os/UUID.h"
+
+#include <vector>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+// Read-only "fast open" of a V3 or V4 database.
+//
+// PWScore::ReadFile decrypts every record into a CItemData before the
+// database can be displayed. Instead, Open() makes a single pass over the
+// file, decrypting only each record's UUID, group, title and user, and
+// remembering where the record starts (see PWSfile::RecordPos), so that
+// the rest of a record can be decrypted on demand by ReadEntry().
+//
+// Since the file's digest covers all the fields, it's checked by a
+// second pass over the file on a background thread, with the keys Open()
+// got (see PWSfile::Duplicate). Until that's done (see WaitForVerify) the
+// database's integrity is unknown. Used by the CLI's --list.
+
+struct st_IndexEntry {
+  st_IndexEntry() : uuid(pws_os::CUUID::NullUUID()) {}
+
+  pws_os::CUUID uuid;
+  StringX group, title, user;
+  PWSfile::RecordPos pos;
+};
+
+class PWSRecordIndex
+{
+public:
+  PWSRecordIndex();
+  ~PWSRecordIndex();
+
+  // Returns a PWSfile status. V1/V2 databases and chunked V4 ones aren't
+  // supported (UNSUPPORTED_VERSION), PWScore::ReadFile must be used for them.
+  int Open(const StringX &filename, const StringX &passkey);
+  void Close();
+
+  PWSfile::VERSION GetVersion() const {return m_version;}
+  const PWSfileHeader &GetHeader() const {return m_hdr;}
+  const std::vector<StringX> &GetEmptyGroups() const {return m_vEmptyGroups;}
+
+  // Entries are in file order
+  size_t GetNumEntries() const {return m_vEntries.size();}
+  const st_IndexEntry &GetEntry(size_t i) const {return m_vEntries[i];}
+  bool Find(const pws_os::CUUID &uuid, size_t &i) const;
+
+  // Decrypts all of entry i, may be called from any thread
+  int ReadEntry(size_t i, CItemData &ci);
+
+  // Background integrity check: WaitForVerify returns SUCCESS,
+  // BAD_DIGEST or some other PWSfile status if the file couldn't be read.
+  bool IsVerifyDone() const {return m_verifyStatus != VERIFY_PENDING;}
+  int WaitForVerify();
+
+private:
+  PWSRecordIndex(const PWSRecordIndex &); // Do not implement
+  PWSRecordIndex &operator=(const PWSRecordIndex &); // Do not implement
+
+  enum {VERIFY_PENDING = -1};
+  void Verify(PWSfile *pf); // Runs on its own thread, deletes pf!
+
+  StringX m_filename;
+  PWSfile::VERSION m_version;
+  PWSfileHeader m_hdr;
+  std::vector<StringX> m_vEmptyGroups;
+  std::vector<st_IndexEntry> m_vEntries;
+  std::map<pws_os::CUUID, size_t> m_uuidMap;
+
+  PWSfile *m_pfile; // kept open for ReadEntry
+  std::mutex m_mutex; // protects m_pfile
+
+  std::thread m_verifier;
+  std::atomic<int> m_verifyStatus;
+  std::atomic<bool> m_bStopVerify;
+};
+
+#endif /* __PWSRECORDINDEX_H */
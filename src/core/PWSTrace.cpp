@@ -0,0 +1,252 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// PWSTrace.cpp : implementation file
+//
+
+#include "PWSTrace.h"
+#include "os/debug.h"
+#include "os/file.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <vector>
+
+// Only PODs are thread local, as VS2013 has no thread_local
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define PWS_THREAD_LOCAL __declspec(thread)
+#else
+#define PWS_THREAD_LOCAL thread_local
+#endif
+
+using namespace std;
+
+std::atomic<bool> PWSTrace::s_bEnabled(false);
+
+namespace {
+  enum {RING_SIZE = 4096, // records per buffer, a power of 2
+        MAX_BUFFERS = 64}; // threads traced at once
+
+  struct TraceRecord {
+    int64 ts; // ns, steady clock
+    uint64 span; // thread id in high 32 bits
+    const st_TraceSite *pSite;
+    int64 args[2];
+    unsigned int tid;
+    char phase; // 'B'egin or 'E'nd
+  };
+
+  struct TraceBuffer {
+    TraceBuffer() : writing(0), head(0), bInUse(true) {}
+    // The writer bumps 'writing' before overwriting a record, and 'head'
+    // once it's done, so that a reader can tell which records it may
+    // have read half-written
+    atomic<uint64> writing;
+    atomic<uint64> head; // records written so far
+    atomic<bool> bInUse;
+    TraceRecord records[RING_SIZE];
+  };
+
+  // Buffers are added but never removed, so readers needn't lock
+  atomic<TraceBuffer *> Buffers[MAX_BUFFERS];
+  atomic<unsigned int> NextTid(0);
+
+  PWS_THREAD_LOCAL TraceBuffer *t_pBuffer = NULL; // while spans are open
+  PWS_THREAD_LOCAL unsigned int t_depth = 0; // spans open
+  PWS_THREAD_LOCAL unsigned int t_tid = 0;
+  PWS_THREAD_LOCAL unsigned int t_numSpans = 0;
+
+  TraceBuffer *ClaimBuffer()
+  {
+    for (size_t i = 0; i < MAX_BUFFERS; i++) {
+      TraceBuffer *pBuffer = Buffers[i].load(memory_order_acquire);
+      if (pBuffer == NULL) {
+        TraceBuffer *pNew = new TraceBuffer; // in use from the start
+        if (Buffers[i].compare_exchange_strong(pBuffer, pNew, memory_order_acq_rel))
+          return pNew;
+        delete pNew; // another thread added one here first
+      }
+      bool bInUse = false;
+      if (pBuffer->bInUse.compare_exchange_strong(bInUse, true, memory_order_acquire))
+        return pBuffer;
+    }
+    return NULL;
+  }
+
+  void Record(TraceBuffer *pBuffer, char phase, const st_TraceSite &site,
+              uint64 span, const int64 *args)
+  {
+    const uint64 head = pBuffer->head.load(memory_order_relaxed);
+    pBuffer->writing.store(head + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    TraceRecord &rec = pBuffer->records[head & (RING_SIZE - 1)];
+    rec.ts = chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+    rec.span = span;
+    rec.pSite = &site;
+    rec.args[0] = (args != NULL) ? args[0] : 0;
+    rec.args[1] = (args != NULL) ? args[1] : 0;
+    rec.tid = t_tid;
+    rec.phase = phase;
+
+    pBuffer->head.store(head + 1, memory_order_release);
+  }
+
+  void WriteString(ostringstream &os, const char *str)
+  {
+    os << '"';
+    for (; *str != '\0'; str++) {
+      if (*str == '"' || *str == '\\')
+        os << '\\';
+      os << *str;
+    }
+    os << '"';
+  }
+
+  // Times in microseconds since ts0, pEnd NULL for a span that's still open
+  // (or whose end was overwritten)
+  void WriteEvent(ostringstream &os, const TraceRecord &rec, int64 ts0,
+                  const TraceRecord *pEnd)
+  {
+    os << "{\"name\":";
+    WriteString(os, rec.pSite->name);
+    os << ",\"cat\":\"core\",\"pid\":1,\"tid\":" << rec.tid
+       << ",\"ts\":" << double(rec.ts - ts0) / 1000.0;
+    if (pEnd == NULL) {
+      os << ",\"ph\":\"B\"}";
+      return;
+    }
+    os << ",\"ph\":\"X\",\"dur\":" << double(pEnd->ts - rec.ts) / 1000.0;
+    const char *names[2] = {rec.pSite->arg0, rec.pSite->arg1};
+    if (names[0] != NULL || names[1] != NULL) {
+      os << ",\"args\":{";
+      for (int i = 0; i < 2; i++) {
+        if (names[i] == NULL)
+          continue;
+        if (i == 1 && names[0] != NULL)
+          os << ',';
+        WriteString(os, names[i]);
+        os << ':' << pEnd->args[i];
+      }
+      os << '}';
+    }
+    os << '}';
+  }
+}
+
+void PWSTrace::Enable(bool bEnable)
+{
+  s_bEnabled.store(bEnable);
+}
+
+void PWSTrace::Clear()
+{
+  for (size_t i = 0; i < MAX_BUFFERS; i++) {
+    TraceBuffer *pBuffer = Buffers[i].load(memory_order_acquire);
+    if (pBuffer == NULL)
+      break;
+    ASSERT(!pBuffer->bInUse.load());
+    pBuffer->writing.store(0);
+    pBuffer->head.store(0);
+  }
+}
+
+bool PWSTrace::Begin(const st_TraceSite &site, uint64 &span)
+{
+  if (t_depth == 0) {
+    t_pBuffer = ClaimBuffer();
+    if (t_pBuffer == NULL)
+      return false; // too many threads, this one's not traced
+  }
+  t_depth++;
+  if (t_tid == 0)
+    t_tid = ++NextTid;
+  span = (uint64(t_tid) << 32) | ++t_numSpans;
+  Record(t_pBuffer, 'B', site, span, NULL);
+  return true;
+}
+
+void PWSTrace::End(const st_TraceSite &site, uint64 span, const int64 args[2])
+{
+  ASSERT(t_depth > 0 && t_pBuffer != NULL);
+  // Recorded even if tracing's been disabled since the span began
+  Record(t_pBuffer, 'E', site, span, args);
+  if (--t_depth == 0) {
+    t_pBuffer->bInUse.store(false, memory_order_release);
+    t_pBuffer = NULL;
+  }
+}
+
+string PWSTrace::ChromeTrace()
+{
+  // Copy the buffers first, then format at leisure
+  vector<TraceRecord> vRecords;
+  for (size_t i = 0; i < MAX_BUFFERS; i++) {
+    const TraceBuffer *pBuffer = Buffers[i].load(memory_order_acquire);
+    if (pBuffer == NULL)
+      break;
+    const uint64 head = pBuffer->head.load(memory_order_acquire);
+    const uint64 first = (head > RING_SIZE) ? head - RING_SIZE : 0;
+    const size_t start = vRecords.size();
+    for (uint64 j = first; j < head; j++)
+      vRecords.push_back(pBuffer->records[j & (RING_SIZE - 1)]);
+
+    // Drop those that may have been overwritten as they were copied
+    atomic_thread_fence(memory_order_acquire);
+    const uint64 writing = pBuffer->writing.load(memory_order_relaxed);
+    if (writing > first + RING_SIZE) {
+      const size_t numLost = size_t(min(head - first, writing - first - RING_SIZE));
+      vRecords.erase(vRecords.begin() + start, vRecords.begin() + start + numLost);
+    }
+  }
+
+  stable_sort(vRecords.begin(), vRecords.end(),
+              [](const TraceRecord &r1, const TraceRecord &r2) {return r1.ts < r2.ts;});
+  const int64 ts0 = vRecords.empty() ? 0 : vRecords[0].ts;
+
+  // Each span's begin & end make one "complete" event
+  ostringstream os;
+  os << fixed << setprecision(3) << "{\"traceEvents\":[";
+  const char *sep = "\n";
+  map<uint64, size_t> mapOpen; // span -> its begin record
+  for (size_t i = 0; i < vRecords.size(); i++) {
+    const TraceRecord &rec = vRecords[i];
+    if (rec.phase == 'B') {
+      mapOpen[rec.span] = i;
+    } else {
+      auto iter = mapOpen.find(rec.span);
+      if (iter == mapOpen.end())
+        continue; // its begin was overwritten
+      os << sep;
+      WriteEvent(os, vRecords[iter->second], ts0, &rec);
+      sep = ",\n";
+      mapOpen.erase(iter);
+    }
+  }
+  for (auto iter = mapOpen.begin(); iter != mapOpen.end(); iter++) {
+    os << sep;
+    WriteEvent(os, vRecords[iter->second], ts0, NULL);
+    sep = ",\n";
+  }
+  os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+  return os.str();
+}
+
+bool PWSTrace::WriteChromeTrace(const stringT &filename)
+{
+  const string sTrace = ChromeTrace();
+  FILE *fd = pws_os::FOpen(filename, _T("wb"));
+  if (fd == NULL)
+    return false;
+  const bool retval = fwrite(sTrace.data(), 1, sTrace.length(), fd) == sTrace.length();
+  return fclose(fd) == 0 && retval;
+}
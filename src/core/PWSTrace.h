@@ -0,0 +1,111 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// PWSTrace.h
+//-----------------------------------------------------------------------------
+// Timing of the core's phases (key stretching, header read, record decode,
+// validation, save...) for profiling, cheap enough to leave in place.
+//
+// Code is traced by RAII spans, each recording when it begins and ends:
+//
+//   PWS_TRACE_SPAN(span, "ReadFile", "records", NULL);
+//   ...
+//   span.SetArg(0, numRecords); // recorded when the span ends
+//
+// Unlike PWSLog, nothing's formatted as it's recorded. A record is a
+// timestamp, a span id, a pointer to the span's static description and
+// two integers, written to a fixed-size ring buffer without locks: a
+// thread owns a buffer from the start of its outermost span to the end of
+// it, and buffers are only read by the export, which skips records that
+// were overwritten while it was reading them. Once full, a ring keeps the
+// latest records.
+//
+// When tracing isn't enabled, a span costs one atomic load.
+//
+// ChromeTrace() exports what's in the buffers as Chrome's Trace Event
+// Format (JSON), as read by chrome://tracing or https://ui.perfetto.dev
+//-----------------------------------------------------------------------------
+
+#ifndef __PWSTRACE_H
+#define __PWSTRACE_H
+
+#include "os/typedefs.h"
+
+#include <atomic>
+#include <string>
+
+// Static description of a span, its address identifying it
+struct st_TraceSite {
+  const char *name;
+  const char *arg0; // names of the span's arguments, NULL if unused
+  const char *arg1;
+};
+
+class PWSTrace
+{
+public:
+  static void Enable(bool bEnable);
+  static bool IsEnabled() {return s_bEnabled.load(std::memory_order_relaxed);}
+
+  // Forgets what's been recorded; only when no spans are open
+  static void Clear();
+
+  // What's in the buffers, in Chrome's Trace Event Format
+  static std::string ChromeTrace();
+  static bool WriteChromeTrace(const stringT &filename);
+
+private:
+  friend class PWSTraceSpan;
+
+  static bool Begin(const st_TraceSite &site, uint64 &span);
+  static void End(const st_TraceSite &site, uint64 span, const int64 args[2]);
+
+  static std::atomic<bool> s_bEnabled;
+};
+
+class PWSTraceSpan
+{
+public:
+  explicit PWSTraceSpan(const st_TraceSite &site)
+    : m_pSite(NULL), m_span(0)
+  {
+    m_args[0] = m_args[1] = 0;
+    if (PWSTrace::IsEnabled() && PWSTrace::Begin(site, m_span))
+      m_pSite = &site;
+  }
+  ~PWSTraceSpan() {End();}
+
+  void SetArg(int i, int64 value) {m_args[i] = value;}
+  // Ends the span before it goes out of scope
+  void End()
+  {
+    if (m_pSite != NULL)
+      PWSTrace::End(*m_pSite, m_span, m_args);
+    m_pSite = NULL;
+  }
+
+private:
+  PWSTraceSpan(const PWSTraceSpan &); // Do not implement
+  PWSTraceSpan &operator=(const PWSTraceSpan &); // Do not implement
+
+  const st_TraceSite *m_pSite; // NULL if not traced
+  uint64 m_span;
+  int64 m_args[2];
+};
+
+#define PWS_TRACE_SITE2(line) pws_trace_site_ ## line
+#define PWS_TRACE_SITE(line) PWS_TRACE_SITE2(line)
+// Declares span var, described by name and its arguments' names (or NULL)
+#define PWS_TRACE_SPAN(var, name, arg0, arg1) \
+  static const st_TraceSite PWS_TRACE_SITE(__LINE__) = {name, arg0, arg1}; \
+  PWSTraceSpan var(PWS_TRACE_SITE(__LINE__))
+
+#endif /* __PWSTRACE_H */
+//-----------------------------------------------------------------------------
+// Local variables:
+// mode: c++
+// End:
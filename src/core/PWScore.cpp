@@ -19,12 +19,17 @@
 #include "Report.h"
 #include "VerifyFormat.h"
 #include "StringXStream.h"
+#include "PWSfileV4.h"
+#include "hmac.h"
+#include "FuzzyMatch.h"
+#include "PWSTrace.h"
 
 #include "os/pws_tchar.h"
 #include "os/typedefs.h"
 #include "os/dir.h"
 #include "os/debug.h"
 #include "os/file.h"
+#include "os/filewatch.h"
 #include "os/mem.h"
 #include "os/logit.h"
 
@@ -35,7 +40,10 @@
 #include <functional>
 #include <algorithm>
 #include <set>
+#include <unordered_map>
 #include <iterator>
+#include <mutex>
+#include <thread>
 
 extern const TCHAR *GROUPTITLEUSERINCHEVRONS;
 
@@ -124,6 +132,50 @@ struct st_ValidateResults {
 
 //-----------------------------------------------------------------
 
+// Asynchronous save support:
+// A snapshot is a copy of everything that WriteFile writes. Since the
+// entries' fields are kept encrypted in memory, copying them is cheap
+// compared with the decrypt/encrypt/write done by WriteDBFile.
+struct SaveSnapshot {
+  StringX filename;
+  PWSfile::VERSION version;
+  StringX passkey;
+  uint32 nHashIters;
+  PWSfileHeader hdr;
+  UnknownFieldList uhfl;
+  PWSFilters filters;
+  PSWDPolicyMap policies;
+  std::vector<StringX> emptyGroups;
+  ItemList pwlist;
+  AttList attlist;
+  unsigned int changeSeq; // PWScore::m_changeSeq when taken
+  bool bChunked;
+  PWSChunkLayout layout; // PWScore::m_pChunkLayout when taken, if any
+};
+
+struct AsyncSaveState {
+  AsyncSaveState()
+    : bBusy(false), pPending(NULL), pWatcher(NULL),
+      bHaveResult(false), status(PWScore::SUCCESS), changeSeq(0),
+      pSig(NULL), bChunked(false) {}
+  ~AsyncSaveState() {delete pPending; delete pSig;}
+
+  std::mutex mutex; // protects everything but worker & pWatcher
+  std::thread worker;
+  bool bBusy; // worker is running
+  SaveSnapshot *pPending; // latest snapshot not yet being written
+  CFileWatcher *pWatcher; // suspended for the duration, if set
+
+  // Results of the most recently completed write, for CompleteAsyncSave
+  bool bHaveResult;
+  int status;
+  PWSfileHeader hdr;
+  unsigned int changeSeq;
+  PWSFileSig *pSig;
+  bool bChunked;
+  PWSChunkLayout layout; // of the file written, if chunked
+};
+
 PWScore::PWScore() :
                      m_isAuxCore(false),
                      m_currfile(_T("")),
@@ -133,9 +185,14 @@ PWScore::PWScore() :
                      m_lockFileHandle2(INVALID_HANDLE_VALUE),
                      m_LockCount(0), m_LockCount2(0),
                      m_ReadFileVersion(PWSfile::UNKNOWN_VERSION),
-                     m_bIsReadOnly(false), m_bIsOpen(false),
+                     m_bIsReadOnly(false), m_bNotifyDB(false),
+                     m_bIsOpen(false), m_bAttDigestsValid(false),
                      m_nRecordsWithUnknownFields(0),
-                     m_bNotifyDB(false), m_pUIIF(NULL), m_pFileSig(NULL),
+                     m_pUIIF(NULL), m_pFileSig(NULL),
+                     m_pFileWatcher(NULL), m_bWatchCurFile(false),
+                     m_pAsyncSave(NULL),
+                     m_changeSeq(0), m_bChunkedV4(false),
+                     m_pChunkLayout(NULL),
                      m_iAppHotKey(0)
 {
   // following should ideally be wrapped in a mutex
@@ -165,7 +222,12 @@ PWScore::~PWScore()
   m_UHFL.clear();
   m_vNodes_Modified.clear();
 
+  if (m_pAsyncSave != NULL && m_pAsyncSave->worker.joinable())
+    m_pAsyncSave->worker.join();
+  delete m_pAsyncSave;
+  delete m_pFileWatcher; // stops watcher thread
   delete m_pFileSig;
+  delete m_pChunkLayout;
 }
 
 void PWScore::SetApplicationNameAndVersion(const stringT &appName,
@@ -177,6 +239,24 @@ void PWScore::SetApplicationNameAndVersion(const stringT &appName,
          nMajor, nMinor);
 }
 
+// Our own changes to the database or its lock file shouldn't be
+// reported as external ones, so we bracket them with one of these.
+class WatchSuspender
+{
+public:
+  WatchSuspender(PWScore *pcore, const StringX &filename)
+    : m_pWatcher((pcore->m_pFileWatcher != NULL &&
+                  filename == pcore->m_currfile) ? pcore->m_pFileWatcher : NULL)
+  {if (m_pWatcher != NULL) m_pWatcher->Suspend();}
+  ~WatchSuspender()
+  {if (m_pWatcher != NULL) m_pWatcher->Resume();}
+
+private:
+  WatchSuspender(const WatchSuspender &); // Do not implement
+  WatchSuspender &operator=(const WatchSuspender &); // Do not implement
+  CFileWatcher *m_pWatcher;
+};
+
 // Return whether first [g:t:u] is greater than the second [g:t:u]
 // used in std::sort in SortDependents below.
 static bool GTUCompare(const StringX &elem1, const StringX &elem2)
@@ -237,19 +317,20 @@ void PWScore::DoAddEntry(const CItemData &item, const CItemAtt *att)
   // Also "UndoDeleteEntry" !
   ASSERT(m_pwlist.find(item.GetUUID()) == m_pwlist.end());
   m_pwlist[item.GetUUID()] = item;
+  m_GroupTree.AddEntry(item.GetGroup(), item.GetUUID());
+  m_URLIndex.AddEntry(item.GetURL(), item.GetUUID());
 
   if (item.NumberUnknownFields() > 0)
     IncrementNumRecordsWithUnknownFields();
 
   if (item.IsNormal() && item.IsPolicyNameSet()) {
-    IncrementPasswordPolicy(item.GetPolicyName());
+    IncrementPasswordPolicy(item.GetPolicyName(), item.GetUUID());
   }
 
   if (att != NULL && att->HasContent()) {
-    m_pwlist[item.GetUUID()].SetAttUUID(att->GetUUID());
-    if (m_attlist.find(att->GetUUID()) == m_attlist.end())
-      m_attlist.insert(std::make_pair(att->GetUUID(), *att));
-    m_attlist[att->GetUUID()].IncRefcount();
+    const CUUID attuuid = ShareAtt(*att);
+    m_pwlist[item.GetUUID()].SetAttUUID(attuuid);
+    m_attlist[attuuid].IncRefcount();
   }
 
   int32 iKBShortcut;
@@ -336,22 +417,24 @@ void PWScore::DoDeleteEntry(const CItemData &item)
     if (iKBShortcut != 0)
       VERIFY(DelKBShortcut(iKBShortcut, item.GetUUID()));
 
+    // The entry's attachment may be a shared one (see ShareAtt) rather
+    // than the one item was created with
+    const CUUID attuuid = pos->second.HasAttRef() ?
+      pos->second.GetAttUUID() : CUUID::NullUUID();
+
+    m_GroupTree.RemoveEntry(pos->second.GetGroup(), entry_uuid);
+    m_URLIndex.RemoveEntry(pos->second.GetURL(), entry_uuid);
     m_pwlist.erase(pos); // at last!
 
     if (item.NumberUnknownFields() > 0)
       DecrementNumRecordsWithUnknownFields();
 
     if (item.IsNormal() && item.IsPolicyNameSet()) {
-      DecrementPasswordPolicy(item.GetPolicyName());
+      DecrementPasswordPolicy(item.GetPolicyName(), entry_uuid);
     }
 
-    if (item.HasAttRef()) {
-      CItemAtt &att = GetAtt(item.GetAttUUID());
-      if (att.GetRefcount() == 1)
-        RemoveAtt(item.GetAttUUID());
-      else
-        att.DecRefcount();
-    }
+    if (attuuid != CUUID::NullUUID())
+      RemoveAtt(attuuid);
   } // pos != m_pwlist.end()
 }
 
@@ -360,6 +443,8 @@ void PWScore::DoReplaceEntry(const CItemData &old_ci, const CItemData &new_ci)
   // Assumes that old_uuid == new_uuid
   ASSERT(old_ci.GetUUID() == new_ci.GetUUID());
   m_pwlist[old_ci.GetUUID()] = new_ci;
+  m_GroupTree.MoveEntry(old_ci.GetGroup(), new_ci.GetGroup(), new_ci.GetUUID());
+  m_URLIndex.UpdateEntry(old_ci.GetURL(), new_ci.GetURL(), new_ci.GetUUID());
   if (old_ci.GetEntryType() != new_ci.GetEntryType() || old_ci.GetStatus() != new_ci.GetStatus() ||
       old_ci.IsProtected() != new_ci.IsProtected())
     GUIRefreshEntry(new_ci);
@@ -377,11 +462,11 @@ void PWScore::DoReplaceEntry(const CItemData &old_ci, const CItemData &new_ci)
   }
 
   if (old_ci.IsNormal() && old_ci.IsPolicyNameSet()) {
-    DecrementPasswordPolicy(old_ci.GetPolicyName());
+    DecrementPasswordPolicy(old_ci.GetPolicyName(), old_ci.GetUUID());
   }
 
   if (new_ci.IsNormal() && new_ci.IsPolicyNameSet()) {
-    IncrementPasswordPolicy(new_ci.GetPolicyName());
+    IncrementPasswordPolicy(new_ci.GetPolicyName(), new_ci.GetUUID());
   }
 
   int ioldKBShortcut, inewKBShortcut;
@@ -414,6 +499,9 @@ void PWScore::DoDeleteAtt(const CItemAtt &att)
 
 void PWScore::ClearData(void)
 {
+  WaitForAsyncSave(); // don't leave it to update whatever comes next
+  UnwatchCurFile(); // until the next file's read
+
   const unsigned int BS = TwoFish::BLOCKSIZE;
   if (m_passkey_len > 0) {
     trashMemory(m_passkey, ((m_passkey_len + (BS - 1)) / BS) * BS);
@@ -426,6 +514,11 @@ void PWScore::ClearData(void)
   //Composed of ciphertext, so doesn't need to be overwritten
   m_pwlist.clear();
   m_attlist.clear();
+  m_attdigests.clear();
+  trashMemory(m_attkey, sizeof(m_attkey));
+  m_bAttDigestsValid = false;
+  m_GroupTree.Clear();
+  m_URLIndex.Clear();
 
   // Clear out out dependents mappings
   m_base2aliases_mmap.clear();
@@ -442,6 +535,7 @@ void PWScore::ClearData(void)
   // Clear out policies
   m_MapPSWDPLC.clear();
   m_InitialMapPSWDPLC.clear();
+  m_PolicyEntries.clear();
 
   // Clear out Empty Groups
   m_vEmptyGroups.clear();
@@ -460,7 +554,9 @@ void PWScore::ClearData(void)
   m_KBShortcutMap.clear();
 
   // Clear any unknown preferences from previous databases
-  PWSprefs::GetInstance()->ClearUnknownPrefs();
+  // (an aux. core never put any there)
+  if (!m_isAuxCore)
+    PWSprefs::GetInstance()->ClearUnknownPrefs();
 
   // Reset state of unchanged DB
   m_stDBCS.Clear();
@@ -488,16 +584,32 @@ void PWScore::NewFile(const StringX &passkey)
   ClearData();
   SetPassKey(passkey);
   m_ReadFileVersion = PWSfile::VCURRENT;
+  SetChunkedV4(false);
+}
+
+void PWScore::SetChunkedV4(bool bChunked)
+{
+  m_bChunkedV4 = bChunked;
+  if (!bChunked) {
+    delete m_pChunkLayout;
+    m_pChunkLayout = NULL;
+  }
 }
 
 // functor object type for for_each:
 // Writes out all records to a PasswordSafe database of any version
 struct RecordWriter {
-  RecordWriter(PWSfile *pout, PWScore *pcore, PWSfile::VERSION version)
-    : m_pout(pout), m_pcore(pcore), m_version(version) {}
+  RecordWriter(PWSfile *pout, PWScore *pcore, PWSfile::VERSION version,
+               const std::set<CUUID> &copied)
+    : m_pout(pout), m_pcore(pcore), m_version(version), m_copied(copied) {}
 
   void operator()(std::pair<CUUID const, CItemData> &p)
   {
+    if (m_copied.find(p.first) != m_copied.end()) {
+      // Already in a chunk copied from the previous file
+      p.second.ClearStatus();
+      return;
+    }
     if (p.second.IsAlias() && m_version < PWSfile::V30) {
       // Pre V30 does not support aliases.  Write as a normal record
       // with the base record's password
@@ -519,16 +631,32 @@ private:
   PWSfile *m_pout;
   PWScore *m_pcore;
   const PWSfile::VERSION m_version;
+  const std::set<CUUID> &m_copied;
 };
 
-int PWScore::WriteFile(const StringX &filename, PWSfile::VERSION version,
-                       bool bUpdateSig)
+// Writes a complete database: WriteFile passes the core's own data,
+// an asynchronous save passes a snapshot (pcore == NULL, V30 or later).
+// hdr is updated with time saved, etc.
+// If bChunked (V40 only), pPrevLayout is that of the file as last read
+// or written, if any, and pNewLayout is set to that of the new file.
+// If ppSig isn't NULL, it's set to the new file's reference signature.
+static int WriteDBFile(const StringX &filename, PWSfile::VERSION version,
+                       const StringX &passkey, uint32 nHashIters,
+                       PWSfileHeader &hdr, UnknownFieldList &uhfl,
+                       const PWSFilters &filters, const PSWDPolicyMap &policies,
+                       const std::vector<StringX> &emptyGroups,
+                       ItemList &pwlist, AttList &attlist, PWScore *pcore,
+                       bool bChunked, const PWSChunkLayout *pPrevLayout,
+                       PWSChunkLayout *pNewLayout, PWSFileSig **ppSig)
 {
-  PWS_LOGIT_ARGS("bUpdateSig=%ls", bUpdateSig ? L"true" : L"false");
-
   int status;
 
-  PWSfile *out = PWSfile::MakePWSfile(filename, GetPassKey(), version,
+  // Write to a temporary file alongside the target, and only replace
+  // the target once the new file's complete. That way, a failure or
+  // crash mid-save leaves the previous version intact.
+  const StringX tmpname = filename + _T(".tmp");
+
+  PWSfile *out = PWSfile::MakePWSfile(tmpname, passkey, version,
                                       PWSfile::Write, status);
 
   if (status != PWSfile::SUCCESS) {
@@ -536,69 +664,126 @@ int PWScore::WriteFile(const StringX &filename, PWSfile::VERSION version,
     return status;
   }
 
-  if (bUpdateSig) {
-    // since we're writing a new file, the previous sig's
-    // about to be invalidated but NOT if a user initiated Backup
-    delete m_pFileSig;
-    m_pFileSig = NULL;
-  }
-
-  // If writing in a prior version format (ie. exporting) - save the header
-  const PWSfileHeader saved_hdr = m_hdr;
-
-  m_hdr.m_prefString = PWSprefs::GetInstance()->Store();
-  m_hdr.m_whatlastsaved = m_AppNameAndVersion.c_str();
-  m_hdr.m_RUEList = m_RUEList;
+  out->SetHeader(hdr);
+  out->SetUnknownHeaderFields(uhfl);
+  out->SetNHashIters(nHashIters);
+  out->SetDBFilters(filters);
+  out->SetPasswordPolicies(policies);
+  out->SetEmptyGroups(emptyGroups);
 
-  out->SetHeader(m_hdr);
-  out->SetUnknownHeaderFields(m_UHFL);
-  out->SetNHashIters(GetHashIters());
-  out->SetDBFilters(m_MapDBFilters);
-  out->SetPasswordPolicies(m_MapPSWDPLC);
-  out->SetEmptyGroups(m_vEmptyGroups);
+  PWSfileV4 *out4 = dynamic_cast<PWSfileV4 *>(out);
+  bChunked = bChunked && out4 != NULL;
+  if (bChunked) {
+    out4->SetChunked(true);
+    // Chunks can only be copied from the file we're replacing
+    if (pPrevLayout != NULL && pPrevLayout->filename == filename)
+      out4->SetPrevLayout(pPrevLayout);
+  }
 
   try { // exception thrown on write error
-    status = out->Open(GetPassKey());
+    status = out->Open(passkey);
 
     if (status != PWSfile::SUCCESS) {
       delete out;
-
-      if (version < m_ReadFileVersion) // Exporting - restore saved header
-        m_hdr = saved_hdr;
-
+      pws_os::DeleteAFile(tmpname.c_str());
       return status;
     }
 
-    RecordWriter write_record(out, this, version);
-    for_each(m_pwlist.begin(), m_pwlist.end(), write_record);
+    // Records in chunks copied from the previous file aren't written again
+    std::set<CUUID> copied;
+    if (bChunked &&
+        out4->CopyCleanChunks(pwlist, attlist, copied) != PWSfile::SUCCESS) {
+      out->Close();
+      delete out;
+      pws_os::DeleteAFile(tmpname.c_str());
+      return PWScore::FAILURE;
+    }
+
+    RecordWriter write_record(out, pcore, version, copied);
+    for_each(pwlist.begin(), pwlist.end(), write_record);
 
     // Write attachments (only from V4)
-    if (version >= PWSfile::V40)
-      for_each(m_attlist.begin(), m_attlist.end(),
+    if (out4 != NULL)
+      for_each(attlist.begin(), attlist.end(),
                [&](std::pair<CUUID const, CItemAtt> &p)
                {
-                 p.second.Write(out);
+                 if (copied.find(p.first) == copied.end())
+                   out4->WriteRecord(p.second);
                } );
-
-    // Update header if V30 or later (no headers before V30)
-    if (version >= PWSfile::V30) {
-      m_hdr = out->GetHeader(); // update time saved, etc.
-    }
   }
 
   catch (...) {
     out->Close();
     delete out;
+    pws_os::DeleteAFile(tmpname.c_str());
+    return PWScore::FAILURE;
+  }
+
+  // Update header if V30 or later (no headers before V30)
+  if (version >= PWSfile::V30)
+    hdr = out->GetHeader(); // update time saved, etc.
+
+  status = out->Close();
+  PWSChunkLayout layout;
+  if (bChunked && status == PWSfile::SUCCESS)
+    layout = out4->GetLayout();
+  unsigned char fileHash[SHA256::HASHLEN];
+  ulong64 hashLength = 0;
+  const bool bHashed = out->GetFileHash(fileHash, hashLength);
+  delete out;
+
+  if (status != PWSfile::SUCCESS ||
+      !pws_os::ReplaceAFile(tmpname.c_str(), filename.c_str())) {
+    pws_os::DeleteAFile(tmpname.c_str());
+    return PWScore::FAILURE;
+  }
+
+  if (bChunked && pNewLayout != NULL) {
+    *pNewLayout = layout;
+    pNewLayout->filename = filename;
+  }
+  if (ppSig != NULL)
+    *ppSig = new PWSFileSig(filename.c_str(), bHashed ? fileHash : NULL,
+                            hashLength);
+  return PWScore::SUCCESS;
+}
+
+int PWScore::WriteFile(const StringX &filename, PWSfile::VERSION version,
+                       bool bUpdateSig)
+{
+  PWS_LOGIT_ARGS("bUpdateSig=%ls", bUpdateSig ? L"true" : L"false");
+  PWS_TRACE_SPAN(span, "WriteFile", "entries", "version");
+  span.SetArg(0, m_pwlist.size());
+  span.SetArg(1, version);
+
+  // Don't race with a background save, and pick up its results
+  WaitForAsyncSave();
+
+  WatchSuspender ws(this, filename);
 
+  // If writing in a prior version format (ie. exporting) - save the header
+  const PWSfileHeader saved_hdr = m_hdr;
+
+  m_hdr.m_prefString = PWSprefs::GetInstance()->Store();
+  m_hdr.m_whatlastsaved = m_AppNameAndVersion.c_str();
+  m_hdr.m_RUEList = m_RUEList;
+
+  const bool bChunked = m_bChunkedV4 && version == PWSfile::V40;
+  PWSChunkLayout layout;
+  PWSFileSig *pSig = NULL;
+  const int status = WriteDBFile(filename, version, GetPassKey(), GetHashIters(),
+                                 m_hdr, m_UHFL, m_MapDBFilters, m_MapPSWDPLC,
+                                 m_vEmptyGroups, m_pwlist, m_attlist, this,
+                                 bChunked, m_pChunkLayout, &layout,
+                                 bUpdateSig ? &pSig : NULL);
+
+  if (status != SUCCESS) {
     if (version < m_ReadFileVersion) // Exporting - restore saved header
       m_hdr = saved_hdr;
 
-    return FAILURE;
+    return status;
   }
 
-  out->Close();
-  delete out;
-
   // Update info only if written version is same as read version
   // (otherwise we're exporting, not saving)
   if (version == m_ReadFileVersion) {
@@ -611,12 +796,194 @@ int PWScore::WriteFile(const StringX &filename, PWSfile::VERSION version,
   }
 
   // Create new signature if required
-  if (bUpdateSig)
-    m_pFileSig = new PWSFileSig(filename.c_str());
+  // (not if a user initiated Backup)
+  if (bUpdateSig) {
+    delete m_pFileSig;
+    m_pFileSig = pSig;
+
+    // Same for the chunk layout, for the next incremental save
+    delete m_pChunkLayout;
+    m_pChunkLayout = bChunked ? new PWSChunkLayout(layout) : NULL;
+  }
 
   return SUCCESS;
 }
 
+int PWScore::WriteCurFileAsync()
+{
+  PWS_LOGIT;
+
+  // Older formats need the core (aliases, shortcuts), so write them now
+  if (m_ReadFileVersion != PWSfile::V30 && m_ReadFileVersion != PWSfile::V40)
+    return WriteCurFile();
+
+  if (m_pAsyncSave == NULL)
+    m_pAsyncSave = new AsyncSaveState;
+
+  SaveSnapshot *pss = new SaveSnapshot;
+  pss->filename = m_currfile;
+  pss->version = m_ReadFileVersion;
+  pss->passkey = GetPassKey();
+  pss->nHashIters = GetHashIters();
+  pss->hdr = m_hdr;
+  pss->hdr.m_prefString = PWSprefs::GetInstance()->Store();
+  pss->hdr.m_whatlastsaved = m_AppNameAndVersion.c_str();
+  pss->hdr.m_RUEList = m_RUEList;
+  pss->uhfl = m_UHFL;
+  pss->filters = m_MapDBFilters;
+  pss->policies = m_MapPSWDPLC;
+  pss->emptyGroups = m_vEmptyGroups;
+  pss->pwlist = m_pwlist;
+  pss->attlist = m_attlist;
+  pss->changeSeq = m_changeSeq;
+  pss->bChunked = m_bChunkedV4 && m_ReadFileVersion == PWSfile::V40;
+  if (m_pChunkLayout != NULL)
+    pss->layout = *m_pChunkLayout;
+
+  AsyncSaveState &as = *m_pAsyncSave;
+  bool bStart;
+  {
+    std::lock_guard<std::mutex> guard(as.mutex);
+    // If a save's in progress, this snapshot will be written when it's
+    // done, superseding any that was already waiting
+    delete as.pPending;
+    as.pPending = pss;
+    bStart = !as.bBusy;
+    as.bBusy = true;
+  }
+
+  if (bStart) {
+    if (as.worker.joinable())
+      as.worker.join(); // previous worker's done, or about to be
+    as.pWatcher = NULL;
+    if (m_pFileWatcher != NULL) {
+      as.pWatcher = m_pFileWatcher;
+      as.pWatcher->Suspend();
+    }
+    as.worker = std::thread(&PWScore::AsyncSaveWorker, this);
+  }
+  return SUCCESS;
+}
+
+void PWScore::AsyncSaveWorker()
+{
+  AsyncSaveState &as = *m_pAsyncSave;
+  int status = SUCCESS;
+
+  // Once a snapshot's written, the next one replaces that file, not the
+  // one whose layout it was taken with
+  PWSChunkLayout lastLayout;
+  bool bHaveLastLayout = false;
+
+  for (;;) {
+    SaveSnapshot *pss;
+    {
+      std::lock_guard<std::mutex> guard(as.mutex);
+      pss = as.pPending;
+      as.pPending = NULL;
+      if (pss == NULL) {
+        as.bBusy = false;
+        break;
+      }
+    }
+
+    PWSChunkLayout layout;
+    PWSFileSig *pSig = NULL;
+    status = WriteDBFile(pss->filename, pss->version, pss->passkey,
+                         pss->nHashIters, pss->hdr, pss->uhfl, pss->filters,
+                         pss->policies, pss->emptyGroups, pss->pwlist,
+                         pss->attlist, NULL, pss->bChunked,
+                         bHaveLastLayout ? &lastLayout : &pss->layout, &layout,
+                         &pSig);
+    if (status == SUCCESS) {
+      lastLayout = layout;
+      bHaveLastLayout = true;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(as.mutex);
+      as.bHaveResult = true;
+      as.status = status;
+      as.hdr = pss->hdr;
+      as.changeSeq = pss->changeSeq;
+      delete as.pSig;
+      as.pSig = pSig;
+      as.bChunked = pss->bChunked;
+      as.layout = layout;
+    }
+    delete pss;
+  }
+
+  if (as.pWatcher != NULL)
+    as.pWatcher->Resume();
+
+  if (m_pUIIF != NULL &&
+      m_bsSupportedFunctions.test(UIInterFace::ASYNCSAVECOMPLETED))
+    m_pUIIF->AsyncSaveCompleted(status);
+}
+
+bool PWScore::IsAsyncSaveInProgress() const
+{
+  if (m_pAsyncSave == NULL)
+    return false;
+
+  std::lock_guard<std::mutex> guard(m_pAsyncSave->mutex);
+  return m_pAsyncSave->bBusy;
+}
+
+int PWScore::CompleteAsyncSave()
+{
+  if (m_pAsyncSave == NULL)
+    return SUCCESS;
+
+  AsyncSaveState &as = *m_pAsyncSave;
+  std::lock_guard<std::mutex> guard(as.mutex);
+  if (!as.bHaveResult)
+    return as.status;
+  as.bHaveResult = false;
+
+  if (as.status != SUCCESS)
+    return as.status;
+
+  if (as.changeSeq == m_changeSeq) {
+    // Nothing's changed since the snapshot - same as after WriteFile
+    m_hdr = as.hdr;
+    SetInitialValues();
+    for (auto &p : m_pwlist)
+      p.second.ClearStatus();
+  } else {
+    // Commands were executed meanwhile, so we're still changed.
+    // Just note that we've saved.
+    m_hdr.m_file_uuid = as.hdr.m_file_uuid;
+    m_hdr.m_whenlastsaved = as.hdr.m_whenlastsaved;
+    m_hdr.m_lastsavedby = as.hdr.m_lastsavedby;
+    m_hdr.m_lastsavedon = as.hdr.m_lastsavedon;
+    m_hdr.m_whatlastsaved = as.hdr.m_whatlastsaved;
+  }
+
+  if (as.pSig != NULL) {
+    delete m_pFileSig;
+    m_pFileSig = as.pSig;
+    as.pSig = NULL;
+  }
+
+  // The file's been replaced either way
+  delete m_pChunkLayout;
+  m_pChunkLayout = as.bChunked ? new PWSChunkLayout(as.layout) : NULL;
+  return SUCCESS;
+}
+
+int PWScore::WaitForAsyncSave()
+{
+  if (m_pAsyncSave == NULL)
+    return SUCCESS;
+
+  // Worker only exits once there's nothing pending
+  if (m_pAsyncSave->worker.joinable())
+    m_pAsyncSave->worker.join();
+  return CompleteAsyncSave();
+}
+
 // functor object type for for_each:
 // Writes out subset of records to a PasswordSafe database at the current version
 // Used by Export entry or Export Group
@@ -804,6 +1171,8 @@ void PWScore::GetChangedStatus(Command *pcmd, st_DBChangeStatus &st_Command)
 
 void PWScore::SetChangedStatus()
 {
+  m_changeSeq++; // for CompleteAsyncSave
+
   // Update bDBPrefsChanged, bEmptyGroupsChanged, bPolicyNamesChanged
   // and bDBFiltersChanged by checking against original values set in
   // SetInitialValues. This bypasses the need to check do/undo/revert.
@@ -1082,7 +1451,7 @@ static void ProcessPasswordPolicy(CItemData &ci_temp, PWScore &core)
   }
 
   if (ci_temp.IsPolicyNameSet()) {
-    if (!core.IncrementPasswordPolicy(ci_temp.GetPolicyName())) {
+    if (!core.IncrementPasswordPolicy(ci_temp.GetPolicyName(), ci_temp.GetUUID())) {
       // Map name not present in database - clear it!
       ci_temp.ClearField(CItemData::POLICYNAME);
     }
@@ -1106,7 +1475,7 @@ void PWScore::ProcessReadEntry(CItemData &ci_temp,
       ci_temp.SetKBShortcut(0);
     } else { // non-zero shortcut != app hotkey
       if (!ValidateKBShortcut(iKBShortcut)) {
-        m_KBShortcutMap.insert(KBShortcutMapPair(iKBShortcut, ci_temp.GetUUID()));
+        AddKBShortcut(iKBShortcut, ci_temp.GetUUID());
       } else {
         ci_temp.SetKBShortcut(0);
       }
@@ -1114,14 +1483,13 @@ void PWScore::ProcessReadEntry(CItemData &ci_temp,
   } // non-zero shortcut
 
   // Possibly expired?
-  time_t tttXTime;
-  ci_temp.GetXTime(tttXTime);
-  if (tttXTime != time_t(0)) {
-    m_ExpireCandidates.push_back(ExpPWEntry(ci_temp));
-  }
+  m_ExpireCandidates.Add(ci_temp);
 
   // Finally, add it to the list!
-  m_pwlist.insert(std::make_pair(ci_temp.GetUUID(), ci_temp));
+  if (m_pwlist.insert(std::make_pair(ci_temp.GetUUID(), ci_temp)).second) {
+    m_GroupTree.AddEntry(ci_temp.GetGroup(), ci_temp.GetUUID());
+    m_URLIndex.AddEntry(ci_temp.GetURL(), ci_temp.GetUUID());
+  }
 }
 
 
@@ -1173,6 +1541,7 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
   PWS_LOGIT_ARGS("bValidate=%ls; iMAXCHARS=%d; pRpt=%p",
                  bValidate ? L"true" : L"false", iMAXCHARS,
                  pRpt);
+  PWS_TRACE_SPAN(span, "ReadFile", "entries", NULL);
 
   int status;
   st_ValidateResults st_vr;
@@ -1257,6 +1626,7 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
   if (in->GetDBFilters() != NULL) m_MapDBFilters = *in->GetDBFilters();
   if (in->GetPasswordPolicies() != NULL) m_MapPSWDPLC = *in->GetPasswordPolicies();
   if (in->GetEmptyGroups() != NULL) m_vEmptyGroups = *in->GetEmptyGroups();
+  m_GroupTree.SetEmptyGroups(m_vEmptyGroups);
 
   // Set initial values
   SetInitialValues();
@@ -1270,6 +1640,7 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
     pRpt->StartReport(cs_title.c_str(), m_currfile.c_str());
   }
 
+  PWS_TRACE_SPAN(recordsSpan, "ReadRecords", "entries", "attachments");
   do {
     ci_temp.Clear(); // Rather than creating a new one each time.
     status = in->ReadRecord(ci_temp);
@@ -1294,9 +1665,11 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
       case PWSfile::WRONG_RECORD: {
         // See if this is a V4 attachment:
         CItemAtt att;
-        status = att.Read(in);
+        PWSfileV4 *in4 = dynamic_cast<PWSfileV4 *>(in);
+        status = (in4 != NULL) ? in4->ReadRecord(att) : att.Read(in);
         if (status == PWSfile::SUCCESS) {
           m_attlist.insert(std::make_pair(att.GetUUID(), att));
+          m_bAttDigestsValid = false;
         } else {
           // XXX report problem!
         }
@@ -1309,12 +1682,30 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
         break;
     } // switch
   } while (go);
+  recordsSpan.SetArg(0, m_pwlist.size());
+  recordsSpan.SetArg(1, m_attlist.size());
+  recordsSpan.End();
 
   ParseDependants();
 
   m_nRecordsWithUnknownFields = in->GetNumRecordsWithUnknownFields();
   in->GetUnknownHeaderFields(m_UHFL);
   int closeStatus = in->Close(); // in V3 & later this checks integrity
+  unsigned char fileHash[SHA256::HASHLEN];
+  ulong64 hashLength = 0;
+  const bool bHashed = in->GetFileHash(fileHash, hashLength);
+
+  // A chunked file's saved as such. Its layout's only trusted for
+  // copying chunks by the next save if they all checked out.
+  PWSfileV4 *in4 = dynamic_cast<PWSfileV4 *>(in);
+  SetChunkedV4(false);
+  if (in4 != NULL && in4->IsChunked()) {
+    m_bChunkedV4 = true;
+    if (closeStatus == PWSfile::SUCCESS) {
+      m_pChunkLayout = new PWSChunkLayout(in4->GetLayout());
+      m_pChunkLayout->filename = a_filename;
+    }
+  }
   delete in;
 
   ReportReadErrors(pRpt, vGTU_INVALID_UUID, vGTU_DUPLICATE_UUID);
@@ -1336,7 +1727,9 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
   // Goal is to prevent overwriting a good backup with a corrupt file.
   if (a_filename == m_currfile) {
     delete m_pFileSig;
-    m_pFileSig = new PWSFileSig(a_filename.c_str());
+    m_pFileSig = new PWSFileSig(a_filename.c_str(), bHashed ? fileHash : NULL,
+                                hashLength);
+    WatchCurFile(); // from what we've just read
   }
 
   // Make return code negative if validation errors
@@ -1346,6 +1739,7 @@ int PWScore::ReadFile(const StringX &a_filename, const StringX &a_passkey,
   // OK DB open
   m_bIsOpen = true;
 
+  span.SetArg(0, m_pwlist.size());
   return closeStatus;
 }
 
@@ -1449,6 +1843,8 @@ bool PWScore::BackupCurFile(unsigned int maxNumIncBackups, int backupSuffix,
       return false;
   }
 
+  WatchSuspender ws(this, m_currfile);
+
   pws_os::splitpath(path, drv, dir, name, ext);
   // Get location for intermediate backup
   if (userBackupDir.empty()) {
@@ -1504,9 +1900,11 @@ bool PWScore::BackupCurFile(unsigned int maxNumIncBackups, int backupSuffix,
 
   bu_fname +=  _T(".ibak");
 
-  // Current file becomes backup
+  // Current file is copied to backup, and stays in place until
+  // WriteFile atomically replaces it, so there's always a valid database.
+  // On copy-on-write filesystems the copy is a cheap clone.
   // Directories along the specified backup path are created as needed
-  return pws_os::RenameFile(m_currfile.c_str(), bu_fname);
+  return pws_os::CopyAFile(m_currfile.c_str(), bu_fname);
 }
 
 void PWScore::ChangePasskey(const StringX &newPasskey)
@@ -1516,8 +1914,10 @@ void PWScore::ChangePasskey(const StringX &newPasskey)
 }
 
 // functor object type for find_if:
+// (Takes the element by reference - a copy would set up the
+// copy's cipher on each call, which is far costlier than the comparison)
 struct FieldsMatch {
-  bool operator()(std::pair<CUUID, CItemData> p) {
+  bool operator()(const ItemList::value_type &p) const {
     const CItemData &item = p.second;
     return (m_group == item.GetGroup() &&
             m_title == item.GetTitle() &&
@@ -1545,8 +1945,97 @@ ItemListIter PWScore::Find(const StringX &a_group,const StringX &a_title,
   return retval;
 }
 
+namespace {
+  struct FuzzyRanked {
+    unsigned int score;
+    size_t index; // in m_pwlist order
+    CItemData::FieldType ft;
+  };
+
+  // Higher score first, then entry order
+  bool FuzzyBetter(const FuzzyRanked &a, const FuzzyRanked &b)
+  {
+    return a.score != b.score ? a.score > b.score : a.index < b.index;
+  }
+}
+
+void PWScore::FuzzyFind(const StringX &sxText, size_t maxResults,
+                        std::vector<st_FuzzyMatch> &vMatches, unsigned int nThreads) const
+{
+  vMatches.clear();
+  const FuzzyMatcher matcher(sxText);
+  if (matcher.IsEmpty() || maxResults == 0 || m_pwlist.empty())
+    return;
+
+  // Title first, so that it's reported when other fields score the same
+  const CItemData::FieldType Fields[] = {
+    CItemData::TITLE, CItemData::USER, CItemData::URL, CItemData::GROUP,
+  };
+
+  std::vector<const CItemData *> vItems;
+  vItems.reserve(m_pwlist.size());
+  for (ItemListConstIter iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++)
+    vItems.push_back(&iter->second);
+
+  // Each thread scores a contiguous range of entries, keeping its best
+  // maxResults in a heap with the worst of them on top
+  const size_t MinPerThread = 256;
+  size_t numThreads = nThreads != 0 ? nThreads : std::thread::hardware_concurrency();
+  numThreads = std::max(size_t(1), std::min(numThreads, vItems.size() / MinPerThread));
+
+  std::vector<std::vector<FuzzyRanked> > vvRanked(numThreads);
+  auto RankRange = [&](size_t t, size_t begin, size_t end) {
+    std::vector<FuzzyRanked> &vHeap = vvRanked[t];
+    for (size_t i = begin; i < end; i++) {
+      FuzzyRanked r = {0, i, CItemData::END};
+      for (size_t f = 0; f < sizeof(Fields) / sizeof(Fields[0]); f++) {
+        const unsigned int score = matcher.Score(vItems[i]->GetFieldValue(Fields[f]));
+        if (score > r.score) {
+          r.score = score;
+          r.ft = Fields[f];
+        }
+      }
+      if (r.score == 0)
+        continue;
+      if (vHeap.size() == maxResults) {
+        if (!FuzzyBetter(r, vHeap.front()))
+          continue;
+        std::pop_heap(vHeap.begin(), vHeap.end(), FuzzyBetter);
+        vHeap.pop_back();
+      }
+      vHeap.push_back(r);
+      std::push_heap(vHeap.begin(), vHeap.end(), FuzzyBetter);
+    }
+  };
+
+  std::vector<std::thread> vThreads;
+  const size_t perThread = (vItems.size() + numThreads - 1) / numThreads;
+  for (size_t t = 1; t < numThreads; t++) {
+    const size_t begin = std::min(t * perThread, vItems.size());
+    const size_t end = std::min(begin + perThread, vItems.size());
+    vThreads.push_back(std::thread(RankRange, t, begin, end));
+  }
+  RankRange(0, 0, std::min(perThread, vItems.size()));
+  for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+    iter->join();
+
+  std::vector<FuzzyRanked> vRanked;
+  for (auto iter = vvRanked.begin(); iter != vvRanked.end(); iter++)
+    vRanked.insert(vRanked.end(), iter->begin(), iter->end());
+  std::sort(vRanked.begin(), vRanked.end(), FuzzyBetter);
+  if (vRanked.size() > maxResults)
+    vRanked.resize(maxResults);
+
+  vMatches.resize(vRanked.size());
+  for (size_t i = 0; i < vRanked.size(); i++) {
+    vMatches[i].uuid = vItems[vRanked[i].index]->GetUUID();
+    vMatches[i].score = vRanked[i].score;
+    vMatches[i].ft = vRanked[i].ft;
+  }
+}
+
 struct TitleMatch {
-  bool operator()(std::pair<CUUID, CItemData> p) {
+  bool operator()(const ItemList::value_type &p) const {
     const CItemData &item = p.second;
     return (m_title == item.GetTitle());
   }
@@ -1589,7 +2078,7 @@ ItemListIter PWScore::GetUniqueBase(const StringX &a_title, bool &bMultiple)
 }
 
 struct GroupTitle_TitleUserMatch {
-  bool operator()(std::pair<CUUID, CItemData> p) {
+  bool operator()(const ItemList::value_type &p) const {
     const CItemData &item = p.second;
     return ((m_gt == item.GetGroup() && m_tu == item.GetTitle()) ||
             (m_gt == item.GetTitle() && m_tu == item.GetUser()));
@@ -1760,59 +2249,12 @@ bool PWScore::HasRUEListChanged() const
 }
 
 
-static void collectGroups(const StringX &sxg, std::set<stringT> &setGroups)
-{
-  StringX sxGroup(sxg);
-  if (sxGroup.find(_T('.')) == StringX::npos) {
-    // We have exactly one group
-    setGroups.insert(sxGroup.c_str());
-  } else {
-    // We have > 1 group. Tokenize:
-    StringX sxPath, token;
-    std::vector<StringX> vTokens;
-    size_t pos = 0;
-    while ((pos = sxGroup.find(_T('.'))) != StringX::npos) {
-      token = sxGroup.substr(0, pos);
-      vTokens.push_back(token);
-      sxGroup.erase(0, pos + 1);
-    }
-    vTokens.push_back(sxGroup); // rightmost subgroup, e.g., "b" in "a.b"
-    ASSERT(vTokens.size() >= 2);
-    sxPath = vTokens[0];
-
-    setGroups.insert(sxPath.c_str());
-    for (size_t i = 1; i < vTokens.size(); i++) {
-      sxPath += StringX(_T(".")) + vTokens[i];
-      setGroups.insert(sxPath.c_str());
-    }
-  } // > 1 group
-}
-
 // GetAllGroups - returns an array of all unique group prefix names
 // e.g., "A", "A.B", "A.B.C"
 void PWScore::GetAllGroups(std::vector<stringT> &vAllGroups) const
 {
-  // use the fact that set eliminates dups for us
-  std::set<stringT> setGroups;
-
-  // Start with groups that have elements
-  for (auto iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++) {
-    const CItemData &ci = iter->second;
-    if (ci.IsGroupSet()) {
-      // We have at least one group
-      collectGroups(ci.GetGroup(), setGroups);
-    } // IsGroupSet()
-  } // for m_pwlist
-
-  // Now add Empty groups in the same manner
-  for (auto iter2 = m_vEmptyGroups.begin(); iter2 != m_vEmptyGroups.end(); iter2++) {
-    ASSERT(!iter2->empty());
-    collectGroups(*iter2, setGroups);
-  }
-
-  vAllGroups.clear();
-  // copy unique results from set to caller's vector
-  copy(setGroups.begin(), setGroups.end(), back_inserter(vAllGroups));
+  // Includes the prefixes of empty groups, as these are in the tree too
+  m_GroupTree.GetAllGroups(vAllGroups);
 }
 
 // GetPolicyNames - returns an array of all password policy names
@@ -1902,35 +2344,20 @@ void PWScore::MakePolicyUnique(std::map<StringX, StringX> &mapRenamedPolicies,
   return;
 }
 
-// functor object type for for_each:
-// Updates vector with entries using named password policy
-struct AddEntry {
-  AddEntry(const StringX sxPolicyName, std::vector<st_GroupTitleUser> &ventries)
-    : m_sxPolicyName(sxPolicyName), m_pventries(&ventries) {}
-
-  void operator()(std::pair<CUUID const, CItemData> &p)
-  {
-    if (p.second.GetPolicyName() == m_sxPolicyName) {
-      st_GroupTitleUser st;
-      st.group = p.second.GetGroup();
-      st.title = p.second.GetTitle();
-      st.user = p.second.GetUser();
-      m_pventries->push_back(st);
-      return;
-    }
-  }
-
-private:
-  AddEntry& operator=(const AddEntry&); // Do not implement
-  StringX m_sxPolicyName;
-  std::vector<st_GroupTitleUser> *m_pventries;
-};
-
 bool PWScore::GetEntriesUsingNamedPasswordPolicy(const StringX sxPolicyName,
               std::vector<st_GroupTitleUser> &ventries)
 {
-  AddEntry add_entry(sxPolicyName, ventries);
-  std::for_each(m_pwlist.begin(), m_pwlist.end(), add_entry);
+  const UUIDSet &setUUID = GetEntriesUsingNamedPasswordPolicy(sxPolicyName);
+
+  ventries.reserve(ventries.size() + setUUID.size());
+  for (auto uuid_iter = setUUID.begin(); uuid_iter != setUUID.end(); uuid_iter++) {
+    ItemListConstIter citer = m_pwlist.find(*uuid_iter);
+    ASSERT(citer != m_pwlist.end());
+    if (citer == m_pwlist.end())
+      continue;
+    const CItemData &ci = citer->second;
+    ventries.push_back(st_GroupTitleUser(ci.GetGroup(), ci.GetTitle(), ci.GetUser()));
+  }
 
   // Sort them before displayed in the dialog later
   std::sort(ventries.begin(), ventries.end(), GTUCompareV1);
@@ -1938,6 +2365,13 @@ bool PWScore::GetEntriesUsingNamedPasswordPolicy(const StringX sxPolicyName,
   return ventries.size() > 0;
 }
 
+const UUIDSet &PWScore::GetEntriesUsingNamedPasswordPolicy(const StringX &sxPolicyName) const
+{
+  static const UUIDSet emptyset;
+  std::map<StringX, UUIDSet>::const_iterator iter = m_PolicyEntries.find(sxPolicyName);
+  return (iter == m_PolicyEntries.end()) ? emptyset : iter->second;
+}
+
 // For Validate only
 struct st_GroupTitleUser2 {
   StringX group;
@@ -2021,6 +2455,22 @@ void PWScore::ParseDependants()
   }
 }
 
+namespace {
+  // Per-entry findings from the parallel part of PWScore::Validate()
+  struct ValidateRecord {
+    ValidateRecord(ItemListIter it, const CItemData &ci)
+      : iter(it), gtu(ci.GetGroup(), ci.GetTitle(), ci.GetUser()),
+        bEmptyPassword(false), bPWHFixed(false), bBigText(false),
+        bMissingAtt(false), size(0) {}
+
+    ItemListIter iter;
+    st_GroupTitleUser gtu; // as read, before any fixes
+    bool bEmptyPassword, bPWHFixed, bBigText, bMissingAtt;
+    StringX sxPWH; // fixed password history, if bPWHFixed
+    size_t size; // of entry, if bBigText
+  };
+} // anonymous namespace
+
 bool PWScore::Validate(const size_t iMAXCHARS, CReport *pRpt, st_ValidateResults &st_vr)
 {
   /*
@@ -2042,16 +2492,15 @@ bool PWScore::Validate(const size_t iMAXCHARS, CReport *pRpt, st_ValidateResults
   */
 
   PWS_LOGIT_ARGS("iMAXCHARS=%d; pRpt=%p", iMAXCHARS, pRpt);
+  PWS_TRACE_SPAN(span, "Validate", "entries", "threads");
 
-  int n = -1;
   size_t uimaxsize(0);
 
   stringT cs_Error;
   pws_os::Trace(_T("Start validation\n"));
 
   st_GroupTitleUser st_gtu;
-  GTUSet setGTU;
-  GTUSetPair pr_gtu;
+  GTUHashSet setGTU;
   std::vector<st_GroupTitleUser> vGTU_UUID, vGTU_EmptyPassword, vGTU_PWH, vGTU_TEXT,
                                  vGTU_ALIASES, vGTU_SHORTCUTS;
   std::vector<st_GroupTitleUser2> vGTU_NONUNIQUE, vGTU_EmptyTitle;
@@ -2059,129 +2508,177 @@ bool PWScore::Validate(const size_t iMAXCHARS, CReport *pRpt, st_ValidateResults
   std::vector<st_AttTitle_Filename> vOrphanAtt;
   std::set<CUUID> sAtts;
 
-  ItemListIter iter;
+  // Checks 1, 2 (password), 4 & 5.1 only involve the entry itself, so they're
+  // done in parallel over contiguous ranges of entries. The workers only
+  // note what's wrong: setting a field needs random data for its in-memory
+  // encryption, which isn't to be had from several threads at once.
+  // The fixes, and GTU uniqueness (2 (title) & 3), are then done on one
+  // thread in m_pwlist order, so that which of a set of duplicates is renamed
+  // doesn't depend on thread timing.
+  StringX sxMissingPassword;
+  LoadAString(sxMissingPassword, IDSC_MISSINGPASSWORD);
+
+  std::vector<ItemListIter> vIters;
+  vIters.reserve(m_pwlist.size());
+  for (ItemListIter iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++)
+    vIters.push_back(iter);
+
+  // Not worth a thread for fewer than this many entries
+  const size_t MinPerThread = 256;
+  const size_t numThreads = std::max(size_t(1),
+                                    std::min(size_t(std::thread::hardware_concurrency()),
+                                             vIters.size() / MinPerThread));
+  span.SetArg(0, vIters.size());
+  span.SetArg(1, numThreads);
+
+  std::vector<std::vector<ValidateRecord> > vvRecords(numThreads);
+  std::vector<std::vector<CUUID> > vvAtts(numThreads);
+  auto ValidateRange = [&](size_t t, size_t begin, size_t end) {
+    PWS_TRACE_SPAN(rangeSpan, "ValidateRange", "entries", NULL);
+    rangeSpan.SetArg(0, end - begin);
+    std::vector<ValidateRecord> &vRecords = vvRecords[t];
+    vRecords.reserve(end - begin);
+    for (size_t i = begin; i < end; i++) {
+      const CItemData &ci = vIters[i]->second;
+      ValidateRecord rec(vIters[i], ci);
+
+      // Test if Password is present as it is mandatory!
+      rec.bEmptyPassword = ci.GetPassword().empty();
+
+      // Test if Password History needs fixing
+      rec.bPWHFixed = !ci.CheckPWHistory(rec.sxPWH);
+
+      // Note excessively sized text fields
+      if (iMAXCHARS > 0) {
+        for (unsigned char uc = static_cast<unsigned char>(CItem::GROUP);
+             uc < static_cast<unsigned char>(CItem::LAST_DATA); uc++) {
+          if (CItemData::IsTextField(uc)) {
+            StringX sxvalue = ci.GetFieldValue(static_cast<CItemData::FieldType>(uc));
+            if (sxvalue.length() > iMAXCHARS) {
+              rec.bBigText = true;
+              //  We don't truncate the field, but if we did, then the the code would be:
+              //  ci.SetFieldValue((CItemData::FieldType)uc, sxvalue.substr(0, iMAXCHARS))
+              break;
+            }
+          }
+        }
+        if (rec.bBigText)
+          rec.size = ci.GetSize();
+      }
 
-  for (iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++) {
-    CItemData &ci = iter->second;
-    CItemData fixedItem(ci);
-    bool bFixed(false);
-
-    n++;
-
-    // Fix GTU uniqueness - can't do this in a CItemData member function as it causes
-    // circular includes:
-    //  "ItemData.h" would need to include "coredefs.h", which needs to include "ItemData.h"!
-    StringX sxgroup(ci.GetGroup()), sxtitle(ci.GetTitle()), sxuser(ci.GetUser());
-    st_gtu.group = sxgroup;
-    st_gtu.title = sxtitle;
-    st_gtu.user = sxuser;
-
-    if (sxtitle.empty()) {
-      // This field is mandatory!
-      // Change it and insert into a std::set which guarantees uniqueness
-      int i = 0;
-      StringX sxnewtitle(sxtitle);
-      do {
-        i++;
-        Format(sxnewtitle, IDSC_MISSINGTITLE, i);
-        st_gtu.title = sxnewtitle;
-        pr_gtu =  setGTU.insert(st_gtu);
-      } while (!pr_gtu.second);
-
-      fixedItem.SetTitle(sxnewtitle);
-
-      bFixed = true;
-      vGTU_EmptyTitle.push_back(st_GroupTitleUser2(sxgroup, sxtitle, sxuser, sxnewtitle));
-      st_vr.num_empty_titles++;
-      sxtitle = sxnewtitle;
-    } else {
-      // Title was not empty
-      // Insert into a std::set which guarantees uniqueness
-      pr_gtu = setGTU.insert(st_gtu);
-      if (!pr_gtu.second) {
-        // Already have this group/title/user entry
+      // Attachment Reference check (5.1)
+      if (ci.HasAttRef()) {
+        vvAtts[t].push_back(ci.GetAttUUID());
+        rec.bMissingAtt = !HasAtt(ci.GetAttUUID());
+      }
+      vRecords.push_back(rec);
+    }
+  };
+
+  std::vector<std::thread> vThreads;
+  const size_t perThread = (vIters.size() + numThreads - 1) / numThreads;
+  for (size_t t = 1; t < numThreads; t++) {
+    const size_t begin = std::min(t * perThread, vIters.size());
+    const size_t end = std::min(begin + perThread, vIters.size());
+    vThreads.push_back(std::thread(ValidateRange, t, begin, end));
+  }
+  ValidateRange(0, 0, std::min(perThread, vIters.size()));
+  for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+    iter->join();
+
+  // Merge per-thread findings, in m_pwlist order
+  setGTU.reserve(vIters.size());
+  size_t n = 0;
+  for (auto vr_iter = vvRecords.begin(); vr_iter != vvRecords.end(); vr_iter++) {
+    for (auto iter = vr_iter->begin(); iter != vr_iter->end(); iter++, n++) {
+      const ValidateRecord &rec = *iter;
+      CItemData &ci = rec.iter->second;
+      bool bFixed = rec.bEmptyPassword || rec.bPWHFixed || rec.bMissingAtt;
+
+      // Fix GTU uniqueness - can't do this in a CItemData member function as it causes
+      // circular includes:
+      //  "ItemData.h" would need to include "coredefs.h", which needs to include "ItemData.h"!
+      const StringX &sxgroup(rec.gtu.group), &sxuser(rec.gtu.user);
+      StringX sxtitle(rec.gtu.title);
+      st_gtu = rec.gtu;
+
+      if (sxtitle.empty()) {
+        // This field is mandatory!
+        // Change it and insert into a set which guarantees uniqueness
         int i = 0;
-        StringX s_copy, sxnewtitle(sxtitle);
+        StringX sxnewtitle(sxtitle);
         do {
           i++;
-          Format(s_copy, IDSC_DUPLICATENUMBER, i);
-          sxnewtitle = sxtitle + s_copy;
+          Format(sxnewtitle, IDSC_MISSINGTITLE, i);
           st_gtu.title = sxnewtitle;
-          pr_gtu =  setGTU.insert(st_gtu);
-        } while (!pr_gtu.second);
+        } while (!setGTU.insert(st_gtu).second);
 
-        fixedItem.SetTitle(sxnewtitle);
+        ci.SetTitle(sxnewtitle);
 
         bFixed = true;
-        vGTU_NONUNIQUE.push_back(st_GroupTitleUser2(sxgroup, sxtitle, sxuser, sxnewtitle));
-        st_vr.num_duplicate_GTU_fixed++;
+        vGTU_EmptyTitle.push_back(st_GroupTitleUser2(sxgroup, sxtitle, sxuser, sxnewtitle));
+        st_vr.num_empty_titles++;
         sxtitle = sxnewtitle;
+      } else {
+        // Title was not empty
+        // Insert into a set which guarantees uniqueness
+        if (!setGTU.insert(st_gtu).second) {
+          // Already have this group/title/user entry
+          int i = 0;
+          StringX s_copy, sxnewtitle(sxtitle);
+          do {
+            i++;
+            Format(s_copy, IDSC_DUPLICATENUMBER, i);
+            sxnewtitle = sxtitle + s_copy;
+            st_gtu.title = sxnewtitle;
+          } while (!setGTU.insert(st_gtu).second);
+
+          ci.SetTitle(sxnewtitle);
+
+          bFixed = true;
+          vGTU_NONUNIQUE.push_back(st_GroupTitleUser2(sxgroup, sxtitle, sxuser, sxnewtitle));
+          st_vr.num_duplicate_GTU_fixed++;
+          sxtitle = sxnewtitle;
+        }
       }
-    }
 
-    // Test if Password is present as it is mandatory! was fixed
-    if (ci.GetPassword().empty()) {
-      StringX sxMissingPassword;
-      LoadAString(sxMissingPassword, IDSC_MISSINGPASSWORD);
-      fixedItem.SetPassword(sxMissingPassword);
-
-      bFixed = true;
-      vGTU_EmptyPassword.push_back(st_GroupTitleUser(sxgroup, sxtitle, sxuser));
-      st_vr.num_empty_passwords++;
-    }
-
-    // Test if Password History was fixed
-    if (!fixedItem.ValidatePWHistory()) {
-      bFixed = true;
-      vGTU_PWH.push_back(st_GroupTitleUser(sxgroup, sxtitle, sxuser));
-      st_vr.num_PWH_fixed++;
-    }
-
-    // Note excessively sized text fields
-    if (iMAXCHARS > 0) {
-      bool bEntryHasBigField(false);
-      for (unsigned char uc = static_cast<unsigned char>(CItem::GROUP);
-           uc < static_cast<unsigned char>(CItem::LAST_DATA); uc++) {
-        if (CItemData::IsTextField(uc)) {
-          StringX sxvalue = ci.GetFieldValue(static_cast<CItemData::FieldType>(uc));
-          if (sxvalue.length() > iMAXCHARS) {
-            bEntryHasBigField = true;
-            //  We don't truncate the field, but if we did, then the the code would be:
-            //  fixedItem.SetFieldValue((CItemData::FieldType)uc, sxvalue.substr(0, iMAXCHARS))
-            break;
-          }
-        }
+      if (rec.bEmptyPassword) {
+        ci.SetPassword(sxMissingPassword);
+        vGTU_EmptyPassword.push_back(st_GroupTitleUser(sxgroup, sxtitle, sxuser));
+        st_vr.num_empty_passwords++;
       }
-      if (bEntryHasBigField) {
-        uimaxsize = std::max(uimaxsize, ci.GetSize());
+
+      if (rec.bPWHFixed) {
+        if (ci.GetPWHistory() != rec.sxPWH)
+          ci.SetPWHistory(rec.sxPWH);
+        vGTU_PWH.push_back(st_GroupTitleUser(sxgroup, sxtitle, sxuser));
+        st_vr.num_PWH_fixed++;
+      }
+
+      if (rec.bBigText) {
+        uimaxsize = std::max(uimaxsize, rec.size);
         vGTU_TEXT.push_back(st_GroupTitleUser(sxgroup, sxtitle, sxuser));
         st_vr.num_excessivetxt_found++;
       }
-    }
 
-    // Attachment Reference check (5.1)
-    if (ci.HasAttRef()) {
-      sAtts.insert(ci.GetAttUUID());
-      if (!HasAtt(ci.GetAttUUID())) {
-        vGTU_MissingAtt.push_back(st_GroupTitleUser(ci.GetGroup(),
-                                                    ci.GetTitle(),
-                                                    ci.GetUser()));
+      if (rec.bMissingAtt) {
+        ci.ClearAttUUID();
+        vGTU_MissingAtt.push_back(rec.gtu);
         st_vr.num_missing_att++;
-        // Fix the problem:
-        fixedItem.ClearAttUUID();
-        bFixed = true;
       }
-    }
 
-    if (bFixed) {
-      // Mark as modified
-      fixedItem.SetStatus(CItemData::ES_MODIFIED);
-      // We assume that this is run during file read. If not, then we
-      // need to run using the Command mechanism for Undo/Redo.
-      m_pwlist[fixedItem.GetUUID()] = fixedItem;
+      if (bFixed) {
+        // Mark as modified
+        // We assume that this is run during file read. If not, then we
+        // need to run using the Command mechanism for Undo/Redo.
+        ci.SetStatus(CItemData::ES_MODIFIED);
+      }
     }
   } // iteration over m_pwlist
 
+  for (auto va_iter = vvAtts.begin(); va_iter != vvAtts.end(); va_iter++)
+    sAtts.insert(va_iter->begin(), va_iter->end());
+
   // Check for orphan attachments (5.2)
   for (auto att_iter = m_attlist.begin(); att_iter != m_attlist.end(); att_iter++) {
     if (sAtts.find(att_iter->first) == sAtts.end()) {
@@ -2194,7 +2691,6 @@ bool PWScore::Validate(const size_t iMAXCHARS, CReport *pRpt, st_ValidateResults
     }
   }
 
-
 #if 0 // XXX We've separated alias/shortcut processing from Validate - reconsider this!
   // See if we have any entries with passwords that imply they are an alias
   // but there is no equivalent base entry
@@ -2392,7 +2888,7 @@ bool PWScore::Validate(const size_t iMAXCHARS, CReport *pRpt, st_ValidateResults
     }
   } // End of issues report handling
 
-  pws_os::Trace(_T("End validation. %d entries processed\n"), n + 1);
+  pws_os::Trace(_T("End validation. %d entries processed\n"), static_cast<int>(n));
 
   m_bUniqueGTUValidated = true;
   if (st_vr.TotalIssues() > 0) {
@@ -2483,19 +2979,21 @@ bool PWScore::InitialiseGTU(GTUSet &setGTU, const StringX &sxPolicyName)
   if (sxPolicyName.empty())
     return false;
 
-  // Populate the set of all group/title/user entries
+  // Populate the set of group/title/user entries using this policy
   GTUSetPair pr_gtu;
-  ItemListConstIter citer;
+  const UUIDSet &setUUID = GetEntriesUsingNamedPasswordPolicy(sxPolicyName);
 
-  for (citer = m_pwlist.begin(); citer != m_pwlist.end(); citer++) {
+  for (auto uuid_iter = setUUID.begin(); uuid_iter != setUUID.end(); uuid_iter++) {
+    ItemListConstIter citer = m_pwlist.find(*uuid_iter);
+    ASSERT(citer != m_pwlist.end());
+    if (citer == m_pwlist.end())
+      continue;
     const CItemData &ci = citer->second;
-    if (ci.GetPolicyName() == sxPolicyName) {
-      pr_gtu = setGTU.insert(st_GroupTitleUser(ci.GetGroup(), ci.GetTitle(), ci.GetUser()));
-      if (!pr_gtu.second) {
-        // Could happen if merging or synching a bad database!
-        setGTU.clear();
-        return false;
-      }
+    pr_gtu = setGTU.insert(st_GroupTitleUser(ci.GetGroup(), ci.GetTitle(), ci.GetUser()));
+    if (!pr_gtu.second) {
+      // Could happen if merging or synching a bad database!
+      setGTU.clear();
+      return false;
     }
   }
   return true;
@@ -2726,6 +3224,21 @@ int PWScore::DoAddDependentEntries(UUIDVector &dependentlist, CReport *pRpt,
   int num_warnings(0);
   st_SaveTypePW st_typepw;
 
+  // Resolve [g:t:u] via a hash of all entries' group/title/user, built in
+  // one pass, rather than a linear Find(g, t, u) per dependent. As Find
+  // returns the first match, so do we. UUIDs rather than iterators are
+  // kept, as entries may be erased along the way.
+  std::unordered_map<st_GroupTitleUser, CUUID, st_GroupTitleUser::Hash> mapGTU;
+  if (iVia != CItemData::UUID && !dependentlist.empty()) {
+    mapGTU.reserve(m_pwlist.size());
+    for (ItemListConstIter citer = m_pwlist.begin(); citer != m_pwlist.end(); citer++) {
+      const CItemData &ci = citer->second;
+      mapGTU.insert(std::make_pair(st_GroupTitleUser(ci.GetGroup(), ci.GetTitle(),
+                                                     ci.GetUser()),
+                                   citer->first));
+    }
+  }
+
   if (!dependentlist.empty()) {
     UUIDVectorIter paiter;
     ItemListIter iter;
@@ -2757,8 +3270,10 @@ int PWScore::DoAddDependentEntries(UUIDVector &dependentlist, CReport *pRpt,
           sxPwdTitle = tmp.substr(0, tmp.find_first_of(_T(":")));
           // Skip over 'title:'
           sxPwdUser = tmp.substr(sxPwdTitle.length() + 1);
-          iter = Find(sxPwdGroup, sxPwdTitle, sxPwdUser);
-          base_uuid = iter->second.GetUUID();
+          auto gtu_iter = mapGTU.find(st_GroupTitleUser(sxPwdGroup, sxPwdTitle, sxPwdUser));
+          iter = gtu_iter != mapGTU.end() ? m_pwlist.find(gtu_iter->second) : m_pwlist.end();
+          if (iter != m_pwlist.end())
+            base_uuid = iter->first;
         } else {
           iter = m_pwlist.end();
         }
@@ -2787,6 +3302,8 @@ int PWScore::DoAddDependentEntries(UUIDVector &dependentlist, CReport *pRpt,
             // Invalid - delete!
             if (pmapDeletedItems != NULL)
               pmapDeletedItems->insert(ItemList_Pair(*paiter, *pci_curitem));
+            m_GroupTree.RemoveEntry(iter->second.GetGroup(), iter->first);
+            m_URLIndex.RemoveEntry(iter->second.GetURL(), iter->first);
             m_pwlist.erase(iter);
             continue;
           }
@@ -2811,6 +3328,8 @@ int PWScore::DoAddDependentEntries(UUIDVector &dependentlist, CReport *pRpt,
             // Invalid - delete!
             if (pmapDeletedItems != NULL)
               pmapDeletedItems->insert(ItemList_Pair(*paiter, *pci_curitem));
+            m_GroupTree.RemoveEntry(iter->second.GetGroup(), iter->first);
+            m_URLIndex.RemoveEntry(iter->second.GetURL(), iter->first);
             m_pwlist.erase(iter);
             continue;
           }
@@ -2919,6 +3438,10 @@ void PWScore::UndoAddDependentEntries(ItemList *pmapDeletedItems,
   for (add_iter = pmapDeletedItems->begin();
        add_iter != pmapDeletedItems->end();
        add_iter++) {
+    if (m_pwlist.find(add_iter->first) == m_pwlist.end()) {
+      m_GroupTree.AddEntry(add_iter->second.GetGroup(), add_iter->first);
+      m_URLIndex.AddEntry(add_iter->second.GetURL(), add_iter->first);
+    }
     m_pwlist[add_iter->first] = add_iter->second;
   }
 
@@ -3177,6 +3700,7 @@ void PWScore::UpdateWizard(const stringT &s)
 
 bool PWScore::LockFile(const stringT &filename, stringT &locker)
 {
+  WatchSuspender ws(this, filename.c_str());
   return pws_os::LockFile(filename, locker,
                           m_lockFileHandle, m_LockCount);
 }
@@ -3188,6 +3712,7 @@ bool PWScore::IsLockedFile(const stringT &filename) const
 
 void PWScore::UnlockFile(const stringT &filename)
 {
+  WatchSuspender ws(this, filename.c_str());
   return pws_os::UnlockFile(filename,
                             m_lockFileHandle, m_LockCount);
 }
@@ -3204,6 +3729,75 @@ void PWScore::UnlockFile2(const stringT &filename)
                             m_lockFileHandle2, m_LockCount2);
 }
 
+void PWScore::SetCurFile(const StringX &file)
+{
+  if (file != m_currfile || m_pFileWatcher == NULL) {
+    m_currfile = file;
+    WatchCurFile();
+  }
+}
+
+bool PWScore::StartWatchingCurFile()
+{
+  m_bWatchCurFile = true;
+  return WatchCurFile();
+}
+
+void PWScore::StopWatchingCurFile()
+{
+  m_bWatchCurFile = false;
+  UnwatchCurFile();
+}
+
+bool PWScore::WatchCurFile()
+{
+  UnwatchCurFile();
+  if (!m_bWatchCurFile || m_currfile.empty())
+    return false;
+
+  const stringT dbfile(m_currfile.c_str());
+  std::vector<stringT> vFiles;
+  vFiles.push_back(dbfile);
+  vFiles.push_back(pws_os::GetLockFileName(dbfile));
+
+  m_pFileWatcher = new CFileWatcher;
+  if (!m_pFileWatcher->Start(vFiles,
+                             [this, dbfile](const std::vector<stringT> &vChanged)
+                             {OnCurFileChanged(dbfile, vChanged);})) {
+    delete m_pFileWatcher;
+    m_pFileWatcher = NULL;
+    return false;
+  }
+  return true;
+}
+
+void PWScore::UnwatchCurFile()
+{
+  if (m_pFileWatcher != NULL) {
+    WaitForAsyncSave(); // as it may be suspending the watcher
+    delete m_pFileWatcher; // stops watcher thread
+    m_pFileWatcher = NULL;
+  }
+}
+
+bool PWScore::IsWatchingCurFile() const
+{
+  return m_pFileWatcher != NULL && m_pFileWatcher->IsWatching();
+}
+
+void PWScore::OnCurFileChanged(const stringT &dbfile,
+                               const std::vector<stringT> &vChanged)
+{
+  // Note that this is called on the file watcher's thread, after a burst of
+  // changes has settled down. We leave it to the UI to figure out what to do.
+  const bool bLockFileOnly = std::find(vChanged.begin(), vChanged.end(),
+                                       dbfile) == vChanged.end();
+
+  if (m_pUIIF != NULL &&
+      m_bsSupportedFunctions.test(UIInterFace::DATABASEFILECHANGED))
+    m_pUIIF->DatabaseFileChanged(bLockFileOnly);
+}
+
 bool PWScore::IsNodeModified(StringX &path) const
 {
   return std::find(m_vNodes_Modified.begin(),
@@ -3251,14 +3845,12 @@ struct HistoryUpdateResetOff : public HistoryUpdater {
   void operator()(CItemData &ci) {
     if (!ci.IsProtected() ||
         (!m_bExcludeProtected && ci.IsProtected())) {
-      StringX cs_tmp = ci.GetPWHistory();
-      if (cs_tmp.length() >= 5 && cs_tmp[0] == L'1') {
+      if (ci.IsPasswordHistorySet() && ci.GetPWHistoryStatus()) {
         st_PWH_status st_pwhs;
-        st_pwhs.pwh = cs_tmp;
+        st_pwhs.pwh = ci.GetPWHistory();
         st_pwhs.es = ci.GetStatus();
         m_mapSavedHistory[ci.GetUUID()] = st_pwhs;
-        cs_tmp[0] = L'0';
-        ci.SetPWHistory(cs_tmp);
+        ci.SetPWHistoryStatus(false);
         ci.SetStatus(CItemData::ES_MODIFIED);
         m_num_altered++;
       }
@@ -3278,19 +3870,17 @@ struct HistoryUpdateResetOn : public HistoryUpdater {
   void operator()(CItemData &ci) {
     if (!ci.IsProtected() ||
         (!m_bExcludeProtected && ci.IsProtected())) {
-      StringX cs_tmp = ci.GetPWHistory();
       st_PWH_status st_pwhs;
-      st_pwhs.pwh = cs_tmp;
       st_pwhs.es = ci.GetStatus();
-      if (cs_tmp.length() < 5) {
+      if (!ci.IsPasswordHistorySet()) {
         m_mapSavedHistory[ci.GetUUID()] = st_pwhs;
         ci.SetPWHistory(m_text);
         m_num_altered++;
       } else {
-        if (cs_tmp[0] == L'0') {
+        if (!ci.GetPWHistoryStatus()) {
+          st_pwhs.pwh = ci.GetPWHistory();
           m_mapSavedHistory[ci.GetUUID()] = st_pwhs;
-          cs_tmp[0] = L'1';
-          ci.SetPWHistory(cs_tmp);
+          ci.SetPWHistoryStatus(true);
           ci.SetStatus(CItemData::ES_MODIFIED);
           m_num_altered++;
         }
@@ -3308,29 +3898,20 @@ struct HistoryUpdateSetMax : public HistoryUpdater {
                       SavePWHistoryMap &mapSavedHistory, bool bExcludeProtected)
     : HistoryUpdater(num_altered, mapSavedHistory, bExcludeProtected),
     m_new_default_max(new_default_max)
-  {Format(m_text, L"1%02x", new_default_max);}
+  {}
 
   void operator()(CItemData &ci) {
     if (!ci.IsProtected() ||
         (!m_bExcludeProtected && ci.IsProtected())) {
-      StringX cs_tmp = ci.GetPWHistory();
-
-      size_t len = cs_tmp.length();
-      if (len >= 5) {
+      if (ci.IsPasswordHistorySet() && ci.GetPWHistoryStatus() &&
+          ci.GetPWHistoryCount() <= size_t(m_new_default_max)) {
         st_PWH_status st_pwhs;
-        st_pwhs.pwh = cs_tmp;
+        st_pwhs.pwh = ci.GetPWHistory();
         st_pwhs.es = ci.GetStatus();
         m_mapSavedHistory[ci.GetUUID()] = st_pwhs;
-        int status, old_max, num_saved;
-        const wchar_t *lpszPWHistory = cs_tmp.c_str();
-        int iread = _stscanf_s(lpszPWHistory, _T("%01d%02x%02x"),
-                               &status, &old_max, &num_saved);
-        if (iread == 3 && status == 1 && num_saved <= m_new_default_max) {
-          cs_tmp = m_text + cs_tmp.substr(3);
-          ci.SetPWHistory(cs_tmp);
-          ci.SetStatus(CItemData::ES_MODIFIED);
-          m_num_altered++;
-        }
+        ci.SetPWHistoryMax(m_new_default_max);
+        ci.SetStatus(CItemData::ES_MODIFIED);
+        m_num_altered++;
       }
     }
   }
@@ -3338,7 +3919,6 @@ struct HistoryUpdateSetMax : public HistoryUpdater {
 private:
   HistoryUpdateSetMax& operator=(const HistoryUpdateSetMax&); // Do not implement
   int m_new_default_max;
-  StringX m_text;
 };
 
 struct HistoryUpdateClearAll : public HistoryUpdater {
@@ -3349,11 +3929,9 @@ struct HistoryUpdateClearAll : public HistoryUpdater {
   void operator()(CItemData &ci) {
     if (!ci.IsProtected() ||
         (!m_bExcludeProtected && ci.IsProtected())) {
-      StringX cs_tmp = ci.GetPWHistory();
-      size_t len = cs_tmp.length();
-      if (len != 0 && cs_tmp != _T("00000")) {
+      if (ci.IsPasswordHistorySet()) {
         st_PWH_status st_pwhs;
-        st_pwhs.pwh = cs_tmp;
+        st_pwhs.pwh = ci.GetPWHistory();
         st_pwhs.es = ci.GetStatus();
         m_mapSavedHistory[ci.GetUUID()] = st_pwhs;
         ci.SetPWHistory(L"");
@@ -3446,21 +4024,35 @@ int PWScore::DoRenameGroup(const StringX &sxOldPath, const StringX &sxNewPath)
   const wchar_t wcDot=L'.';
   StringX sxOldPath2 = sxOldPath + sxDot;
   const size_t len2 = sxOldPath2.length();
-  ItemListIter iter;
 
-  for (iter = m_pwlist.begin(); iter != m_pwlist.end(); iter++) {
-    if (iter->second.GetGroup() == sxOldPath) {
-      iter->second.SetGroup(sxNewPath);
+  // Only entries in the renamed subtree can be affected
+  UUIDVector vEntries;
+  m_GroupTree.GetEntries(sxOldPath, true, vEntries);
+
+  for (auto uuid_iter = vEntries.begin(); uuid_iter != vEntries.end(); uuid_iter++) {
+    ItemListIter iter = m_pwlist.find(*uuid_iter);
+    ASSERT(iter != m_pwlist.end());
+    if (iter == m_pwlist.end())
+      continue;
+
+    const StringX sxGroup = iter->second.GetGroup();
+    StringX sxNewGroup;
+    if (sxGroup == sxOldPath) {
+      sxNewGroup = sxNewPath;
     }
-    else if ((iter->second.GetGroup().length() > len2) && (iter->second.GetGroup().substr(0, len2) == sxOldPath2) &&
-     (iter->second.GetGroup()[len2] != wcDot)) {
+    else if ((sxGroup.length() > len2) && (sxGroup.substr(0, len2) == sxOldPath2) &&
+     (sxGroup[len2] != wcDot)) {
       // Need to check that next symbol is not a dot
       // to ensure not affecting another group
       // (group name could contain trailing dots, for example abc..def.g)
       // subgroup name will have len > len2 (old_name + dot + subgroup_name)
-      StringX sxSubGroups = iter->second.GetGroup().substr(len2);
-      iter->second.SetGroup(sxNewPath + sxDot + sxSubGroups);
-    }
+      StringX sxSubGroups = sxGroup.substr(len2);
+      sxNewGroup = sxNewPath + sxDot + sxSubGroups;
+    } else
+      continue;
+
+    iter->second.SetGroup(sxNewGroup);
+    m_GroupTree.MoveEntry(sxGroup, sxNewGroup, *uuid_iter);
   }
   return 0;
 }
@@ -3488,14 +4080,26 @@ void PWScore::GetDBProperties(st_DBProperties &st_dbp)
                           m_hdr.m_nCurrentMajorVersion,
                           m_hdr.m_nCurrentMinorVersion);
 
-  std::vector<std::wstring> vAllGroups;
-  GetAllGroups(vAllGroups);
-  Format(st_dbp.numgroups, L"%d", vAllGroups.size());
+  Format(st_dbp.numgroups, L"%d", m_GroupTree.GetNumGroups());
   Format(st_dbp.numemptygroups, L"%d", m_vEmptyGroups.size());
   Format(st_dbp.numentries, L"%d", m_pwlist.size());
-  if (GetReadFileVersion() >= PWSfile::V40)
-    Format(st_dbp.numattachments, L"%d", m_attlist.size());
-  else
+  if (GetReadFileVersion() >= PWSfile::V40) {
+    // Stored once, however many entries refer to them
+    unsigned int nShared = 0;
+    ulong64 saved = 0;
+    for (auto att_iter = m_attlist.begin(); att_iter != m_attlist.end(); att_iter++) {
+      const unsigned int refcount = att_iter->second.GetRefcount();
+      if (refcount > 1) {
+        nShared++;
+        saved += ulong64(refcount - 1) * att_iter->second.GetContentLength();
+      }
+    }
+    if (nShared == 0)
+      Format(st_dbp.numattachments, L"%d", m_attlist.size());
+    else
+      Format(st_dbp.numattachments, IDSC_ATTSHARED,
+             static_cast<unsigned int>(m_attlist.size()), nShared, saved);
+  } else
     st_dbp.numattachments = L"N/A";
 
   time_t twls = m_hdr.m_whenlastsaved;
@@ -3588,20 +4192,13 @@ int PWScore::SetHeaderItem(const StringX &sxNewValue, PWSfile::HeaderType ht)
 void PWScore::UpdateExpiryEntry(const CUUID &uuid, const CItemData::FieldType ft,
                                 const StringX &value)
 {
-  ExpiredList::iterator iter;
-
-  iter = std::find_if(m_ExpireCandidates.begin(), m_ExpireCandidates.end(),
-                      std::bind2nd(std::equal_to<pws_os::CUUID>(), uuid));
-  if (iter == m_ExpireCandidates.end())
-    return;
-
   if (ft == CItemData::XTIME) {
     time_t t;
     if ((VerifyImportDateTimeString(value.c_str(), t) ||
          VerifyXMLDateTimeString(value.c_str(), t)    ||
          VerifyASCDateTimeString(value.c_str(), t))   &&
          (t != time_t(-1))) {  // checkerror despite all our verification!
-      iter->expirytttXTime = t;
+      m_ExpireCandidates.SetExpiryTime(uuid, t);
     } else {
       ASSERT(0);
     }
@@ -3624,6 +4221,8 @@ bool PWScore::ChangeMode(stringT &locker, int &iErrorCode)
   iErrorCode = SUCCESS;
   locker = _T(""); // Important!
 
+  WatchSuspender ws(this, m_currfile);
+
   if (m_bIsReadOnly) {
     // We know the file did exist but this will also determine if it is R-O
     bool isRO;
@@ -3736,24 +4335,33 @@ bool PWScore::SetDBFilters(const PWSFilters &MapDBFilters)
   return brc;
 }
 
-bool PWScore::IncrementPasswordPolicy(const StringX &sxPolicyName)
+bool PWScore::IncrementPasswordPolicy(const StringX &sxPolicyName,
+                                      const CUUID &uuid)
 {
   PSWDPolicyMapIter iter = m_MapPSWDPLC.find(sxPolicyName);
   if (iter == m_MapPSWDPLC.end()) {
     return false;
   } else {
     iter->second.usecount++;
+    m_PolicyEntries[sxPolicyName].insert(uuid);
     return true;
   }
 }
 
-bool PWScore::DecrementPasswordPolicy(const StringX &sxPolicyName)
+bool PWScore::DecrementPasswordPolicy(const StringX &sxPolicyName,
+                                      const CUUID &uuid)
 {
   PSWDPolicyMapIter iter = m_MapPSWDPLC.find(sxPolicyName);
   if (iter == m_MapPSWDPLC.end() || iter->second.usecount == 0) {
     return false;
   } else {
     iter->second.usecount--;
+    std::map<StringX, UUIDSet>::iterator pe_iter = m_PolicyEntries.find(sxPolicyName);
+    if (pe_iter != m_PolicyEntries.end()) {
+      pe_iter->second.erase(uuid);
+      if (pe_iter->second.empty())
+        m_PolicyEntries.erase(pe_iter);
+    }
     return true;
   }
 }
@@ -3781,6 +4389,7 @@ bool PWScore::SetEmptyGroups(const std::vector<StringX> &vEmptyGroups)
   bool brc(false);
   if (m_vEmptyGroups != vEmptyGroups) {
     m_vEmptyGroups = vEmptyGroups;
+    m_GroupTree.SetEmptyGroups(m_vEmptyGroups);
     brc = true;
   }
   return brc;
@@ -3788,8 +4397,7 @@ bool PWScore::SetEmptyGroups(const std::vector<StringX> &vEmptyGroups)
 
 bool PWScore::IsEmptyGroup(const StringX &sxEmptyGroup) const
 {
-  return find(m_vEmptyGroups.begin(), m_vEmptyGroups.end(), sxEmptyGroup) !=
-                   m_vEmptyGroups.end();
+  return m_GroupTree.IsEmptyGroup(sxEmptyGroup);
 }
 
 bool PWScore::AddEmptyGroup(const StringX &sxEmptyGroup)
@@ -3799,10 +4407,10 @@ bool PWScore::AddEmptyGroup(const StringX &sxEmptyGroup)
   if (sxEmptyGroup.empty())
     return false;
 
-  if (find(m_vEmptyGroups.begin(), m_vEmptyGroups.end(), sxEmptyGroup) ==
-           m_vEmptyGroups.end()) {
+  if (!m_GroupTree.IsEmptyGroup(sxEmptyGroup)) {
     // Add it
     m_vEmptyGroups.push_back(sxEmptyGroup);
+    m_GroupTree.AddEmptyGroup(sxEmptyGroup);
 
     // Then sort it for when we campare.
     // Could use std::set but unnecessary complication/overhead
@@ -3819,6 +4427,7 @@ bool PWScore::RemoveEmptyGroup(const StringX &sxEmptyGroup)
 
   if (iter != m_vEmptyGroups.end()) {
     m_vEmptyGroups.erase(iter);
+    m_GroupTree.RemoveEmptyGroup(sxEmptyGroup);
     return true;
   } else
     return false;
@@ -3832,8 +4441,10 @@ bool PWScore::RenameEmptyGroup(const StringX &sxOldGroup, const StringX &sxNewGr
   if (iter != m_vEmptyGroups.end()) {
     // Delete old name
     m_vEmptyGroups.erase(iter);
+    m_GroupTree.RemoveEmptyGroup(sxOldGroup);
     // Add new name
     m_vEmptyGroups.push_back(sxNewGroup);
+    m_GroupTree.AddEmptyGroup(sxNewGroup);
     // Sort it for when we campare.
     std::sort(m_vEmptyGroups.begin(), m_vEmptyGroups.end());
     bChanged = true;
@@ -3861,6 +4472,8 @@ bool PWScore::RenameEmptyGroupPaths(const StringX &sxOldPath, const StringX &sxN
 
     // Now sort it for when we campare.
     std::sort(m_vEmptyGroups.begin(), m_vEmptyGroups.end());
+    if (bChanged)
+      m_GroupTree.SetEmptyGroups(m_vEmptyGroups);
   }
   return bChanged;
 }
@@ -3898,6 +4511,35 @@ const pws_os::CUUID & PWScore::GetKBShortcut(const int32 &iKBShortcut)
     return iter->second;
 }
 
+size_t PWScore::GetKBShortcutsUsingModifiers(const WORD wPWSModifiers,
+                                             std::vector<KBShortcutMapPair> &vShortcuts,
+                                             const bool bAny) const
+{
+  // Shortcuts are keyed by (modifiers << 16) | key, so all those with the
+  // same modifiers are adjacent in m_KBShortcutMap.  For bAny, jump from one
+  // run of modifiers to the next rather than visiting every shortcut.
+  // Valid modifiers fit in the low 7 bits (see ValidateKBShortcut), so
+  // keys are never negative.
+  vShortcuts.clear();
+  KBShortcutMapConstIter iter = m_KBShortcutMap.lower_bound(int32(wPWSModifiers) << 16);
+  while (iter != m_KBShortcutMap.end()) {
+    const WORD wModifiers = WORD(iter->first >> 16);
+    const int64 iNext = int64(wModifiers + 1) << 16;
+    if (wModifiers == wPWSModifiers ||
+        (bAny && (wModifiers & wPWSModifiers) == wPWSModifiers)) {
+      for (; iter != m_KBShortcutMap.end() && iter->first < iNext; iter++)
+        vShortcuts.push_back(*iter);
+      if (!bAny)
+        break;
+    } else if (!bAny) {
+      break;
+    } else {
+      iter = m_KBShortcutMap.lower_bound(int32(iNext));
+    }
+  }
+  return vShortcuts.size();
+}
+
 uint32 PWScore::GetHashIters() const
 {
   return m_hashIters;
@@ -3916,7 +4558,94 @@ void PWScore::RemoveAtt(const pws_os::CUUID &attuuid)
   // Should be a Command setting new CommandDBChange enum value
   ASSERT(HasAtt(attuuid));
   //m_stDBCS.bDBChanged = true; // Can't do this outside a Command
-  m_attlist.erase(m_attlist.find(attuuid));
+  auto pos = m_attlist.find(attuuid);
+  if (pos == m_attlist.end())
+    return;
+  if (pos->second.GetRefcount() > 1)
+    pos->second.DecRefcount(); // still shared
+  else
+    m_attlist.erase(pos); // its digest's dropped when next looked up
+}
+
+pws_os::CUUID PWScore::PutAtt(const CItemAtt &att)
+{
+  // Should be a Command setting new CommandDBChange enum value
+  const CUUID attuuid = att.GetUUID();
+  auto pos = m_attlist.find(attuuid);
+  if (pos != m_attlist.end() && pos->second.GetRefcount() <= 1) {
+    const unsigned refcount = pos->second.GetRefcount();
+    pos->second = att;
+    pos->second.SetRefcount(refcount);
+    m_bAttDigestsValid = false;
+    return attuuid;
+  }
+
+  // A new attachment, or an edit of a shared one: the edit's for this entry
+  // only, unless it's (still) identical to a stored one
+  CItemAtt newatt(att);
+  newatt.SetRefcount(0);
+  if (pos != m_attlist.end()) {
+    pos->second.DecRefcount();
+    newatt.CreateUUID();
+  }
+  const CUUID newuuid = ShareAtt(newatt);
+  m_attlist[newuuid].IncRefcount();
+  return newuuid;
+}
+
+std::string PWScore::AttDigest(const CItemAtt &att) const
+{
+  HMAC_SHA256 hmac(m_attkey, sizeof(m_attkey));
+  att.HashContent(hmac);
+  unsigned char digest[HMAC_SHA256::HASHLEN];
+  hmac.Final(digest);
+  return std::string(reinterpret_cast<const char *>(digest), sizeof(digest));
+}
+
+pws_os::CUUID PWScore::ShareAtt(const CItemAtt &att)
+{
+  // Returns the uuid of a stored attachment identical to att,
+  // adding att if there's none.
+  const CUUID attuuid = att.GetUUID();
+  if (m_attlist.find(attuuid) != m_attlist.end())
+    return attuuid;
+
+  // Content that couldn't be decompressed can't be compared
+  if (att.IsContentCompressed()) {
+    m_attlist.insert(std::make_pair(attuuid, att));
+    return attuuid;
+  }
+
+  if (!m_bAttDigestsValid) {
+    m_attdigests.clear();
+    PWSrand::GetInstance()->GetRandomData(m_attkey, sizeof(m_attkey));
+    for (auto att_iter = m_attlist.begin(); att_iter != m_attlist.end(); att_iter++)
+      if (!att_iter->second.IsContentCompressed())
+        m_attdigests.insert(std::make_pair(AttDigest(att_iter->second), att_iter->first));
+    m_bAttDigestsValid = true;
+  }
+
+  // Same content, and the same as far as the user can tell
+  const std::string digest = AttDigest(att);
+  auto range = m_attdigests.equal_range(digest);
+  for (auto iter = range.first; iter != range.second;) {
+    auto pos = m_attlist.find(iter->second);
+    if (pos == m_attlist.end()) { // removed since
+      iter = m_attdigests.erase(iter);
+      continue;
+    }
+    const CItemAtt &other = pos->second;
+    if (other.GetContentLength() == att.GetContentLength() &&
+        other.GetTitle() == att.GetTitle() &&
+        other.GetFileName() == att.GetFileName() &&
+        other.GetMediaType() == att.GetMediaType())
+      return pos->first;
+    ++iter;
+  }
+
+  m_attlist.insert(std::make_pair(attuuid, att));
+  m_attdigests.insert(std::make_pair(digest, attuuid));
+  return attuuid;
 }
 
 std::set<StringX> PWScore::GetAllMediaTypes() const
@@ -22,6 +22,8 @@
 #include "CommandInterface.h"
 #include "DBCompareData.h"
 #include "ExpiredList.h"
+#include "GroupTree.h"
+#include "URLIndex.h"
 
 #include "coredefs.h"
 
@@ -56,7 +58,50 @@ struct st_DBProperties {
   StringX db_description;
 };
 
+// Password audit - see PWScore::AuditPasswords()
+struct st_AuditOptions {
+  st_AuditOptions() : bIncludeHistory(false), dMinEntropy(50.0), nThreads(0) {}
+  bool bIncludeHistory; // look for reuse of passwords in history as well
+  double dMinEntropy; // fewer bits (see CPasswordCharPool::EstimateEntropy) is weak
+  unsigned int nThreads; // 0 = one per hardware thread
+};
+
+struct st_AuditPassword {
+  st_AuditPassword() : iHistory(-1), dEntropy(0.0), bWeak(false), bConforms(true) {}
+  pws_os::CUUID uuid;
+  int iHistory; // -1 for the current password, else index in password history
+  // Following only for current passwords:
+  double dEntropy;
+  bool bWeak; // fails CPasswordCharPool::CheckPassword or under dMinEntropy
+  bool bConforms; // to the entry's password policy (named, own or default)
+};
+
+struct st_AuditResults {
+  st_AuditResults() : numEntries(0), numPasswords(0), numWeak(0),
+                      numNonConforming(0), numReused(0) {}
+  size_t numEntries; // audited, i.e., excluding aliases & shortcuts
+  size_t numPasswords; // current and, optionally, history
+  size_t numWeak;
+  size_t numNonConforming;
+  size_t numReused; // current passwords in vReused
+  // Current passwords that are weak or don't conform to their policy
+  std::vector<st_AuditPassword> vFlagged;
+  // Groups of identical passwords, each including at least one current one
+  std::vector<std::vector<st_AuditPassword> > vReused;
+};
+
+// Fuzzy search - see PWScore::FuzzyFind()
+struct st_FuzzyMatch {
+  st_FuzzyMatch() : uuid(pws_os::CUUID::NullUUID()), score(0), ft(CItemData::END) {}
+  pws_os::CUUID uuid;
+  unsigned int score; // see FuzzyMatcher::Score()
+  CItemData::FieldType ft; // best scoring field
+};
+
 struct st_ValidateResults;
+class CFileWatcher;
+struct AsyncSaveState;
+struct PWSChunkLayout;
 
 class PWScore : public CommandInterface
 {
@@ -124,7 +169,7 @@ public:
 
   // Following used to read/write databases and Get/Set file name
   StringX GetCurFile() const {return m_currfile;}
-  void SetCurFile(const StringX &file) {m_currfile = file;}
+  void SetCurFile(const StringX &file); // see StartWatchingCurFile
 
   int ReadCurFile(const StringX &passkey, const bool bValidate = false,
                   const size_t iMAXCHARS = 0, CReport *pRpt = NULL)
@@ -141,6 +186,28 @@ public:
   int WriteCurFile() {return WriteFile(m_currfile, m_ReadFileVersion);}
   int WriteFile(const StringX &filename, PWSfile::VERSION version,
                 bool bUpdateSig = true);
+
+  // V4 only: save as a chunked container (see formatV4chunked.txt), so
+  // that a save copies the chunks whose entries haven't changed instead
+  // of re-encrypting them. Set by ReadFile when the file read is chunked.
+  bool IsChunkedV4() const {return m_bChunkedV4;}
+  void SetChunkedV4(bool bChunked);
+
+  // Asynchronous save of the current database (V3 and later, older
+  // formats are written synchronously):
+  // Takes a snapshot of the database and writes it on a worker thread,
+  // so that commands may be executed meanwhile. If a save is already in
+  // progress, the snapshot is written once it's done. Repeated calls are
+  // coalesced: only the latest waiting snapshot is written.
+  // When the worker's done, UIInterFace::AsyncSaveCompleted is called
+  // (from the worker's thread) - the UI should then call CompleteAsyncSave
+  // from its own thread. WaitForAsyncSave blocks until the worker's done
+  // and then calls CompleteAsyncSave. Both return the status of the
+  // last write.
+  int WriteCurFileAsync();
+  bool IsAsyncSaveInProgress() const;
+  int CompleteAsyncSave();
+  int WaitForAsyncSave();
   int WriteExportFile(const StringX &filename, OrderedItemList *pOIL,
                       PWScore *pINcore, PWSfile::VERSION version,
                       std::vector<StringX> &vEmptyGroups, 
@@ -258,6 +325,16 @@ public:
   // e.g., "A", "A.B", "A.B.C"
   // "All" includes empty groups!
   void GetAllGroups(std::vector<stringT> &vAllGroups) const;
+  // The group hierarchy itself, for UIs to build their trees from
+  const GroupTree &GetGroupTree() const {return m_GroupTree;}
+  // Entries whose URL is on the same site as sxURL, best matches first
+  void FindByURL(const StringX &sxURL, std::vector<URLIndex::Candidate> &vCandidates) const
+  {m_URLIndex.Find(sxURL, vCandidates);}
+  // Up to maxResults entries whose title, user name, URL or group matches
+  // sxText approximately (see FuzzyMatch.h), best first, scored on nThreads
+  // threads (0 = one per hardware thread)
+  void FuzzyFind(const StringX &sxText, size_t maxResults,
+                 std::vector<st_FuzzyMatch> &vMatches, unsigned int nThreads = 0) const;
   // Construct unique title
   StringX GetUniqueTitle(const StringX &group, const StringX &title,
                          const StringX &user, const int IDS_MESSAGE);
@@ -277,6 +354,7 @@ public:
 
   bool GetEntriesUsingNamedPasswordPolicy(const StringX sxPolicyName,
                                           std::vector<st_GroupTitleUser> &ventries);
+  const UUIDSet &GetEntriesUsingNamedPasswordPolicy(const StringX &sxPolicyName) const;
 
   // Populate setGTU & setUUID from m_pwlist. Returns false & empty set if
   // m_pwlist had one or more entries with same GTU/UUID respectively.
@@ -374,6 +452,15 @@ public:
   bool ChangeMode(stringT &locker, int &iErrorCode);
   PWSFileSig& GetCurrentFileSig() {return *m_pFileSig;}
 
+  // Watch the current database and its lock file for changes made by
+  // others. Reported via UIInterFace::DatabaseFileChanged, if supported.
+  // Until stopped, this follows SetCurFile, and restarts whenever the
+  // file's read (ClearData stops the watcher until then).
+  // Returns true if a file's being watched now.
+  bool StartWatchingCurFile();
+  void StopWatchingCurFile();
+  bool IsWatchingCurFile() const;
+
   // Callback to be notified if the database changes
   void NotifyDBModified();
   void SuspendOnDBNotification()
@@ -394,6 +481,11 @@ public:
   const PWSfileHeader &GetHeader() const {return m_hdr;}
 
   void GetDBProperties(st_DBProperties &st_dbp);
+
+  // Look for weak, non-conforming and reused passwords (CoreAudit.cpp)
+  void AuditPasswords(const st_AuditOptions &st_ao, st_AuditResults &st_ar,
+                      CReport *pRpt = NULL) const;
+
   StringX GetHeaderItem(PWSfile::HeaderType ht);
 
   StringX &GetDBPreferences() {return m_hdr.m_prefString;}
@@ -411,15 +503,21 @@ public:
   {m_RUEList = RUElist;}
 
   size_t GetExpirySize() {return m_ExpireCandidates.size();}
-  ExpiredList GetExpired(int idays) {return m_ExpireCandidates.GetExpired(idays);}
+  ExpPWEntryList GetExpired(int idays) {return m_ExpireCandidates.GetExpired(idays);}
+  // Earliest expiry time not before tttFrom, 0 if none - see ExpiredList
+  time_t GetNextExpiry(time_t tttFrom = 0) const
+  {return m_ExpireCandidates.GetNextExpiry(tttFrom);}
 
   // Yubi support:
   const unsigned char *GetYubiSK() const;
   void SetYubiSK(const unsigned char *);
   
   // Password Policies
-  bool IncrementPasswordPolicy(const StringX &sxPolicyName);
-  bool DecrementPasswordPolicy(const StringX &sxPolicyName);
+  // Also maintain the policy name -> entry UUIDs index
+  bool IncrementPasswordPolicy(const StringX &sxPolicyName,
+                               const pws_os::CUUID &uuid);
+  bool DecrementPasswordPolicy(const StringX &sxPolicyName,
+                               const pws_os::CUUID &uuid);
 
   const PSWDPolicyMap &GetPasswordPolicies()
   {return m_MapPSWDPLC;}
@@ -431,6 +529,11 @@ public:
 
   const pws_os::CUUID & GetKBShortcut(const int32 &iKBShortcut);
   const KBShortcutMap &GetAllKBShortcuts() { return m_KBShortcutMap; }
+  // Entries whose shortcut uses exactly wPWSModifiers, or, if bAny,
+  // at least all of the modifier bits in wPWSModifiers
+  size_t GetKBShortcutsUsingModifiers(const WORD wPWSModifiers,
+                                      std::vector<KBShortcutMapPair> &vShortcuts,
+                                      const bool bAny = false) const;
   int32 GetAppHotKey() const {return m_iAppHotKey;}
   void SetAppHotKey(const int32 &iAppHotKey) { m_iAppHotKey = iAppHotKey; }
 
@@ -439,8 +542,10 @@ public:
 
   const CItemAtt &GetAtt(const pws_os::CUUID &attuuid) const {return m_attlist.find(attuuid)->second;}
   CItemAtt &GetAtt(const pws_os::CUUID &attuuid) {return m_attlist[attuuid];}
-  void PutAtt(const CItemAtt &att) {m_attlist[att.GetUUID()] = att;}
-  void RemoveAtt(const pws_os::CUUID &attuuid);
+  // Stores an entry's edited attachment, returning the uuid the entry's to
+  // refer to: a shared attachment's left as is for the other entries
+  pws_os::CUUID PutAtt(const CItemAtt &att);
+  void RemoveAtt(const pws_os::CUUID &attuuid); // drops a reference, removes with the last
   bool HasAtt(const pws_os::CUUID &attuuid) const {return m_attlist.find(attuuid) != m_attlist.end();}
   AttList::size_type GetNumAtts() const {return m_attlist.size();}
   std::set<StringX> GetAllMediaTypes() const;
@@ -582,6 +687,16 @@ private:
 
   // Attachments, if any
   AttList m_attlist;
+
+  // Identical attachments are stored once, shared by the entries that
+  // refer to them. They're found by an HMAC of their content, keyed
+  // with m_attkey so that the digests don't identify known files.
+  // Built the first time an attachment's added (see ShareAtt).
+  std::multimap<std::string, pws_os::CUUID> m_attdigests;
+  unsigned char m_attkey[32];
+  bool m_bAttDigestsValid;
+  std::string AttDigest(const CItemAtt &att) const;
+  pws_os::CUUID ShareAtt(const CItemAtt &att);
   
   // Alias/Shortcut structures
   // Permanent Multimap: since potentially more than one alias/shortcut per base
@@ -602,6 +717,11 @@ private:
   // Following are private in PWScore, public in CommandInterface:
   void AddChangedNodes(StringX path);
 
+  // Group hierarchy of m_pwlist & m_vEmptyGroups, kept in step with both
+  GroupTree m_GroupTree;
+  // Entries' URL fields, by host & site, likewise
+  URLIndex m_URLIndex;
+
   // EmptyGroups
   std::vector<StringX> m_vEmptyGroups;
   std::vector<StringX> m_InitialvEmptyGroups;
@@ -631,6 +751,25 @@ private:
   static Asker *m_pAsker;
   PWSFileSig *m_pFileSig;
 
+  // Called on the watcher's thread, hence the watched file's passed
+  // rather than read from m_currfile
+  void OnCurFileChanged(const stringT &dbfile,
+                        const std::vector<stringT> &vChanged);
+  bool WatchCurFile(); // (re)starts m_pFileWatcher, if m_bWatchCurFile
+  void UnwatchCurFile();
+  CFileWatcher *m_pFileWatcher;
+  bool m_bWatchCurFile;
+  friend class WatchSuspender;
+
+  // See WriteCurFileAsync
+  void AsyncSaveWorker(); // Runs on its own thread!
+  AsyncSaveState *m_pAsyncSave;
+  unsigned int m_changeSeq; // incremented by each Execute/Undo/Redo
+
+  // See SetChunkedV4
+  bool m_bChunkedV4;
+  PWSChunkLayout *m_pChunkLayout; // of the file as last read or saved
+
   // Entries with an expiry date
   ExpiredList m_ExpireCandidates;
   void AddExpiryEntry(const CItemData &ci)
@@ -642,13 +781,25 @@ private:
   void RemoveExpiryEntry(const CItemData &ci)
   {m_ExpireCandidates.Remove(ci);}
 
+  // For commands that change an entry's group in place
+  void UpdateGroupTree(const pws_os::CUUID &uuid, const StringX &sxOldGroup,
+                       const StringX &sxNewGroup)
+  {m_GroupTree.MoveEntry(sxOldGroup, sxNewGroup, uuid);}
+  // ...or its URL
+  void UpdateURLIndex(const pws_os::CUUID &uuid, const StringX &sxOldURL,
+                      const StringX &sxNewURL)
+  {m_URLIndex.UpdateEntry(sxOldURL, sxNewURL, uuid);}
+
   stringT GetXMLPWPolicies(const OrderedItemList *pOIL = NULL);
   PSWDPolicyMap m_MapPSWDPLC;
   PSWDPolicyMap m_InitialMapPSWDPLC;  // Needed for HavePasswordPolicyNamesChanged
+  // Entries counted in each named policy's usecount
+  std::map<StringX, UUIDSet> m_PolicyEntries;
   
   PWSFilters m_MapDBFilters;  // DB filters only
   PWSFilters m_InitialMapDBFilters;
 
+  // Ordered by shortcut, i.e., by modifiers (high word) then key (low byte)
   KBShortcutMap m_KBShortcutMap;
   int32 m_iAppHotKey;
 
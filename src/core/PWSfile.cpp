@@ -11,6 +11,7 @@
 #include "PWSfileV4.h"
 #include "SysInfo.h"
 #include "core.h"
+#include "Util.h"
 #include "os/file.h"
 
 #include "sha1.h" // for simple encrypt/decrypt
@@ -102,7 +103,8 @@ PWSfile::PWSfile(const StringX &filename, RWmode mode, VERSION v)
   : m_filename(filename), m_passkey(_T("")), m_fd(NULL),
   m_curversion(v), m_rw(mode), m_defusername(_T("")),
     m_fish(NULL), m_terminal(NULL), m_status(SUCCESS),
-  m_nRecordsWithUnknownFields(0)
+  m_nRecordsWithUnknownFields(0), m_hashedLength(0), m_hashFrom(0),
+  m_bHashed(false)
 {
 }
 
@@ -137,25 +139,110 @@ void PWSfile::FOpen()
   }
   m_fd = pws_os::FOpen(m_filename.c_str(), m);
   m_fileLength = pws_os::fileLength(m_fd);
+  m_fileHash = SHA256();
+  m_hashedLength = 0;
+  m_bHashed = false;
 }
 
 int PWSfile::Close()
 {
+  int retval = SUCCESS;
   delete m_fish;
   m_fish = NULL;
   if (m_fd != NULL) {
-    fflush(m_fd);
-    fclose(m_fd);
+    // A failure here may be the only sign of a short write (disk full)
+    if (fflush(m_fd) != 0)
+      retval = FAILURE;
+    const ulong64 length = (m_rw == Read) ?
+      m_fileLength : pws_os::fileLength(m_fd);
+    if (retval == SUCCESS && m_hashedLength == length) {
+      m_fileHash.Final(m_hash);
+      m_bHashed = true;
+    }
+    if (fclose(m_fd) != 0)
+      retval = FAILURE;
     m_fd = NULL;
   }
-  return SUCCESS;
+  return retval;
+}
+
+bool PWSfile::GetFileHash(unsigned char hash[SHA256::HASHLEN],
+                          ulong64 &length) const
+{
+  if (!m_bHashed)
+    return false;
+  memcpy(hash, m_hash, SHA256::HASHLEN);
+  length = m_hashedLength;
+  return true;
+}
+
+void PWSfile::HashBytes(long offset, const void *p, size_t len)
+{
+  // Only what follows what's been hashed so far counts, so that going
+  // back to read something again, or peeking ahead, doesn't matter
+  if (offset < 0 || ulong64(offset) > m_hashedLength ||
+      ulong64(offset) + len <= m_hashedLength)
+    return;
+  const size_t skip = size_t(m_hashedLength - ulong64(offset));
+  m_fileHash.Update(static_cast<const unsigned char *>(p) + skip, len - skip);
+  m_hashedLength = ulong64(offset) + len;
+}
+
+size_t PWSfile::ReadBytes(void *p, size_t size, size_t count)
+{
+  const long offset = ftell(m_fd);
+  const size_t nread = fread(p, 1, size * count, m_fd);
+  HashBytes(offset, p, nread);
+  return nread / size;
+}
+
+size_t PWSfile::WriteBytes(const void *p, size_t size, size_t count)
+{
+  const long offset = ftell(m_fd);
+  const size_t nwritten = fwrite(p, 1, size * count, m_fd);
+  HashBytes(offset, p, nwritten);
+  return nwritten / size;
+}
+
+SHA256 *PWSfile::FileHash()
+{
+  m_hashFrom = ftell(m_fd);
+  return (m_hashFrom >= 0 && ulong64(m_hashFrom) == m_hashedLength) ?
+    &m_fileHash : NULL;
+}
+
+void PWSfile::FileHashed(const SHA256 *fileHash)
+{
+  const long offset = ftell(m_fd);
+  if (fileHash != NULL) {
+    if (offset >= 0)
+      m_hashedLength = ulong64(offset);
+  } else if (m_hashFrom >= 0 && ulong64(m_hashFrom) < m_hashedLength) {
+    // Read something again (see PWSfileV4::RestoreState), and maybe more
+    HashSoFar();
+  }
+}
+
+void PWSfile::HashSoFar()
+{
+  const long offset = ftell(m_fd);
+  if (offset < 0 || ulong64(offset) <= m_hashedLength)
+    return;
+  std::vector<unsigned char> buf(size_t(ulong64(offset) - m_hashedLength));
+  if (fseek(m_fd, long(m_hashedLength), SEEK_SET) == 0)
+    ReadBytes(&buf[0], buf.size(), 1);
+  fseek(m_fd, offset, SEEK_SET);
 }
 
 size_t PWSfile::WriteCBC(unsigned char type, const unsigned char *data,
                          size_t length)
 {
   ASSERT(m_fish != NULL && m_IV != NULL);
-  return _writecbc(m_fd, data, length, type, m_fish, m_IV);
+  SHA256 *fileHash = FileHash();
+  const size_t retval = _writecbc(m_fd, data, length, type, m_fish, m_IV,
+                                  fileHash);
+  FileHashed(fileHash);
+  return retval;
 }
 
 size_t PWSfile::ReadCBC(unsigned char &type, unsigned char* &data,
@@ -166,8 +253,10 @@ size_t PWSfile::ReadCBC(unsigned char &type, unsigned char* &data,
   size_t retval;
 
   ASSERT(m_fish != NULL && m_IV != NULL);
+  SHA256 *fileHash = FileHash();
   retval = _readcbc(m_fd, buffer, buffer_len, type,
-    m_fish, m_IV, m_terminal, m_fileLength);
+    m_fish, m_IV, m_terminal, m_fileLength, fileHash);
+  FileHashed(fileHash);
 
   if (buffer_len > 0) {
     if (buffer_len < length || data == NULL)
@@ -188,6 +277,156 @@ size_t PWSfile::ReadCBC(unsigned char &type, unsigned char* &data,
   return retval;
 }
 
+namespace {
+  // CBC decrypts len bytes (a multiple of the block size) in place
+  void DecryptCBC(Fish *fish, unsigned char *cbcbuffer,
+                  unsigned char *p, size_t len)
+  {
+    const unsigned int BS = fish->GetBlockSize();
+    unsigned char tmpcbc[16];
+    ASSERT(BS <= sizeof(tmpcbc));
+    for (size_t x = 0; x < len; x += BS) {
+      memcpy(tmpcbc, p + x, BS);
+      fish->Decrypt(p + x, p + x);
+      for (unsigned int i = 0; i < BS; i++)
+        p[x + i] ^= cbcbuffer[i];
+      memcpy(cbcbuffer, tmpcbc, BS);
+    }
+  }
+}
+
+PWSfile::RecordPos PWSfile::GetRecordPos() const
+{
+  ASSERT(m_fd != NULL && m_fish != NULL && m_IV != NULL);
+  RecordPos pos;
+  pos.offset = ftell(m_fd);
+  memcpy(pos.iv, m_IV, m_fish->GetBlockSize());
+  return pos;
+}
+
+void PWSfile::SetRecordPos(const RecordPos &pos)
+{
+  ASSERT(m_fd != NULL && m_fish != NULL && m_IV != NULL);
+  if (fseek(m_fd, pos.offset, SEEK_SET) != 0)
+    ASSERT(0);
+  memcpy(m_IV, pos.iv, m_fish->GetBlockSize());
+}
+
+int PWSfile::SkimRecord(const CItemData::FieldBits &bsFields,
+                        const FieldCallback &cb)
+{
+  ASSERT(m_fd != NULL && m_fish != NULL && m_IV != NULL);
+  const unsigned int BS = m_fish->GetBlockSize();
+  // Same layout as _readcbc: the first block has the field's length, type
+  // and up to BS - 5 bytes of data, the rest follow in whole blocks
+  ASSERT(BS == 16);
+  if (BS != 16)
+    return UNSUPPORTED_VERSION;
+
+  const RecordPos start = GetRecordPos();
+  if (ulong64(start.offset) >= GetEffectiveFileLength())
+    return END_OF_FILE;
+
+  unsigned char block[16], cipher[16];
+  int emergencyExit = 255; // to avoid endless loop.
+  bool bFirst = true;
+  for (;;) {
+    if (ReadBytes(block, 1, BS) != BS)
+      return READ_FAIL;
+    if (m_terminal != NULL && memcmp(block, m_terminal, BS) == 0)
+      return bFirst ? END_OF_FILE : READ_FAIL;
+    memcpy(cipher, block, BS);
+    DecryptCBC(m_fish, m_IV, block, BS);
+
+    const size_t length = getInt32(block);
+    const unsigned char type = block[sizeof(int32)];
+    if (length >= m_fileLength) {
+      trashMemory(block, BS);
+      return READ_FAIL;
+    }
+    if (bFirst && type >= CItem::START_ATT && type < CItem::LAST_ATT) {
+      trashMemory(block, BS);
+      SetRecordPos(start);
+      return WRONG_RECORD;
+    }
+    bFirst = false;
+
+    const size_t len1 = (length > BS - 5) ? BS - 5 : length;
+    const size_t BlockLength = ((length - len1 + BS - 1) / BS) * BS;
+    if (type < bsFields.size() && bsFields.test(type)) {
+      unsigned char *data = new unsigned char[len1 + BlockLength];
+      memcpy(data, block + 5, len1);
+      bool bOK = true;
+      if (BlockLength > 0) {
+        bOK = ReadBytes(data + len1, 1, BlockLength) == BlockLength;
+        if (bOK)
+          DecryptCBC(m_fish, m_IV, data + len1, BlockLength);
+      }
+      if (bOK)
+        cb(type, data, length);
+      trashMemory(data, len1 + BlockLength);
+      delete[] data;
+      if (!bOK) {
+        trashMemory(block, BS);
+        return READ_FAIL;
+      }
+    } else if (BlockLength > 0) {
+      // CBC only needs the field's last ciphertext block to carry on
+      if ((BlockLength > BS &&
+           fseek(m_fd, long(BlockLength - BS), SEEK_CUR) != 0) ||
+          ReadBytes(m_IV, 1, BS) != BS) {
+        trashMemory(block, BS);
+        return READ_FAIL;
+      }
+    }
+    trashMemory(block, BS);
+
+    if (type == CItemData::END)
+      return SUCCESS;
+    if (--emergencyExit == 0)
+      return READ_FAIL;
+  }
+}
+
+int PWSfile::SkipRecord()
+{
+  ASSERT(m_fd != NULL && m_fish != NULL);
+  if (ulong64(ftell(m_fd)) >= GetEffectiveFileLength())
+    return END_OF_FILE;
+
+  const unsigned int BS = m_fish->GetBlockSize();
+  int emergencyExit = 255; // to avoid endless loop.
+  bool bFirst = true, bAtt = false;
+  unsigned char type = CItemData::END;
+  do {
+    unsigned char *data = NULL;
+    size_t length = 0;
+    const size_t numRead = ReadField(type, data, length);
+    if (numRead == static_cast<size_t>(-1)) // terminal block
+      return bFirst ? END_OF_FILE : READ_FAIL;
+    if (numRead == 0)
+      return READ_FAIL;
+
+    if (bFirst)
+      bAtt = type >= CItem::START_ATT && type < CItem::LAST_ATT;
+    bFirst = false;
+
+    // A V4 attachment's content follows its CONTENT field, encrypted with
+    // the attachment's own key, and isn't part of the file's digest
+    long skip = 0;
+    if (bAtt && type == CItem::CONTENT && length == sizeof(uint32))
+      skip = long(((getInt32(data) + BS - 1) / BS) * BS);
+    if (data != NULL) {
+      trashMemory(data, length);
+      delete[] data;
+    }
+    if (skip != 0 && fseek(m_fd, skip, SEEK_CUR) != 0)
+      return READ_FAIL;
+  } while (type != CItemData::END && --emergencyExit > 0);
+
+  return (type == CItemData::END) ? SUCCESS : READ_FAIL;
+}
+
 int PWSfile::CheckPasskey(const StringX &filename,
                           const StringX &passkey, VERSION &version)
 {
@@ -459,66 +698,121 @@ bool PWSfile::Decrypt(const stringT &fn, const StringX &passwd, stringT &errmess
 // A quick way to determine if two files are equal, or if a given
 // file has been modified.
 
-// For large files (>2K), we only hash the head & tail of the file.
-// This is due to a performance trade-off.
-
-// For unencrypted file, only checking the head & tail of large files may
-// cause changes made to the middle of the file to be missed.
-// However, since we write encrypted in CBC mode, this means that if the file
-// was modified at offset X, then everything from X to the end of the file will
-// be modified and the digests would be different.
+// Since we write encrypted in CBC mode, if the file was modified at
+// offset X, then everything from X to the end of the file will be
+// modified, and with it the trailer (the HMAC in V3 and later).
 
 PWSFileSig::PWSFileSig(const stringT &fname)
+  : m_fname(fname), m_length(0), m_bHasStamp(false), m_bHasDigest(false),
+    m_iErrorCode(PWSfile::SUCCESS)
+{
+  Init();
+}
+
+PWSFileSig::PWSFileSig(const stringT &fname, const unsigned char *fileHash,
+                       ulong64 hashLength)
+  : m_fname(fname), m_length(0), m_bHasStamp(false), m_bHasDigest(false),
+    m_iErrorCode(PWSfile::SUCCESS)
 {
-  const long THRESHOLD = 2048; // if file's longer than this, hash only head & tail
+  Init();
+  if (m_iErrorCode != PWSfile::SUCCESS)
+    return;
+  if (fileHash != NULL && hashLength == m_length) {
+    memcpy(m_digest, fileHash, sizeof(m_digest));
+    m_bHasDigest = true;
+  } else
+    ComputeDigest();
+}
 
-  m_length = 0;
-  m_iErrorCode = PWSfile::SUCCESS;
+void PWSFileSig::Init()
+{
+  memset(&m_stamp, 0, sizeof(m_stamp));
+  memset(m_trailer, 0, sizeof(m_trailer));
   memset(m_digest, 0, sizeof(m_digest));
-  FILE *fp = pws_os::FOpen(fname, _T("rb"));
-  if (fp != NULL) {
-    SHA256 hash;
-    m_length = pws_os::fileLength(fp);
-    // Not the right place to be worried about min size, as this is format
-    // version specific (and we're in PWSFile).
-    // An empty file, though, should be failed.
-    if (m_length > 0) {
-      unsigned char buf[THRESHOLD];
-      if (m_length <= THRESHOLD) {
-        if (fread(buf, size_t(m_length), 1, fp) == 1) {
-          hash.Update(buf, size_t(m_length));
-          hash.Final(m_digest);
-        }
-      } else { // m_length > THRESHOLD
-        if (fread(buf, THRESHOLD / 2, 1, fp) == 1 &&
-            fseek(fp, -THRESHOLD / 2, SEEK_END) == 0 &&
-            fread(buf + THRESHOLD / 2, THRESHOLD / 2, 1, fp) == 1) {
-          hash.Update(buf, THRESHOLD);
-          hash.Final(m_digest);
-        }
-      }
-    } else { // Empty file
-      m_iErrorCode = PWSfile::TRUNCATED_FILE;
-    }
 
-    fclose(fp);
-  } else {
+  FILE *fp = pws_os::FOpen(m_fname, _T("rb"));
+  if (fp == NULL) {
     m_iErrorCode = PWSfile::CANT_OPEN_FILE;
+    return;
   }
+
+  m_length = pws_os::fileLength(fp);
+  // Not the right place to be worried about min size, as this is format
+  // version specific (and we're in PWSFile).
+  // An empty file, though, should be failed.
+  if (m_length == 0) {
+    m_iErrorCode = PWSfile::TRUNCATED_FILE;
+    fclose(fp);
+    return;
+  }
+
+  // For V3 and later this is the HMAC over the file's content, which
+  // changes with every save (a new HMAC key is generated each time).
+  const size_t trailer_len = (m_length < TRAILERLEN) ?
+    size_t(m_length) : static_cast<size_t>(TRAILERLEN);
+  if (fseek(fp, -long(trailer_len), SEEK_END) != 0 ||
+      fread(m_trailer, trailer_len, 1, fp) != 1)
+    m_iErrorCode = PWSfile::READ_FAIL;
+  fclose(fp);
+
+  m_bHasStamp = pws_os::GetFileStamp(m_fname, m_stamp);
+}
+
+bool PWSFileSig::ComputeDigest() const
+{
+  if (m_bHasDigest)
+    return true;
+
+  // Hashing a file that's been changed since we looked at it
+  // would give us the digest of the wrong content
+  pws_os::FileStamp now;
+  if (m_bHasStamp &&
+      (!pws_os::GetFileStamp(m_fname, now) || now != m_stamp))
+    return false;
+
+  FILE *fp = pws_os::FOpen(m_fname, _T("rb"));
+  if (fp == NULL)
+    return false;
+
+  const size_t BUFSIZE = 64 * 1024;
+  unsigned char *buf = new unsigned char[BUFSIZE];
+  SHA256 hash;
+  ulong64 total = 0;
+  size_t nread;
+  while ((nread = fread(buf, 1, BUFSIZE, fp)) > 0) {
+    hash.Update(buf, nread);
+    total += nread;
+  }
+  const bool bOK = (ferror(fp) == 0 && total == m_length);
+  fclose(fp);
+  delete[] buf;
+
+  if (bOK) {
+    hash.Final(m_digest);
+    m_bHasDigest = true;
+  }
+  return bOK;
 }
 
 PWSFileSig::PWSFileSig(const PWSFileSig &pfs)
+  : m_fname(pfs.m_fname), m_length(pfs.m_length), m_stamp(pfs.m_stamp),
+    m_bHasStamp(pfs.m_bHasStamp), m_bHasDigest(pfs.m_bHasDigest),
+    m_iErrorCode(pfs.m_iErrorCode)
 {
-  m_length = pfs.m_length;
-  m_iErrorCode = pfs.m_iErrorCode;
+  memcpy(m_trailer, pfs.m_trailer, sizeof(m_trailer));
   memcpy(m_digest, pfs.m_digest, sizeof(m_digest));
 }
 
 PWSFileSig &PWSFileSig::operator=(const PWSFileSig &that)
 {
   if (this != &that) {
+    m_fname = that.m_fname;
     m_length = that.m_length;
+    m_stamp = that.m_stamp;
+    m_bHasStamp = that.m_bHasStamp;
+    m_bHasDigest = that.m_bHasDigest;
     m_iErrorCode = that.m_iErrorCode;
+    memcpy(m_trailer, that.m_trailer, sizeof(m_trailer));
     memcpy(m_digest, that.m_digest, sizeof(m_digest));
   }
   return *this;
@@ -530,6 +824,20 @@ bool PWSFileSig::operator==(const PWSFileSig &that)
   if (m_iErrorCode != 0 || that.m_iErrorCode != 0)
     return false;
 
-  return (m_length == that.m_length &&
-          memcmp(m_digest, that.m_digest, sizeof(m_digest)) == 0);
+  if (m_length != that.m_length ||
+      memcmp(m_trailer, that.m_trailer, sizeof(m_trailer)) != 0)
+    return false;
+
+  // Same file, untouched since the first signature was taken?
+  if (m_bHasStamp && that.m_bHasStamp && m_stamp == that.m_stamp)
+    return true;
+
+  // Metadata changed but length & trailer are the same, e.g., file
+  // copied back or modified in place. Only a full hash can tell.
+  // A signature can only be hashed while its file is unchanged, hence
+  // the reference signature needs to have its digest from the start.
+  if (!ComputeDigest() || !that.ComputeDigest())
+    return false;
+
+  return memcmp(m_digest, that.m_digest, sizeof(m_digest)) == 0;
 }
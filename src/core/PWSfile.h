@@ -15,9 +15,11 @@
 
 #include <stdio.h> // for FILE *
 #include <vector>
+#include <functional>
 
 #include "ItemData.h"
 #include "os/UUID.h"
+#include "os/file.h"
 #include "UnknownField.h"
 #include "PWSFilters.h"
 #include "StringX.h"
@@ -150,7 +152,44 @@ public:
   size_t ReadField(unsigned char &type,
                    unsigned char* &data,
                    size_t &length) {return ReadCBC(type, data, length);}
-  
+
+  // Random access to the records of a V3 or later database open for
+  // read (see PWSRecordIndex). As records are CBC encrypted one after the
+  // other, a record's position is its file offset and the CBC state
+  // there, that is, the ciphertext block just before it.
+  struct RecordPos {
+    RecordPos() : offset(0) {memset(iv, 0, sizeof(iv));}
+    long offset;
+    unsigned char iv[16]; // TwoFish::BLOCKSIZE
+  };
+  typedef std::function<void(unsigned char type,
+                             const unsigned char *data,
+                             size_t length)> FieldCallback;
+
+  RecordPos GetRecordPos() const;
+  void SetRecordPos(const RecordPos &pos);
+  // Reads the next record, decrypting only the fields in bsFields, which
+  // are passed to cb. Other fields are skipped without being decrypted, so
+  // this doesn't update the file's digest. Returns SUCCESS, END_OF_FILE
+  // after the last record, or WRONG_RECORD (position unchanged) at a V4
+  // attachment.
+  int SkimRecord(const CItemData::FieldBits &bsFields, const FieldCallback &cb);
+  // Reads the next record or V4 attachment, updating the file's digest
+  // but otherwise discarding it. Returns SUCCESS, or END_OF_FILE after
+  // the last one, at which point Close() verifies the digest.
+  int SkipRecord();
+  // Another reader of this file (open for read), at the same position
+  // and with the same keys and digest state, as Open()ing it again would
+  // stretch the passkey again. NULL if unsupported (before V3, or chunked
+  // V4) or the file can't be opened. Caller deletes.
+  virtual PWSfile *Duplicate() const {return NULL;}
+
+  // SHA-256 of the whole file as read or written, so that PWSFileSig
+  // needn't read it again. Available after Close(), if every byte of the
+  // file went through this object in order, as when a database is read
+  // (unless V4 chunked) or written in full.
+  bool GetFileHash(unsigned char hash[SHA256::HASHLEN], ulong64 &length) const;
+
 protected:
   PWSfile(const StringX &filename, RWmode mode, VERSION v = UNKNOWN_VERSION);
   void FOpen(); // calls right variant of m_fd = fopen(m_filename);
@@ -161,6 +200,18 @@ protected:
                          size_t &length);
   
   static void HashRandom256(unsigned char *p256); // when we don't want to expose our RNG
+  // Where the records (and V4 attachments) end, for read
+  virtual ulong64 GetEffectiveFileLength() const {return m_fileLength;}
+
+  // Reads and writes of m_fd go through these (same as fread & fwrite),
+  // or pass FileHash() to _readcbc or _writecbc and FileHashed() the
+  // result, so that the file's hashed on the way (see GetFileHash)
+  size_t ReadBytes(void *p, size_t size, size_t count);
+  size_t WriteBytes(const void *p, size_t size, size_t count);
+  SHA256 *FileHash();
+  void FileHashed(const SHA256 *fileHash);
+  // For what static helpers such as CheckPasskey read of m_fd
+  void HashSoFar();
 
   const StringX m_filename;
   StringX m_passkey;
@@ -187,16 +238,35 @@ protected:
 
 private:
   PWSfile& operator=(const PWSfile&); // Do not implement
+  void HashBytes(long offset, const void *p, size_t len);
+
+  SHA256 m_fileHash;
+  ulong64 m_hashedLength; // of the file, from its start
+  long m_hashFrom; // where FileHash() was last called
+  unsigned char m_hash[SHA256::HASHLEN]; // m_fileHash once it's final
+  bool m_bHashed;
 };
 
-// A quick way to determine if two files are equal,
-// or if a given file has been modified. For large files,
-// this may miss changes made to the middle. This is due
-// to a performance trade-off.
+// A way to determine if two files are equal, or if a given file has
+// been modified since we last read or wrote it.
+// The check is done in order of increasing cost:
+// 1. If the length or trailing block (the HMAC in V3 and later) differ,
+//    the file has changed - only the trailer is read.
+// 2. If the filesystem stamp (id, length, mtime) is unchanged, the file
+//    is considered unchanged.
+// 3. Otherwise, a SHA-256 over the entire file is compared.
+// The signature we keep as a reference (taken right after reading or
+// writing the database) needs its digest up front, as the file may no
+// longer be available for hashing when we need to compare. Pass the one
+// PWSfile::GetFileHash computed on the way, if any, so as not to read
+// the file again. Signatures taken for checking are cheap, as they're
+// only hashed if step 3 is reached.
 class PWSFileSig
 {
 public:
-  PWSFileSig(const stringT &fname);
+  PWSFileSig(const stringT &fname); // for checking
+  PWSFileSig(const stringT &fname, const unsigned char *fileHash,
+             ulong64 hashLength); // reference, fileHash may be NULL
   PWSFileSig(const PWSFileSig &pfs);
   PWSFileSig &operator=(const PWSFileSig &that);
 
@@ -207,8 +277,17 @@ public:
   bool operator!=(const PWSFileSig &that) {return !(*this == that);}
 
 private:
+  enum {TRAILERLEN = SHA256::HASHLEN};
+  void Init();
+  bool ComputeDigest() const;
+
+  stringT m_fname;
   ulong64 m_length; // -1 if file doesn't exist or zero length
-  unsigned char m_digest[SHA256::HASHLEN];
+  pws_os::FileStamp m_stamp;
+  bool m_bHasStamp;
+  unsigned char m_trailer[TRAILERLEN];
+  mutable unsigned char m_digest[SHA256::HASHLEN]; // computed on demand
+  mutable bool m_bHasDigest;
   int m_iErrorCode;
 };
 #endif /* __PWSFILE_H */
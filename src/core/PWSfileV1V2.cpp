@@ -104,9 +104,9 @@ int PWSfileV1V2::ReadV2Header()
 }
 
 // Following specific for PWSfileV1V2::Open
-#define SAFE_FWRITE(p, sz, cnt, stream) \
+#define SAFE_FWRITE(p, sz, cnt) \
   { \
-    size_t _ret = fwrite(p, sz, cnt, stream); \
+    size_t _ret = WriteBytes(p, sz, cnt); \
     if (_ret != cnt) { status = FAILURE; goto exit;} \
   }
 
@@ -142,15 +142,15 @@ int PWSfileV1V2::Open(const StringX &passkey)
     randstuff[8] = randstuff[9] = TCHAR('\0');
     GenRandhash(m_passkey, randstuff, randhash);
 
-    SAFE_FWRITE(randstuff, 1, 8, m_fd);
-    SAFE_FWRITE(randhash, 1, 20, m_fd);
+    SAFE_FWRITE(randstuff, 1, 8);
+    SAFE_FWRITE(randhash, 1, 20);
 
     PWSrand::GetInstance()->GetRandomData(m_salt, SaltLength);
 
-    SAFE_FWRITE(m_salt, 1, SaltLength, m_fd);
+    SAFE_FWRITE(m_salt, 1, SaltLength);
 
     PWSrand::GetInstance()->GetRandomData( m_ipthing, 8);
-    SAFE_FWRITE(m_ipthing, 1, 8, m_fd);
+    SAFE_FWRITE(m_ipthing, 1, 8);
 
     m_fish = BlowFish::MakeBlowFish(pstr, reinterpret_cast<unsigned int &>(passLen),
                                     m_salt, SaltLength);
@@ -165,8 +165,9 @@ int PWSfileV1V2::Open(const StringX &passkey)
       Close();
       return status;
     }
-    fread(m_salt, 1, SaltLength, m_fd);
-    fread(m_ipthing, 1, 8, m_fd);
+    HashSoFar();
+    ReadBytes(m_salt, 1, SaltLength);
+    ReadBytes(m_ipthing, 1, 8);
 
     m_fish = BlowFish::MakeBlowFish(pstr, reinterpret_cast<unsigned int &>(passLen),
                                     m_salt, SaltLength);
@@ -373,8 +374,10 @@ size_t PWSfileV1V2::ReadCBC(unsigned char &type, StringX &data)
   size_t retval;
 
   ASSERT(m_fish != NULL && m_IV != NULL);
+  SHA256 *fileHash = FileHash();
   retval = _readcbc(m_fd, buffer, buffer_len, type,
-                    m_fish, m_IV, m_terminal);
+                    m_fish, m_IV, m_terminal, 0, fileHash);
+  FileHashed(fileHash);
 
   if (buffer_len > 0) {
     wchar_t *wc = new wchar_t[buffer_len+1];
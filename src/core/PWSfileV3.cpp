@@ -13,6 +13,7 @@
 #include "PWSFilters.h"
 #include "PWSdirs.h"
 #include "PWSprefs.h"
+#include "PWSTrace.h"
 #include "core.h"
 
 #include "os/debug.h"
@@ -121,12 +122,12 @@ int PWSfileV3::Close()
   // Write or verify HMAC, depending on RWmode.
   if (m_rw == Write) {
     size_t fret;
-    fret = fwrite(TERMINAL_BLOCK, sizeof(TERMINAL_BLOCK), 1, m_fd);
+    fret = WriteBytes(TERMINAL_BLOCK, sizeof(TERMINAL_BLOCK), 1);
     if (fret != 1) {
       PWSfile::Close();
       return FAILURE;
     }
-    fret = fwrite(digest, sizeof(digest), 1, m_fd);
+    fret = WriteBytes(digest, sizeof(digest), 1);
     if (fret != 1) {
       PWSfile::Close();
       return FAILURE;
@@ -136,7 +137,7 @@ int PWSfileV3::Close()
     // We're here *after* TERMINAL_BLOCK has been read
     // and detected (by _readcbc) - just read hmac & verify
     unsigned char d[SHA256::HASHLEN];
-    fread(d, sizeof(d), 1, m_fd);
+    ReadBytes(d, sizeof(d), 1);
     if (memcmp(d, digest, SHA256::HASHLEN) == 0)
       return PWSfile::Close();
     else {
@@ -148,6 +149,24 @@ int PWSfileV3::Close()
 
 const char V3TAG[4] = {'P','W','S','3'}; // ASCII chars, not wchar
 
+PWSfile *PWSfileV3::Duplicate() const
+{
+  ASSERT(m_rw == Read && m_fd != NULL && m_fish != NULL);
+  PWSfileV3 *pf = new PWSfileV3(m_filename, Read, m_curversion);
+  pf->FOpen();
+  if (pf->m_fd == NULL || fseek(pf->m_fd, ftell(m_fd), SEEK_SET) != 0) {
+    delete pf;
+    return NULL;
+  }
+  memcpy(pf->m_key, m_key, sizeof(m_key));
+  memcpy(pf->m_ipthing, m_ipthing, sizeof(m_ipthing));
+  pf->m_hmac = m_hmac;
+  pf->m_fish = new TwoFish(m_key, sizeof(m_key));
+  pf->m_hdr = m_hdr;
+  pf->m_nHashIters = m_nHashIters;
+  return pf;
+}
+
 int PWSfileV3::SanityCheck(FILE *stream)
 {
   int retval = SUCCESS;
@@ -303,6 +322,9 @@ void PWSfileV3::StretchKey(const unsigned char *salt, unsigned long saltLen,
                            const StringX &passkey,
                            unsigned int N, unsigned char *Ptag)
 {
+  PWS_TRACE_SPAN(span, "StretchKey", "iterations", NULL);
+  span.SetArg(0, N);
+
   /*
   * P' is the "stretched key" of the user's passphrase and the SALT, as defined
   * by the hash-function-based key stretching algorithm in
@@ -335,15 +357,16 @@ void PWSfileV3::StretchKey(const unsigned char *salt, unsigned long saltLen,
 }
 
 // Following specific for PWSfileV3::WriteHeader
-#define SAFE_FWRITE(p, sz, cnt, stream) \
+#define SAFE_FWRITE(p, sz, cnt) \
   { \
-    size_t _ret = fwrite(p, sz, cnt, stream); \
+    size_t _ret = WriteBytes(p, sz, cnt); \
     if (_ret != cnt) { m_status = FAILURE; goto end;} \
   }
 
 int PWSfileV3::WriteHeader()
 {
   PWS_LOGIT;
+  PWS_TRACE_SPAN(span, "WriteHeader", NULL, NULL);
 
   // Following code is divided into {} blocks to
   // prevent "uninitialized" compile errors, as we use
@@ -360,17 +383,17 @@ int PWSfileV3::WriteHeader()
   else
     NumHashIters = m_nHashIters;
 
-  SAFE_FWRITE(V3TAG, 1, sizeof(V3TAG), m_fd);
+  SAFE_FWRITE(V3TAG, 1, sizeof(V3TAG));
 
   static_assert(int(PWSaltLength) == int(SHA256::HASHLEN),
                 "can't call HashRandom256");
 
   HashRandom256(salt);
-  SAFE_FWRITE(salt, 1, sizeof(salt), m_fd);
+  SAFE_FWRITE(salt, 1, sizeof(salt));
 
   unsigned char Nb[sizeof(NumHashIters)];
   putInt32(Nb, NumHashIters);
-  SAFE_FWRITE(Nb, 1, sizeof(Nb), m_fd);
+  SAFE_FWRITE(Nb, 1, sizeof(Nb));
 
   unsigned char Ptag[SHA256::HASHLEN];
 
@@ -381,7 +404,7 @@ int PWSfileV3::WriteHeader()
     SHA256 H;
     H.Update(Ptag, sizeof(Ptag));
     H.Final(HPtag);
-    SAFE_FWRITE(HPtag, 1, sizeof(HPtag), m_fd);
+    SAFE_FWRITE(HPtag, 1, sizeof(HPtag));
   }
   {
     PWSrand::GetInstance()->GetRandomData(m_key, sizeof(m_key));
@@ -391,13 +414,13 @@ int PWSfileV3::WriteHeader()
     TwoFish TF(Ptag, sizeof(Ptag));
     TF.Encrypt(m_key, B1B2);
     TF.Encrypt(m_key + 16, B1B2 + 16);
-    SAFE_FWRITE(B1B2, 1, sizeof(B1B2), m_fd);
+    SAFE_FWRITE(B1B2, 1, sizeof(B1B2));
     PWSrand::GetInstance()->GetRandomData(L, sizeof(L));
     unsigned char B3B4[sizeof(L)];
     ASSERT(sizeof(B3B4) == 32); // Generalize later
     TF.Encrypt(L, B3B4);
     TF.Encrypt(L + 16, B3B4 + 16);
-    SAFE_FWRITE(B3B4, 1, sizeof(B3B4), m_fd);
+    SAFE_FWRITE(B3B4, 1, sizeof(B3B4));
     m_hmac.Init(L, sizeof(L));
   }
   {
@@ -409,7 +432,7 @@ int PWSfileV3::WriteHeader()
                   "m_ipthing can't be more that 32 bytes to use HashRandom256");
     memcpy(m_ipthing, ip_rand, sizeof(m_ipthing));
   }
-  SAFE_FWRITE(m_ipthing, 1, sizeof(m_ipthing), m_fd);
+  SAFE_FWRITE(m_ipthing, 1, sizeof(m_ipthing));
 
   m_fish = new TwoFish(m_key, sizeof(m_key));
 
@@ -584,6 +607,7 @@ int PWSfileV3::WriteHeader()
 int PWSfileV3::ReadHeader()
 {
   PWS_LOGIT;
+  PWS_TRACE_SPAN(span, "ReadHeader", NULL, NULL);
 
   unsigned char Ptag[SHA256::HASHLEN];
   m_status = CheckPasskey(m_filename, m_passkey, m_fd,
@@ -593,10 +617,11 @@ int PWSfileV3::ReadHeader()
     Close();
     return m_status;
   }
+  HashSoFar();
 
   unsigned char B1B2[sizeof(m_key)];
   ASSERT(sizeof(B1B2) == 32); // Generalize later
-  fread(B1B2, 1, sizeof(B1B2), m_fd);
+  ReadBytes(B1B2, 1, sizeof(B1B2));
   TwoFish TF(Ptag, sizeof(Ptag));
   TF.Decrypt(B1B2, m_key);
   TF.Decrypt(B1B2 + 16, m_key + 16);
@@ -604,13 +629,13 @@ int PWSfileV3::ReadHeader()
   unsigned char L[32]; // for HMAC
   unsigned char B3B4[sizeof(L)];
   ASSERT(sizeof(B3B4) == 32); // Generalize later
-  fread(B3B4, 1, sizeof(B3B4), m_fd);
+  ReadBytes(B3B4, 1, sizeof(B3B4));
   TF.Decrypt(B3B4, L);
   TF.Decrypt(B3B4 + 16, L + 16);
 
   m_hmac.Init(L, sizeof(L));
 
-  fread(m_ipthing, 1, sizeof(m_ipthing), m_fd);
+  ReadBytes(m_ipthing, 1, sizeof(m_ipthing));
 
   m_fish = new TwoFish(m_key, sizeof(m_key));
 
@@ -33,6 +33,7 @@ public:
 
   virtual int Open(const StringX &passkey);
   virtual int Close();
+  virtual PWSfile *Duplicate() const;
 
   virtual int WriteRecord(const CItemData &item);
   virtual int ReadRecord(CItemData &item);
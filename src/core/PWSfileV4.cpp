@@ -15,9 +15,9 @@
 #include "PWSdirs.h"
 #include "PWSprefs.h"
 #include "core.h"
-#include "pbkdf2.h"
 #include "KeyWrap.h"
 #include "PWStime.h"
+#include "PWSTrace.h"
 #include "TwoFish.h"
 
 #include "ItemAtt.h" // for WriteContentFields()
@@ -39,10 +39,24 @@
 #include <iomanip>
 #include <algorithm>
 #include <type_traits> // for static_assert
+#include <thread>
+#include <atomic>
 
 using namespace std;
 using pws_os::CUUID;
 
+namespace {
+  // A chunked file has this where a plain V4 file has its (random) IV,
+  // see formatV4chunked.txt
+  const unsigned char ChunkedTag[TwoFish::BLOCKSIZE] = {
+    'P', 'W', 'S', '4', '-', 'C', 'H', 'U', 'N', 'K', 'E', 'D', '-', '0', '0', '1'
+  };
+  // Directory entry: offset, length, kind, number of records, MAC
+  const size_t DIRENTRYLEN = 8 + 4 + 1 + 4 + SHA256::HASHLEN;
+  // Trailer: directory's offset, root MAC
+  const size_t TRAILERLEN = 8 + SHA256::HASHLEN;
+}
+
 PWSfileV4::CKeyBlocks::KeyBlock::KeyBlock(const KeyBlock &kb)
 {
   memcpy(m_salt, kb.m_salt, PWSaltLength);
@@ -87,7 +101,10 @@ PWSfileV4::CKeyBlocks PWSfileV4::CKeyBlocks::operator=(const PWSfileV4::CKeyBloc
 
 PWSfileV4::PWSfileV4(const StringX &filename, RWmode mode, VERSION version)
   : PWSfile(filename, mode, version),
-    m_effectiveFileLength(0), m_nHashIters(MIN_HASH_ITERATIONS)
+    m_effectiveFileLength(0), m_nHashIters(MIN_HASH_ITERATIONS),
+    m_bChunked(false), m_pPrevLayout(NULL), m_pLayout(new PWSChunkLayout),
+    m_chunkStart(-1), m_bChunksRead(false), m_iChunk(0), m_iRecord(0),
+    m_chunkStatus(SUCCESS)
 {
   m_IV = m_ipthing;
   m_terminal = NULL;
@@ -100,6 +117,7 @@ PWSfileV4::~PWSfileV4()
 {
   trashMemory(m_key, sizeof(m_key));
   trashMemory(m_ell, sizeof(m_ell));
+  delete m_pLayout;
 }
 
 int PWSfileV4::Open(const StringX &passkey)
@@ -123,19 +141,62 @@ int PWSfileV4::Open(const StringX &passkey)
     // Nonce is used to detect end of keyblocks
     static_assert(int(NONCELEN) == int(SHA256::HASHLEN), "can't call HashRandom256");
     HashRandom256(m_nonce); // Generate nonce
-    if (!m_keyblocks.GetKeys(passkey, m_nHashIters, m_key, m_ell)) {
+    bool bGotKeys = false;
+    if (m_bChunked && m_pPrevLayout != NULL) {
+      // Chunks can only be copied from the previous file if we keep its
+      // K & L, i.e., its keyblock - as long as the passphrase and the
+      // number of hash iterations are the same.
+      m_keyblocks = m_pPrevLayout->keyblocks;
+      bGotKeys = m_keyblocks.size() == 1 &&
+        m_keyblocks[0].m_nHashIters == m_nHashIters &&
+        m_keyblocks.GetKeys(passkey, m_nHashIters, m_key, m_ell);
+      if (!bGotKeys) {
+        m_keyblocks = CKeyBlocks();
+        m_pPrevLayout = NULL;
+      }
+    }
+    if (!bGotKeys && !m_keyblocks.GetKeys(passkey, m_nHashIters, m_key, m_ell)) {
       PWSfile::Close();
       return WRONG_PASSWORD;
     }
-    if (WriteKeyBlocks()) {
-      status = WriteHeader();
-    } else {
+    if (!WriteKeyBlocks()) {
       status = WRITE_FAIL;
+    } else if (m_bChunked) {
+      m_pLayout->keyblocks = m_keyblocks;
+      if (WriteBytes(ChunkedTag, sizeof(ChunkedTag), 1) != 1) {
+        status = WRITE_FAIL;
+      } else {
+        // Header's the first chunk, WriteHeader writes its IV
+        m_pLayout->chunks.push_back(PWSChunkLayout::Chunk());
+        m_chunkStart = ftell(m_fd);
+        status = WriteHeader();
+        if (status == SUCCESS)
+          status = EndChunk(PWSChunkLayout::HEADER);
+      }
+    } else {
+      status = WriteHeader();
     }
   } else { // open for read
     status = ParseKeyBlocks(passkey);
+    long headerStart = 0;
+    if (status == SUCCESS) {
+      // A chunked file has a tag where a plain file has its IV
+      unsigned char tag[sizeof(ChunkedTag)];
+      const long pos = ftell(m_fd);
+      if (ReadBytes(tag, sizeof(tag), 1) != 1) {
+        status = TRUNCATED_FILE;
+      } else {
+        m_bChunked = (memcmp(tag, ChunkedTag, sizeof(tag)) == 0);
+        headerStart = m_bChunked ? ftell(m_fd) : pos;
+        fseek(m_fd, headerStart, SEEK_SET);
+      }
+    }
     if (status == SUCCESS)
       status = ReadHeader();
+    if (status == SUCCESS && m_bChunked) {
+      m_pLayout->keyblocks = m_keyblocks;
+      status = ReadDirectory(headerStart);
+    }
   }
   if (status != SUCCESS) {
     Close();
@@ -153,6 +214,22 @@ int PWSfileV4::Close()
   if (m_fd == NULL)
     return SUCCESS; // idempotent
 
+  if (m_bChunked) {
+    // Each chunk's MAC was dealt with as it was read or written
+    int status = SUCCESS;
+    if (m_rw == Write) {
+      // Nothing to finish if the header chunk wasn't written
+      if (!m_pLayout->chunks.empty() && m_pLayout->chunks[0].length != 0)
+        status = WriteDirectory();
+    } else {
+      m_keyblocks.m_kbs.clear();
+      m_vChunkRecords.clear();
+      status = m_chunkStatus;
+    }
+    const int closeStatus = PWSfile::Close();
+    return (status != SUCCESS) ? status : closeStatus;
+  }
+
   if (!m_hmac.IsInited()) {
     // Here if we're closing before starting to work on hmac
     // e.g., wrong password
@@ -167,7 +244,7 @@ int PWSfileV4::Close()
   // Write or verify HMAC, depending on RWmode.
   size_t fret;
   if (m_rw == Write) {
-    fret = fwrite(digest, sizeof(digest), 1, m_fd);
+    fret = WriteBytes(digest, sizeof(digest), 1);
     if (fret != 1) {
       PWSfile::Close();
       return FAILURE;
@@ -178,7 +255,7 @@ int PWSfileV4::Close()
     m_keyblocks.m_kbs.clear();
     // read hmac & verify
     unsigned char d[SHA256::HASHLEN];
-    fret = fread(d, sizeof(d), 1, m_fd);
+    fret = ReadBytes(d, sizeof(d), 1);
     if (fret != 1) {
       PWSfile::Close();
       return TRUNCATED_FILE;
@@ -192,6 +269,29 @@ int PWSfileV4::Close()
   }
 }
 
+PWSfile *PWSfileV4::Duplicate() const
+{
+  ASSERT(m_rw == Read && m_fd != NULL && m_fish != NULL);
+  // A chunked file's read by ReadChunks' own readers
+  if (m_bChunked)
+    return NULL;
+  PWSfileV4 *pf = new PWSfileV4(m_filename, Read, m_curversion);
+  pf->FOpen();
+  if (pf->m_fd == NULL || fseek(pf->m_fd, ftell(m_fd), SEEK_SET) != 0) {
+    delete pf;
+    return NULL;
+  }
+  memcpy(pf->m_key, m_key, sizeof(m_key));
+  memcpy(pf->m_ell, m_ell, sizeof(m_ell));
+  memcpy(pf->m_ipthing, m_ipthing, sizeof(m_ipthing));
+  pf->m_hmac = m_hmac;
+  pf->m_fish = new TwoFish(m_key, sizeof(m_key));
+  pf->m_hdr = m_hdr;
+  pf->m_nHashIters = m_nHashIters;
+  pf->m_effectiveFileLength = m_effectiveFileLength;
+  return pf;
+}
+
 int PWSfileV4::SanityCheck(FILE *stream)
 {
   ASSERT(stream != NULL);
@@ -261,14 +361,50 @@ int PWSfileV4::WriteRecord(const CItemData &item)
 {
   ASSERT(m_fd != NULL);
   ASSERT(m_curversion == V40);
-  return item.Write(this);
+  if (!m_bChunked)
+    return item.Write(this);
+
+  int status = SUCCESS;
+  if (m_chunkStart == -1)
+    status = BeginChunk();
+  if (status == SUCCESS)
+    status = item.Write(this);
+  if (status != SUCCESS)
+    return status;
+
+  PWSChunkLayout::Record rec;
+  rec.uuid = item.GetUUID();
+  item.GetFingerprint(rec.fingerprint);
+  m_pLayout->chunks.back().records.push_back(rec);
+
+  if (ftell(m_fd) - m_chunkStart >= CHUNKSIZE)
+    status = EndChunk(PWSChunkLayout::ENTRIES);
+  return status;
 }
 
 int PWSfileV4::WriteRecord(const CItemAtt &att)
 {
   ASSERT(m_fd != NULL);
   ASSERT(m_curversion == V40);
-  return att.Write(this);
+  if (!m_bChunked)
+    return att.Write(this);
+
+  // Each attachment gets a chunk of its own
+  int status = SUCCESS;
+  if (m_chunkStart != -1)
+    status = EndChunk(PWSChunkLayout::ENTRIES);
+  if (status == SUCCESS)
+    status = BeginChunk();
+  if (status == SUCCESS)
+    status = att.Write(this);
+  if (status != SUCCESS)
+    return status;
+
+  PWSChunkLayout::Record rec;
+  rec.uuid = att.GetUUID();
+  att.GetFingerprint(rec.fingerprint);
+  m_pLayout->chunks.back().records.push_back(rec);
+  return EndChunk(PWSChunkLayout::ATTACHMENT);
 }
 
   // Following writes AttIV, AttEK, AttAK, AttContent
@@ -308,7 +444,9 @@ size_t PWSfileV4::WriteContentFields(unsigned char *content, size_t len)
   trashMemory(AK, sizeof(AK));
 
   // write actual content using EK
-  _writecbc(m_fd, content, len, &fish, IV);
+  SHA256 *fileHash = FileHash();
+  _writecbc(m_fd, content, len, &fish, IV, fileHash);
+  FileHashed(fileHash);
 
   // update content's HMAC
   hmac.Update(content, len);
@@ -325,12 +463,16 @@ size_t PWSfileV4::ReadContent(Fish *fish,  unsigned char *cbcbuffer,
                               unsigned char *&content, size_t clen)
 {
   ASSERT(clen > 0 && fish != NULL && cbcbuffer != NULL);
-  // round up clen to nearest BS:
+  // round up clen to nearest BS, as _writecbc pads only partial blocks:
   const unsigned int BS = fish->GetBlockSize();
-  size_t blen = (clen/BS + 1)*BS;
+  size_t blen = ((clen + BS - 1)/BS)*BS;
 
   content = new unsigned char[blen]; // caller's responsible for delete[]
-  return _readcbc(m_fd, content, blen, fish, cbcbuffer);
+  SHA256 *fileHash = FileHash();
+  const size_t retval = _readcbc(m_fd, content, blen, fish, cbcbuffer,
+                                 fileHash);
+  FileHashed(fileHash);
+  return retval;
 }
 
 size_t PWSfileV4::ReadCBC(unsigned char &type, unsigned char* &data,
@@ -372,6 +514,8 @@ int PWSfileV4::ReadRecord(CItemData &item)
   int status;
   ASSERT(m_fd != NULL);
   ASSERT(m_curversion == V40);
+  if (m_bChunked)
+    return NextChunkRecord(&item, NULL);
   SaveState();
   unsigned fpos = unsigned(ftell(m_fd));
   if (fpos < m_effectiveFileLength) {
@@ -391,6 +535,8 @@ int PWSfileV4::ReadRecord(CItemAtt &att)
 {
   ASSERT(m_fd != NULL);
   ASSERT(m_curversion == V40);
+  if (m_bChunked)
+    return NextChunkRecord(NULL, &att);
   if (unsigned(ftell(m_fd)) < m_effectiveFileLength)
     return att.Read(this);
   else
@@ -401,6 +547,9 @@ void PWSfileV4::StretchKey(const unsigned char *salt, unsigned long saltLen,
                            const StringX &passkey,
                            unsigned int N, unsigned char *Ptag, unsigned long PtagLen)
 {
+  PWS_TRACE_SPAN(span, "StretchKey", "iterations", NULL);
+  span.SetArg(0, N);
+
   /*
   * P' is the "stretched key" of the user's passphrase and the SALT, as defined
   * by the hash-function-based key stretching algorithm PBKDF2, with SHA-256
@@ -410,9 +559,9 @@ void PWSfileV4::StretchKey(const unsigned char *salt, unsigned long saltLen,
   size_t passLen = 0;
   unsigned char *pstr = NULL;
 
-  HMAC<SHA256, SHA256::HASHLEN, SHA256::BLOCKSIZE> hmac;
   ConvertString(passkey, pstr, passLen);
-  pbkdf2(pstr, passLen, salt, saltLen, N, &hmac, Ptag, &PtagLen);
+  HMAC_SHA256 hmac(pstr, static_cast<unsigned long>(passLen));
+  hmac.PBKDF2(salt, saltLen, N, Ptag, PtagLen);
 
 #ifdef UNICODE
   trashMemory(pstr, passLen);
@@ -494,15 +643,15 @@ void PWSfileV4::ComputeEndKB(const unsigned char hnonce[SHA256::HASHLEN],
 }
 
 
-#define SAFE_FWRITE(p, sz, cnt, stream) \
+#define SAFE_FWRITE(p, sz, cnt) \
   { \
-    size_t _ret = fwrite(p, sz, cnt, stream); \
+    size_t _ret = WriteBytes(p, sz, cnt); \
     if (_ret != cnt) { status = FAILURE; goto end;} \
   }
 
 struct PWSfileV4::KeyBlockWriter
 {
-  KeyBlockWriter(FILE *fd) : m_ok(true), m_fd(fd)
+  KeyBlockWriter(PWSfileV4 *file) : m_ok(true), m_file(file)
   {}
   void operator()(const PWSfileV4::CKeyBlocks::KeyBlock &kb)
   {
@@ -515,12 +664,12 @@ struct PWSfileV4::KeyBlockWriter
   }
   bool m_ok;
 private:
-  FILE *m_fd;
+  PWSfileV4 *m_file;
   void write(const void *p, size_t size)
   {
     // First time we fail, m_ok goes to false and we stop trying.
     if (m_ok) {
-      size_t nw = fwrite(p, size, 1, m_fd);
+      size_t nw = m_file->WriteBytes(p, size, 1);
       if (nw != 1)
         m_ok = false; // first time this is false, we stop writing!
     }
@@ -531,11 +680,11 @@ bool PWSfileV4::WriteKeyBlocks()
 {
   size_t nw;
 
-  nw = fwrite(m_nonce, NONCELEN, 1, m_fd);
+  nw = WriteBytes(m_nonce, NONCELEN, 1);
   if (nw != 1)
     return false;
 
-  KeyBlockWriter kbw(m_fd);
+  KeyBlockWriter kbw(this);
   for_each(m_keyblocks.m_kbs.begin(), m_keyblocks.m_kbs.end(), kbw);
   if (!kbw.m_ok)
     return false;
@@ -545,19 +694,20 @@ bool PWSfileV4::WriteKeyBlocks()
   SHA256 noncehasher;
   noncehasher.Update(m_nonce, NONCELEN);
   noncehasher.Final(hnonce);
-  nw = fwrite(hnonce, sizeof(hnonce), 1, m_fd);
+  nw = WriteBytes(hnonce, sizeof(hnonce), 1);
   if (nw != 1)
     return false;
 
   unsigned char digest[SHA256::HASHLEN];
   ComputeEndKB(hnonce, digest);
-  nw = fwrite(digest, sizeof(digest), 1, m_fd);
+  nw = WriteBytes(digest, sizeof(digest), 1);
   return (nw == 1);
 }
 
 int PWSfileV4::WriteHeader()
 {
   PWS_LOGIT;
+  PWS_TRACE_SPAN(span, "WriteHeader", NULL, NULL);
 
   // Following code is divided into {} blocks to
   // prevent "uninitialized" compile errors, as we use
@@ -574,7 +724,7 @@ int PWSfileV4::WriteHeader()
                   "m_ipthing can't be more that 32 bytes to use HashRandom256");
     memcpy(m_ipthing, ip_rand, sizeof(m_ipthing));
   }
-  SAFE_FWRITE(m_ipthing, 1, sizeof(m_ipthing), m_fd);
+  SAFE_FWRITE(m_ipthing, 1, sizeof(m_ipthing));
 
   m_fish = new TwoFish(m_key, sizeof(m_key));
 
@@ -788,18 +938,18 @@ int PWSfileV4::ReadKeyBlock()
    */
   CKeyBlocks::KeyBlock kb;
   size_t nRead;
-  nRead = fread(kb.m_salt, sizeof(kb.m_salt), 1, m_fd);
+  nRead = ReadBytes(kb.m_salt, sizeof(kb.m_salt), 1);
   if (nRead == 0) return END_OF_FILE;
   unsigned char Nb[sizeof(uint32)];
 
-  nRead = fread(Nb, sizeof(Nb), 1, m_fd);
+  nRead = ReadBytes(Nb, sizeof(Nb), 1);
   if (nRead == 0) return END_OF_FILE;
   kb.m_nHashIters = getInt32(Nb);
 
-  nRead = fread(kb.m_kw_k, CKeyBlocks::KWLEN, 1, m_fd);
+  nRead = ReadBytes(kb.m_kw_k, CKeyBlocks::KWLEN, 1);
   if (nRead == 0) return END_OF_FILE;
 
-  nRead = fread(kb.m_kw_l, CKeyBlocks::KWLEN, 1, m_fd);
+  nRead = ReadBytes(kb.m_kw_l, CKeyBlocks::KWLEN, 1);
   if (nRead == 0) return END_OF_FILE;
 
   m_keyblocks.m_kbs.push_back(kb);
@@ -838,10 +988,10 @@ bool PWSfileV4::VerifyKeyBlocks()
   unsigned char ReadEndKB[SHA256::HASHLEN];
   unsigned char CalcEndKB[SHA256::HASHLEN];
 
-  int nRead = fread(hnonce, sizeof(hnonce), 1, m_fd);
+  int nRead = ReadBytes(hnonce, sizeof(hnonce), 1);
   if (nRead != 1)
     return false;
-  nRead = fread(ReadEndKB, sizeof(ReadEndKB), 1, m_fd);
+  nRead = ReadBytes(ReadEndKB, sizeof(ReadEndKB), 1);
   if (nRead != 1)
     return false;
 
@@ -852,7 +1002,7 @@ bool PWSfileV4::VerifyKeyBlocks()
 bool PWSfileV4::EndKeyBlocks(const unsigned char calc_hnonce[SHA256::HASHLEN])
 {
   unsigned char read_hnonce[SHA256::HASHLEN];
-  size_t nr = fread(read_hnonce, sizeof(read_hnonce), 1, m_fd);
+  size_t nr = ReadBytes(read_hnonce, sizeof(read_hnonce), 1);
   if (nr != 1)
     return false; // EOF will be hit again and reported later
   // go back regardless of success/failure
@@ -878,7 +1028,7 @@ int PWSfileV4::ParseKeyBlocks(const StringX &passkey)
   SHA256 noncehasher;
 
   // Start by reading in nonce
-  size_t nr = fread(m_nonce, NONCELEN, 1, m_fd);
+  size_t nr = ReadBytes(m_nonce, NONCELEN, 1);
   if (nr != 1)
     return READ_FAIL;
 
@@ -971,8 +1121,9 @@ bool PWSfileV4::CKeyBlocks::RemoveKeyBlock(const StringX &passkey)
 
 int PWSfileV4::ReadHeader()
 {
+  PWS_TRACE_SPAN(span, "ReadHeader", NULL, NULL);
   m_hmac.Init(m_ell, sizeof(m_ell));
-  size_t nIPread = fread(m_ipthing, sizeof(m_ipthing), 1, m_fd);
+  size_t nIPread = ReadBytes(m_ipthing, sizeof(m_ipthing), 1);
   if (nIPread != 1) {
     Close();
     return TRUNCATED_FILE;
@@ -1270,3 +1421,387 @@ bool PWSfileV4::IsV4x(const StringX &filename, const StringX &passkey, VERSION &
   } else
     return false;
 }
+
+//-----------------------------------------------------------------------------
+// Chunked container, see formatV4chunked.txt
+
+int PWSfileV4::BeginChunk()
+{
+  ASSERT(m_chunkStart == -1);
+  m_chunkStart = ftell(m_fd);
+  m_pLayout->chunks.push_back(PWSChunkLayout::Chunk());
+
+  unsigned char ip_rand[SHA256::HASHLEN];
+  HashRandom256(ip_rand);
+  memcpy(m_ipthing, ip_rand, sizeof(m_ipthing));
+  if (WriteBytes(m_ipthing, sizeof(m_ipthing), 1) != 1)
+    return FAILURE;
+
+  m_hmac.Init(m_ell, sizeof(m_ell));
+  return SUCCESS;
+}
+
+int PWSfileV4::EndChunk(unsigned char kind)
+{
+  ASSERT(m_chunkStart != -1);
+  PWSChunkLayout::Chunk &chunk = m_pLayout->chunks.back();
+  m_hmac.Final(chunk.mac);
+  if (WriteBytes(chunk.mac, sizeof(chunk.mac), 1) != 1)
+    return FAILURE;
+
+  chunk.offset = ulong64(m_chunkStart);
+  chunk.length = uint32(ftell(m_fd) - m_chunkStart);
+  chunk.kind = kind;
+  m_chunkStart = -1;
+  return SUCCESS;
+}
+
+int PWSfileV4::WriteDirectory()
+{
+  int status = SUCCESS;
+  if (m_chunkStart != -1) // attachments' chunks are closed as written
+    status = EndChunk(PWSChunkLayout::ENTRIES);
+  if (status != SUCCESS)
+    return status;
+
+  const long dirOffset = ftell(m_fd);
+  const vector<PWSChunkLayout::Chunk> &chunks = m_pLayout->chunks;
+  vector<unsigned char> dir(4 + chunks.size() * DIRENTRYLEN);
+  unsigned char *p = &dir[0];
+  putInt32(p, int32(chunks.size())); p += 4;
+  for (auto iter = chunks.begin(); iter != chunks.end(); iter++) {
+    putInt64(p, int64(iter->offset)); p += 8;
+    putInt32(p, int32(iter->length)); p += 4;
+    *p++ = iter->kind;
+    putInt32(p, int32(iter->records.size())); p += 4;
+    memcpy(p, iter->mac, sizeof(iter->mac)); p += sizeof(iter->mac);
+  }
+
+  // Root MAC covers the nonce and the directory, so it depends on every
+  // chunk's MAC, position and kind
+  unsigned char trailer[TRAILERLEN];
+  putInt64(trailer, int64(dirOffset));
+  HMAC_SHA256 hmac(m_ell, sizeof(m_ell));
+  hmac.Update(m_nonce, NONCELEN);
+  hmac.Update(&dir[0], static_cast<unsigned long>(dir.size()));
+  hmac.Final(trailer + 8);
+  memcpy(m_pLayout->rootMAC, trailer + 8, SHA256::HASHLEN);
+
+  unsigned char ip_rand[SHA256::HASHLEN];
+  HashRandom256(ip_rand);
+  unsigned char IV[TwoFish::BLOCKSIZE];
+  memcpy(IV, ip_rand, sizeof(IV));
+  try { // _writecbc throws on write error
+    if (WriteBytes(IV, sizeof(IV), 1) != 1)
+      return FAILURE;
+    SHA256 *fileHash = FileHash();
+    _writecbc(m_fd, &dir[0], dir.size(), m_fish, IV, fileHash); // pads with randomness
+    FileHashed(fileHash);
+  } catch (...) {
+    return FAILURE;
+  }
+  if (WriteBytes(trailer, sizeof(trailer), 1) != 1)
+    return FAILURE;
+  return SUCCESS;
+}
+
+int PWSfileV4::ReadDirectory(long headerStart)
+{
+  // We're just past the header's fields, followed by their MAC
+  unsigned char mac[SHA256::HASHLEN], calc_mac[SHA256::HASHLEN];
+  if (ReadBytes(mac, sizeof(mac), 1) != 1)
+    return TRUNCATED_FILE;
+  m_hmac.Final(calc_mac);
+  const long headerEnd = ftell(m_fd);
+
+  unsigned char trailer[TRAILERLEN];
+  if (m_fileLength < ulong64(headerEnd) + TRAILERLEN ||
+      fseek(m_fd, long(m_fileLength - TRAILERLEN), SEEK_SET) != 0 ||
+      ReadBytes(trailer, sizeof(trailer), 1) != 1)
+    return TRUNCATED_FILE;
+
+  const ulong64 BS = TwoFish::BLOCKSIZE;
+  const ulong64 dirOffset = ulong64(getInt64(trailer));
+  const ulong64 dirEnd = m_fileLength - TRAILERLEN;
+  if (dirOffset < ulong64(headerEnd) || dirOffset + 2 * BS > dirEnd ||
+      (dirEnd - dirOffset) % BS != 0)
+    return READ_FAIL;
+
+  unsigned char IV[TwoFish::BLOCKSIZE];
+  const size_t dirLen = size_t(dirEnd - dirOffset - BS);
+  vector<unsigned char> dir(dirLen);
+  if (fseek(m_fd, long(dirOffset), SEEK_SET) != 0 ||
+      ReadBytes(IV, sizeof(IV), 1) != 1 ||
+      _readcbc(m_fd, &dir[0], dirLen, m_fish, IV) != dirLen)
+    return TRUNCATED_FILE;
+
+  const size_t numChunks = size_t(uint32(getInt32(&dir[0])));
+  if (numChunks == 0 || numChunks > (dirLen - 4) / DIRENTRYLEN)
+    return READ_FAIL;
+  const size_t used = 4 + numChunks * DIRENTRYLEN; // rest is padding
+
+  unsigned char root_mac[SHA256::HASHLEN];
+  HMAC_SHA256 hmac(m_ell, sizeof(m_ell));
+  hmac.Update(m_nonce, NONCELEN);
+  hmac.Update(&dir[0], static_cast<unsigned long>(used));
+  hmac.Final(root_mac);
+  if (memcmp(root_mac, trailer + 8, SHA256::HASHLEN) != 0)
+    m_chunkStatus = BAD_DIGEST;
+  memcpy(m_pLayout->rootMAC, trailer + 8, SHA256::HASHLEN);
+
+  vector<PWSChunkLayout::Chunk> &chunks = m_pLayout->chunks;
+  chunks.resize(numChunks);
+  const unsigned char *p = &dir[4];
+  for (size_t i = 0; i < numChunks; i++) {
+    PWSChunkLayout::Chunk &chunk = chunks[i];
+    chunk.offset = ulong64(getInt64(p)); p += 8;
+    chunk.length = uint32(getInt32(p)); p += 4;
+    chunk.kind = *p++;
+    const uint32 numRecords = uint32(getInt32(p)); p += 4;
+    memcpy(chunk.mac, p, sizeof(chunk.mac)); p += sizeof(chunk.mac);
+
+    // Each record's at least two blocks (UUID and END)
+    if (chunk.offset < ulong64(headerStart) ||
+        chunk.offset + chunk.length > dirOffset ||
+        chunk.length < BS + SHA256::HASHLEN ||
+        (chunk.length - SHA256::HASHLEN) % BS != 0 ||
+        numRecords > chunk.length / (2 * BS) ||
+        chunk.kind > PWSChunkLayout::ATTACHMENT ||
+        (chunk.kind == PWSChunkLayout::HEADER) != (i == 0))
+      return READ_FAIL;
+    chunk.records.resize(numRecords); // filled in by ReadChunk
+  }
+
+  if (chunks[0].offset != ulong64(headerStart) ||
+      chunks[0].length != ulong64(headerEnd - headerStart) ||
+      !chunks[0].records.empty())
+    return READ_FAIL;
+  if (memcmp(mac, calc_mac, sizeof(mac)) != 0 ||
+      memcmp(mac, chunks[0].mac, sizeof(mac)) != 0)
+    m_chunkStatus = BAD_DIGEST;
+
+  return SUCCESS;
+}
+
+int PWSfileV4::ReadChunks()
+{
+  PWS_LOGIT;
+  PWS_TRACE_SPAN(span, "ReadChunks", "chunks", "threads");
+
+  // Each thread decrypts with a reader of its own (file, cipher, HMAC),
+  // taking the next chunk as soon as it's free.
+  const size_t numChunks = m_pLayout->chunks.size() - 1; // less header
+  m_vChunkRecords.resize(numChunks);
+  vector<int> vStatus(numChunks, SUCCESS);
+
+  size_t numThreads = thread::hardware_concurrency();
+  numThreads = max(size_t(1), min(numThreads, numChunks));
+  span.SetArg(0, numChunks);
+  span.SetArg(1, numThreads);
+
+  atomic<size_t> next(0);
+  atomic<int> numUnknown(0);
+  auto Worker = [this, numChunks, &next, &numUnknown, &vStatus]() {
+    PWSfileV4 reader(m_filename, Read, V40);
+    reader.FOpen();
+    if (reader.m_fd != NULL) {
+      memcpy(reader.m_key, m_key, sizeof(m_key));
+      memcpy(reader.m_ell, m_ell, sizeof(m_ell));
+      reader.m_fish = new TwoFish(m_key, sizeof(m_key));
+      reader.m_hdr = m_hdr;
+    }
+    for (size_t i = next++; i < numChunks; i = next++)
+      vStatus[i] = (reader.m_fd != NULL) ?
+        reader.ReadChunk(*m_pLayout, i + 1, m_vChunkRecords[i]) : CANT_OPEN_FILE;
+    numUnknown += reader.m_nRecordsWithUnknownFields;
+    reader.PWSfile::Close();
+  };
+
+  vector<thread> vThreads;
+  for (size_t t = 1; t < numThreads; t++)
+    vThreads.push_back(thread(Worker));
+  Worker();
+  for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+    iter->join();
+
+  m_nRecordsWithUnknownFields += numUnknown;
+
+  // What's been read is kept regardless, as when reading a plain file
+  int status = SUCCESS;
+  for (auto iter = vStatus.begin(); iter != vStatus.end(); iter++) {
+    if (*iter != SUCCESS && (status == SUCCESS || status == BAD_DIGEST))
+      status = *iter;
+  }
+  return status;
+}
+
+int PWSfileV4::ReadChunk(PWSChunkLayout &layout, size_t i, ChunkRecords &cr)
+{
+  PWSChunkLayout::Chunk &chunk = layout.chunks[i];
+  PWS_TRACE_SPAN(span, "ReadChunk", "chunk", "records");
+  span.SetArg(0, i);
+  span.SetArg(1, chunk.records.size());
+  if (fseek(m_fd, long(chunk.offset), SEEK_SET) != 0 ||
+      ReadBytes(m_ipthing, sizeof(m_ipthing), 1) != 1)
+    return TRUNCATED_FILE;
+
+  // ReadRecord stops at the chunk's MAC
+  m_effectiveFileLength = chunk.offset + chunk.length - SHA256::HASHLEN;
+  m_hmac.Init(m_ell, sizeof(m_ell));
+
+  int status = SUCCESS;
+  const size_t numRecords = chunk.records.size();
+  if (chunk.kind == PWSChunkLayout::ENTRIES) {
+    cr.items.reserve(numRecords);
+    cr.itemStatus.reserve(numRecords);
+  }
+  // As in PWScore::ReadFile, entries are read into the same item each
+  // time, so that they share its key rather than each making their own
+  CItemData ci;
+  for (size_t r = 0; r < numRecords && status == SUCCESS; r++) {
+    PWSChunkLayout::Record &rec = chunk.records[r];
+    int rstatus;
+    if (chunk.kind == PWSChunkLayout::ENTRIES) {
+      ci.Clear();
+      rstatus = ReadRecord(ci);
+      // FAILURE's an encoding problem, the entry's still returned
+      if (rstatus == SUCCESS || rstatus == FAILURE) {
+        cr.items.push_back(ci);
+        cr.itemStatus.push_back(rstatus);
+        rec.uuid = ci.GetUUID();
+        ci.GetFingerprint(rec.fingerprint);
+      }
+    } else {
+      cr.atts.push_back(CItemAtt());
+      CItemAtt &att = cr.atts.back();
+      rstatus = ReadRecord(att);
+      if (rstatus == SUCCESS) {
+        rec.uuid = att.GetUUID();
+        att.GetFingerprint(rec.fingerprint);
+      } else {
+        cr.atts.pop_back();
+      }
+    }
+    if (rstatus != SUCCESS && rstatus != FAILURE)
+      status = READ_FAIL;
+  }
+
+  unsigned char mac[SHA256::HASHLEN], calc_mac[SHA256::HASHLEN];
+  m_hmac.Final(calc_mac);
+  if (status != SUCCESS)
+    return status;
+  if (ulong64(ftell(m_fd)) != m_effectiveFileLength ||
+      ReadBytes(mac, sizeof(mac), 1) != 1)
+    return READ_FAIL;
+  if (memcmp(mac, calc_mac, sizeof(mac)) != 0 ||
+      memcmp(mac, chunk.mac, sizeof(mac)) != 0)
+    return BAD_DIGEST;
+  return SUCCESS;
+}
+
+int PWSfileV4::NextChunkRecord(CItemData *pItem, CItemAtt *pAtt)
+{
+  // Chunks are decrypted when the first record's asked for, so that
+  // opening a file doesn't cost more than it used to
+  if (!m_bChunksRead) {
+    m_bChunksRead = true;
+    const int status = ReadChunks();
+    if (status != SUCCESS && m_chunkStatus == SUCCESS)
+      m_chunkStatus = status;
+  }
+
+  while (m_iChunk < m_vChunkRecords.size()) {
+    ChunkRecords &cr = m_vChunkRecords[m_iChunk];
+    if (m_iRecord < cr.items.size()) {
+      if (pItem == NULL)
+        return WRONG_RECORD;
+      *pItem = cr.items[m_iRecord];
+      return cr.itemStatus[m_iRecord++];
+    }
+    if (m_iRecord - cr.items.size() < cr.atts.size()) {
+      if (pAtt == NULL)
+        return WRONG_RECORD;
+      *pAtt = cr.atts[m_iRecord++ - cr.items.size()];
+      return SUCCESS;
+    }
+    cr = ChunkRecords(); // done with this one
+    m_iChunk++;
+    m_iRecord = 0;
+  }
+  return END_OF_FILE;
+}
+
+int PWSfileV4::CopyCleanChunks(const ItemList &pwlist, const AttList &attlist,
+                               set<CUUID> &copied)
+{
+  PWS_LOGIT;
+
+  ASSERT(m_rw == Write && m_chunkStart == -1);
+  if (!m_bChunked || m_pPrevLayout == NULL)
+    return SUCCESS;
+
+  // Only if the previous file's still the one the layout describes.
+  // Its trailer has the root MAC, which depends on all the rest.
+  const PWSChunkLayout &prev = *m_pPrevLayout;
+  FILE *fd = pws_os::FOpen(prev.filename.c_str(), _T("rb"));
+  if (fd == NULL)
+    return SUCCESS;
+  unsigned char trailer[TRAILERLEN];
+  if (fseek(fd, -long(TRAILERLEN), SEEK_END) != 0 ||
+      fread(trailer, sizeof(trailer), 1, fd) != 1 ||
+      memcmp(trailer + 8, prev.rootMAC, SHA256::HASHLEN) != 0) {
+    fclose(fd);
+    return SUCCESS;
+  }
+
+  int status = SUCCESS;
+  vector<unsigned char> buf;
+  unsigned char fingerprint[SHA256::HASHLEN];
+  for (auto chunk = prev.chunks.begin(); chunk != prev.chunks.end(); chunk++) {
+    if (chunk->kind == PWSChunkLayout::HEADER || chunk->records.empty())
+      continue;
+    // Small chunks of entries are left by earlier saves' changes.
+    // Rewriting them merges them into full ones.
+    if (chunk->kind == PWSChunkLayout::ENTRIES && chunk->length < CHUNKSIZE / 4)
+      continue;
+
+    // Clean if all its records are still there, and unchanged
+    bool bClean = true;
+    for (auto rec = chunk->records.begin(); bClean && rec != chunk->records.end(); rec++) {
+      const CItem *pitem = NULL;
+      if (chunk->kind == PWSChunkLayout::ENTRIES) {
+        auto iter = pwlist.find(rec->uuid);
+        if (iter != pwlist.end())
+          pitem = &iter->second;
+      } else {
+        auto iter = attlist.find(rec->uuid);
+        if (iter != attlist.end())
+          pitem = &iter->second;
+      }
+      if (pitem == NULL || copied.find(rec->uuid) != copied.end()) {
+        bClean = false;
+      } else {
+        pitem->GetFingerprint(fingerprint);
+        bClean = (memcmp(fingerprint, rec->fingerprint, sizeof(fingerprint)) == 0);
+      }
+    }
+    if (!bClean)
+      continue;
+
+    buf.resize(chunk->length);
+    if (fseek(fd, long(chunk->offset), SEEK_SET) != 0 ||
+        fread(&buf[0], buf.size(), 1, fd) != 1)
+      break; // the rest will be written from memory
+    PWSChunkLayout::Chunk copy(*chunk);
+    copy.offset = ulong64(ftell(m_fd));
+    if (WriteBytes(&buf[0], buf.size(), 1) != 1) {
+      status = FAILURE;
+      break;
+    }
+    m_pLayout->chunks.push_back(copy);
+    for (auto rec = chunk->records.begin(); rec != chunk->records.end(); rec++)
+      copied.insert(rec->uuid);
+  }
+  fclose(fd);
+  return status;
+}
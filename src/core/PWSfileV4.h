@@ -18,8 +18,12 @@
 #include "sha256.h"
 #include "hmac.h"
 #include "UTF8Conv.h"
+#include "ItemAtt.h"
 
 #include <vector>
+#include <set>
+
+struct PWSChunkLayout; // see below
 
 class PWSfileV4 : public PWSfile
 {
@@ -38,6 +42,7 @@ public:
 
   virtual int Open(const StringX &passkey);
   virtual int Close();
+  virtual PWSfile *Duplicate() const;
 
   virtual int WriteRecord(const CItemData &item);
   virtual int ReadRecord(CItemData &item);
@@ -59,6 +64,22 @@ public:
   // Following for low-level details that changed between format versions
   virtual size_t timeFieldLen() const {return 5;} // Experimental
 
+  // Chunked container (see formatV4chunked.txt): records are kept in
+  // independently encrypted and authenticated chunks, which are decrypted
+  // in parallel when reading, and copied as-is by an incremental save.
+  enum {CHUNKSIZE = 64 * 1024}; // a chunk of entries is closed past this
+  void SetChunked(bool bChunked) {m_bChunked = bChunked;} // before Open for write
+  bool IsChunked() const {return m_bChunked;} // set by Open for read
+  // Layout of the file being replaced, for CopyCleanChunks. Call before Open.
+  void SetPrevLayout(const PWSChunkLayout *pLayout) {m_pPrevLayout = pLayout;}
+  // Call right after Open for write: copies the previous file's chunks
+  // whose records are all still in pwlist/attlist and unchanged, and adds
+  // their UUIDs to copied, so that the caller doesn't write them again.
+  int CopyCleanChunks(const ItemList &pwlist, const AttList &attlist,
+                      std::set<pws_os::CUUID> &copied);
+  // Layout of the file as read (after Open) or written (after Close)
+  const PWSChunkLayout &GetLayout() const {return *m_pLayout;}
+
   // Following unique to V4
 
   // Following needs to be public so that we can manipulate it
@@ -134,6 +155,7 @@ public:
 
   virtual size_t ReadCBC(unsigned char &type, unsigned char* &data,
                          size_t &length);
+  virtual ulong64 GetEffectiveFileLength() const {return m_effectiveFileLength;}
 
   void GetCurrentKeys();
   bool WriteKeyBlocks();
@@ -149,9 +171,61 @@ public:
   void SaveState();
   void RestoreState();
 
+  // Chunked container support
+  struct ChunkRecords { // a chunk's records, decrypted by ReadChunks
+    std::vector<CItemData> items;
+    std::vector<int> itemStatus; // ReadRecord's
+    std::vector<CItemAtt> atts;
+  };
+  bool m_bChunked;
+  const PWSChunkLayout *m_pPrevLayout;
+  PWSChunkLayout *m_pLayout;
+  long m_chunkStart; // write: offset of the open chunk, -1 if none
+  std::vector<ChunkRecords> m_vChunkRecords; // read: one per record chunk
+  bool m_bChunksRead;
+  size_t m_iChunk, m_iRecord; // read: next record to return
+  int m_chunkStatus; // read: reported by Close
+
+  int BeginChunk();
+  int EndChunk(unsigned char kind);
+  int WriteDirectory();
+  int ReadDirectory(long dirStart);
+  int ReadChunks();
+  int ReadChunk(PWSChunkLayout &layout, size_t i, ChunkRecords &cr); // on a reader of its own
+  int NextChunkRecord(CItemData *pItem, CItemAtt *pAtt);
+
   static int SanityCheck(FILE *stream); // Check for TAG and EOF marker
   static void StretchKey(const unsigned char *salt, unsigned long saltLen,
                          const StringX &passkey, uint32 N,
                          unsigned char *Ptag, unsigned long PtagLen);
 };
+
+// Where a chunked V4 file's chunks are, and what records they hold, as
+// recorded when the file was read or written. Kept by PWScore, so that
+// the next save of the same file can tell which chunks it may copy.
+struct PWSChunkLayout {
+  enum Kind {HEADER = 0, ENTRIES = 1, ATTACHMENT = 2};
+
+  struct Record {
+    Record() : uuid(pws_os::CUUID::NullUUID()) {}
+    pws_os::CUUID uuid;
+    unsigned char fingerprint[SHA256::HASHLEN]; // CItem::GetFingerprint
+  };
+
+  struct Chunk {
+    Chunk() : offset(0), length(0), kind(HEADER) {}
+    ulong64 offset; // of the chunk's IV
+    uint32 length; // IV, encrypted fields and MAC
+    unsigned char kind;
+    unsigned char mac[SHA256::HASHLEN];
+    std::vector<Record> records;
+  };
+
+  PWSChunkLayout() {memset(rootMAC, 0, sizeof(rootMAC));}
+
+  StringX filename;
+  PWSfileV4::CKeyBlocks keyblocks; // K & L are kept across saves
+  unsigned char rootMAC[SHA256::HASHLEN]; // identifies the file's contents
+  std::vector<Chunk> chunks; // header chunk first
+};
 #endif /* __PWSFILEV4_H */
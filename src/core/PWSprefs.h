@@ -126,6 +126,7 @@ public:
     IgnoreHelpLoadError, // Only under WX
     VKPlaySound, // Windows only
     ListSortAscending,
+    CompressAttachments,
     NumBoolPrefs};
 
   enum IntPrefs {Column1Width, Column2Width, Column3Width, Column4Width,
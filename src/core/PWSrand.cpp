@@ -53,6 +53,7 @@ PWSrand::~PWSrand()
 void PWSrand::AddEntropy(unsigned char *bytes, unsigned int numBytes)
 {
   ASSERT(bytes != NULL);
+  std::lock_guard<std::mutex> lock(m_mutex);
 
   SHA256 s;
 
@@ -77,6 +78,12 @@ void PWSrand::NextRandBlock()
 }
 
 void PWSrand::GetRandomData( void * const buffer, unsigned long length )
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  GetRandomDataLocked(buffer, length);
+}
+
+void PWSrand::GetRandomDataLocked( void * const buffer, unsigned long length )
 {
   if (!m_IsInternalPRNG) {
     bool status;
@@ -115,10 +122,11 @@ unsigned int PWSrand::RandUInt()
 {
   // we don't want to keep filling the random buffer for each number we
   // want, so fill the buffer with random data and use it up
+  std::lock_guard<std::mutex> lock(m_mutex);
 
   if (ibRandomData > (SHA256::HASHLEN - sizeof(uint32))) {
     // no data left, refill the buffer
-    GetRandomData(rgbRandomData, SHA256::HASHLEN);
+    GetRandomDataLocked(rgbRandomData, SHA256::HASHLEN);
     ibRandomData = 0;
   }
 
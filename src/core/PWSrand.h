@@ -13,6 +13,8 @@
 
 #include "sha256.h"
 
+#include <mutex>
+
 class PWSrand
 {
 public:
@@ -32,7 +34,9 @@ private:
   ~PWSrand();
 
   void NextRandBlock();
+  void GetRandomDataLocked(void * const buffer, unsigned long length);
   static PWSrand *self;
+  std::mutex m_mutex; // several threads may read/write databases at once
   bool m_IsInternalPRNG;
   unsigned char K[SHA256::HASHLEN];
   unsigned char R[SHA256::HASHLEN];
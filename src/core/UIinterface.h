@@ -35,7 +35,7 @@ public:
    */
   enum Functions {
     DATABASEMODIFIED = 0, UPDATEGUI, GUISETUPDISPLAYINFO, GUIREFRESHENTRY,
-    UPDATEWIZARD,
+    UPDATEWIZARD, DATABASEFILECHANGED, ASYNCSAVECOMPLETED,
     // Add new functions here!
     NUM_SUPPORTED};
 
@@ -64,6 +64,18 @@ public:
   // UpdateWizard: called to update text in Wizard during export Text/XML.
   virtual void UpdateWizard(const stringT &s) = 0;
 
+  // DatabaseFileChanged: the open database (or only its lock file, if
+  // bLockFileOnly) was changed by someone else, see PWScore::StartWatchingCurFile.
+  // NOTE: Called from a worker thread - the UI must marshal this to its
+  // own thread before doing anything, e.g., offering to reload or merge.
+  virtual void DatabaseFileChanged(bool bLockFileOnly) = 0;
+
+  // AsyncSaveCompleted: a save started by PWScore::WriteCurFileAsync is done,
+  // status as per PWScore::WriteFile.
+  // NOTE: Called from a worker thread - the UI must marshal this to its
+  // own thread, which then calls PWScore::CompleteAsyncSave.
+  virtual void AsyncSaveCompleted(int status) = 0;
+
   virtual ~UIInterFace() {}
 };
 
@@ -0,0 +1,300 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// URLIndex.cpp : implementation file
+//
+
+#include "URLIndex.h"
+#include "os/debug.h"
+#include "os/pws_tchar.h"
+
+#include <algorithm>
+
+using namespace std;
+using pws_os::CUUID;
+
+namespace {
+  // Browse-to directives that may appear anywhere in the URL field,
+  // as handled by PWSAuxParse::GetExpandedString
+  const TCHAR *const Directives[] = {
+    _T("[alt]"), _T("[ssh]"), _T("{alt}"), _T("[autotype]"), _T("[xa]"),
+  };
+
+  // Second level labels that, under a two-letter country code, are
+  // public suffixes rather than sites (co.uk, com.au, ac.jp, ...)
+  const TCHAR *const GenericSLDs[] = {
+    _T("ac"), _T("co"), _T("com"), _T("edu"), _T("gob"), _T("go"), _T("gov"),
+    _T("ltd"), _T("mil"), _T("ne"), _T("net"), _T("nic"), _T("nom"), _T("or"),
+    _T("org"), _T("plc"), _T("sch"),
+  };
+
+  const struct {
+    const TCHAR *scheme;
+    unsigned int port;
+  } DefaultPorts[] = {
+    {_T("http"), 80}, {_T("https"), 443}, {_T("ftp"), 21}, {_T("ssh"), 22},
+    {_T("sftp"), 22}, {_T("ldap"), 389}, {_T("ldaps"), 636},
+  };
+
+  void ToLowerASCII(StringX &sx)
+  {
+    // Not towlower(): hosts aren't to be mangled by the locale
+    for (auto iter = sx.begin(); iter != sx.end(); iter++)
+      if (*iter >= _T('A') && *iter <= _T('Z'))
+        *iter = static_cast<TCHAR>(*iter - _T('A') + _T('a'));
+  }
+
+  bool IsSpace(TCHAR c)
+  {
+    return c == _T(' ') || c == _T('\t') || c == _T('\r') || c == _T('\n');
+  }
+
+  bool IsDigits(const StringX &sx)
+  {
+    if (sx.empty())
+      return false;
+    for (auto iter = sx.begin(); iter != sx.end(); iter++)
+      if (*iter < _T('0') || *iter > _T('9'))
+        return false;
+    return true;
+  }
+
+  bool IsIPv4(const StringX &host)
+  {
+    for (auto iter = host.begin(); iter != host.end(); iter++)
+      if ((*iter < _T('0') || *iter > _T('9')) && *iter != _T('.'))
+        return false;
+    return true;
+  }
+
+  StringX Site(const StringX &host)
+  {
+    // IP addresses and single labels (intranet hosts) are sites of their own
+    if (host.find(_T(':')) != StringX::npos || IsIPv4(host))
+      return host;
+    const StringX::size_type last = host.rfind(_T('.'));
+    if (last == StringX::npos || last == 0)
+      return host;
+    StringX::size_type second = host.rfind(_T('.'), last - 1);
+    if (second == StringX::npos)
+      return host;
+
+    if (host.length() - last - 1 == 2) { // ccTLD
+      const StringX sld = host.substr(second + 1, last - second - 1);
+      for (size_t i = 0; i < sizeof(GenericSLDs) / sizeof(GenericSLDs[0]); i++) {
+        if (sld == GenericSLDs[i]) {
+          if (second == 0)
+            return host;
+          second = host.rfind(_T('.'), second - 1);
+          if (second == StringX::npos)
+            return host;
+          break;
+        }
+      }
+    }
+    return host.substr(second + 1);
+  }
+
+  // Number of leading path segments in common ("/a/b" and "/a/c" have 1)
+  unsigned int CommonSegments(const StringX &p1, const StringX &p2)
+  {
+    unsigned int retval = 0;
+    size_t i = 0;
+    const size_t n = min(p1.length(), p2.length());
+    while (i < n && p1[i] == p2[i]) {
+      i++;
+      // a segment's complete when both reach a '/' or the end
+      if ((i == p1.length() || p1[i] == _T('/')) &&
+          (i == p2.length() || p2[i] == _T('/')))
+        retval++;
+    }
+    return retval;
+  }
+}
+
+size_t URLIndex::StringXHash::operator()(const StringX &sx) const
+{
+  // FNV-1a, as st_GroupTitleUser::Hash
+  size_t h = 2166136261U;
+  for (auto iter = sx.begin(); iter != sx.end(); iter++) {
+    h ^= static_cast<size_t>(*iter);
+    h *= 16777619U;
+  }
+  return h;
+}
+
+bool URLIndex::Parse(const StringX &sxURL, URLParts &parts)
+{
+  parts = URLParts();
+
+  StringX sx(sxURL);
+  for (size_t i = 0; i < sizeof(Directives) / sizeof(Directives[0]); i++) {
+    const StringX::size_type pos = sx.find(Directives[i]);
+    if (pos != StringX::npos)
+      sx.erase(pos, _tcslen(Directives[i]));
+  }
+  StringX::size_type start = 0, end = sx.length();
+  while (start < end && IsSpace(sx[start]))
+    start++;
+  while (end > start && IsSpace(sx[end - 1]))
+    end--;
+
+  // Scheme, if any: letters, digits, '+', '-' or '.' before "://"
+  const StringX::size_type colon = sx.find(_T("://"), start);
+  if (colon != StringX::npos && colon > start && colon < end) {
+    bool bScheme = true;
+    for (StringX::size_type i = start; i < colon && bScheme; i++) {
+      const TCHAR c = sx[i];
+      bScheme = (c >= _T('a') && c <= _T('z')) || (c >= _T('A') && c <= _T('Z')) ||
+        (c >= _T('0') && c <= _T('9')) || c == _T('+') || c == _T('-') || c == _T('.');
+    }
+    if (bScheme) {
+      parts.scheme = sx.substr(start, colon - start);
+      ToLowerASCII(parts.scheme);
+      start = colon + 3;
+    }
+  }
+
+  // Authority is up to the path, query or fragment
+  StringX::size_type authEnd = start;
+  while (authEnd < end && sx[authEnd] != _T('/') && sx[authEnd] != _T('?') &&
+         sx[authEnd] != _T('#'))
+    authEnd++;
+  StringX authority = sx.substr(start, authEnd - start);
+  const StringX::size_type at = authority.rfind(_T('@'));
+  if (at != StringX::npos)
+    authority.erase(0, at + 1);
+
+  StringX sxPort;
+  if (!authority.empty() && authority[0] == _T('[')) { // IPv6 literal
+    const StringX::size_type rb = authority.find(_T(']'));
+    if (rb == StringX::npos)
+      return false;
+    parts.host = authority.substr(1, rb - 1);
+    if (rb + 1 < authority.length()) {
+      if (authority[rb + 1] != _T(':'))
+        return false;
+      sxPort = authority.substr(rb + 2);
+    }
+  } else {
+    const StringX::size_type pc = authority.rfind(_T(':'));
+    parts.host = authority.substr(0, pc);
+    if (pc != StringX::npos)
+      sxPort = authority.substr(pc + 1);
+  }
+
+  ToLowerASCII(parts.host);
+  while (!parts.host.empty() && parts.host[parts.host.length() - 1] == _T('.'))
+    parts.host.erase(parts.host.length() - 1);
+  if (parts.host.compare(0, 4, _T("www.")) == 0 && parts.host.length() > 4)
+    parts.host.erase(0, 4);
+  if (parts.host.empty())
+    return false;
+  for (auto iter = parts.host.begin(); iter != parts.host.end(); iter++)
+    if (IsSpace(*iter) || *iter == _T('\\'))
+      return false;
+
+  if (!sxPort.empty()) {
+    if (!IsDigits(sxPort) || sxPort.length() > 5)
+      return false;
+    for (auto iter = sxPort.begin(); iter != sxPort.end(); iter++)
+      parts.port = parts.port * 10 + static_cast<unsigned int>(*iter - _T('0'));
+  } else {
+    for (size_t i = 0; i < sizeof(DefaultPorts) / sizeof(DefaultPorts[0]); i++)
+      if (parts.scheme == DefaultPorts[i].scheme) {
+        parts.port = DefaultPorts[i].port;
+        break;
+      }
+  }
+
+  parts.site = Site(parts.host);
+
+  // Path, without query or fragment
+  if (authEnd < end && sx[authEnd] == _T('/')) {
+    StringX::size_type pathEnd = authEnd;
+    while (pathEnd < end && sx[pathEnd] != _T('?') && sx[pathEnd] != _T('#'))
+      pathEnd++;
+    parts.path = sx.substr(authEnd, pathEnd - authEnd);
+    while (!parts.path.empty() && parts.path[parts.path.length() - 1] == _T('/'))
+      parts.path.erase(parts.path.length() - 1);
+  }
+  return true;
+}
+
+void URLIndex::Clear()
+{
+  m_entries.clear();
+  m_sites.clear();
+}
+
+void URLIndex::AddEntry(const StringX &sxURL, const CUUID &uuid)
+{
+  URLParts parts;
+  if (sxURL.empty() || !Parse(sxURL, parts))
+    return;
+  m_sites[parts.site].insert(uuid);
+  m_entries[uuid] = parts;
+}
+
+void URLIndex::RemoveEntry(const StringX &, const CUUID &uuid)
+{
+  // What was indexed is kept, so the URL itself isn't needed
+  auto iter = m_entries.find(uuid);
+  if (iter == m_entries.end())
+    return;
+  auto siter = m_sites.find(iter->second.site);
+  ASSERT(siter != m_sites.end());
+  if (siter != m_sites.end()) {
+    siter->second.erase(uuid);
+    if (siter->second.empty())
+      m_sites.erase(siter);
+  }
+  m_entries.erase(iter);
+}
+
+void URLIndex::UpdateEntry(const StringX &sxOldURL, const StringX &sxNewURL,
+                           const CUUID &uuid)
+{
+  if (sxOldURL == sxNewURL)
+    return;
+  RemoveEntry(sxOldURL, uuid);
+  AddEntry(sxNewURL, uuid);
+}
+
+unsigned int URLIndex::Score(const URLParts &query, const URLParts &entry)
+{
+  unsigned int retval = (query.host == entry.host) ? HOST_MATCH : SITE_MATCH;
+  retval += min(CommonSegments(query.path, entry.path) * unsigned(PATH_SEGMENT),
+                unsigned(MAX_PATH_SCORE));
+  if (!query.scheme.empty() && query.scheme == entry.scheme)
+    retval += SCHEME_MATCH;
+  if (query.port != 0 && query.port == entry.port)
+    retval += PORT_MATCH;
+  return retval;
+}
+
+void URLIndex::Find(const StringX &sxURL, vector<Candidate> &vCandidates) const
+{
+  vCandidates.clear();
+  URLParts query;
+  if (!Parse(sxURL, query))
+    return;
+
+  auto siter = m_sites.find(query.site);
+  if (siter == m_sites.end())
+    return;
+  vCandidates.reserve(siter->second.size());
+  for (auto iter = siter->second.begin(); iter != siter->second.end(); iter++) {
+    auto eiter = m_entries.find(*iter);
+    ASSERT(eiter != m_entries.end());
+    vCandidates.push_back(Candidate(*iter, Score(query, eiter->second)));
+  }
+  // Stable, so that equal scores stay in uuid order
+  stable_sort(vCandidates.begin(), vCandidates.end(),
+              [](const Candidate &c1, const Candidate &c2)
+              {return c1.score > c2.score;});
+}
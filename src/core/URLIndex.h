@@ -0,0 +1,96 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// URLIndex.h
+//-----------------------------------------------------------------------------
+// Index of the entries' URL fields by host and by site, maintained
+// incrementally by PWScore as entries are added, deleted or changed, so
+// that the entries for a given web site can be found without decrypting
+// every entry's URL (see PWScore::FindByURL).
+//
+// URLs are taken as users type them in the URL field: the scheme may be
+// missing ("www.example.com/login"), and the browse-to directives
+// ("[alt]", "[ssh]", "{alt}", "[autotype]", "[xa]") are ignored. Hosts are
+// compared in lower case, without a leading "www." label or trailing dot.
+//
+// A host's site is its "registrable" part, e.g. "example.com" for
+// "mail.example.com", or "example.co.uk" for "www.example.co.uk". There's
+// no Public Suffix List here, so a two-label suffix is recognized only in
+// the common form of a generic second level under a country code (co.uk,
+// com.au, ac.jp, ...), which covers most sites but not all.
+//-----------------------------------------------------------------------------
+
+#ifndef __URLINDEX_H
+#define __URLINDEX_H
+
+#include "StringX.h"
+#include "os/UUID.h"
+
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+class URLIndex
+{
+public:
+  struct URLParts {
+    URLParts() : port(0) {}
+    StringX scheme; // lower case, empty if none given
+    StringX host;   // lower case, without "www." or trailing '.'
+    StringX site;   // registrable part of host, see above
+    StringX path;   // without query, fragment or trailing '/'
+    unsigned int port; // explicit, else scheme's default, else 0
+  };
+
+  // Ranked candidates of Find(), best first
+  struct Candidate {
+    Candidate(const pws_os::CUUID &u, unsigned int s) : uuid(u), score(s) {}
+    pws_os::CUUID uuid;
+    unsigned int score;
+  };
+
+  // Scores: the match on host dominates, then the path, then the rest
+  enum {SITE_MATCH = 100, HOST_MATCH = 200, PATH_SEGMENT = 10,
+        MAX_PATH_SCORE = 90, SCHEME_MATCH = 4, PORT_MATCH = 2};
+
+  URLIndex() {}
+
+  void Clear();
+
+  void AddEntry(const StringX &sxURL, const pws_os::CUUID &uuid);
+  void RemoveEntry(const StringX &sxURL, const pws_os::CUUID &uuid);
+  void UpdateEntry(const StringX &sxOldURL, const StringX &sxNewURL,
+                   const pws_os::CUUID &uuid);
+
+  // Entries with the same site as sxURL, best first
+  void Find(const StringX &sxURL, std::vector<Candidate> &vCandidates) const;
+
+  size_t GetNumEntries() const {return m_entries.size();}
+
+  // False if there's no host to be found in sxURL
+  static bool Parse(const StringX &sxURL, URLParts &parts);
+
+private:
+  URLIndex(const URLIndex &); // Do not implement
+  URLIndex &operator=(const URLIndex &); // Do not implement
+
+  struct StringXHash {
+    size_t operator()(const StringX &sx) const;
+  };
+  static unsigned int Score(const URLParts &query, const URLParts &entry);
+
+  std::map<pws_os::CUUID, URLParts> m_entries; // only those with a host
+  // Entries by site (entries on the same host are on the same site)
+  std::unordered_map<StringX, std::set<pws_os::CUUID>, StringXHash> m_sites;
+};
+
+#endif /* __URLINDEX_H */
+//-----------------------------------------------------------------------------
+// Local variables:
+// mode: c++
+// End:
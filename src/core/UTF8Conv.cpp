@@ -15,6 +15,16 @@
 #include "os/debug.h"
 #include "os/utf8conv.h"
 
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
 CUTF8Conv::~CUTF8Conv()
 {
   if (m_utf8 != NULL) {
@@ -31,29 +41,210 @@ CUTF8Conv::~CUTF8Conv()
   }
 }
 
+namespace {
+  // ASCII fast paths: convert whole vectors of ASCII at once, stopping
+  // at the first vector with anything else in it. Return number of
+  // characters converted.
+  size_t DecodeASCII(const unsigned char *src, size_t srcLen, wchar_t *dst)
+  {
+    size_t i = 0;
+    if (dst == NULL) { // just counting
+#ifdef UTF8_SSE2
+      for (; i + 16 <= srcLen; i += 16)
+        if (_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i))) != 0)
+          break;
+#endif
+      while (i < srcLen && src[i] < 0x80)
+        i++;
+      return i;
+    }
+#ifdef __AVX2__
+    for (; i + 32 <= srcLen; i += 32) {
+      const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+      if (_mm256_movemask_epi8(v) != 0)
+        break;
+      const __m128i lo = _mm256_castsi256_si128(v);
+      const __m128i hi = _mm256_extracti128_si256(v, 1);
+      __m256i *p = reinterpret_cast<__m256i *>(dst + i);
+      if (sizeof(wchar_t) == 2) {
+        _mm256_storeu_si256(p, _mm256_cvtepu8_epi16(lo));
+        _mm256_storeu_si256(p + 1, _mm256_cvtepu8_epi16(hi));
+      } else {
+        _mm256_storeu_si256(p, _mm256_cvtepu8_epi32(lo));
+        _mm256_storeu_si256(p + 1, _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+        _mm256_storeu_si256(p + 2, _mm256_cvtepu8_epi32(hi));
+        _mm256_storeu_si256(p + 3, _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+      }
+    }
+#endif
+#ifdef UTF8_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= srcLen; i += 16) {
+      const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+      if (_mm_movemask_epi8(v) != 0)
+        break;
+      const __m128i lo = _mm_unpacklo_epi8(v, zero);
+      const __m128i hi = _mm_unpackhi_epi8(v, zero);
+      __m128i *p = reinterpret_cast<__m128i *>(dst + i);
+      if (sizeof(wchar_t) == 2) {
+        _mm_storeu_si128(p, lo);
+        _mm_storeu_si128(p + 1, hi);
+      } else {
+        _mm_storeu_si128(p, _mm_unpacklo_epi16(lo, zero));
+        _mm_storeu_si128(p + 1, _mm_unpackhi_epi16(lo, zero));
+        _mm_storeu_si128(p + 2, _mm_unpacklo_epi16(hi, zero));
+        _mm_storeu_si128(p + 3, _mm_unpackhi_epi16(hi, zero));
+      }
+    }
+#endif
+    for (; i < srcLen && src[i] < 0x80; i++)
+      dst[i] = static_cast<wchar_t>(src[i]);
+    return i;
+  }
+
+  size_t EncodeASCII(const wchar_t *src, size_t srcLen, unsigned char *dst)
+  {
+    size_t i = 0;
+#ifdef UTF8_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ascii = sizeof(wchar_t) == 2 ?
+      _mm_set1_epi16(static_cast<short>(0xff80)) : _mm_set1_epi32(~0x7f);
+    for (; i + 16 <= srcLen; i += 16) {
+      const __m128i *p = reinterpret_cast<const __m128i *>(src + i);
+      __m128i packed;
+      if (sizeof(wchar_t) == 2) {
+        const __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+        const __m128i high = _mm_and_si128(_mm_or_si128(a, b), ascii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xffff)
+          break;
+        packed = _mm_packus_epi16(a, b);
+      } else {
+        const __m128i a = _mm_loadu_si128(p), b = _mm_loadu_si128(p + 1);
+        const __m128i c = _mm_loadu_si128(p + 2), d = _mm_loadu_si128(p + 3);
+        const __m128i high = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b),
+                                                        _mm_or_si128(c, d)), ascii);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(high, zero)) != 0xffff)
+          break;
+        packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), packed);
+    }
+#endif
+    for (; i < srcLen && static_cast<ulong32>(src[i]) < 0x80; i++)
+      dst[i] = static_cast<unsigned char>(src[i]);
+    return i;
+  }
+}
+
+bool CUTF8Conv::Decode(const unsigned char *src, size_t srcLen,
+                       wchar_t *dst, size_t &dstLen)
+{
+  size_t i = 0, o = 0;
+  dstLen = 0;
+  while (i < srcLen) {
+    if (src[i] < 0x80) {
+      const size_t n = DecodeASCII(src + i, srcLen - i,
+                                   dst == NULL ? NULL : dst + o);
+      i += n; o += n;
+      continue;
+    }
+
+    // Leading byte: C0, C1 would only start overlong forms,
+    // F5 and up code points past U+10FFFF
+    const unsigned char b = src[i];
+    size_t len;
+    ulong32 cp;
+    if (b < 0xc2)
+      return false;
+    else if (b < 0xe0) {
+      len = 2; cp = b & 0x1f;
+    } else if (b < 0xf0) {
+      len = 3; cp = b & 0x0f;
+    } else if (b < 0xf5) {
+      len = 4; cp = b & 0x07;
+    } else
+      return false;
+
+    if (srcLen - i < len)
+      return false;
+    for (size_t k = 1; k < len; k++) {
+      const unsigned char c = src[i + k];
+      if ((c & 0xc0) != 0x80)
+        return false;
+      cp = (cp << 6) | (c & 0x3f);
+    }
+    if ((len == 3 && cp < 0x800) ||
+        (len == 4 && (cp < 0x10000 || cp > 0x10ffff)) ||
+        (cp >= 0xd800 && cp <= 0xdfff))
+      return false;
+    i += len;
+
+    if (dst == NULL) {
+      o += (sizeof(wchar_t) == 2 && cp >= 0x10000) ? 2 : 1;
+    } else if (sizeof(wchar_t) == 2 && cp >= 0x10000) {
+      cp -= 0x10000;
+      dst[o++] = static_cast<wchar_t>(0xd800 + (cp >> 10));
+      dst[o++] = static_cast<wchar_t>(0xdc00 + (cp & 0x3ff));
+    } else
+      dst[o++] = static_cast<wchar_t>(cp);
+  }
+  dstLen = o;
+  return true;
+}
+
+bool CUTF8Conv::Encode(const wchar_t *src, size_t srcLen,
+                       unsigned char *dst, size_t &dstLen)
+{
+  size_t i = 0, o = 0;
+  dstLen = 0;
+  while (i < srcLen) {
+    ulong32 cp = sizeof(wchar_t) == 2 ?
+      static_cast<unsigned short>(src[i]) : static_cast<ulong32>(src[i]);
+    if (cp < 0x80) {
+      const size_t n = EncodeASCII(src + i, srcLen - i, dst + o);
+      i += n; o += n;
+      continue;
+    }
+    i++;
+
+    if (cp >= 0xd800 && cp <= 0xdfff) {
+      // Only valid as a UTF-16 high surrogate followed by a low one
+      if (sizeof(wchar_t) != 2 || cp > 0xdbff || i == srcLen)
+        return false;
+      const ulong32 lo = static_cast<unsigned short>(src[i]);
+      if (lo < 0xdc00 || lo > 0xdfff)
+        return false;
+      cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+      i++;
+    }
+
+    if (cp < 0x800) {
+      dst[o++] = static_cast<unsigned char>(0xc0 | (cp >> 6));
+    } else if (cp < 0x10000) {
+      dst[o++] = static_cast<unsigned char>(0xe0 | (cp >> 12));
+      dst[o++] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3f));
+    } else if (cp <= 0x10ffff) {
+      dst[o++] = static_cast<unsigned char>(0xf0 | (cp >> 18));
+      dst[o++] = static_cast<unsigned char>(0x80 | ((cp >> 12) & 0x3f));
+      dst[o++] = static_cast<unsigned char>(0x80 | ((cp >> 6) & 0x3f));
+    } else
+      return false;
+    dst[o++] = static_cast<unsigned char>(0x80 | (cp & 0x3f));
+  }
+  dstLen = o;
+  return true;
+}
+
 bool CUTF8Conv::ToUTF8(const StringX &data,
                        const unsigned char *&utf8, size_t &utf8Len)
 {
-  // If we're not in Unicode, call MultiByteToWideChar to get from
-  // current codepage to Unicode, and then WideCharToMultiByte to
-  // get to UTF-8 encoding.
-
   if (data.empty()) {
     utf8Len = 0;
     return true;
   }
 
-  wchar_t *wcPtr = const_cast<wchar_t *>(data.c_str());
-  size_t wcLen = data.length()+1;
-  // first get needed utf8 buffer size
-  size_t mbLen = pws_os::wcstombs(NULL, 0, wcPtr, wcLen);
-
-  if (mbLen == 0) { // uh-oh
-    ASSERT(0);
-    m_utf8Len = 0;
-    return false;
-  }
   // Allocate buffer (if previous allocation was smaller)
+  const size_t mbLen = MaxUTF8Len(data.length());
   if (mbLen > m_utf8MaxLen) {
     if (m_utf8 != NULL)
       trashMemory(m_utf8, m_utf8MaxLen);
@@ -61,10 +252,12 @@ bool CUTF8Conv::ToUTF8(const StringX &data,
     m_utf8 = new unsigned char[mbLen];
     m_utf8MaxLen = mbLen;
   }
-  // Finally get result
-  m_utf8Len = pws_os::wcstombs(reinterpret_cast<char *>(m_utf8), mbLen, wcPtr, wcLen);
-  ASSERT(m_utf8Len != 0);
-  m_utf8Len--; // remove unneeded null termination
+
+  if (!Encode(data.data(), data.length(), m_utf8, m_utf8Len)) { // uh-oh
+    ASSERT(0);
+    m_utf8Len = 0;
+    return false;
+  }
   utf8 = m_utf8;
   utf8Len = m_utf8Len;
   return true;
@@ -74,10 +267,6 @@ bool CUTF8Conv::ToUTF8(const StringX &data,
 bool CUTF8Conv::FromUTF8(const unsigned char *utf8, size_t utf8Len,
                          StringX &data)
 {
-  // Call MultiByteToWideChar to get from UTF-8 to Unicode.
-  // If we're not in Unicode, call WideCharToMultiByte to
-  // get to current codepage.
-  //
   // Due to a bug in pre-3.08 versions, data may be in ACP
   // instead of UTF-8. We try to detect and workaround this.
 
@@ -88,18 +277,48 @@ bool CUTF8Conv::FromUTF8(const unsigned char *utf8, size_t utf8Len,
 
   ASSERT(utf8 != NULL);
 
-  // first get needed wide char buffer size
-  size_t wcLen = pws_os::mbstowcs(NULL, 0,
-                                  reinterpret_cast<const char *>(utf8),
-                                  size_t(-1), !m_cp_acp);
-  if (wcLen == 0) { // uh-oh
-    // it seems that this always returns non-zero, even if encoding
-    // broken. Therefore, we'll give a conservative value here,
-    // and try to recover later
-    pws_os::Trace0(_T("FromUTF8: Couldn't get buffer size - guessing!"));
-    wcLen = sizeof(StringX::value_type) * (utf8Len + 1);
-  }
+  // As before, data ends at the first NUL, if any
+  const void *nul = memchr(utf8, 0, utf8Len);
+  if (nul != NULL)
+    utf8Len = static_cast<const unsigned char *>(nul) - utf8;
+
+  if (m_cp_acp)
+    return FromACP(utf8, utf8Len, data);
+
   // Allocate buffer (if previous allocation was smaller)
+  if (utf8Len > m_wcMaxLen) {
+    if (m_wc != NULL)
+      trashMemory(m_wc, m_wcMaxLen);
+    delete[] m_wc;
+    m_wc = new wchar_t[utf8Len];
+    m_wcMaxLen = utf8Len;
+  }
+
+  size_t wcLen;
+  if (!Decode(utf8, utf8Len, m_wc, wcLen)) {
+    pws_os::Trace0(_T("FromUTF8: not UTF-8, trying ACP\n"));
+    return FromACP(utf8, utf8Len, data);
+  }
+  data.assign(m_wc, wcLen);
+  return true;
+}
+
+bool CUTF8Conv::FromACP(const unsigned char *mb, size_t mbLen,
+                        StringX &data)
+{
+  // Locale (or Windows ANSI codepage) conversion, which needs
+  // a NUL-terminated copy of the input
+  if (mbLen + 1 > m_tmpMaxLen) {
+    if (m_tmp != NULL)
+      trashMemory(m_tmp, m_tmpMaxLen);
+    delete[] m_tmp;
+    m_tmp = new unsigned char[mbLen + 1];
+    m_tmpMaxLen = mbLen + 1;
+  }
+  memcpy(m_tmp, mb, mbLen);
+  m_tmp[mbLen] = '\0';
+
+  size_t wcLen = mbLen + 1;
   if (wcLen > m_wcMaxLen) {
     if (m_wc != NULL)
       trashMemory(m_wc, m_wcMaxLen);
@@ -107,43 +326,14 @@ bool CUTF8Conv::FromUTF8(const unsigned char *utf8, size_t utf8Len,
     m_wc = new wchar_t[wcLen];
     m_wcMaxLen = wcLen;
   }
-  // next translate to buffer
-  wcLen = pws_os::mbstowcs(m_wc, wcLen,
-                           reinterpret_cast<const char *>(utf8),
-                           size_t(-1), !m_cp_acp);
-#ifdef _WIN32
+  wcLen = pws_os::mbstowcs(m_wc, wcLen, reinterpret_cast<const char *>(m_tmp),
+                           size_t(-1), false);
+  trashMemory(m_tmp, mbLen);
   if (wcLen == 0) {
-    DWORD errCode = GetLastError();
-    switch (errCode) {
-    case ERROR_INSUFFICIENT_BUFFER:
-      pws_os::Trace0(_T("INSUFFICIENT BUFFER")); break;
-    case ERROR_INVALID_FLAGS:
-      pws_os::Trace0(_T("INVALID FLAGS")); break;
-    case ERROR_INVALID_PARAMETER:
-      pws_os::Trace0(_T("INVALID PARAMETER")); break;
-    case ERROR_NO_UNICODE_TRANSLATION:
-      // try to recover
-      pws_os::Trace0(_T("NO UNICODE TRANSLATION"));
-      wcLen = MultiByteToWideChar(CP_ACP,        // code page
-                                  0,             // character-type options
-                                  LPSTR(utf8),   // string to map
-                                  -1,            // -1 means null-terminated
-                                  m_wc,          // output buffer
-                                  reinterpret_cast<int &>(wcLen));  // output buffer size
-      if (wcLen > 0) {
-        pws_os::Trace0(_T("FromUTF8: recovery succeeded!"));
-      }
-      break;
-    default:
-      ASSERT(0);
-    }
-  }
-  ASSERT(wcLen != 0);
-#endif /* _WIN32 */
-  if (wcLen != 0) {
-    m_wc[wcLen - 1] = TCHAR('\0');
-    data = m_wc;
-    return true;
-  } else
+    pws_os::Trace0(_T("FromACP: conversion failed\n"));
     return false;
+  }
+  m_wc[wcLen - 1] = TCHAR('\0');
+  data = m_wc;
+  return true;
 }
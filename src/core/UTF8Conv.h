@@ -29,7 +29,23 @@ public:
   // In following, char * is managed by caller.
   bool FromUTF8(const unsigned char *utf8, size_t utf8Len, StringX &data);
 
+  // Locale-independent codec used by the above, with explicit lengths
+  // and no NUL termination. wchar_t is UTF-32, or UTF-16 where it's 16
+  // bits wide. Malformed input (overlong forms, surrogates in UTF-8,
+  // unpaired surrogates in UTF-16, code points past U+10FFFF, truncated
+  // sequences) is rejected.
+  // dst needs room for MaxUTF8Len(srcLen) bytes, resp. srcLen wchar_ts.
+  // Decode's dst may be NULL, to just validate and count.
+  static size_t MaxUTF8Len(size_t wcLen)
+  {return wcLen * (sizeof(wchar_t) == 2 ? 3 : 4);}
+  static bool Encode(const wchar_t *src, size_t srcLen,
+                     unsigned char *dst, size_t &dstLen);
+  static bool Decode(const unsigned char *src, size_t srcLen,
+                     wchar_t *dst, size_t &dstLen);
+
 private:
+  bool FromACP(const unsigned char *mb, size_t mbLen, StringX &data);
+
   CUTF8Conv(const CUTF8Conv &); // not supported
   CUTF8Conv &operator=(const CUTF8Conv &); // ditto
   // following pointers allocated dynamically and monotonically increase in size
@@ -157,7 +157,7 @@ void GenRandhash(const StringX &a_passkey,
 }
 
 size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length, unsigned char type,
-                 Fish *Algorithm, unsigned char *cbcbuffer)
+                 Fish *Algorithm, unsigned char *cbcbuffer, SHA256 *fileHash)
 {
   const unsigned int BS = Algorithm->GetBlockSize();
   size_t numWritten = 0;
@@ -198,15 +198,17 @@ size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length, unsigned
     trashMemory(curblock, BS);
     throw(EIO);
   }
+  if (fileHash != NULL)
+    fileHash->Update(curblock, BS);
 
-  numWritten += _writecbc(fp, buffer, length, Algorithm, cbcbuffer);
+  numWritten += _writecbc(fp, buffer, length, Algorithm, cbcbuffer, fileHash);
 
   trashMemory(curblock, BS);
   return numWritten;
 }
 
 size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length,
-                 Fish *Algorithm, unsigned char *cbcbuffer)
+                 Fish *Algorithm, unsigned char *cbcbuffer, SHA256 *fileHash)
 {
   // Doesn't write out length, just CBC's the data, padding with randomness
   // as required.
@@ -248,6 +250,8 @@ size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length,
         trashMemory(curblock, BS);
         throw(EIO);
       }
+      if (fileHash != NULL)
+        fileHash->Update(curblock, BS);
       numWritten += nw;
     }
   }
@@ -274,7 +278,8 @@ size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length,
 size_t _readcbc(FILE *fp,
          unsigned char* &buffer, size_t &buffer_len, unsigned char &type,
          Fish *Algorithm, unsigned char *cbcbuffer,
-         const unsigned char *TERMINAL_BLOCK, ulong64 file_len)
+         const unsigned char *TERMINAL_BLOCK, ulong64 file_len,
+         SHA256 *fileHash)
 {
   const unsigned int BS = Algorithm->GetBlockSize();
   size_t numRead = 0;
@@ -299,6 +304,8 @@ size_t _readcbc(FILE *fp,
   if (numRead != BS) {
     return 0;
   }
+  if (fileHash != NULL)
+    fileHash->Update(lengthblock, BS);
 
   if (TERMINAL_BLOCK != NULL &&
     memcmp(lengthblock, TERMINAL_BLOCK, BS) == 0)
@@ -353,7 +360,10 @@ size_t _readcbc(FILE *fp,
   if (length > 0 ||
       (BS == 8 && length == 0)) { // pre-3 pain
     unsigned char *tempcbc = block3;
-    numRead += fread(b, 1, BlockLength, fp);
+    const size_t nr = fread(b, 1, BlockLength, fp);
+    if (fileHash != NULL)
+      fileHash->Update(b, nr);
+    numRead += nr;
     for (unsigned int x = 0; x < BlockLength; x += BS) {
       memcpy(tempcbc, b + x, BS);
       Algorithm->Decrypt(b + x, b + x);
@@ -372,7 +382,7 @@ size_t _readcbc(FILE *fp,
 // typeless version for V4 content (caller pre-allocates buffer)
 size_t _readcbc(FILE *fp, unsigned char *buffer,
                 const size_t buffer_len, Fish *Algorithm,
-                unsigned char *cbcbuffer)
+                unsigned char *cbcbuffer, SHA256 *fileHash)
 {
   const unsigned int BS = Algorithm->GetBlockSize();
   ASSERT((buffer_len % BS) == 0);
@@ -383,6 +393,8 @@ size_t _readcbc(FILE *fp, unsigned char *buffer,
   do {
     size_t nr = fread(p, 1, BS, fp);
     nread += nr;
+    if (fileHash != NULL)
+      fileHash->Update(p, nr);
     if (nr != BS)
       break;
 
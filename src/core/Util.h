@@ -48,27 +48,30 @@ extern void GenRandhash(const StringX &passkey,
                         const unsigned char *m_randstuff,
                         unsigned char *m_randhash);
 
+// If non-NULL, fileHash is updated with what's read or written, as on file
+
 // buffer is allocated by _readcbc, *** delete[] is responsibility of caller ***
 extern size_t _readcbc(FILE *fp, unsigned char * &buffer,
                        size_t &buffer_len,
                        unsigned char &type, Fish *Algorithm,
                        unsigned char *cbcbuffer,
                        const unsigned char *TERMINAL_BLOCK = NULL, 
-                       ulong64 file_len = 0);
+                       ulong64 file_len = 0, SHA256 *fileHash = NULL);
 
 // typeless version for V4 content (caller pre-allocates buffer)
 extern size_t _readcbc(FILE *fp, unsigned char *buffer,
                        const size_t buffer_len, Fish *Algorithm,
-                       unsigned char *cbcbuffer);
+                       unsigned char *cbcbuffer, SHA256 *fileHash = NULL);
 
 // _writecbc will throw(EIO) iff a write fail occurs!
 extern size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length,
                         unsigned char type, Fish *Algorithm,
-                        unsigned char *cbcbuffer);
+                        unsigned char *cbcbuffer, SHA256 *fileHash = NULL);
 
 // typeless version for V4 content:
 extern size_t _writecbc(FILE *fp, const unsigned char *buffer, size_t length,
-                        Fish *Algorithm, unsigned char *cbcbuffer);
+                        Fish *Algorithm, unsigned char *cbcbuffer,
+                        SHA256 *fileHash = NULL);
 
 
 // The following can be used directly or via template functions getInt<> / putInt<>
@@ -285,6 +285,9 @@ void XMLFileHandlers::ProcessEndElement(const int icurrent_element)
     case XLE_PREF_COPYPASSWORDWHENBROWSETOURL:
       bpref = PWSprefs::CopyPasswordWhenBrowseToURL;
       break;
+    case XLE_PREF_COMPRESSATTACHMENTS:
+      bpref = PWSprefs::CompressAttachments;
+      break;
     // Integer DB preferences
     case XLE_PREF_PWDEFAULTLENGTH:
       if (m_bPolicyBeingProcessed)
@@ -54,6 +54,7 @@ const XMLFileValidation::st_file_elements XMLFileValidation::m_file_elements[XLE
   {_T("UseDefaultUser"), {XLE_PREF_USEDEFAULTUSER, 0}},
   {_T("PWDefaultLength"), {XLE_PREF_PWDEFAULTLENGTH, 0}},
   {_T("LockDBOnIdleTimeout"), {XLE_PREF_LOCKDBONIDLETIMEOUT, 0}},
+  {_T("CompressAttachments"), {XLE_PREF_COMPRESSATTACHMENTS, 0}},
   {_T("IdleTimeout"), {XLE_PREF_IDLETIMEOUT, 0}},
   {_T("TreeDisplayStatusAtOpen"), {XLE_PREF_TREEDISPLAYSTATUSATOPEN, 0}},
   {_T("NumPWHistoryDefault"), {XLE_PREF_NUMPWHISTORYDEFAULT, 0}},
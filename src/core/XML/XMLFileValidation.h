@@ -59,6 +59,7 @@ enum XLE_PASSWORDSAFE {
   XLE_PREF_PWMAKEPRONOUNCEABLE,
   XLE_PREF_LOCKDBONIDLETIMEOUT,
   XLE_PREF_COPYPASSWORDWHENBROWSETOURL,
+  XLE_PREF_COMPRESSATTACHMENTS,
 
   //  Integer Preferences
   XLE_PREF_PWDEFAULTLENGTH,
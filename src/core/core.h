@@ -285,6 +285,13 @@
 #define IDSC_EMPTYGROUPS                3458
 #define IDSC_IMPORTEDEMPTYGROUPS        3459
 #define IDSC_FILTERSEXPORTEDTODB        3460
+#define IDSC_AUDIT_SUMMARY              3461
+#define IDSC_AUDIT_WEAK                 3462
+#define IDSC_AUDIT_NONCONFORMING        3463
+#define IDSC_AUDIT_REUSED               3464
+#define IDSC_AUDIT_ENTROPY              3465
+#define IDSC_AUDIT_HISTORY              3466
+#define IDSC_ATTSHARED                  3467
 
 // Keep DCA together
 #define IDSC_CURRENTDEFAULTDCA          4000
@@ -11,6 +11,7 @@
 #include <map>
 #include <vector>
 #include <set>
+#include <unordered_set>
 #include <list>
 #include <algorithm>  // For std::sort & std::unique used by st_DBChangeStatus
 
@@ -69,6 +70,31 @@ struct st_GroupTitleUser {
     else
       return gtu1.user.compare(gtu2.user) < 0;
   }
+
+  friend bool operator== (const st_GroupTitleUser &gtu1,
+                          const st_GroupTitleUser &gtu2)
+  {
+    return gtu1.group == gtu2.group && gtu1.title == gtu2.title &&
+      gtu1.user == gtu2.user;
+  }
+
+  // For unordered containers: FNV-1a over the fields, with a separator
+  // so that e.g., ("ab", "c") and ("a", "bc") hash differently
+  struct Hash {
+    size_t operator()(const st_GroupTitleUser &gtu) const
+    {
+      size_t h = 2166136261U;
+      const StringX *fields[] = {&gtu.group, &gtu.title, &gtu.user};
+      for (int i = 0; i < 3; i++) {
+        for (auto iter = fields[i]->begin(); iter != fields[i]->end(); iter++) {
+          h ^= static_cast<size_t>(*iter);
+          h *= 16777619U;
+        }
+        h *= 16777619U;
+      }
+      return h;
+    }
+  };
 };
 
 struct st_PWH_status {
@@ -189,6 +215,7 @@ typedef std::map<pws_os::CUUID, st_PWH_status, std::less<pws_os::CUUID> > SavePW
 
 typedef std::set<st_GroupTitleUser> GTUSet;
 typedef std::pair<GTUSet::iterator, bool > GTUSetPair;
+typedef std::unordered_set<st_GroupTitleUser, st_GroupTitleUser::Hash> GTUHashSet;
 
 typedef std::set<pws_os::CUUID> UUIDSet;
 typedef std::pair<UUIDSet::iterator, bool > UUIDSetPair;
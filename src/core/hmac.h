@@ -15,6 +15,7 @@
 // HMAC algorithm as per RFC2104
 
 #include "Util.h" // for ASSERT
+#include "sha256.h"
 
 class HMAC_BASE
 {
@@ -131,6 +132,153 @@ private:
   unsigned char K[BLOCKSIZE];
 };
 
+// HMAC-SHA256 that hashes the key's inner and outer pads once, in Init(),
+// and keeps the resulting midstates. Each Final() then costs two
+// compressions for a short message, with no heap allocation, and leaves
+// the object keyed, so it can be reused for another Update()/Final()
+// without calling Init() again.
+class HMAC_SHA256 : public HMAC_BASE
+{
+public:
+  enum {HASHLEN = SHA256::HASHLEN, BLOCKSIZE = SHA256::BLOCKSIZE};
+
+  HMAC_SHA256(const unsigned char *key, unsigned long keylen)
+    : HMAC_BASE(), m_bKeyed(false)
+  {
+    Init(key, keylen);
+  }
+
+  HMAC_SHA256() : HMAC_BASE(), m_bKeyed(false)
+  { // Init needs to be called separately
+  }
+
+  ~HMAC_SHA256()
+  {
+    trashMemory(m_istate, sizeof(m_istate));
+    trashMemory(m_ostate, sizeof(m_ostate));
+  }
+
+  unsigned int GetBlockSize() const {return BLOCKSIZE;}
+  unsigned int GetHashLen() const {return HASHLEN;}
+  bool IsInited() const {return m_bKeyed;}
+
+  void Init(const unsigned char *key, unsigned long keylen)
+  {
+    ASSERT(key != NULL || keylen == 0);
+    unsigned char K[BLOCKSIZE];
+    memset(K, 0, sizeof(K));
+    if (keylen > BLOCKSIZE) {
+      SHA256 H0;
+      H0.Update(key, keylen);
+      H0.Final(K);
+    } else if (keylen > 0) {
+      memcpy(K, key, keylen);
+    }
+
+    unsigned char pad[BLOCKSIZE];
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+      pad[i] = K[i] ^ 0x36;
+    memcpy(m_istate, SHA256::IV, sizeof(m_istate));
+    SHA256::Compress(m_istate, pad);
+    for (unsigned int i = 0; i < BLOCKSIZE; i++)
+      pad[i] = K[i] ^ 0x5c;
+    memcpy(m_ostate, SHA256::IV, sizeof(m_ostate));
+    SHA256::Compress(m_ostate, pad);
+
+    trashMemory(pad, sizeof(pad));
+    trashMemory(K, sizeof(K));
+    burnStack(SHA256::BurnSize);
+
+    m_inner = SHA256(m_istate, 1);
+    m_bKeyed = true;
+  }
+
+  void Update(const unsigned char *in, unsigned long inlen)
+  {
+    ASSERT(m_bKeyed);
+    m_inner.Update(in, inlen);
+  }
+
+  void Final(unsigned char digest[HASHLEN])
+  {
+    ASSERT(m_bKeyed);
+    unsigned char d[HASHLEN];
+    m_inner.Final(d);
+    SHA256 outer(m_ostate, 1);
+    outer.Update(d, HASHLEN);
+    trashMemory(d, HASHLEN);
+    outer.Final(digest);
+    m_inner = SHA256(m_istate, 1); // ready for the next message
+  }
+
+  // PBKDF2 (RFC2898 Section 5.2) with this HMAC, keyed with the password,
+  // as PRF. Every iteration after the first is an HMAC of the previous
+  // 32-byte result, which fits in one padded block, so the loop works
+  // on the state words directly: two compressions per iteration.
+  void PBKDF2(const unsigned char *salt, unsigned long salt_len,
+              unsigned int iteration_count,
+              unsigned char *out, unsigned long outlen)
+  {
+    ASSERT(m_bKeyed);
+    ASSERT(salt != NULL || salt_len == 0);
+    ASSERT(out != NULL);
+
+    // Message block for HMAC of a digest: the digest, then padding
+    // and the bit length of the pad plus digest
+    unsigned char block[BLOCKSIZE];
+    memset(block, 0, sizeof(block));
+    block[HASHLEN] = 0x80;
+    STORE64H(ulong64(BLOCKSIZE + HASHLEN) * 8, block + BLOCKSIZE - 8);
+
+    ulong32 U[8], T[8];
+    unsigned char digest[HASHLEN];
+    for (ulong32 blkno = 1; outlen != 0; blkno++) {
+      // U_1 = PRF(P, S || INT(blkno))
+      unsigned char b[4];
+      STORE32H(blkno, b);
+      Update(salt, salt_len);
+      Update(b, sizeof(b));
+      Final(digest);
+      for (int i = 0; i < 8; i++) {
+        LOAD32H(U[i], digest + 4 * i);
+        T[i] = U[i];
+      }
+
+      for (unsigned int itts = 1; itts < iteration_count; itts++) {
+        for (int i = 0; i < 8; i++)
+          STORE32H(U[i], block + 4 * i);
+        memcpy(U, m_istate, sizeof(U));
+        SHA256::Compress(U, block);
+        for (int i = 0; i < 8; i++)
+          STORE32H(U[i], block + 4 * i);
+        memcpy(U, m_ostate, sizeof(U));
+        SHA256::Compress(U, block);
+        for (int i = 0; i < 8; i++)
+          T[i] ^= U[i];
+      }
+
+      for (int i = 0; i < 8; i++)
+        STORE32H(T[i], digest + 4 * i);
+      const unsigned long n = outlen < HASHLEN ? outlen :
+        static_cast<unsigned long>(HASHLEN);
+      memcpy(out, digest, n);
+      out += n;
+      outlen -= n;
+    }
+
+    trashMemory(block, sizeof(block));
+    trashMemory(digest, sizeof(digest));
+    trashMemory(U, sizeof(U));
+    trashMemory(T, sizeof(T));
+    burnStack(SHA256::BurnSize);
+  }
+
+private:
+  bool m_bKeyed;
+  ulong32 m_istate[8], m_ostate[8]; // after hashing K^ipad, K^opad
+  SHA256 m_inner;
+};
+
 #endif /* __HMAC_H */
 //-----------------------------------------------------------------------------
 // Local variables:
@@ -171,14 +171,31 @@ static void  sha256_compress(ulong32 state[8], const unsigned char *buf)
   }
 }
 
+const unsigned long SHA256::BurnSize = sizeof(unsigned long) * 74;
+
 #ifdef LTC_CLEAN_STACK
 static void sha256_compress(ulong32 state[8], const unsigned char *buf)
 {
   _sha256_compress(state, buf);
-  burnStack(sizeof(unsigned long) * 74);
+  burnStack(SHA256::BurnSize);
+}
+
+void SHA256::Compress(ulong32 st[8], const unsigned char block[BLOCKSIZE])
+{
+  _sha256_compress(st, block);
+}
+#else
+void SHA256::Compress(ulong32 st[8], const unsigned char block[BLOCKSIZE])
+{
+  sha256_compress(st, block);
 }
 #endif
 
+const ulong32 SHA256::IV[8] = {
+  0x6A09E667UL, 0xBB67AE85UL, 0x3C6EF372UL, 0xA54FF53AUL,
+  0x510E527FUL, 0x9B05688CUL, 0x1F83D9ABUL, 0x5BE0CD19UL
+};
+
 /*
   Initialize the hash state
 */
@@ -186,14 +203,16 @@ SHA256::SHA256()
 {
   curlen = 0;
   length = 0;
-  state[0] = 0x6A09E667UL;
-  state[1] = 0xBB67AE85UL;
-  state[2] = 0x3C6EF372UL;
-  state[3] = 0xA54FF53AUL;
-  state[4] = 0x510E527FUL;
-  state[5] = 0x9B05688CUL;
-  state[6] = 0x1F83D9ABUL;
-  state[7] = 0x5BE0CD19UL;
+  for (int i = 0; i < 8; i++)
+    state[i] = IV[i];
+}
+
+SHA256::SHA256(const ulong32 midstate[8], size_t nBlocks)
+{
+  curlen = 0;
+  length = ulong64(nBlocks) * BLOCKSIZE * 8;
+  for (int i = 0; i < 8; i++)
+    state[i] = midstate[i];
 }
 
 SHA256::~SHA256()
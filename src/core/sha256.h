@@ -20,10 +20,20 @@ class SHA256
 public:
   enum {HASHLEN = 32, BLOCKSIZE = 64};
   SHA256();
+  // Resume from a chaining state saved after nBlocks whole blocks,
+  // e.g., HMAC_SHA256's keyed pads (see hmac.h)
+  SHA256(const ulong32 midstate[8], size_t nBlocks);
   ~SHA256();
   void Update(const unsigned char *in, size_t inlen);
   void Final(unsigned char digest[HASHLEN]);
 
+  // The raw block function, for code that keeps its own chaining state.
+  // Unlike Update(), doesn't burn the stack after each block - callers
+  // handling secrets should call burnStack(BurnSize) when done.
+  static void Compress(ulong32 st[8], const unsigned char block[BLOCKSIZE]);
+  static const ulong32 IV[8];
+  static const unsigned long BurnSize;
+
 private:
   ulong64 length;
   size_t curlen;
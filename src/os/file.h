@@ -13,16 +13,33 @@
 #include <vector>
 
 namespace pws_os {
+  // Filesystem-level identity of a file's current contents. Any rewrite,
+  // replacement or truncation of the file changes at least one member.
+  struct FileStamp {
+    ulong64 id;       // inode (Unix) or volume serial ^ file index (Windows)
+    ulong64 length;
+    time_t mtime;
+    long mtime_nsec;  // sub-second part of mtime, 0 if unsupported
+    bool operator==(const FileStamp &that) const
+    {return id == that.id && length == that.length &&
+        mtime == that.mtime && mtime_nsec == that.mtime_nsec;}
+    bool operator!=(const FileStamp &that) const {return !(*this == that);}
+  };
+
   extern void AddDrive(stringT &path);
   extern bool FileExists(const stringT &filename);
   extern bool FileExists(const stringT &filename, bool &bReadOnly);
   extern bool RenameFile(const stringT &oldname, const stringT &newname);
+  // ReplaceAFile: flush tmpname to disk & atomically rename it to filename,
+  // replacing any existing file. Both must be on the same filesystem.
+  extern bool ReplaceAFile(const stringT &tmpname, const stringT &filename);
   extern bool CopyAFile(const stringT &from, const stringT &to); // creates dirs as needed!
   extern bool DeleteAFile(const stringT &filename);
   extern void FindFiles(const stringT &filter, std::vector<stringT> &res);
   extern bool LockFile(const stringT &filename, stringT &locker,
                        HANDLE &lockFileHandle, int &LockCount);
   extern bool IsLockedFile(const stringT &filename);
+  extern stringT GetLockFileName(const stringT &filename);
   extern void UnlockFile(const stringT &filename,
                          HANDLE &lockFileHandle, int &LockCount);
 
@@ -32,6 +49,7 @@ namespace pws_os {
       time_t &ctime, time_t &mtime, time_t &atime);
   extern bool SetFileTimes(const stringT &filename,
       time_t ctime, time_t mtime, time_t atime);
+  extern bool GetFileStamp(const stringT &filename, FileStamp &stamp);
   extern const TCHAR PathSeparator; // slash for Unix, backslash for Windows
 }
 #endif /* __FILE_H */
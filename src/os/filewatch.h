@@ -0,0 +1,66 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+#ifndef __FILEWATCH_H
+#define __FILEWATCH_H
+
+//
+// filewatch.h
+// Watch a small set of files (typically the open database and its lock
+// file) for modifications made by other processes or machines.
+//
+// Linux implementation uses inotify on the files' directories, so that
+// files replaced via rename are handled. If inotify is unavailable (or
+// on other platforms), the files are polled.
+//
+// A change is only reported if the file's stamp (see file.h) differs from
+// the one recorded when watching started, or when Resume() was last called.
+// Bursts of events are coalesced: the callback is invoked once, after no
+// further events arrived for the debounce period.
+//-----------------------------------------------------------------------------
+
+#include "typedefs.h"
+
+#include <vector>
+#include <functional>
+
+class CFileWatcherImpl; // for os-specific stuff
+
+class CFileWatcher
+{
+public:
+  // Called from the watcher's thread, NOT the caller's!
+  // Argument is the subset of watched files that have changed.
+  typedef std::function<void(const std::vector<stringT> &)> Callback;
+
+  CFileWatcher(unsigned debounceMS = 500, unsigned pollMS = 2000);
+  ~CFileWatcher();
+
+  bool Start(const std::vector<stringT> &files, const Callback &callback);
+  void Stop(); // idempotent, blocks until watcher thread has exited
+
+  // Bracket our own changes to the watched files with these, so that
+  // they're not reported. Calls may be nested.
+  void Suspend();
+  void Resume();
+
+  bool IsWatching() const;
+  bool IsPolling() const; // true if fallen back to polling
+
+private:
+  CFileWatcher(const CFileWatcher &); // Do not implement
+  CFileWatcher &operator=(const CFileWatcher &); // Do not implement
+
+  CFileWatcherImpl *m_impl;
+};
+
+#endif /* __FILEWATCH_H */
+//-----------------------------------------------------------------------------
+// Local variables:
+// mode: c++
+// End:
@@ -88,6 +88,36 @@ bool pws_os::RenameFile(const stringT &oldname, const stringT &newname)
   return (status == 0);
 }
 
+bool pws_os::ReplaceAFile(const stringT &tmpname, const stringT &filename)
+{
+  int status;
+#ifndef UNICODE
+  const char *tmpfn = tmpname.c_str();
+  const char *fn = filename.c_str();
+#else
+  size_t tmpN = wcstombs(NULL, tmpname.c_str(), 0) + 1;
+  char *tmpfn = new char[tmpN];
+  wcstombs(tmpfn, tmpname.c_str(), tmpN);
+  size_t N = wcstombs(NULL, filename.c_str(), 0) + 1;
+  char *fn = new char[N];
+  wcstombs(fn, filename.c_str(), N);
+#endif /* UNICODE */
+  // Data must be on disk before the rename makes it visible.
+  // On OS X, only F_FULLFSYNC really guarantees that.
+  int fd = ::open(tmpfn, O_RDONLY);
+  if (fd != -1) {
+    if (::fcntl(fd, F_FULLFSYNC) == -1)
+      ::fsync(fd);
+    ::close(fd);
+  }
+  status = ::rename(tmpfn, fn);
+#ifdef UNICODE
+  delete[] tmpfn;
+  delete[] fn;
+#endif
+  return (status == 0);
+}
+
 bool pws_os::CopyAFile(const stringT &from, const stringT &to)
 {
   const char *szfrom = NULL;
@@ -228,7 +258,7 @@ void pws_os::FindFiles(const stringT &filter, vector<stringT> &res)
   free(namelist);
 }
 
-static stringT GetLockFileName(const stringT &filename)
+stringT pws_os::GetLockFileName(const stringT &filename)
 {
   assert(!filename.empty());
   // derive lock filename from filename
@@ -383,6 +413,24 @@ bool pws_os::GetFileTimes(const stringT &filename,
   }
 }
 
+bool pws_os::GetFileStamp(const stringT &filename, FileStamp &stamp)
+{
+  struct stat info;
+  size_t N = wcstombs(NULL, filename.c_str(), 0) + 1;
+  char *fn = new char[N];
+  wcstombs(fn, filename.c_str(), N);
+  int status = ::stat(fn, &info);
+  delete[] fn;
+  if (status != 0)
+    return false;
+
+  stamp.id = (ulong64(info.st_dev) << 32) ^ ulong64(info.st_ino);
+  stamp.length = ulong64(info.st_size);
+  stamp.mtime = info.st_mtime;
+  stamp.mtime_nsec = long(info.st_mtimespec.tv_nsec);
+  return true;
+}
+
 bool pws_os::SetFileTimes(const stringT &filename,
       time_t ctime, time_t mtime, time_t atime)
 {
@@ -19,6 +19,15 @@
 #include <cassert>
 #include <fstream>
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> // for FICLONE
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 27))
+#define PWS_HAVE_COPY_FILE_RANGE
+#endif
+#endif
+
 #include <dirent.h>
 #include <fnmatch.h>
 #ifndef __FreeBSD__
@@ -76,6 +85,102 @@ bool pws_os::RenameFile(const stringT &oldname, const stringT &newname)
   return (status == 0);
 }
 
+bool pws_os::ReplaceAFile(const stringT &tmpname, const stringT &filename)
+{
+  size_t tmpN = wcstombs(NULL, tmpname.c_str(), 0) + 1;
+  char *tmpfn = new char[tmpN];
+  wcstombs(tmpfn, tmpname.c_str(), tmpN);
+  size_t N = wcstombs(NULL, filename.c_str(), 0) + 1;
+  char *fn = new char[N];
+  wcstombs(fn, filename.c_str(), N);
+
+  // Make sure the data's on disk before the rename makes it visible,
+  // else a crash could leave us with an empty file under the real name
+  int fd = ::open(tmpfn, O_RDONLY);
+  if (fd != -1) {
+    ::fsync(fd);
+    ::close(fd);
+  }
+
+  const bool retval = (::rename(tmpfn, fn) == 0);
+
+  if (retval) { // persist the rename itself
+    string dir(fn);
+    string::size_type slash = dir.find_last_of('/');
+    dir = (slash == string::npos) ? "." : (slash == 0 ? "/" : dir.substr(0, slash));
+    int dfd = ::open(dir.c_str(), O_RDONLY);
+    if (dfd != -1) {
+      ::fsync(dfd);
+      ::close(dfd);
+    }
+  }
+  delete[] tmpfn;
+  delete[] fn;
+  return retval;
+}
+
+/*
+ * Copy the contents of src to the (empty) dst, trying the cheapest
+ * method first:
+ * 1. Clone (reflink) - shares extents on CoW filesystems (btrfs, xfs, ...)
+ * 2. copy_file_range - in-kernel copy, server-side on NFS 4.2 & CIFS
+ * 3. sendfile - in-kernel copy, any filesystem
+ * 4. Plain read/write
+ * Each method picks up where the previous left off, so falling back
+ * after a partial copy is safe.
+ */
+static bool CopyFileData(int src, int dst, off_t size)
+{
+#ifdef FICLONE
+  if (::ioctl(dst, FICLONE, src) == 0)
+    return true;
+#endif
+
+  off_t done = 0;
+
+#ifdef PWS_HAVE_COPY_FILE_RANGE
+  while (done < size) {
+    loff_t in_off = done, out_off = done;
+    ssize_t n = ::copy_file_range(src, &in_off, dst, &out_off,
+                                  size_t(size - done), 0);
+    if (n <= 0)
+      break; // EXDEV, ENOSYS, EOPNOTSUPP... or unexpected EOF
+    done += n;
+  }
+#endif
+
+#ifdef __linux__
+  while (done < size) {
+    off_t in_off = done;
+    if (::lseek(dst, done, SEEK_SET) == -1)
+      break;
+    ssize_t n = ::sendfile(dst, src, &in_off, size_t(size - done));
+    if (n <= 0)
+      break;
+    done += n;
+  }
+#endif
+
+  if (done < size) {
+    if (::lseek(src, done, SEEK_SET) == -1 || ::lseek(dst, done, SEEK_SET) == -1)
+      return false;
+    const size_t BUFSIZE = 65536;
+    char *buf = new char[BUFSIZE];
+    ssize_t n;
+    while ((n = ::read(src, buf, BUFSIZE)) > 0) {
+      if (::write(dst, buf, size_t(n)) != n) {
+        n = -1;
+        break;
+      }
+      done += n;
+    }
+    delete[] buf;
+    if (n < 0)
+      return false;
+  }
+  return true;
+}
+
 bool pws_os::CopyAFile(const stringT &from, const stringT &to)
 {
   const char *szfrom = NULL;
@@ -88,35 +193,30 @@ bool pws_os::CopyAFile(const stringT &from, const stringT &to)
   assert(tosize > 0);
   szto = new char[tosize];
   wcstombs(const_cast<char *>(szto), to.c_str(), tosize);
-  // can we read the source?
-  bool readable = ::access(szfrom, R_OK) == 0;
-  if (!readable) {
-    retval = false;
-  } else { // creates dirs as needed
 
+  int src = ::open(szfrom, O_RDONLY);
+  struct stat statbuf;
+  if (src != -1 && ::fstat(src, &statbuf) == 0) { // creates dirs as needed
     string cto(szto);
     string::size_type start = (cto[0] == '/') ? 1 : 0;
     string::size_type stop;
     do {
       stop = cto.find_first_of("/", start);
       if (stop != stringT::npos)
-        ::mkdir(cto.substr(start, stop).c_str(), 0700); // fail if already there - who cares?
+        ::mkdir(cto.substr(0, stop).c_str(), 0700); // fail if already there - who cares?
       start = stop + 1;
     } while (stop != stringT::npos);
 
-    ifstream src(szfrom, ios_base::in|ios_base::binary);
-    ofstream dst(szto, ios_base::out|ios_base::binary);
-    const size_t BUFSIZE = 2048;
-    char buf[BUFSIZE];
-    streamsize readBytes;
-
-    do {
-      src.read(buf, BUFSIZE);
-      readBytes = src.gcount();
-      dst.write(buf, readBytes);
-    } while(readBytes != 0);
-    retval = true;
+    int dst = ::open(szto, O_WRONLY | O_CREAT | O_TRUNC,
+                     statbuf.st_mode & (S_IRWXU | S_IRWXG | S_IRWXO));
+    if (dst != -1) {
+      retval = CopyFileData(src, dst, statbuf.st_size);
+      if (::close(dst) != 0)
+        retval = false;
+    }
   }
+  if (src != -1)
+    ::close(src);
   delete[] szfrom;
   delete[] szto;
   return retval;
@@ -182,7 +282,7 @@ void pws_os::FindFiles(const stringT &filter, vector<stringT> &res)
   free(namelist);
 }
 
-static stringT GetLockFileName(const stringT &filename)
+stringT pws_os::GetLockFileName(const stringT &filename)
 {
   assert(!filename.empty());
   // derive lock filename from filename
@@ -323,6 +423,24 @@ bool pws_os::GetFileTimes(const stringT &filename,
   }
 }
 
+bool pws_os::GetFileStamp(const stringT &filename, FileStamp &stamp)
+{
+  struct stat info;
+  size_t N = wcstombs(NULL, filename.c_str(), 0) + 1;
+  char *fn = new char[N];
+  wcstombs(fn, filename.c_str(), N);
+  int status = ::stat(fn, &info);
+  delete[] fn;
+  if (status != 0)
+    return false;
+
+  stamp.id = (ulong64(info.st_dev) << 32) ^ ulong64(info.st_ino);
+  stamp.length = ulong64(info.st_size);
+  stamp.mtime = info.st_mtime;
+  stamp.mtime_nsec = long(info.st_mtim.tv_nsec);
+  return true;
+}
+
 bool pws_os::SetFileTimes(const stringT &filename,
       time_t ctime, time_t mtime, time_t atime)
 {
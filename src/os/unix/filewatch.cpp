@@ -0,0 +1,319 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+/**
+ * \file Linux-specific implementation of filewatch.h
+ * Uses inotify where available, polling otherwise (e.g., FreeBSD)
+ */
+
+#include "../filewatch.h"
+#include "../file.h"
+#include "../utf8conv.h"
+#include "../debug.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#define PWS_HAVE_INOTIFY
+#endif
+
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+class CFileWatcherImpl
+{
+public:
+  CFileWatcherImpl(unsigned debounceMS, unsigned pollMS)
+    : m_debounceMS(debounceMS), m_pollMS(pollMS), m_polling(false),
+      m_stop(false), m_suspended(0), m_inotify_fd(-1)
+  {m_wakeup[0] = m_wakeup[1] = -1;}
+
+  bool Start(const vector<stringT> &files, const CFileWatcher::Callback &cb);
+  void Stop();
+  void Suspend();
+  void Resume();
+
+  bool IsWatching() const {return m_thread.joinable();}
+  bool IsPolling() const {return m_polling;}
+
+private:
+  struct WatchedFile {
+    stringT name;
+    string dir, base; // narrow, for matching inotify events
+    bool exists;
+    pws_os::FileStamp stamp;
+  };
+
+  void Baseline(); // record current stamps, call with m_mutex held
+  vector<stringT> GetChanged(); // updates baseline
+  bool SetupInotify();
+  bool ReadInotifyEvents(); // true if any event concerned our files
+  void Run();
+
+  const unsigned m_debounceMS, m_pollMS;
+  bool m_polling;
+  atomic<bool> m_stop;
+  int m_suspended;
+
+  vector<WatchedFile> m_files;
+  CFileWatcher::Callback m_callback;
+  mutex m_mutex; // protects m_files & m_suspended
+  thread m_thread;
+
+  int m_inotify_fd;
+  int m_wakeup[2]; // pipe, to interrupt poll() on Stop()
+};
+
+void CFileWatcherImpl::Baseline()
+{
+  for (auto &wf : m_files)
+    wf.exists = pws_os::GetFileStamp(wf.name, wf.stamp);
+}
+
+vector<stringT> CFileWatcherImpl::GetChanged()
+{
+  vector<stringT> changed;
+  lock_guard<mutex> guard(m_mutex);
+  if (m_suspended > 0)
+    return changed;
+
+  for (auto &wf : m_files) {
+    pws_os::FileStamp stamp;
+    const bool exists = pws_os::GetFileStamp(wf.name, stamp);
+    if (exists != wf.exists || (exists && stamp != wf.stamp)) {
+      changed.push_back(wf.name);
+      wf.exists = exists;
+      wf.stamp = stamp;
+    }
+  }
+  return changed;
+}
+
+bool CFileWatcherImpl::SetupInotify()
+{
+#ifdef PWS_HAVE_INOTIFY
+  m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (m_inotify_fd == -1)
+    return false;
+
+  // Watch directories rather than the files themselves, as a save
+  // replaces the database (backup is renamed away, new file written)
+  const uint32_t mask = IN_CLOSE_WRITE | IN_MODIFY | IN_ATTRIB | IN_CREATE |
+                        IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO;
+  for (const auto &wf : m_files) {
+    if (inotify_add_watch(m_inotify_fd, wf.dir.c_str(), mask) == -1) {
+      pws_os::Trace(L"CFileWatcher: inotify_add_watch failed, errno %d\n", errno);
+      close(m_inotify_fd);
+      m_inotify_fd = -1;
+      return false;
+    }
+  }
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool CFileWatcherImpl::ReadInotifyEvents()
+{
+  bool retval = false;
+#ifdef PWS_HAVE_INOTIFY
+  char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+  ssize_t len;
+  while ((len = read(m_inotify_fd, buf, sizeof(buf))) > 0) {
+    for (char *ptr = buf; ptr < buf + len;
+         ptr += sizeof(struct inotify_event) + reinterpret_cast<struct inotify_event *>(ptr)->len) {
+      const struct inotify_event *event = reinterpret_cast<struct inotify_event *>(ptr);
+      if (event->len == 0)
+        continue;
+      for (const auto &wf : m_files) {
+        if (wf.base == event->name) {
+          retval = true;
+          break;
+        }
+      }
+    }
+  }
+#endif
+  return retval;
+}
+
+void CFileWatcherImpl::Run()
+{
+  bool pending = false;
+  Clock::time_point deadline;
+
+  while (!m_stop) {
+    int timeout;
+    if (pending) {
+      const auto remaining = chrono::duration_cast<chrono::milliseconds>(deadline - Clock::now()).count();
+      timeout = remaining > 0 ? int(remaining) : 0;
+    } else {
+      timeout = m_polling ? int(m_pollMS) : -1;
+    }
+
+    struct pollfd fds[2];
+    nfds_t nfds = 1;
+    fds[0].fd = m_wakeup[0];
+    fds[0].events = POLLIN;
+    if (!m_polling) {
+      fds[1].fd = m_inotify_fd;
+      fds[1].events = POLLIN;
+      nfds = 2;
+    }
+
+    int rc = ::poll(fds, nfds, timeout);
+    if (m_stop)
+      break;
+    if (rc < 0 && errno != EINTR)
+      break;
+
+    if (rc > 0 && !m_polling && (fds[1].revents & POLLIN) && ReadInotifyEvents()) {
+      // (Re)start debounce period
+      pending = true;
+      deadline = Clock::now() + chrono::milliseconds(m_debounceMS);
+      continue;
+    }
+
+    if (m_polling && rc == 0 && !pending) {
+      // Poll tick - the polling interval is debounce enough
+      pending = true;
+      deadline = Clock::now();
+    }
+
+    if (pending && Clock::now() >= deadline) {
+      pending = false;
+      const vector<stringT> changed = GetChanged();
+      if (!changed.empty() && m_callback)
+        m_callback(changed);
+    }
+  }
+}
+
+bool CFileWatcherImpl::Start(const vector<stringT> &files,
+                             const CFileWatcher::Callback &cb)
+{
+  Stop();
+  if (files.empty())
+    return false;
+
+  m_files.clear();
+  for (const auto &f : files) {
+    WatchedFile wf;
+    wf.name = f;
+    const string path = pws_os::tomb(f);
+    const string::size_type slash = path.find_last_of('/');
+    if (slash == string::npos) {
+      wf.dir = ".";
+      wf.base = path;
+    } else {
+      wf.dir = (slash == 0) ? "/" : path.substr(0, slash);
+      wf.base = path.substr(slash + 1);
+    }
+    m_files.push_back(wf);
+  }
+  Baseline();
+  m_callback = cb;
+  m_suspended = 0;
+  m_stop = false;
+
+  if (pipe(m_wakeup) == -1)
+    return false;
+  fcntl(m_wakeup[0], F_SETFL, O_NONBLOCK);
+
+  m_polling = !SetupInotify();
+  m_thread = thread(&CFileWatcherImpl::Run, this);
+  return true;
+}
+
+void CFileWatcherImpl::Stop()
+{
+  if (m_thread.joinable()) {
+    m_stop = true;
+    const char c = 'x';
+    if (write(m_wakeup[1], &c, 1) != 1)
+      pws_os::Trace(L"CFileWatcher: failed to wake watcher thread\n");
+    m_thread.join();
+  }
+  if (m_inotify_fd != -1) {
+    close(m_inotify_fd);
+    m_inotify_fd = -1;
+  }
+  for (int i = 0; i < 2; i++) {
+    if (m_wakeup[i] != -1) {
+      close(m_wakeup[i]);
+      m_wakeup[i] = -1;
+    }
+  }
+}
+
+void CFileWatcherImpl::Suspend()
+{
+  lock_guard<mutex> guard(m_mutex);
+  m_suspended++;
+}
+
+void CFileWatcherImpl::Resume()
+{
+  lock_guard<mutex> guard(m_mutex);
+  if (m_suspended > 0 && --m_suspended == 0)
+    Baseline(); // whatever we did while suspended is now the norm
+}
+
+//-----------------------------------------------------------------
+
+CFileWatcher::CFileWatcher(unsigned debounceMS, unsigned pollMS)
+  : m_impl(new CFileWatcherImpl(debounceMS, pollMS))
+{
+}
+
+CFileWatcher::~CFileWatcher()
+{
+  m_impl->Stop();
+  delete m_impl;
+}
+
+bool CFileWatcher::Start(const std::vector<stringT> &files, const Callback &callback)
+{
+  return m_impl->Start(files, callback);
+}
+
+void CFileWatcher::Stop()
+{
+  m_impl->Stop();
+}
+
+void CFileWatcher::Suspend()
+{
+  m_impl->Suspend();
+}
+
+void CFileWatcher::Resume()
+{
+  m_impl->Resume();
+}
+
+bool CFileWatcher::IsWatching() const
+{
+  return m_impl->IsWatching();
+}
+
+bool CFileWatcher::IsPolling() const
+{
+  return m_impl->IsPolling();
+}
@@ -120,6 +120,14 @@ bool pws_os::RenameFile(const stringT &oldname, const stringT &newname)
   return FileOP(oldname, newname, FO_MOVE);
 }
 
+bool pws_os::ReplaceAFile(const stringT &tmpname, const stringT &filename)
+{
+  // MoveFileEx replaces the target atomically on NTFS (same volume),
+  // and with MOVEFILE_WRITE_THROUGH only returns once it's on disk
+  return MoveFileEx(tmpname.c_str(), filename.c_str(),
+                    MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) == TRUE;
+}
+
 extern bool pws_os::CopyAFile(const stringT &from, const stringT &to)
 {
   return FileOP(from, to, FO_COPY);
@@ -157,7 +165,7 @@ void pws_os::FindFiles(const stringT &filter, std::vector<stringT> &res)
 * Thanks to Frank (xformer) for discussion on the subject.
 */
 
-static stringT GetLockFileName(const stringT &filename)
+stringT pws_os::GetLockFileName(const stringT &filename)
 {
   ASSERT(!filename.empty());
   // derive lock filename from filename
@@ -460,3 +468,31 @@ bool pws_os::SetFileTimes(const stringT &filename,
     return false;
   }
 }
+
+bool pws_os::GetFileStamp(const stringT &filename, FileStamp &stamp)
+{
+  // Zero access rights: we only want the metadata, and don't want
+  // to interfere with whoever else has the file open
+  HANDLE hFile = CreateFile(filename.c_str(), 0,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (hFile == INVALID_HANDLE_VALUE)
+    return false;
+
+  BY_HANDLE_FILE_INFORMATION info;
+  BOOL brc = GetFileInformationByHandle(hFile, &info);
+  CloseHandle(hFile);
+  if (!brc)
+    return false;
+
+  const ulong64 index = (ulong64(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+  const ulong64 ft = (ulong64(info.ftLastWriteTime.dwHighDateTime) << 32) |
+                     info.ftLastWriteTime.dwLowDateTime;
+
+  stamp.id = (ulong64(info.dwVolumeSerialNumber) << 32) ^ index;
+  stamp.length = (ulong64(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+  // FILETIME is in 100ns units since 1601-01-01
+  stamp.mtime = time_t((ft - 116444736000000000ULL) / 10000000ULL);
+  stamp.mtime_nsec = long((ft % 10000000ULL) * 100);
+  return true;
+}
@@ -0,0 +1,178 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+
+/**
+ * \file Windows-specific implementation of filewatch.h
+ * Polling only for now - ReadDirectoryChangesW would be the way to go.
+ */
+
+#include "../filewatch.h"
+#include "../file.h"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+using namespace std;
+
+class CFileWatcherImpl
+{
+public:
+  CFileWatcherImpl(unsigned pollMS)
+    : m_pollMS(pollMS), m_stop(false), m_suspended(0) {}
+
+  bool Start(const vector<stringT> &files, const CFileWatcher::Callback &cb);
+  void Stop();
+  void Suspend();
+  void Resume();
+
+  bool IsWatching() const {return m_thread.joinable();}
+
+private:
+  struct WatchedFile {
+    stringT name;
+    bool exists;
+    pws_os::FileStamp stamp;
+  };
+
+  void Baseline(); // call with m_mutex held
+  void Run();
+
+  const unsigned m_pollMS;
+  bool m_stop;
+  int m_suspended;
+  vector<WatchedFile> m_files;
+  CFileWatcher::Callback m_callback;
+  mutex m_mutex; // protects all of the above
+  condition_variable m_cv;
+  thread m_thread;
+};
+
+void CFileWatcherImpl::Baseline()
+{
+  for (auto &wf : m_files)
+    wf.exists = pws_os::GetFileStamp(wf.name, wf.stamp);
+}
+
+void CFileWatcherImpl::Run()
+{
+  unique_lock<mutex> lock(m_mutex);
+  while (!m_cv.wait_for(lock, chrono::milliseconds(m_pollMS),
+                        [this] {return m_stop;})) {
+    if (m_suspended > 0)
+      continue;
+
+    vector<stringT> changed;
+    for (auto &wf : m_files) {
+      pws_os::FileStamp stamp;
+      const bool exists = pws_os::GetFileStamp(wf.name, stamp);
+      if (exists != wf.exists || (exists && stamp != wf.stamp)) {
+        changed.push_back(wf.name);
+        wf.exists = exists;
+        wf.stamp = stamp;
+      }
+    }
+
+    if (!changed.empty() && m_callback) {
+      lock.unlock();
+      m_callback(changed);
+      lock.lock();
+    }
+  }
+}
+
+bool CFileWatcherImpl::Start(const vector<stringT> &files,
+                             const CFileWatcher::Callback &cb)
+{
+  Stop();
+  if (files.empty())
+    return false;
+
+  lock_guard<mutex> guard(m_mutex);
+  m_files.clear();
+  for (const auto &f : files) {
+    WatchedFile wf;
+    wf.name = f;
+    m_files.push_back(wf);
+  }
+  Baseline();
+  m_callback = cb;
+  m_suspended = 0;
+  m_stop = false;
+  m_thread = thread(&CFileWatcherImpl::Run, this);
+  return true;
+}
+
+void CFileWatcherImpl::Stop()
+{
+  if (m_thread.joinable()) {
+    {
+      lock_guard<mutex> guard(m_mutex);
+      m_stop = true;
+    }
+    m_cv.notify_all();
+    m_thread.join();
+  }
+}
+
+void CFileWatcherImpl::Suspend()
+{
+  lock_guard<mutex> guard(m_mutex);
+  m_suspended++;
+}
+
+void CFileWatcherImpl::Resume()
+{
+  lock_guard<mutex> guard(m_mutex);
+  if (m_suspended > 0 && --m_suspended == 0)
+    Baseline();
+}
+
+//-----------------------------------------------------------------
+
+CFileWatcher::CFileWatcher(unsigned, unsigned pollMS)
+  : m_impl(new CFileWatcherImpl(pollMS))
+{
+}
+
+CFileWatcher::~CFileWatcher()
+{
+  m_impl->Stop();
+  delete m_impl;
+}
+
+bool CFileWatcher::Start(const std::vector<stringT> &files, const Callback &callback)
+{
+  return m_impl->Start(files, callback);
+}
+
+void CFileWatcher::Stop()
+{
+  m_impl->Stop();
+}
+
+void CFileWatcher::Suspend()
+{
+  m_impl->Suspend();
+}
+
+void CFileWatcher::Resume()
+{
+  m_impl->Resume();
+}
+
+bool CFileWatcher::IsWatching() const
+{
+  return m_impl->IsWatching();
+}
+
+bool CFileWatcher::IsPolling() const
+{
+  return true;
+}
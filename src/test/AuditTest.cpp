@@ -0,0 +1,150 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// AuditTest.cpp: Unit test for PWScore::AuditPasswords
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWScore.h"
+#include "core/PWCharPool.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+// A fixture for factoring common code across tests
+class AuditTest : public ::testing::Test
+{
+protected:
+  AuditTest() {}
+
+  pws_os::CUUID AddEntry(const StringX &title, const StringX &password)
+  {
+    CItemData di;
+    di.CreateUUID();
+    di.SetTitle(title);
+    di.SetPassword(password);
+    core.Execute(AddEntryCommand::Create(&core, di));
+    return di.GetUUID();
+  }
+
+  PWScore core;
+};
+
+// And now the tests...
+
+TEST_F(AuditTest, Entropy)
+{
+  EXPECT_EQ(0.0, CPasswordCharPool::EstimateEntropy(L""));
+  // repeats & sequences are cheap
+  EXPECT_LT(CPasswordCharPool::EstimateEntropy(L"aaaaaaaaaaaaaaaa"), 25.0);
+  EXPECT_LT(CPasswordCharPool::EstimateEntropy(L"1234567890123"), 25.0);
+  EXPECT_GT(CPasswordCharPool::EstimateEntropy(L"q7#Lx9!vR2@m"), 70.0);
+  EXPECT_LT(CPasswordCharPool::EstimateEntropy(L"qwpzxv"),
+            CPasswordCharPool::EstimateEntropy(L"qwpzxvQ"));
+}
+
+TEST_F(AuditTest, WeakAndReused)
+{
+  const StringX strong1(L"q7#Lx9!vR2@mZ4"), strong2(L"T8$kp3&Wn5^cY1");
+  // Enough entries for several threads
+  for (int i = 0; i < 300; i++) {
+    stringT title;
+    Format(title, L"filler %d", i);
+    AddEntry(title.c_str(), StringX(L"Fp9#") + title.c_str() + L"!zQ");
+  }
+  const pws_os::CUUID weak = AddEntry(L"weak", L"password");
+  const pws_os::CUUID reuse1 = AddEntry(L"reuse1", strong1);
+  const pws_os::CUUID reuse2 = AddEntry(L"reuse2", strong1);
+  const pws_os::CUUID other = AddEntry(L"other", strong2);
+
+  st_AuditOptions st_ao;
+  st_ao.nThreads = 4;
+  st_AuditResults st_ar;
+  CReport rpt;
+  core.AuditPasswords(st_ao, st_ar, &rpt);
+
+  EXPECT_EQ(304, st_ar.numEntries);
+  EXPECT_EQ(304, st_ar.numPasswords);
+  EXPECT_EQ(1, st_ar.numWeak);
+  ASSERT_EQ(1, st_ar.vFlagged.size());
+  EXPECT_EQ(weak, st_ar.vFlagged[0].uuid);
+  EXPECT_EQ(2, st_ar.numReused);
+  ASSERT_EQ(1, st_ar.vReused.size());
+  ASSERT_EQ(2, st_ar.vReused[0].size());
+  EXPECT_TRUE((st_ar.vReused[0][0].uuid == reuse1 && st_ar.vReused[0][1].uuid == reuse2) ||
+              (st_ar.vReused[0][0].uuid == reuse2 && st_ar.vReused[0][1].uuid == reuse1));
+
+  // Report mentions entries, never passwords
+  const StringX sxReport = rpt.GetString();
+  EXPECT_NE(StringX::npos, sxReport.find(L"reuse2"));
+  EXPECT_EQ(StringX::npos, sxReport.find(strong1));
+
+  // Single-threaded gives same results
+  st_AuditResults st_ar1;
+  st_ao.nThreads = 1;
+  core.AuditPasswords(st_ao, st_ar1);
+  EXPECT_EQ(st_ar.numWeak, st_ar1.numWeak);
+  EXPECT_EQ(st_ar.numReused, st_ar1.numReused);
+
+  // Old password of one entry is another's current one
+  ItemListIter iter = core.Find(other);
+  ASSERT_NE(core.GetEntryEndIter(), iter);
+  iter->second.SetPWHistory(L"10300");
+  iter->second.UpdatePassword(strong1);
+  iter->second.UpdatePassword(strong2); // history is now strong2, strong1
+  core.AuditPasswords(st_ao, st_ar);
+  EXPECT_EQ(2, st_ar.numReused);
+  ASSERT_EQ(1, st_ar.vReused.size());
+  EXPECT_EQ(2, st_ar.vReused[0].size()); // history not audited
+  st_ao.bIncludeHistory = true;
+  core.AuditPasswords(st_ao, st_ar);
+  EXPECT_EQ(306, st_ar.numPasswords);
+  EXPECT_EQ(2, st_ar.numReused);
+  // Reverting to an entry's own old password isn't reuse
+  ASSERT_EQ(1, st_ar.vReused.size());
+  ASSERT_EQ(3, st_ar.vReused[0].size());
+  EXPECT_EQ(1, std::count_if(st_ar.vReused[0].begin(), st_ar.vReused[0].end(),
+                             [other](const st_AuditPassword &ap)
+                             {return ap.uuid == other && ap.iHistory == 1;}));
+}
+
+TEST_F(AuditTest, Policy)
+{
+  PWPolicy pwp;
+  pwp.flags = PWPolicy::UseDigits;
+  pwp.length = 6;
+  pwp.digitminlength = 1;
+  CItemData di;
+  di.CreateUUID();
+  di.SetTitle(L"pin");
+  di.SetPassword(L"123456");
+  di.SetPWPolicy(pwp);
+  core.Execute(AddEntryCommand::Create(&core, di));
+  AddEntry(L"pin2", L"12345a");
+
+  CItemData di2;
+  di2.CreateUUID();
+  di2.SetTitle(L"pin3");
+  di2.SetPassword(L"12345a");
+  di2.SetPWPolicy(pwp);
+  core.Execute(AddEntryCommand::Create(&core, di2));
+
+  st_AuditOptions st_ao;
+  st_AuditResults st_ar;
+  core.AuditPasswords(st_ao, st_ar);
+  // pin conforms to its own policy, pin3 doesn't (pin2 depends on the
+  // default policy)
+  auto nonconforming = [&st_ar](const pws_os::CUUID &uuid) {
+    return std::find_if(st_ar.vFlagged.begin(), st_ar.vFlagged.end(),
+                        [&uuid](const st_AuditPassword &ap)
+                        {return ap.uuid == uuid && !ap.bConforms;}) != st_ar.vFlagged.end();
+  };
+  EXPECT_FALSE(nonconforming(di.GetUUID()));
+  EXPECT_TRUE(nonconforming(di2.GetUUID()));
+}
@@ -0,0 +1,199 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// ChunkedV4Test.cpp: Unit test for the chunked V4 container
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWSfileV4.h"
+#include "core/PWScore.h"
+#include "os/file.h"
+#include "gtest/gtest.h"
+
+#include <cstring>
+
+// A fixture for factoring common code across tests
+class ChunkedV4Test : public ::testing::Test
+{
+protected:
+  ChunkedV4Test() : fname(_T("chunked.psafe4")), passkey(_T("chunky-passkey")) {}
+  void SetUp();
+  void TearDown();
+  bool ReadLayout(const StringX &passphrase, PWSChunkLayout &layout);
+  size_t CommonChunks(const PWSChunkLayout &a, const PWSChunkLayout &b);
+  void CheckRead(const StringX &passphrase);
+
+  const StringX fname, passkey;
+  PWScore core;
+  pws_os::CUUID attUUID;
+};
+
+void ChunkedV4Test::SetUp()
+{
+  // Enough entries for a good number of chunks
+  for (int i = 0; i < 2000; i++) {
+    CItemData ci;
+    ci.CreateUUID();
+    StringX title, notes;
+    Format(title, _T("entry %d"), i);
+    Format(notes, _T("Notes of entry %d, padded to make the chunks fill up faster."), i);
+    ci.SetGroup(i % 2 ? _T("odd") : _T("even.sub"));
+    ci.SetTitle(title);
+    ci.SetUser(_T("user"));
+    ci.SetPassword(_T("password"));
+    ci.SetNotes(notes);
+    core.Execute(AddEntryCommand::Create(&core, ci));
+  }
+
+  CItemAtt att;
+  att.CreateUUID();
+  att.SetTitle(L"attachment");
+  ASSERT_EQ(PWSfile::SUCCESS, att.Import(L"data/text1.txt"));
+  attUUID = att.GetUUID();
+  CItemData ci;
+  ci.CreateUUID();
+  ci.SetTitle(_T("with attachment"));
+  ci.SetPassword(_T("password"));
+  ci.SetAttUUID(attUUID);
+  core.Execute(AddEntryCommand::Create(&core, ci, pws_os::CUUID::NullUUID(), &att));
+
+  core.SetPassKey(passkey);
+  core.SetChunkedV4(true);
+}
+
+void ChunkedV4Test::TearDown()
+{
+  pws_os::DeleteAFile(fname.c_str());
+}
+
+bool ChunkedV4Test::ReadLayout(const StringX &passphrase, PWSChunkLayout &layout)
+{
+  PWSfileV4 fr(fname.c_str(), PWSfile::Read, PWSfile::V40);
+  if (fr.Open(passphrase) != PWSfile::SUCCESS)
+    return false;
+  const bool bChunked = fr.IsChunked();
+  layout = fr.GetLayout();
+  fr.Close();
+  return bChunked;
+}
+
+size_t ChunkedV4Test::CommonChunks(const PWSChunkLayout &a, const PWSChunkLayout &b)
+{
+  // The header's always written anew, though its MAC is the same if
+  // it was saved within the same second, so it's not counted
+  size_t retval = 0;
+  for (size_t i = 1; i < a.chunks.size(); i++)
+    for (size_t j = 1; j < b.chunks.size(); j++)
+      if (std::memcmp(a.chunks[i].mac, b.chunks[j].mac, sizeof(a.chunks[i].mac)) == 0)
+        retval++;
+  return retval;
+}
+
+void ChunkedV4Test::CheckRead(const StringX &passphrase)
+{
+  PWScore core2;
+  ASSERT_EQ(PWScore::SUCCESS, core2.ReadFile(fname, passphrase));
+  EXPECT_TRUE(core2.IsChunkedV4());
+  ASSERT_EQ(core.GetNumEntries(), core2.GetNumEntries());
+  for (auto iter = core.GetEntryIter(); iter != core.GetEntryEndIter(); iter++) {
+    ItemListIter iter2 = core2.Find(iter->first);
+    ASSERT_NE(core2.GetEntryEndIter(), iter2);
+    EXPECT_EQ(iter->second, iter2->second);
+  }
+  ASSERT_EQ(1, core2.GetNumAtts());
+  EXPECT_EQ(core.GetAtt(attUUID), core2.GetAtt(attUUID));
+}
+
+// And now the tests...
+
+TEST_F(ChunkedV4Test, RoundTrip)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+
+  PWSChunkLayout layout;
+  ASSERT_TRUE(ReadLayout(passkey, layout));
+  ASSERT_LT(3U, layout.chunks.size());
+  EXPECT_EQ(PWSChunkLayout::HEADER, layout.chunks[0].kind);
+  EXPECT_EQ(PWSChunkLayout::ATTACHMENT, layout.chunks.back().kind);
+
+  CheckRead(passkey);
+
+  // ...and back to a plain V4 file
+  core.SetChunkedV4(false);
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+  EXPECT_FALSE(ReadLayout(passkey, layout));
+  PWScore core2;
+  ASSERT_EQ(PWScore::SUCCESS, core2.ReadFile(fname, passkey));
+  EXPECT_FALSE(core2.IsChunkedV4());
+  EXPECT_EQ(core.GetNumEntries(), core2.GetNumEntries());
+}
+
+TEST_F(ChunkedV4Test, IncrementalSave)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+  PWSChunkLayout before;
+  ASSERT_TRUE(ReadLayout(passkey, before));
+
+  // Change one entry: only its chunk (and the header) should be rewritten
+  const CItemData &ci = core.GetEntryIter()->second;
+  core.Execute(UpdateEntryCommand::Create(&core, ci, CItemData::NOTES,
+                                          _T("changed notes")));
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+
+  PWSChunkLayout after;
+  ASSERT_TRUE(ReadLayout(passkey, after));
+  EXPECT_EQ(before.chunks.size() - 2, CommonChunks(before, after));
+  CheckRead(passkey);
+
+  // New passkey, new keys: nothing can be copied
+  const StringX passkey2(_T("another-passkey"));
+  core.SetPassKey(passkey2);
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+  ASSERT_TRUE(ReadLayout(passkey2, before));
+  EXPECT_EQ(0U, CommonChunks(before, after));
+  CheckRead(passkey2);
+}
+
+TEST_F(ChunkedV4Test, ReadThenSave)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+  PWSChunkLayout before;
+  ASSERT_TRUE(ReadLayout(passkey, before));
+
+  // A freshly read database copies all but the header
+  PWScore core2;
+  ASSERT_EQ(PWScore::SUCCESS, core2.ReadFile(fname, passkey));
+  ASSERT_EQ(PWScore::SUCCESS, core2.WriteFile(fname, PWSfile::V40));
+  PWSChunkLayout after;
+  ASSERT_TRUE(ReadLayout(passkey, after));
+  EXPECT_EQ(before.chunks.size() - 1, CommonChunks(before, after));
+  CheckRead(passkey);
+}
+
+TEST_F(ChunkedV4Test, Tampered)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+  PWSChunkLayout layout;
+  ASSERT_TRUE(ReadLayout(passkey, layout));
+
+  // Flip a bit of the second chunk's MAC, which is its last 32 bytes
+  // (garbling its records would trip over their decoding instead)
+  const PWSChunkLayout::Chunk &chunk = layout.chunks[1];
+  FILE *fd = pws_os::FOpen(fname.c_str(), _T("r+b"));
+  ASSERT_TRUE(fd != NULL);
+  const long pos = long(chunk.offset + chunk.length - 1);
+  ASSERT_EQ(0, fseek(fd, pos, SEEK_SET));
+  const int c = fgetc(fd);
+  ASSERT_EQ(0, fseek(fd, pos, SEEK_SET));
+  fputc(c ^ 0x01, fd);
+  fclose(fd);
+
+  PWScore core2;
+  EXPECT_EQ(PWScore::BAD_DIGEST, core2.ReadFile(fname, passkey));
+}
@@ -14,6 +14,8 @@
 #include "core/PWScore.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+
 // A fixture for factoring common code across tests
 class CommandsTest : public ::testing::Test
 {
@@ -228,3 +230,202 @@ TEST_F(CommandsTest, CountGroups)
   core.GetAllGroups(vGroups);
   EXPECT_EQ(3, vGroups.size());
 }
+
+TEST_F(CommandsTest, GroupTree)
+{
+  PWScore core;
+  const GroupTree &gt = core.GetGroupTree();
+  std::vector<stringT> vGroups;
+
+  CItemData d1, d2, d3;
+  d1.CreateUUID(); d1.SetTitle(L"t1"); d1.SetPassword(L"p"); d1.SetGroup(L"a.b");
+  d2.CreateUUID(); d2.SetTitle(L"t2"); d2.SetPassword(L"p"); d2.SetGroup(L"a.b.c");
+  d3.CreateUUID(); d3.SetTitle(L"t3"); d3.SetPassword(L"p"); d3.SetGroup(L"a..d");
+
+  core.Execute(AddEntryCommand::Create(&core, d1));
+  core.Execute(AddEntryCommand::Create(&core, d2));
+  core.Execute(AddEntryCommand::Create(&core, d3));
+
+  // "a", "a.", "a..d", "a.b", "a.b.c"
+  core.GetAllGroups(vGroups);
+  ASSERT_EQ(5, vGroups.size());
+  EXPECT_EQ(L"a", vGroups[0]);
+  EXPECT_EQ(L"a.b.c", vGroups[4]);
+  EXPECT_EQ(3, gt.GetNumEntries(L"a"));
+  EXPECT_EQ(1, gt.GetNumEntries(L"a.b", false));
+  EXPECT_EQ(2, gt.GetNumEntries(L"a.b"));
+
+  // Renaming "a" must not touch the entry in "a..d" (group "a.")
+  core.Execute(RenameGroupCommand::Create(&core, L"a", L"x"));
+  EXPECT_EQ(L"x.b", core.GetEntry(core.Find(d1.GetUUID())).GetGroup());
+  EXPECT_EQ(L"x.b.c", core.GetEntry(core.Find(d2.GetUUID())).GetGroup());
+  EXPECT_EQ(L"a..d", core.GetEntry(core.Find(d3.GetUUID())).GetGroup());
+  EXPECT_TRUE(gt.GroupExists(L"x.b.c"));
+  EXPECT_FALSE(gt.GroupExists(L"a.b"));
+  EXPECT_EQ(1, gt.GetNumEntries(L"a"));
+
+  core.Undo();
+  EXPECT_EQ(L"a.b", core.GetEntry(core.Find(d1.GetUUID())).GetGroup());
+  EXPECT_FALSE(gt.GroupExists(L"x"));
+  EXPECT_EQ(3, gt.GetNumEntries(L"a"));
+
+  // In-place group change, then deletion
+  core.Execute(UpdateEntryCommand::Create(&core, core.GetEntry(core.Find(d2.GetUUID())),
+                                          CItemData::GROUP, L"e"));
+  EXPECT_EQ(1, gt.GetNumEntries(L"e"));
+  EXPECT_FALSE(gt.GroupExists(L"a.b.c"));
+  core.Execute(DeleteEntryCommand::Create(&core, core.GetEntry(core.Find(d2.GetUUID()))));
+  EXPECT_FALSE(gt.GroupExists(L"e"));
+  core.Undo();
+  EXPECT_TRUE(gt.GroupExists(L"e"));
+
+  // Empty groups keep their nodes alive
+  core.Execute(DBEmptyGroupsCommand::Create(&core, StringX(L"a.b.f"),
+                                            DBEmptyGroupsCommand::EG_ADD));
+  EXPECT_TRUE(core.IsEmptyGroup(L"a.b.f"));
+  EXPECT_FALSE(core.IsEmptyGroup(L"a.b"));
+  core.Execute(DeleteEntryCommand::Create(&core, core.GetEntry(core.Find(d1.GetUUID()))));
+  EXPECT_TRUE(gt.GroupExists(L"a.b"));
+  core.Undo();
+  core.Undo();
+  EXPECT_FALSE(core.IsEmptyGroup(L"a.b.f"));
+  EXPECT_FALSE(gt.GroupExists(L"a.b.f"));
+
+  core.GetAllGroups(vGroups);
+  EXPECT_EQ(gt.GetNumGroups(), vGroups.size());
+}
+
+TEST_F(CommandsTest, AddDependentsByGTU)
+{
+  PWScore core;
+  CItemData b1, b2, b3, a1, a2, s1;
+  b1.CreateUUID(); b1.SetGroup(L"g"); b1.SetTitle(L"t"); b1.SetUser(L"u");
+  b1.SetPassword(L"base password");
+  // Same GTU as b1 - first in entry order should be the base
+  b2 = b1; b2.CreateUUID();
+  b3.CreateUUID(); b3.SetTitle(L"t3"); b3.SetPassword(L"base password 3");
+  a1.CreateUUID(); a1.SetTitle(L"alias"); a1.SetPassword(L"[[g:t:u]]");
+  a2.CreateUUID(); a2.SetTitle(L"dangling"); a2.SetPassword(L"[[g:nosuch:u]]");
+  s1.CreateUUID(); s1.SetTitle(L"shortcut"); s1.SetPassword(L"[~:t3:~]");
+  const CItemData *items[] = {&b1, &b2, &b3, &a1, &a2, &s1};
+  for (auto pci : items)
+    core.Execute(AddEntryCommand::Create(&core, *pci));
+
+  UUIDVector vAliases, vShortcuts;
+  vAliases.push_back(a1.GetUUID());
+  vAliases.push_back(a2.GetUUID());
+  vShortcuts.push_back(s1.GetUUID());
+  EXPECT_EQ(1, core.Execute(AddDependentEntriesCommand::Create(&core, vAliases, NULL,
+                                                               CItemData::ET_ALIAS,
+                                                               CItemData::PASSWORD)));
+  core.Execute(AddDependentEntriesCommand::Create(&core, vShortcuts, NULL,
+                                                  CItemData::ET_SHORTCUT,
+                                                  CItemData::PASSWORD));
+
+  const CItemData &alias = core.GetEntry(core.Find(a1.GetUUID()));
+  ASSERT_TRUE(alias.IsAlias());
+  const pws_os::CUUID first = std::min(b1.GetUUID(), b2.GetUUID());
+  EXPECT_EQ(first, alias.GetBaseUUID());
+  ASSERT_NE(nullptr, core.GetBaseEntry(&alias));
+  EXPECT_EQ(L"base password", core.GetBaseEntry(&alias)->GetPassword());
+  EXPECT_EQ(1, core.NumAliases(first));
+  EXPECT_TRUE(core.GetEntry(core.Find(first)).IsAliasBase());
+
+  // No base - left as a normal entry
+  EXPECT_TRUE(core.GetEntry(core.Find(a2.GetUUID())).IsNormal());
+
+  const CItemData &shortcut = core.GetEntry(core.Find(s1.GetUUID()));
+  ASSERT_TRUE(shortcut.IsShortcut());
+  EXPECT_EQ(b3.GetUUID(), shortcut.GetBaseUUID());
+  EXPECT_EQ(1, core.NumShortcuts(b3.GetUUID()));
+}
+
+TEST_F(CommandsTest, NamedPolicyEntries)
+{
+  PWScore core;
+  StringX sxPolicy(L"pin"), sxOther(L"other");
+  PWPolicy pwp;
+  pwp.flags = PWPolicy::UseDigits;
+  pwp.length = 4;
+  core.Execute(DBPolicyNamesCommand::Create(&core, sxPolicy, pwp));
+  core.Execute(DBPolicyNamesCommand::Create(&core, sxOther, pwp));
+
+  std::vector<CItemData> items;
+  for (int i = 0; i < 5; i++) {
+    CItemData di;
+    di.CreateUUID();
+    stringT title;
+    Format(title, L"entry %d", i);
+    di.SetTitle(title.c_str());
+    di.SetPassword(L"1234");
+    if (i < 3)
+      di.SetPolicyName(sxPolicy);
+    core.Execute(AddEntryCommand::Create(&core, di));
+    items.push_back(di);
+  }
+
+  EXPECT_EQ(3, core.GetEntriesUsingNamedPasswordPolicy(sxPolicy).size());
+  EXPECT_TRUE(core.GetEntriesUsingNamedPasswordPolicy(sxOther).empty());
+  std::vector<st_GroupTitleUser> ventries;
+  ASSERT_TRUE(core.GetEntriesUsingNamedPasswordPolicy(sxPolicy, ventries));
+  ASSERT_EQ(3, ventries.size());
+  EXPECT_EQ(L"entry 0", ventries[0].title);
+  EXPECT_EQ(L"entry 2", ventries[2].title);
+
+  // Moving an entry to another policy, deleting one
+  CItemData di = items[1];
+  di.SetPolicyName(sxOther);
+  core.Execute(EditEntryCommand::Create(&core, items[1], di));
+  core.Execute(DeleteEntryCommand::Create(&core, items[2]));
+  EXPECT_EQ(1, core.GetEntriesUsingNamedPasswordPolicy(sxPolicy).size());
+  EXPECT_EQ(1, core.GetEntriesUsingNamedPasswordPolicy(sxOther).size());
+  EXPECT_EQ(1, core.GetPasswordPolicies().find(sxPolicy)->second.usecount);
+  GTUSet setGTU;
+  ASSERT_TRUE(core.InitialiseGTU(setGTU, sxOther));
+  ASSERT_EQ(1, setGTU.size());
+  EXPECT_EQ(L"entry 1", setGTU.begin()->title);
+
+  // ...and back again
+  core.Undo();
+  core.Undo();
+  EXPECT_EQ(3, core.GetEntriesUsingNamedPasswordPolicy(sxPolicy).size());
+  EXPECT_TRUE(core.GetEntriesUsingNamedPasswordPolicy(sxOther).empty());
+  EXPECT_EQ(3, core.GetPasswordPolicies().find(sxPolicy)->second.usecount);
+}
+
+TEST_F(CommandsTest, KBShortcutModifiers)
+{
+  PWScore core;
+  const int32 iCtrlA = (PWS_HOTKEYF_CONTROL << 16) | 'A';
+  const int32 iCtrlB = (PWS_HOTKEYF_CONTROL << 16) | 'B';
+  const int32 iCtrlAltC = ((PWS_HOTKEYF_CONTROL | PWS_HOTKEYF_ALT) << 16) | 'C';
+  const int32 iAltD = (PWS_HOTKEYF_ALT << 16) | 'D';
+  const int32 shortcuts[] = {iCtrlB, iAltD, iCtrlAltC, iCtrlA};
+  std::vector<pws_os::CUUID> uuids;
+  for (int32 iKBShortcut : shortcuts) {
+    CItemData di;
+    di.CreateUUID();
+    di.SetTitle(L"title");
+    di.SetPassword(L"password");
+    di.SetKBShortcut(iKBShortcut);
+    core.Execute(AddEntryCommand::Create(&core, di));
+    uuids.push_back(di.GetUUID());
+  }
+
+  std::vector<KBShortcutMapPair> vShortcuts;
+  ASSERT_EQ(2, core.GetKBShortcutsUsingModifiers(PWS_HOTKEYF_CONTROL, vShortcuts));
+  EXPECT_EQ(iCtrlA, vShortcuts[0].first);
+  EXPECT_EQ(uuids[3], vShortcuts[0].second);
+  EXPECT_EQ(iCtrlB, vShortcuts[1].first);
+
+  ASSERT_EQ(3, core.GetKBShortcutsUsingModifiers(PWS_HOTKEYF_CONTROL, vShortcuts, true));
+  EXPECT_EQ(iCtrlAltC, vShortcuts[2].first);
+  ASSERT_EQ(2, core.GetKBShortcutsUsingModifiers(PWS_HOTKEYF_ALT, vShortcuts, true));
+  EXPECT_EQ(iAltD, vShortcuts[0].first);
+  EXPECT_EQ(iCtrlAltC, vShortcuts[1].first);
+  EXPECT_EQ(0, core.GetKBShortcutsUsingModifiers(PWS_HOTKEYF_SHIFT, vShortcuts, true));
+  EXPECT_EQ(4, core.GetKBShortcutsUsingModifiers(0, vShortcuts, true));
+
+  core.Undo();
+  EXPECT_EQ(1, core.GetKBShortcutsUsingModifiers(PWS_HOTKEYF_CONTROL, vShortcuts));
+}
@@ -0,0 +1,100 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// ExpiredListTest.cpp: Unit test for ExpiredList
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/ExpiredList.h"
+#include "gtest/gtest.h"
+
+// A fixture for factoring common code across tests
+class ExpiredListTest : public ::testing::Test
+{
+protected:
+  ExpiredListTest() : now(time(NULL)) {}
+
+  CItemData MakeEntry(time_t xtime)
+  {
+    CItemData ci;
+    ci.CreateUUID();
+    ci.SetTitle(L"title");
+    ci.SetPassword(L"password");
+    ci.SetXTime(xtime);
+    return ci;
+  }
+
+  const time_t now;
+  enum {DAY = 86400};
+};
+
+// And now the tests...
+
+TEST_F(ExpiredListTest, Order)
+{
+  ExpiredList el;
+  const CItemData c1 = MakeEntry(now + 10 * DAY);
+  const CItemData c2 = MakeEntry(now - DAY);
+  const CItemData c3 = MakeEntry(now + 3 * DAY);
+  CItemData c4 = MakeEntry(now + 3 * DAY);
+  el.Add(c1); el.Add(c2); el.Add(c3); el.Add(c4);
+  el.Add(MakeEntry(0)); // no expiry
+  EXPECT_EQ(4, el.size());
+
+  ExpPWEntryList v = el.GetExpired(0);
+  ASSERT_EQ(1, v.size());
+  EXPECT_EQ(c2.GetUUID(), v[0].uuid);
+
+  v = el.GetExpired(5);
+  ASSERT_EQ(3, v.size());
+  EXPECT_EQ(c2.GetUUID(), v[0].uuid);
+  EXPECT_EQ(now + 3 * DAY, v[1].expirytttXTime);
+  EXPECT_EQ(now + 3 * DAY, v[2].expirytttXTime);
+
+  EXPECT_EQ(now - DAY, el.GetNextExpiry());
+  EXPECT_EQ(now + 3 * DAY, el.GetNextExpiry(now));
+  EXPECT_EQ(now + 10 * DAY, el.GetNextExpiry(now + 4 * DAY));
+  EXPECT_EQ(0, el.GetNextExpiry(now + 11 * DAY));
+
+  // Update moves, Remove removes, no duplicates
+  c4.SetXTime(now + 20 * DAY);
+  el.Update(c4);
+  el.Add(c4);
+  EXPECT_EQ(4, el.size());
+  EXPECT_EQ(2, el.GetExpired(5).size());
+  EXPECT_TRUE(el.SetExpiryTime(c4.GetUUID(), now - 2 * DAY));
+  EXPECT_EQ(c4.GetUUID(), el.GetExpired(0)[0].uuid);
+
+  el.Remove(c2);
+  el.Remove(c2);
+  EXPECT_EQ(3, el.size());
+  EXPECT_FALSE(el.SetExpiryTime(c2.GetUUID(), now));
+
+  // Entry no longer expiring
+  c4.SetXTime(time_t(0));
+  el.Update(c4);
+  EXPECT_EQ(2, el.size());
+  EXPECT_EQ(now + 3 * DAY, el.GetNextExpiry());
+
+  el.clear();
+  EXPECT_TRUE(el.empty());
+  EXPECT_EQ(0, el.GetNextExpiry());
+}
+
+TEST_F(ExpiredListTest, Interval)
+{
+  // XTime <= 3650 is a number of days since the password was last changed
+  ExpiredList el;
+  CItemData ci = MakeEntry(time_t(30));
+  ci.SetPMTime(now - 28 * DAY);
+  el.Add(ci);
+  EXPECT_EQ(now + 2 * DAY, el.GetNextExpiry());
+  EXPECT_TRUE(el.GetExpired(1).empty());
+  EXPECT_EQ(1, el.GetExpired(3).size());
+}
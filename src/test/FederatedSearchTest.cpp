@@ -0,0 +1,124 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// FederatedSearchTest.cpp: Unit test for searching several databases at once
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/FederatedSearch.h"
+#include "os/file.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+
+// A fixture for factoring common code across tests
+class FederatedSearchTest : public ::testing::Test
+{
+protected:
+  FederatedSearchTest() : passkey(_T("federated-passkey")) {}
+  void SetUp();
+  void TearDown();
+
+  std::vector<StringX> fnames;
+  const StringX passkey;
+};
+
+void FederatedSearchTest::SetUp()
+{
+  // Three team safes, each with some filler and one or two hosts
+  const TCHAR *urls[3][2] = {
+    {_T("https://alpha.example.com/login"), _T("")},
+    {_T("https://beta.example.com"), _T("ssh://ALPHA.example.com")},
+    {_T("https://gamma.example.org"), _T("")},
+  };
+  for (int db = 0; db < 3; db++) {
+    StringX fname;
+    Format(fname, _T("federated%d.psafe3"), db);
+    fnames.push_back(fname);
+
+    PWScore core;
+    for (int i = 0; i < 50; i++) {
+      CItemData ci;
+      ci.CreateUUID();
+      StringX title;
+      Format(title, _T("entry %d"), i);
+      ci.SetGroup(_T("team"));
+      ci.SetTitle(title);
+      ci.SetPassword(_T("password"));
+      if (i < 2)
+        ci.SetURL(urls[db][i]);
+      core.Execute(AddEntryCommand::Create(&core, ci));
+    }
+    core.SetPassKey(passkey);
+    ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+  }
+}
+
+void FederatedSearchTest::TearDown()
+{
+  for (auto iter = fnames.begin(); iter != fnames.end(); iter++)
+    pws_os::DeleteAFile(iter->c_str());
+}
+
+// And now the tests...
+
+TEST_F(FederatedSearchTest, Find)
+{
+  std::vector<st_FederatedDB> vDBs;
+  for (auto iter = fnames.begin(); iter != fnames.end(); iter++)
+    vDBs.push_back(st_FederatedDB(*iter, passkey));
+  vDBs.push_back(st_FederatedDB(fnames[0], _T("wrong passkey")));
+  vDBs.push_back(st_FederatedDB(_T("no-such-file.psafe3"), passkey));
+
+  FederatedSearch fs;
+  std::vector<int> vStatus;
+  ASSERT_EQ(3, fs.Open(vDBs, vStatus, 4));
+  ASSERT_EQ(5, vStatus.size());
+  EXPECT_EQ(PWScore::SUCCESS, vStatus[2]);
+  EXPECT_EQ(PWScore::WRONG_PASSWORD, vStatus[3]);
+  EXPECT_NE(PWScore::SUCCESS, vStatus[4]);
+  EXPECT_EQ(nullptr, fs.GetCore(3));
+  ASSERT_NE(nullptr, fs.GetCore(1));
+  EXPECT_EQ(50, fs.GetCore(1)->GetNumEntries());
+  EXPECT_EQ(fnames[1], fs.GetDBName(1));
+
+  CItemData::FieldBits bsFields;
+  bsFields.set();
+  std::vector<st_FederatedMatch> vMatches;
+  const FederatedSearch::Callback Collect =
+    [&vMatches](const std::vector<st_FederatedMatch> &v) {
+      vMatches.insert(vMatches.end(), v.begin(), v.end());
+    };
+
+  EXPECT_EQ(2, fs.Find(_T("alpha.example"), bsFields, false, Collect, 3));
+  ASSERT_EQ(2, vMatches.size());
+  std::sort(vMatches.begin(), vMatches.end(),
+            [](const st_FederatedMatch &a, const st_FederatedMatch &b)
+            {return a.iDB < b.iDB;});
+  EXPECT_EQ(0, vMatches[0].iDB);
+  EXPECT_EQ(_T("entry 0"), vMatches[0].title);
+  EXPECT_EQ(CItemData::URL, vMatches[0].ft);
+  EXPECT_EQ(1, vMatches[1].iDB);
+  EXPECT_EQ(_T("entry 1"), vMatches[1].title);
+  EXPECT_EQ(fs.GetCore(1)->Find(_T("team"), _T("entry 1"), _T(""))->first,
+            vMatches[1].uuid);
+
+  // Case sensitive, and restricted to the fields asked for
+  vMatches.clear();
+  EXPECT_EQ(1, fs.Find(_T("alpha.example"), bsFields, true, Collect));
+  bsFields.reset();
+  bsFields.set(CItemData::TITLE);
+  vMatches.clear();
+  EXPECT_EQ(0, fs.Find(_T("example"), bsFields, false, Collect));
+  EXPECT_TRUE(vMatches.empty());
+  EXPECT_EQ(3, fs.Find(_T("entry 49"), bsFields, false, Collect, 1));
+
+  fs.Close();
+  EXPECT_EQ(0, fs.GetNumDBs());
+}
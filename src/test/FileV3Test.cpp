@@ -154,6 +154,30 @@ TEST_F(FileV3Test, ItemTest)
   EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
 }
 
+TEST_F(FileV3Test, TrailingNULsTest)
+{
+  // [BR1150, BR1167]: text fields are written without terminating NULs
+  StringX sxTitle(_T("nul-terminated"));
+  sxTitle += TCHAR('\0');
+  sxTitle += TCHAR('\0');
+  CItemData d1;
+  d1.CreateUUID();
+  d1.SetTitle(sxTitle);
+  d1.SetPassword(_T("password"));
+
+  PWSfileV3 fw(fname.c_str(), PWSfile::Write, PWSfile::V30);
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fw.WriteRecord(d1));
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Close());
+
+  PWSfileV3 fr(fname.c_str(), PWSfile::Read, PWSfile::V30);
+  ASSERT_EQ(PWSfile::SUCCESS, fr.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.ReadRecord(item));
+  EXPECT_EQ(_T("nul-terminated"), item.GetTitle());
+  EXPECT_EQ(PWSfile::END_OF_FILE, fr.ReadRecord(item));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
+}
+
 TEST_F(FileV3Test, UnknownPersistencyTest)
 {
   CItemData d1;
@@ -176,3 +200,66 @@ TEST_F(FileV3Test, UnknownPersistencyTest)
   EXPECT_EQ(PWSfile::END_OF_FILE, fr.ReadRecord(item));
   EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
 }
+
+TEST_F(FileV3Test, FileSigTest)
+{
+  PWSfileV3 fw1(fname.c_str(), PWSfile::Write, PWSfile::V30);
+  ASSERT_EQ(PWSfile::SUCCESS, fw1.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fw1.WriteRecord(fullItem));
+  ASSERT_EQ(PWSfile::SUCCESS, fw1.Close());
+
+  // The file's hashed as it's written, and again as it's read
+  unsigned char hash[SHA256::HASHLEN], readHash[SHA256::HASHLEN];
+  ulong64 hashLength = 0, readLength = 0;
+  ASSERT_TRUE(fw1.GetFileHash(hash, hashLength));
+  FILE *fp = pws_os::FOpen(fname, _T("rb"));
+  ASSERT_TRUE(fp != NULL);
+  std::vector<unsigned char> content(size_t(pws_os::fileLength(fp)));
+  ASSERT_EQ(1U, fread(&content[0], content.size(), 1, fp));
+  fclose(fp);
+  SHA256 sha;
+  sha.Update(&content[0], content.size());
+  sha.Final(readHash);
+  EXPECT_EQ(content.size(), hashLength);
+  EXPECT_EQ(0, memcmp(hash, readHash, sizeof(hash)));
+  PWSfileV3 fr(fname.c_str(), PWSfile::Read, PWSfile::V30);
+  ASSERT_EQ(PWSfile::SUCCESS, fr.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.ReadRecord(item));
+  EXPECT_EQ(PWSfile::END_OF_FILE, fr.ReadRecord(item));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
+  ASSERT_TRUE(fr.GetFileHash(readHash, readLength));
+  EXPECT_EQ(hashLength, readLength);
+  EXPECT_EQ(0, memcmp(hash, readHash, sizeof(hash)));
+
+  PWSFileSig refSig(fname, hash, hashLength);
+  ASSERT_TRUE(refSig.IsValid());
+  PWSFileSig curSig(fname);
+  EXPECT_TRUE(refSig == curSig);
+  EXPECT_TRUE(curSig == refSig);
+
+  // Same content, different file: only the full digest can tell
+  const stringT copyname(_T("V3test-copy.psafe3"));
+  ASSERT_TRUE(pws_os::CopyAFile(fname, copyname));
+  PWSFileSig copySig(copyname);
+  EXPECT_TRUE(refSig == copySig);
+
+  // Rewriting the file changes its HMAC trailer
+  PWSfileV3 fw2(fname.c_str(), PWSfile::Write, PWSfile::V30);
+  ASSERT_EQ(PWSfile::SUCCESS, fw2.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fw2.WriteRecord(fullItem));
+  ASSERT_EQ(PWSfile::SUCCESS, fw2.Close());
+  PWSFileSig newSig(fname);
+  EXPECT_TRUE(refSig != newSig);
+
+  // Flip a byte in the middle of the copy: same length & trailer
+  fp = pws_os::FOpen(copyname, _T("r+b"));
+  ASSERT_TRUE(fp != NULL);
+  fseek(fp, 200, SEEK_SET);
+  int c = fgetc(fp);
+  fseek(fp, 200, SEEK_SET);
+  fputc(c ^ 0xff, fp);
+  fclose(fp);
+  PWSFileSig badSig(copyname);
+  EXPECT_TRUE(refSig != badSig);
+  EXPECT_TRUE(pws_os::DeleteAFile(copyname));
+}
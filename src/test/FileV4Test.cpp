@@ -13,6 +13,7 @@
 
 #include "core/PWSfileV4.h"
 #include "core/PWScore.h"
+#include "core/PWSCompress.h"
 
 #include "os/file.h"
 
@@ -101,6 +102,14 @@ void FileV4Test::TearDown()
   ASSERT_FALSE(pws_os::FileExists(fname));
 }
 
+static ulong64 FileLength(const stringT &fname)
+{
+  FILE *fd = pws_os::FOpen(fname, _T("rb"));
+  const ulong64 retval = pws_os::fileLength(fd);
+  fclose(fd);
+  return retval;
+}
+
 // And now the tests...
 
 TEST_F(FileV4Test, EmptyFile)
@@ -221,6 +230,76 @@ TEST_F(FileV4Test, AttTest)
   EXPECT_EQ(attItem, readAtt);
 }
 
+TEST_F(FileV4Test, CompressedAttTest)
+{
+  // Text's compressed, the image (image/jpeg) isn't worth trying
+  CItemAtt textAtt;
+  textAtt.CreateUUID();
+  textAtt.SetTitle(L"compressible");
+  ASSERT_EQ(PWSfile::SUCCESS, textAtt.Import(L"data/text1.txt"));
+  std::vector<unsigned char> text;
+  for (int i = 0; i < 200; i++) {
+    std::string line = "key" + std::to_string(i % 17) + " = some value\n";
+    text.insert(text.end(), line.begin(), line.end());
+  }
+  textAtt.SetContent(text.data(), text.size());
+  textAtt.SetCompression(PWSCompress::ZLIB);
+  attItem.SetCompression(PWSCompress::ZLIB);
+
+  PWSfileV4 fw(fname.c_str(), PWSfile::Write, PWSfile::V40);
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fw.WriteRecord(textAtt));
+  EXPECT_EQ(PWSfile::SUCCESS, fw.WriteRecord(attItem));
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Close());
+  const ulong64 compressedLength = FileLength(fname);
+
+  CItemAtt readAtt;
+  PWSfileV4 fr(fname.c_str(), PWSfile::Read, PWSfile::V40);
+  ASSERT_EQ(PWSfile::SUCCESS, fr.Open(passphrase));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.ReadRecord(readAtt));
+  EXPECT_EQ(textAtt, readAtt);
+  EXPECT_EQ(PWSCompress::ZLIB, readAtt.GetCompression());
+  EXPECT_FALSE(readAtt.IsContentCompressed());
+  EXPECT_EQ(PWSfile::SUCCESS, fr.ReadRecord(readAtt));
+  EXPECT_EQ(attItem, readAtt);
+  EXPECT_EQ(PWSfile::END_OF_FILE, fr.ReadRecord(item));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
+
+  // Same again, uncompressed
+  if (PWSCompress::CanCompress(PWSCompress::ZLIB)) {
+    textAtt.SetCompression(PWSCompress::NONE);
+    attItem.SetCompression(PWSCompress::NONE);
+    PWSfileV4 fw2(fname.c_str(), PWSfile::Write, PWSfile::V40);
+    ASSERT_EQ(PWSfile::SUCCESS, fw2.Open(passphrase));
+    EXPECT_EQ(PWSfile::SUCCESS, fw2.WriteRecord(textAtt));
+    EXPECT_EQ(PWSfile::SUCCESS, fw2.WriteRecord(attItem));
+    ASSERT_EQ(PWSfile::SUCCESS, fw2.Close());
+    EXPECT_GT(FileLength(fname), compressedLength + text.size() / 2);
+  }
+}
+
+TEST_F(FileV4Test, CompressedLengthTest)
+{
+  // A record claiming more than can be decompressed from its content
+  // is rejected before anything's allocated for it
+  unsigned char comp[5] = {PWSCompress::ZLIB, 0xff, 0xff, 0xff, 0xff};
+  unsigned char content[16] = {0x78, 0x01};
+
+  PWSfileV4 fw(fname.c_str(), PWSfile::Write, PWSfile::V40);
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Open(passphrase));
+  fw.WriteField(CItem::CONTENTCOMP, comp, sizeof(comp));
+  fw.WriteContentFields(content, sizeof(content));
+  fw.WriteField(CItem::END, _T(""));
+  ASSERT_EQ(PWSfile::SUCCESS, fw.Close());
+
+  CItemAtt readAtt;
+  PWSfileV4 fr(fname.c_str(), PWSfile::Read, PWSfile::V40);
+  ASSERT_EQ(PWSfile::SUCCESS, fr.Open(passphrase));
+  EXPECT_EQ(PWSfile::READ_FAIL, fr.ReadRecord(readAtt));
+  EXPECT_EQ(PWSfile::END_OF_FILE, fr.ReadRecord(readAtt));
+  EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
+}
+
 TEST_F(FileV4Test, HdrItemAttTest)
 {
   PWSfileHeader hdr1;
@@ -248,6 +327,14 @@ TEST_F(FileV4Test, HdrItemAttTest)
   EXPECT_EQ(PWSfile::SUCCESS, fr.ReadRecord(readAtt));
   EXPECT_EQ(attItem, readAtt);
   EXPECT_EQ(PWSfile::SUCCESS, fr.Close());
+
+  // Both hashed the whole file, despite the att being read twice over
+  unsigned char whash[SHA256::HASHLEN], rhash[SHA256::HASHLEN];
+  ulong64 wlen = 0, rlen = 0;
+  ASSERT_TRUE(fw.GetFileHash(whash, wlen));
+  ASSERT_TRUE(fr.GetFileHash(rhash, rlen));
+  EXPECT_EQ(wlen, rlen);
+  EXPECT_EQ(0, memcmp(whash, rhash, sizeof(whash)));
 }
 
 TEST_F(FileV4Test, CoreRWTest)
@@ -285,3 +372,196 @@ TEST_F(FileV4Test, CoreRWTest)
   // Get core to delete any existing commands
   core.ClearCommands();
 }
+
+TEST_F(FileV4Test, SharedAttTest)
+{
+  PWScore core;
+  const StringX passkey(L"3rdMambo");
+  core.SetPassKey(passkey);
+
+  // Same file imported for three entries, the third with another title
+  CItemData ci[3];
+  CItemAtt att[3];
+  for (int i = 0; i < 3; i++) {
+    ci[i].CreateUUID();
+    StringX title;
+    Format(title, L"entry %d", i);
+    ci[i].SetTitle(title);
+    ci[i].SetPassword(L"password");
+    att[i].CreateUUID();
+    att[i].SetTitle(i < 2 ? L"bundle" : L"other bundle");
+    ASSERT_EQ(PWScore::SUCCESS, att[i].Import(L"data/image1.jpg"));
+    core.Execute(AddEntryCommand::Create(&core, ci[i], pws_os::CUUID::NullUUID(), &att[i]));
+  }
+  ASSERT_EQ(2, core.GetNumAtts());
+  EXPECT_FALSE(core.HasAtt(att[1].GetUUID()));
+  EXPECT_EQ(att[0].GetUUID(), core.Find(ci[1].GetUUID())->second.GetAttUUID());
+  EXPECT_EQ(2, core.GetAtt(att[0].GetUUID()).GetRefcount());
+  EXPECT_EQ(1, core.GetAtt(att[2].GetUUID()).GetRefcount());
+  EXPECT_EQ(PWSfile::SUCCESS, core.WriteFile(fname.c_str(), PWSfile::V40));
+
+  core.ClearData();
+  EXPECT_EQ(PWSfile::SUCCESS, core.ReadFile(fname.c_str(), passkey, true));
+  ASSERT_EQ(3, core.GetNumEntries());
+  ASSERT_EQ(2, core.GetNumAtts());
+  EXPECT_EQ(2, core.GetAtt(att[0].GetUUID()).GetRefcount());
+  st_DBProperties dbp;
+  core.GetDBProperties(dbp);
+  EXPECT_NE(StringX::npos, dbp.numattachments.find(L"1 shared"));
+
+  // ...and also with attachments that were read
+  CItemData ci3;
+  ci3.CreateUUID();
+  ci3.SetTitle(L"another entry");
+  ci3.SetPassword(L"password");
+  CItemAtt att3;
+  att3.CreateUUID();
+  att3.SetTitle(L"other bundle");
+  ASSERT_EQ(PWScore::SUCCESS, att3.Import(L"data/image1.jpg"));
+  core.Execute(AddEntryCommand::Create(&core, ci3, pws_os::CUUID::NullUUID(), &att3));
+  EXPECT_EQ(2, core.GetNumAtts());
+  EXPECT_EQ(2, core.GetAtt(att[2].GetUUID()).GetRefcount());
+  core.Undo();
+  EXPECT_EQ(1, core.GetAtt(att[2].GetUUID()).GetRefcount());
+
+  // Shared attachment goes with the last entry referring to it
+  const CItemData ci0 = core.Find(ci[0].GetUUID())->second;
+  core.Execute(DeleteEntryCommand::Create(&core, ci0));
+  ASSERT_TRUE(core.HasAtt(att[0].GetUUID()));
+  EXPECT_EQ(1, core.GetAtt(att[0].GetUUID()).GetRefcount());
+  const CItemData ci1 = core.Find(ci[1].GetUUID())->second;
+  core.Execute(DeleteEntryCommand::Create(&core, ci1));
+  EXPECT_FALSE(core.HasAtt(att[0].GetUUID()));
+  EXPECT_EQ(1, core.GetNumAtts());
+
+  core.ClearCommands();
+}
+
+TEST_F(FileV4Test, SharedAttEditTest)
+{
+  PWScore core;
+  CItemData ci[2];
+  CItemAtt att[2];
+  for (int i = 0; i < 2; i++) {
+    ci[i].CreateUUID();
+    StringX title;
+    Format(title, L"entry %d", i);
+    ci[i].SetTitle(title);
+    ci[i].SetPassword(L"password");
+    att[i].CreateUUID();
+    att[i].SetTitle(L"bundle");
+    ASSERT_EQ(PWScore::SUCCESS, att[i].Import(L"data/image1.jpg"));
+    core.Execute(AddEntryCommand::Create(&core, ci[i], pws_os::CUUID::NullUUID(), &att[i]));
+  }
+  const pws_os::CUUID shared = att[0].GetUUID();
+  ASSERT_EQ(1, core.GetNumAtts());
+  ASSERT_EQ(2, core.GetAtt(shared).GetRefcount());
+
+  // Left as is, it stays shared
+  EXPECT_EQ(shared, core.PutAtt(core.GetAtt(shared)));
+  EXPECT_EQ(1, core.GetNumAtts());
+  EXPECT_EQ(2, core.GetAtt(shared).GetRefcount());
+
+  // Renamed by one entry, only that one sees the new name
+  CItemAtt edited = core.GetAtt(shared);
+  edited.SetTitle(L"renamed");
+  const pws_os::CUUID attuuid = core.PutAtt(edited);
+  EXPECT_NE(shared, attuuid);
+  ASSERT_EQ(2, core.GetNumAtts());
+  EXPECT_EQ(L"bundle", core.GetAtt(shared).GetTitle());
+  EXPECT_EQ(1, core.GetAtt(shared).GetRefcount());
+  EXPECT_EQ(L"renamed", core.GetAtt(attuuid).GetTitle());
+  EXPECT_EQ(1, core.GetAtt(attuuid).GetRefcount());
+  core.Find(ci[1].GetUUID())->second.SetAttUUID(attuuid); // as the editor does
+
+  // Once no longer shared, edited in place
+  edited = core.GetAtt(shared);
+  edited.SetTitle(L"renamed too");
+  EXPECT_EQ(shared, core.PutAtt(edited));
+  EXPECT_EQ(2, core.GetNumAtts());
+  EXPECT_EQ(L"renamed too", core.GetAtt(shared).GetTitle());
+  EXPECT_EQ(1, core.GetAtt(shared).GetRefcount());
+
+  const StringX passkey(L"3rdMambo");
+  core.SetPassKey(passkey);
+  EXPECT_EQ(PWSfile::SUCCESS, core.WriteFile(fname.c_str(), PWSfile::V40));
+  core.ClearData();
+  EXPECT_EQ(PWSfile::SUCCESS, core.ReadFile(fname.c_str(), passkey, true));
+  ASSERT_EQ(2, core.GetNumAtts());
+  EXPECT_EQ(L"renamed too",
+            core.GetAtt(core.Find(ci[0].GetUUID())->second.GetAttUUID()).GetTitle());
+  EXPECT_EQ(L"renamed",
+            core.GetAtt(core.Find(ci[1].GetUUID())->second.GetAttUUID()).GetTitle());
+
+  core.ClearCommands();
+}
+
+TEST_F(FileV4Test, CoreAsyncWriteTest)
+{
+  PWScore core;
+  const StringX passkey(L"4thMambo");
+
+  core.SetPassKey(passkey);
+  core.Execute(AddEntryCommand::Create(&core, fullItem));
+  ASSERT_EQ(PWSfile::SUCCESS, core.WriteFile(fname.c_str(), PWSfile::V40));
+  core.ClearData();
+  ASSERT_EQ(PWSfile::SUCCESS, core.ReadFile(fname.c_str(), passkey));
+  core.SetCurFile(fname.c_str());
+  ASSERT_EQ(PWSfile::V40, core.GetReadFileVersion());
+
+  // Save, change while (possibly) saving: we're still changed afterwards
+  core.Execute(AddEntryCommand::Create(&core, smallItem));
+  EXPECT_EQ(PWSfile::SUCCESS, core.WriteCurFileAsync());
+  item.CreateUUID();
+  item.SetTitle(L"added during save");
+  item.SetPassword(L"whatever");
+  core.Execute(AddEntryCommand::Create(&core, item));
+  EXPECT_EQ(PWSfile::SUCCESS, core.WaitForAsyncSave());
+  EXPECT_FALSE(core.IsAsyncSaveInProgress());
+  EXPECT_TRUE(core.HasDBChanged());
+
+  // Back-to-back saves are coalesced, last one wins
+  EXPECT_EQ(PWSfile::SUCCESS, core.WriteCurFileAsync());
+  EXPECT_EQ(PWSfile::SUCCESS, core.WriteCurFileAsync());
+  EXPECT_EQ(PWSfile::SUCCESS, core.WaitForAsyncSave());
+  EXPECT_FALSE(core.HasDBChanged());
+
+  PWScore core2;
+  ASSERT_EQ(PWSfile::SUCCESS, core2.ReadFile(fname.c_str(), passkey, true));
+  EXPECT_EQ(3, core2.GetNumEntries());
+  EXPECT_TRUE(core2.Find(item.GetUUID()) != core2.GetEntryEndIter());
+
+  core.ClearCommands();
+}
+
+TEST_F(FileV4Test, CoreWatchTest)
+{
+  PWScore core;
+  const StringX passkey(L"5thMambo");
+
+  EXPECT_FALSE(core.StartWatchingCurFile()); // nothing to watch yet
+  core.SetPassKey(passkey);
+  core.Execute(AddEntryCommand::Create(&core, fullItem));
+  ASSERT_EQ(PWSfile::SUCCESS, core.WriteFile(fname.c_str(), PWSfile::V40));
+
+  // The watcher follows the current file...
+  core.SetCurFile(fname.c_str());
+  EXPECT_TRUE(core.IsWatchingCurFile());
+  core.ClearData();
+  EXPECT_FALSE(core.IsWatchingCurFile());
+  ASSERT_EQ(PWSfile::SUCCESS, core.ReadCurFile(passkey));
+  EXPECT_TRUE(core.IsWatchingCurFile());
+  core.SetCurFile(StringX());
+  EXPECT_FALSE(core.IsWatchingCurFile());
+
+  // ...until told to stop
+  core.SetCurFile(fname.c_str());
+  EXPECT_TRUE(core.IsWatchingCurFile());
+  core.StopWatchingCurFile();
+  EXPECT_FALSE(core.IsWatchingCurFile());
+  core.SetCurFile(StringX());
+  core.SetCurFile(fname.c_str());
+  EXPECT_FALSE(core.IsWatchingCurFile());
+
+  core.ClearCommands();
+}
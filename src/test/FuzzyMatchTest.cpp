@@ -0,0 +1,199 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// FuzzyMatchTest.cpp: Unit test for FuzzyMatcher and PWScore::FuzzyFind
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/FuzzyMatch.h"
+#include "core/PWScore.h"
+#include "gtest/gtest.h"
+
+#include <algorithm>
+#include <random>
+
+// A fixture for factoring common code across tests
+class FuzzyMatchTest : public ::testing::Test
+{
+protected:
+  pws_os::CUUID AddEntry(const StringX &group, const StringX &title,
+                         const StringX &user, const StringX &url);
+  // Plain dynamic programming, for comparison with FuzzyMatcher::Distance
+  static unsigned int Distance(const StringX &pattern, const StringX &text);
+
+  PWScore core;
+};
+
+pws_os::CUUID FuzzyMatchTest::AddEntry(const StringX &group, const StringX &title,
+                                       const StringX &user, const StringX &url)
+{
+  CItemData ci;
+  ci.CreateUUID();
+  ci.SetGroup(group);
+  ci.SetTitle(title);
+  ci.SetUser(user);
+  ci.SetPassword(_T("password"));
+  ci.SetURL(url);
+  core.Execute(AddEntryCommand::Create(&core, ci));
+  return ci.GetUUID();
+}
+
+unsigned int FuzzyMatchTest::Distance(const StringX &pattern, const StringX &text)
+{
+  const size_t m = pattern.length(), n = text.length();
+  std::vector<std::vector<unsigned int> > D(m + 1, std::vector<unsigned int>(n + 1, 0));
+  for (size_t i = 1; i <= m; i++) {
+    D[i][0] = static_cast<unsigned int>(i);
+    for (size_t j = 1; j <= n; j++) {
+      D[i][j] = std::min(std::min(D[i - 1][j], D[i][j - 1]) + 1,
+                         D[i - 1][j - 1] + (pattern[i - 1] != text[j - 1] ? 1 : 0));
+      if (i > 1 && j > 1 && pattern[i - 1] == text[j - 2] && pattern[i - 2] == text[j - 1])
+        D[i][j] = std::min(D[i][j], D[i - 2][j - 2] + 1);
+    }
+  }
+  return *std::min_element(D[m].begin(), D[m].end());
+}
+
+// And now the tests...
+
+TEST_F(FuzzyMatchTest, Fold)
+{
+  EXPECT_EQ(TCHAR('a'), FuzzyMatcher::Fold(TCHAR('A')));
+  EXPECT_EQ(TCHAR('1'), FuzzyMatcher::Fold(TCHAR('1')));
+  EXPECT_EQ(TCHAR(0xE9), FuzzyMatcher::Fold(TCHAR(0xC9)));   // É
+  EXPECT_EQ(TCHAR(0xD7), FuzzyMatcher::Fold(TCHAR(0xD7)));   // ×
+  EXPECT_EQ(TCHAR(0xDF), FuzzyMatcher::Fold(TCHAR(0xDF)));   // ß
+  EXPECT_EQ(TCHAR(0x101), FuzzyMatcher::Fold(TCHAR(0x100))); // Ā
+  EXPECT_EQ(TCHAR(0x142), FuzzyMatcher::Fold(TCHAR(0x141))); // Ł
+  EXPECT_EQ(TCHAR(0x17E), FuzzyMatcher::Fold(TCHAR(0x17D))); // Ž
+  EXPECT_EQ(TCHAR(0xFF), FuzzyMatcher::Fold(TCHAR(0x178)));  // Ÿ
+  EXPECT_EQ(TCHAR(0x3C3), FuzzyMatcher::Fold(TCHAR(0x3A3))); // Σ
+  EXPECT_EQ(TCHAR(0x3C3), FuzzyMatcher::Fold(TCHAR(0x3C2))); // ς
+  EXPECT_EQ(TCHAR(0x3AD), FuzzyMatcher::Fold(TCHAR(0x388))); // Έ
+  EXPECT_EQ(TCHAR(0x434), FuzzyMatcher::Fold(TCHAR(0x414))); // Д
+  EXPECT_EQ(TCHAR(0x451), FuzzyMatcher::Fold(TCHAR(0x401))); // Ё
+}
+
+TEST_F(FuzzyMatchTest, Distance)
+{
+  const FuzzyMatcher gmail(_T("gmail"));
+  EXPECT_EQ(0U, gmail.Distance(_T("My GMail account")));
+  EXPECT_EQ(1U, gmail.Distance(_T("gmial")));  // transposition
+  EXPECT_EQ(1U, gmail.Distance(_T("gnail")));  // substitution
+  EXPECT_EQ(1U, gmail.Distance(_T("gmal")));   // deletion
+  EXPECT_EQ(1U, gmail.Distance(_T("my gmaiil"))); // insertion, anywhere
+  EXPECT_EQ(5U, gmail.Distance(_T("")));
+
+  // Against the textbook algorithm, on a small alphabet for many near matches
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> letter(0, 3);
+  for (int iter = 0; iter < 500; iter++) {
+    const size_t m = 1 + iter % 70, n = iter % 40;
+    StringX pattern, text;
+    for (size_t i = 0; i < m; i++)
+      pattern += static_cast<TCHAR>(_T('a') + letter(rng));
+    for (size_t i = 0; i < n; i++)
+      text += static_cast<TCHAR>(_T('a') + letter(rng));
+    const FuzzyMatcher matcher(pattern);
+    // Longer patterns are truncated
+    const StringX truncated = pattern.substr(0, FuzzyMatcher::MAX_PATTERN);
+    EXPECT_EQ(Distance(truncated, text), matcher.Distance(text))
+      << "pattern " << pattern.c_str() << ", text " << text.c_str();
+  }
+}
+
+TEST_F(FuzzyMatchTest, Score)
+{
+  const FuzzyMatcher gmail(_T("gmail"));
+  EXPECT_EQ(1U, gmail.GetMaxEdits());
+  EXPECT_GT(gmail.Score(_T("Gmail")), gmail.Score(_T("gmial")));
+  EXPECT_GT(gmail.Score(_T("gmial")), 0U);
+  EXPECT_GT(gmail.Score(_T("gmail")), gmail.Score(_T("hotmail"))); // "tmail"
+  EXPECT_EQ(0U, gmail.Score(_T("yahoo")));
+  EXPECT_EQ(0U, gmail.Score(_T("")));
+  EXPECT_EQ(0U, FuzzyMatcher(_T("")).Score(_T("Gmail")));
+
+  // Subsequences: consecutive characters and word starts count
+  const FuzzyMatcher gml(_T("gml"));
+  EXPECT_EQ(0U, gml.GetMaxEdits());
+  EXPECT_GT(gml.Score(_T("Gmail")), 0U);
+  EXPECT_EQ(0U, gml.Score(_T("Gmai")));
+  EXPECT_GT(gml.Score(_T("gmlx")), gml.Score(_T("Gmail")));
+  EXPECT_GT(gml.Score(_T("Google Mail")), gml.Score(_T("ogre small")));
+
+  const FuzzyMatcher bank(_T("bank"));
+  EXPECT_GT(bank.Score(_T("My Bank")), bank.Score(_T("Embankment")));
+  EXPECT_GT(bank.Score(_T("MyBank")), bank.Score(_T("Embankment")));
+  EXPECT_GT(bank.Score(_T("Bank")), bank.Score(_T("My Bank")));
+  // An exact match somewhere beats a scattered one earlier on
+  EXPECT_GT(bank.Score(_T("b a n k bank")), bank.Score(_T("b a n k")));
+
+  // Case folded beyond ASCII
+  const FuzzyMatcher cafe(_T("CAF\x00C9"));
+  EXPECT_EQ(cafe.Score(_T("CAF\x00C9")), cafe.Score(_T("caf\x00E9")));
+}
+
+TEST_F(FuzzyMatchTest, FuzzyFind)
+{
+  const pws_os::CUUID gmail = AddEntry(_T("Mail"), _T("Gmail"), _T("me"), _T(""));
+  const pws_os::CUUID google = AddEntry(_T("Mail"), _T("Google Mail"), _T("me"), _T(""));
+  AddEntry(_T("Mail"), _T("Hotmail"), _T("me"), _T(""));
+  const pws_os::CUUID url = AddEntry(_T("Web"), _T("Login"), _T("me"),
+                                     _T("https://mail.gmial.com"));
+  AddEntry(_T("Bank"), _T("Savings"), _T("me"), _T("https://bank.example.com"));
+
+  std::vector<st_FuzzyMatch> vMatches;
+  core.FuzzyFind(_T("gmial"), 10, vMatches);
+  ASSERT_EQ(2U, vMatches.size());
+  EXPECT_EQ(url, vMatches[0].uuid); // exact in URL
+  EXPECT_EQ(CItemData::URL, vMatches[0].ft);
+  EXPECT_EQ(gmail, vMatches[1].uuid);
+  EXPECT_EQ(CItemData::TITLE, vMatches[1].ft);
+
+  core.FuzzyFind(_T("mail"), 10, vMatches);
+  ASSERT_EQ(4U, vMatches.size());
+  for (size_t i = 1; i < vMatches.size(); i++)
+    EXPECT_GE(vMatches[i - 1].score, vMatches[i].score);
+  core.FuzzyFind(_T("mail"), 2, vMatches);
+  EXPECT_EQ(2U, vMatches.size());
+
+  core.FuzzyFind(_T("gm"), 10, vMatches);
+  ASSERT_EQ(3U, vMatches.size());
+  EXPECT_EQ(gmail, vMatches[0].uuid); // at the start
+  EXPECT_EQ(url, vMatches[1].uuid);   // consecutive, at a word start
+  EXPECT_EQ(google, vMatches[2].uuid); // scattered
+
+  core.FuzzyFind(_T(""), 10, vMatches);
+  EXPECT_TRUE(vMatches.empty());
+  core.FuzzyFind(_T("mail"), 0, vMatches);
+  EXPECT_TRUE(vMatches.empty());
+  core.ClearData();
+  core.ClearCommands();
+}
+
+TEST_F(FuzzyMatchTest, Threads)
+{
+  // Enough entries for several threads, with plenty of equal scores
+  for (unsigned i = 0; i < 1200; i++) {
+    StringX title;
+    Format(title, _T("Account %u"), i);
+    AddEntry(_T("Group"), title, _T("user"), _T(""));
+  }
+  std::vector<st_FuzzyMatch> v1, v4;
+  core.FuzzyFind(_T("acount 12"), 25, v1, 1);
+  core.FuzzyFind(_T("acount 12"), 25, v4, 4);
+  ASSERT_EQ(25U, v1.size());
+  ASSERT_EQ(v1.size(), v4.size());
+  for (size_t i = 0; i < v1.size(); i++) {
+    EXPECT_EQ(v1[i].uuid, v4[i].uuid);
+    EXPECT_EQ(v1[i].score, v4[i].score);
+  }
+  core.ClearData();
+  core.ClearCommands();
+}
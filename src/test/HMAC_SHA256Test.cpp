@@ -6,7 +6,8 @@
 * http://www.opensource.org/licenses/artistic-license-2.0.php
 */
 // HMAC_SHA256Test.cpp: Unit test for HMAC implementation with SHA256
-// Test vectors from RFC4231
+// Test vectors from RFC4231, PBKDF2 vectors as published for RFC2898
+// with SHA-256 (cf. RFC7914 Section 11, RFC6070)
 
 #ifdef WIN32
 #include "../ui/Windows/stdafx.h"
@@ -14,8 +15,11 @@
 
 #include "core/hmac.h"
 #include "core/sha256.h"
+#include "core/pbkdf2.h"
 #include "gtest/gtest.h"
 
+#include <cstring>
+
 TEST(HMAC_SHA256Test, hmac_sha256_test)
 {
   static const unsigned char key1[] =
@@ -182,6 +186,80 @@ TEST(HMAC_SHA256Test, hmac_sha256_test)
     md.Final(tmp);
     EXPECT_TRUE(memcmp(tmp, tests[i].hash, 32) == 0) << "Test vector " << i;
   }
+
+  // Same again with precomputed pads, twice per key as Final() leaves
+  // the HMAC keyed
+  for (i = 0; i < (sizeof(tests) / sizeof(tests[0])); i++) {
+    HMAC_SHA256 md(tests[i].key, tests[i].keylen);
+    for (int n = 0; n < 2; n++) {
+      md.Update(tests[i].data, tests[i].datalen);
+      md.Final(tmp);
+      EXPECT_TRUE(memcmp(tmp, tests[i].hash, 32) == 0) << "Test vector " << i;
+    }
+  }
+}
+
+TEST(HMAC_SHA256Test, pbkdf2_sha256_test)
+{
+  static const struct {
+    const char *password;
+    const char *salt;
+    unsigned int c;
+    unsigned long dkLen;
+    unsigned char dk[40];
+  } tests[] = {
+    {"password", "salt", 1, 32,
+     {0x12, 0x0f, 0xb6, 0xcf, 0xfc, 0xf8, 0xb3, 0x2c,
+      0x43, 0xe7, 0x22, 0x52, 0x56, 0xc4, 0xf8, 0x37,
+      0xa8, 0x65, 0x48, 0xc9, 0x2c, 0xcc, 0x35, 0x48,
+      0x08, 0x05, 0x98, 0x7c, 0xb7, 0x0b, 0xe1, 0x7b, }
+    },
+    {"password", "salt", 2, 32,
+     {0xae, 0x4d, 0x0c, 0x95, 0xaf, 0x6b, 0x46, 0xd3,
+      0x2d, 0x0a, 0xdf, 0xf9, 0x28, 0xf0, 0x6d, 0xd0,
+      0x2a, 0x30, 0x3f, 0x8e, 0xf3, 0xc2, 0x51, 0xdf,
+      0xd6, 0xe2, 0xd8, 0x5a, 0x95, 0x47, 0x4c, 0x43, }
+    },
+    {"password", "salt", 4096, 32,
+     {0xc5, 0xe4, 0x78, 0xd5, 0x92, 0x88, 0xc8, 0x41,
+      0xaa, 0x53, 0x0d, 0xb6, 0x84, 0x5c, 0x4c, 0x8d,
+      0x96, 0x28, 0x93, 0xa0, 0x01, 0xce, 0x4e, 0x11,
+      0xa4, 0x96, 0x38, 0x73, 0xaa, 0x98, 0x13, 0x4a, }
+    },
+    {"passwordPASSWORDpassword", "saltSALTsaltSALTsaltSALTsaltSALTsalt", 4096, 40,
+     {0x34, 0x8c, 0x89, 0xdb, 0xcb, 0xd3, 0x2b, 0x2f,
+      0x32, 0xd8, 0x14, 0xb8, 0x11, 0x6e, 0x84, 0xcf,
+      0x2b, 0x17, 0x34, 0x7e, 0xbc, 0x18, 0x00, 0x18,
+      0x1c, 0x4e, 0x2a, 0x1f, 0xb8, 0xdd, 0x53, 0xe1,
+      0xc6, 0x35, 0x51, 0x8c, 0x7d, 0xac, 0x47, 0xe9, }
+    },
+  };
+
+  for (size_t i = 0; i < (sizeof(tests) / sizeof(tests[0])); i++) {
+    const unsigned char *P = reinterpret_cast<const unsigned char *>(tests[i].password);
+    const unsigned char *S = reinterpret_cast<const unsigned char *>(tests[i].salt);
+    const unsigned long Plen = static_cast<unsigned long>(strlen(tests[i].password));
+    const unsigned long Slen = static_cast<unsigned long>(strlen(tests[i].salt));
+    unsigned char dk[40];
+
+    // Fused loop
+    HMAC_SHA256 hmac(P, Plen);
+    hmac.PBKDF2(S, Slen, tests[i].c, dk, tests[i].dkLen);
+    EXPECT_TRUE(memcmp(dk, tests[i].dk, tests[i].dkLen) == 0) << "Test vector " << i;
+
+    // Generic implementation, with either HMAC
+    HMAC<SHA256, SHA256::HASHLEN, SHA256::BLOCKSIZE> hmac1;
+    unsigned long dkLen = tests[i].dkLen;
+    memset(dk, 0, sizeof(dk));
+    pbkdf2(P, Plen, S, Slen, tests[i].c, &hmac1, dk, &dkLen);
+    EXPECT_EQ(tests[i].dkLen, dkLen);
+    EXPECT_TRUE(memcmp(dk, tests[i].dk, tests[i].dkLen) == 0) << "Test vector " << i;
+
+    HMAC_SHA256 hmac2;
+    memset(dk, 0, sizeof(dk));
+    pbkdf2(P, Plen, S, Slen, tests[i].c, &hmac2, dk, &dkLen);
+    EXPECT_TRUE(memcmp(dk, tests[i].dk, tests[i].dkLen) == 0) << "Test vector " << i;
+  }
 }
 
 
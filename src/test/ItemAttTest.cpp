@@ -12,13 +12,18 @@
 #endif
 
 #include "core/ItemAtt.h"
+#include "core/PWSCompress.h"
 #include "core/PWScore.h"
+#include "core/PWSprefs.h"
+#include "core/PWSrand.h"
 #include "os/file.h"
 #include "os/dir.h"
 #include "os/debug.h"
 
 #include "gtest/gtest.h"
 
+#include <cstring>
+#include <string>
 #include <vector>
 
 using namespace std;
@@ -176,3 +181,105 @@ TEST_F(ItemAttTest, Getters_n_Setters)
 
   delete[] contentVal;
 }
+
+TEST_F(ItemAttTest, Compression)
+{
+  CItemAtt a1, a2;
+  EXPECT_EQ(PWSCompress::NONE, a1.GetCompression());
+  a1.SetCompression(PWSCompress::ZLIB);
+  EXPECT_EQ(PWSCompress::ZLIB, a1.GetCompression());
+  EXPECT_FALSE(a1.IsContentCompressed());
+  EXPECT_FALSE(a1 == a2);
+  a1.SetCompression(PWSCompress::NONE);
+  EXPECT_TRUE(a1 == a2);
+
+  EXPECT_FALSE(PWSCompress::IsCompressible(_T("image/jpeg")));
+  EXPECT_FALSE(PWSCompress::IsCompressible(_T("video/mp4")));
+  EXPECT_FALSE(PWSCompress::IsCompressible(
+    _T("application/vnd.openxmlformats-officedocument.wordprocessingml.document")));
+  EXPECT_TRUE(PWSCompress::IsCompressible(_T("audio/x-wav")));
+  EXPECT_TRUE(PWSCompress::IsCompressible(_T("text/plain")));
+  EXPECT_TRUE(PWSCompress::IsCompressible(_T("unknown")));
+
+  std::vector<unsigned char> text;
+  for (int i = 0; i < 1000; i++)
+    text.push_back(static_cast<unsigned char>('a' + i % 7));
+  unsigned char *out = NULL;
+  size_t outLen = 0;
+  EXPECT_TRUE(PWSCompress::IsSupported(PWSCompress::ZLIB));
+  if (!PWSCompress::CanCompress(PWSCompress::ZLIB)) {
+    EXPECT_FALSE(PWSCompress::Compress(PWSCompress::ZLIB, text.data(), text.size(),
+                                       out, outLen));
+    return;
+  }
+  ASSERT_TRUE(PWSCompress::Compress(PWSCompress::ZLIB, text.data(), text.size(),
+                                    out, outLen));
+  EXPECT_LT(outLen, text.size());
+  std::vector<unsigned char> back(text.size());
+  EXPECT_TRUE(PWSCompress::Decompress(PWSCompress::ZLIB, out, outLen,
+                                      back.data(), back.size()));
+  EXPECT_TRUE(text == back);
+  // same with the built-in decoder
+  back.assign(back.size(), 0);
+  EXPECT_TRUE(PWSCompress::Inflate(out, outLen, back.data(), back.size()));
+  EXPECT_TRUE(text == back);
+  // wrong length recorded
+  EXPECT_FALSE(PWSCompress::Decompress(PWSCompress::ZLIB, out, outLen,
+                                       back.data(), back.size() - 1));
+  delete[] out;
+
+  // Random data doesn't compress enough to keep
+  PWSrand::GetInstance()->GetRandomData(text.data(), text.size());
+  EXPECT_FALSE(PWSCompress::Compress(PWSCompress::ZLIB, text.data(), text.size(),
+                                     out, outLen));
+}
+
+TEST_F(ItemAttTest, Inflate)
+{
+  // "abc" in a stored block, then with a bad Adler-32
+  unsigned char stored[] = {0x78, 0x01, 0x01, 0x03, 0x00, 0xfc, 0xff,
+                            'a', 'b', 'c', 0x02, 0x4d, 0x01, 0x27};
+  unsigned char out[3];
+  EXPECT_TRUE(PWSCompress::Inflate(stored, sizeof(stored), out, sizeof(out)));
+  EXPECT_EQ(0, memcmp(out, "abc", 3));
+  EXPECT_FALSE(PWSCompress::Inflate(stored, sizeof(stored), out, 2));
+  EXPECT_FALSE(PWSCompress::Inflate(stored, sizeof(stored) - 1, out, sizeof(out)));
+  stored[sizeof(stored) - 1]++;
+  EXPECT_FALSE(PWSCompress::Inflate(stored, sizeof(stored), out, sizeof(out)));
+
+  // Enough text for dynamic Huffman blocks
+  std::vector<unsigned char> text;
+  for (int i = 0; i < 2000; i++) {
+    std::string line = "key" + std::to_string(i * 7919 % 1013) + " = value " +
+      std::to_string(i % 31) + "\n";
+    text.insert(text.end(), line.begin(), line.end());
+  }
+  unsigned char *zout = NULL;
+  size_t zoutLen = 0;
+  if (!PWSCompress::Compress(PWSCompress::ZLIB, text.data(), text.size(),
+                             zout, zoutLen))
+    return; // NO_ZLIB
+  EXPECT_EQ(2, (zout[2] >> 1) & 3);
+  std::vector<unsigned char> back(text.size());
+  EXPECT_TRUE(PWSCompress::Inflate(zout, zoutLen, back.data(), back.size()));
+  EXPECT_TRUE(text == back);
+  // Truncated
+  EXPECT_FALSE(PWSCompress::Inflate(zout, zoutLen / 2, back.data(), back.size()));
+  delete[] zout;
+}
+
+TEST_F(ItemAttTest, ImportCompression)
+{
+  // Imported attachments are compressed on file as per preference
+  PWSprefs *prefs = PWSprefs::GetInstance();
+  CItemAtt ai;
+  prefs->SetPref(PWSprefs::CompressAttachments, false);
+  ASSERT_EQ(PWScore::SUCCESS, ai.Import(fullfileName));
+  EXPECT_EQ(PWSCompress::NONE, ai.GetCompression());
+
+  prefs->SetPref(PWSprefs::CompressAttachments, true);
+  ASSERT_EQ(PWScore::SUCCESS, ai.Import(fullfileName));
+  EXPECT_EQ(PWSCompress::CanCompress(PWSCompress::ZLIB) ?
+            PWSCompress::ZLIB : PWSCompress::NONE, ai.GetCompression());
+  prefs->SetPref(PWSprefs::CompressAttachments, false); // the default
+}
@@ -238,3 +238,83 @@ TEST_F(ItemDataTest, UnknownFields)
   // how they're processed. Worth exposing an API
   // just for testing, TBD.
 }
+
+TEST_F(ItemDataTest, ParsedPasswordHistory)
+{
+  // Well-formed history is kept parsed, and round-trips unchanged
+  const StringX pwh(L"10302" L"5a0f3c1e0004pw#1" L"5a0f3c2f0005pw #2");
+  CItemData di;
+  di.SetPWHistory(pwh);
+  EXPECT_TRUE(di.IsPasswordHistorySet());
+  EXPECT_EQ(pwh, di.GetPWHistory());
+  EXPECT_TRUE(di.GetPWHistoryStatus());
+  EXPECT_EQ(3, di.GetPWHistoryMax());
+  EXPECT_EQ(2, di.GetPWHistoryCount());
+  EXPECT_TRUE(di.ValidatePWHistory());
+
+  size_t pwh_max, num_err;
+  PWHistList pwhl;
+  EXPECT_TRUE(di.GetPWHistoryList(pwh_max, num_err, pwhl, PWSUtil::TMC_ASC_UNKNOWN));
+  EXPECT_EQ(0, num_err);
+  ASSERT_EQ(2, pwhl.size());
+  EXPECT_EQ(time_t(0x5a0f3c1e), pwhl[0].changetttdate);
+  EXPECT_EQ(L"pw #2", pwhl[1].password);
+
+  // Copies & comparisons see the same history
+  CItemData di2(di);
+  EXPECT_EQ(di, di2);
+  di2.SetPWHistoryMax(4);
+  EXPECT_EQ(L"10402" L"5a0f3c1e0004pw#1" L"5a0f3c2f0005pw #2", di2.GetPWHistory());
+  EXPECT_NE(di, di2);
+  di2.SetPWHistoryStatus(false);
+  EXPECT_FALSE(di2.GetPWHistoryStatus());
+  EXPECT_EQ(L'0', di2.GetPWHistory()[0]);
+
+  // "00000" is no history
+  di2.SetPWHistory(L"10000");
+  di2.SetPWHistoryStatus(false);
+  EXPECT_FALSE(di2.IsPasswordHistorySet());
+
+  // Malformed history (upper case hex, bad count) is kept as-is
+  const StringX bad(L"10A01" L"5a0f3c1e0004pw#1");
+  di2.SetPWHistory(bad);
+  EXPECT_EQ(bad, di2.GetPWHistory());
+  EXPECT_EQ(10, di2.GetPWHistoryMax());
+  const StringX bad2(L"10302" L"5a0f3c1e0004pw#1");
+  di2.SetPWHistory(bad2);
+  EXPECT_EQ(bad2, di2.GetPWHistory());
+  EXPECT_FALSE(di2.ValidatePWHistory());
+  EXPECT_EQ(L"10301" L"5a0f3c1e0004pw#1", di2.GetPWHistory());
+  EXPECT_EQ(1, di2.GetPWHistoryCount());
+}
+
+TEST_F(ItemDataTest, Matches)
+{
+  CItemData di;
+  di.SetTitle(L"Hello World");
+  di.SetUser(L"J\x00f6rg");
+
+  // Decided on the UTF-8 as held...
+  EXPECT_TRUE(di.Matches(L"Hello World", CItemData::TITLE, -PWSMatch::MR_EQUALS));
+  EXPECT_FALSE(di.Matches(L"hello world", CItemData::TITLE, -PWSMatch::MR_EQUALS));
+  EXPECT_TRUE(di.Matches(L"hello world", CItemData::TITLE, PWSMatch::MR_EQUALS));
+  EXPECT_TRUE(di.Matches(L"hello", CItemData::TITLE, PWSMatch::MR_BEGINS));
+  EXPECT_TRUE(di.Matches(L"hello", CItemData::TITLE, -PWSMatch::MR_NOTBEGIN));
+  EXPECT_TRUE(di.Matches(L"WORLD", CItemData::TITLE, PWSMatch::MR_ENDS));
+  EXPECT_FALSE(di.Matches(L"Hello World", CItemData::TITLE, PWSMatch::MR_ENDS));
+  EXPECT_TRUE(di.Matches(L"o W", CItemData::TITLE, -PWSMatch::MR_CONTAINS));
+  EXPECT_TRUE(di.Matches(L"xyz", CItemData::TITLE, PWSMatch::MR_NOTCONTAIN));
+  EXPECT_TRUE(di.Matches(L"\x00f6r", CItemData::USER, -PWSMatch::MR_CONTAINS));
+  EXPECT_FALSE(di.Matches(L"or", CItemData::USER, -PWSMatch::MR_CONTAINS));
+  EXPECT_TRUE(di.Matches(L"", CItemData::URL, -PWSMatch::MR_EQUALS));
+  EXPECT_TRUE(di.Matches(L"x", CItemData::URL, PWSMatch::MR_NOTCONTAIN));
+
+  EXPECT_TRUE(di.Matches(L"J\x00f6rg", CItemData::USER, -PWSMatch::MR_EQUALS));
+
+  // ...or not
+  EXPECT_TRUE(di.Matches(L"xyzW", CItemData::TITLE, PWSMatch::MR_CNTNANY));
+  EXPECT_TRUE(di.Matches(L"", CItemData::TITLE, PWSMatch::MR_PRESENT));
+  EXPECT_TRUE(di.Matches(L"J\x00f6", CItemData::USER, PWSMatch::MR_BEGINS));
+  di.SetGroup(L"Greetings");
+  EXPECT_TRUE(di.Matches(L"greetings.hello", CItemData::GROUPTITLE, PWSMatch::MR_BEGINS));
+}
@@ -77,3 +77,23 @@ TEST_F(ItemFieldTest, testMe)
   EXPECT_EQ(sizeof(v1), lenV2);
   EXPECT_TRUE(memcmp(v1, v2, sizeof(v1)) == 0);
 }
+
+TEST_F(ItemFieldTest, Text)
+{
+  // Text is held as UTF-8: 1 + 2 + 3 bytes
+  const StringX sx(L"a\x00e9\x20ac");
+  CItemField i1(2);
+  i1.Set(sx, m_bf);
+  EXPECT_EQ(6, i1.GetLength());
+
+  StringX sx2(L"previous");
+  i1.Get(sx2, m_bf);
+  EXPECT_EQ(sx, sx2);
+
+  // What can't be encoded is replaced, not lost
+  StringX sx3(L"ab");
+  sx3 += wchar_t(0xd800);
+  i1.Set(sx3, m_bf);
+  i1.Get(sx2, m_bf);
+  EXPECT_EQ(StringX(L"ab\xfffd"), sx2);
+}
@@ -8,11 +8,91 @@
 // OSTest.cpp: Unit test for misc pws_os functions
 
 #include "os/media.h"
+#include "os/file.h"
+#include "os/filewatch.h"
 #include "gtest/gtest.h"
 
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 TEST(OSTest, testMedia)
 {
   EXPECT_EQ(_S("unknown"), pws_os::GetMediaType(_S("nosuchfile")));
   EXPECT_EQ(_S("text/plain"), pws_os::GetMediaType(_S("data/text1.txt")));
   EXPECT_EQ(_S("image/jpeg"), pws_os::GetMediaType(_S("data/image1.jpg")));
 }
+
+TEST(OSTest, testFileWatcher)
+{
+  const stringT fname(_S("watched.txt"));
+  FILE *fp = pws_os::FOpen(fname, _S("wb"));
+  ASSERT_TRUE(fp != NULL);
+  fputs("before", fp);
+  fclose(fp);
+
+  std::atomic<int> nCalls(0);
+  CFileWatcher watcher(50, 100);
+  std::vector<stringT> vFiles(1, fname);
+  ASSERT_TRUE(watcher.Start(vFiles,
+                            [&nCalls](const std::vector<stringT> &) {nCalls++;}));
+  EXPECT_TRUE(watcher.IsWatching());
+
+  // Our own changes aren't reported
+  watcher.Suspend();
+  fp = pws_os::FOpen(fname, _S("ab"));
+  fputs(" - ours", fp);
+  fclose(fp);
+  watcher.Resume();
+  std::this_thread::sleep_for(std::chrono::milliseconds(400));
+  EXPECT_EQ(0, nCalls);
+
+  // Everyone else's are, once per burst
+  for (int i = 0; i < 3; i++) {
+    fp = pws_os::FOpen(fname, _S("ab"));
+    fputs(" - theirs", fp);
+    fclose(fp);
+  }
+  for (int i = 0; i < 40 && nCalls == 0; i++)
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(1, nCalls);
+
+  watcher.Stop();
+  EXPECT_FALSE(watcher.IsWatching());
+  EXPECT_TRUE(pws_os::DeleteAFile(fname));
+}
+
+TEST(OSTest, testCopyAndReplaceFile)
+{
+  const stringT fname(_S("copysrc.txt"));
+  const stringT cname(_S("copydst.txt"));
+  const stringT tname(_S("copysrc.txt.tmp"));
+  // Large enough to need more than one buffer if we end up with read/write
+  const std::string data(200000, 'x');
+
+  FILE *fp = pws_os::FOpen(fname, _S("wb"));
+  ASSERT_TRUE(fp != NULL);
+  fwrite(data.data(), 1, data.size(), fp);
+  fclose(fp);
+
+  ASSERT_TRUE(pws_os::CopyAFile(fname, cname));
+  fp = pws_os::FOpen(cname, _S("rb"));
+  ASSERT_TRUE(fp != NULL);
+  EXPECT_EQ(data.size(), pws_os::fileLength(fp));
+  fclose(fp);
+  EXPECT_FALSE(pws_os::CopyAFile(_S("nosuchfile"), cname));
+
+  fp = pws_os::FOpen(tname, _S("wb"));
+  ASSERT_TRUE(fp != NULL);
+  fputs("new", fp);
+  fclose(fp);
+  ASSERT_TRUE(pws_os::ReplaceAFile(tname, fname));
+  EXPECT_FALSE(pws_os::FileExists(tname));
+  fp = pws_os::FOpen(fname, _S("rb"));
+  ASSERT_TRUE(fp != NULL);
+  EXPECT_EQ(3U, pws_os::fileLength(fp));
+  fclose(fp);
+
+  EXPECT_TRUE(pws_os::DeleteAFile(fname));
+  EXPECT_TRUE(pws_os::DeleteAFile(cname));
+}
@@ -0,0 +1,132 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// PWCharPoolTest.cpp: Unit test for password generation
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWCharPool.h"
+#include "core/PWPolicy.h"
+#include "gtest/gtest.h"
+
+#include <vector>
+#include <set>
+
+// A fixture for factoring common code across tests
+class PWCharPoolTest : public ::testing::Test
+{
+protected:
+  PWCharPoolTest() {}
+
+  static size_t Count(const StringX &sx, const StringX &chars)
+  {
+    size_t n = 0;
+    for (auto c : sx)
+      n += (chars.find(c) != StringX::npos);
+    return n;
+  }
+
+  static const StringX lower, upper, digits, hexdigits;
+};
+
+const StringX PWCharPoolTest::lower(_T("abcdefghijklmnopqrstuvwxyz"));
+const StringX PWCharPoolTest::upper(_T("ABCDEFGHIJKLMNOPQRSTUVWXYZ"));
+const StringX PWCharPoolTest::digits(_T("0123456789"));
+const StringX PWCharPoolTest::hexdigits(_T("0123456789abcdef"));
+
+// And now the tests...
+
+TEST_F(PWCharPoolTest, Normal)
+{
+  PWPolicy pwp;
+  pwp.flags = PWPolicy::UseLowercase | PWPolicy::UseUppercase |
+    PWPolicy::UseDigits | PWPolicy::UseSymbols;
+  pwp.length = 16;
+  pwp.lowerminlength = 2;
+  pwp.upperminlength = 3;
+  pwp.digitminlength = 4;
+  pwp.symbolminlength = 1;
+  pwp.symbols = _T("#$%");
+
+  std::vector<StringX> vPasswords;
+  pwp.MakeRandomPasswords(500, vPasswords);
+  ASSERT_EQ(500, vPasswords.size());
+  for (auto iter = vPasswords.begin(); iter != vPasswords.end(); iter++) {
+    ASSERT_EQ(16, iter->length());
+    EXPECT_LE(2, Count(*iter, lower));
+    EXPECT_LE(3, Count(*iter, upper));
+    EXPECT_LE(4, Count(*iter, digits));
+    EXPECT_LE(1, Count(*iter, pwp.symbols));
+    EXPECT_EQ(16, Count(*iter, lower + upper + digits + pwp.symbols));
+  }
+  // Not the same password over and over
+  EXPECT_EQ(vPasswords.size(),
+            std::set<StringX>(vPasswords.begin(), vPasswords.end()).size());
+
+  // Same character set one at a time
+  const StringX sx = pwp.MakeRandomPassword();
+  EXPECT_EQ(16, Count(sx, lower + upper + digits + pwp.symbols));
+
+  // Edge cases
+  pwp.MakeRandomPasswords(0, vPasswords);
+  EXPECT_TRUE(vPasswords.empty());
+  pwp.flags = PWPolicy::UseDigits;
+  pwp.length = 1;
+  pwp.digitminlength = 1;
+  pwp.MakeRandomPasswords(100, vPasswords);
+  ASSERT_EQ(100, vPasswords.size());
+  for (auto iter = vPasswords.begin(); iter != vPasswords.end(); iter++)
+    EXPECT_EQ(1, Count(*iter, digits));
+}
+
+TEST_F(PWCharPoolTest, Hex)
+{
+  PWPolicy pwp;
+  pwp.flags = PWPolicy::UseHexDigits;
+  pwp.length = 32;
+
+  std::vector<StringX> vPasswords;
+  pwp.MakeRandomPasswords(200, vPasswords);
+  ASSERT_EQ(200, vPasswords.size());
+  std::set<charT> seen;
+  for (auto iter = vPasswords.begin(); iter != vPasswords.end(); iter++) {
+    ASSERT_EQ(32, iter->length());
+    EXPECT_EQ(32, Count(*iter, hexdigits));
+    seen.insert(iter->begin(), iter->end());
+  }
+  // 6400 draws, every digit should turn up
+  EXPECT_EQ(16, seen.size());
+}
+
+TEST_F(PWCharPoolTest, Pronounceable)
+{
+  PWPolicy pwp;
+  pwp.flags = PWPolicy::UseLowercase | PWPolicy::MakePronounceable;
+  pwp.length = 12;
+
+  std::vector<StringX> vPasswords;
+  pwp.MakeRandomPasswords(200, vPasswords);
+  ASSERT_EQ(200, vPasswords.size());
+  for (auto iter = vPasswords.begin(); iter != vPasswords.end(); iter++) {
+    // The random walk may stop early, but never starts with less than a trigram
+    EXPECT_LE(3, iter->length());
+    EXPECT_GE(12, iter->length());
+    EXPECT_EQ(iter->length(), Count(*iter, lower));
+  }
+
+  // Leet substitutions when digits are allowed
+  pwp.flags |= PWPolicy::UseDigits;
+  pwp.MakeRandomPasswords(200, vPasswords);
+  size_t numWithDigits = 0;
+  for (auto iter = vPasswords.begin(); iter != vPasswords.end(); iter++) {
+    EXPECT_EQ(iter->length(), Count(*iter, lower + digits));
+    numWithDigits += (Count(*iter, digits) != 0);
+  }
+  EXPECT_LT(0, numWithDigits);
+}
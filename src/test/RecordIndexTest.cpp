@@ -0,0 +1,161 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// RecordIndexTest.cpp: Unit test for read-only fast open of a database
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWSRecordIndex.h"
+#include "core/PWScore.h"
+#include "core/PWSTrace.h"
+#include "os/file.h"
+#include "gtest/gtest.h"
+
+#include <string>
+
+// A fixture for factoring common code across tests
+class RecordIndexTest : public ::testing::Test
+{
+protected:
+  RecordIndexTest() : fname(_T("recordindex.psafe3")), passkey(_T("index-passkey")) {}
+  void SetUp();
+  void TearDown();
+  void CheckIndex(PWSRecordIndex &index);
+
+  const StringX fname, passkey;
+  PWScore core;
+};
+
+void RecordIndexTest::SetUp()
+{
+  for (int i = 0; i < 200; i++) {
+    CItemData ci;
+    ci.CreateUUID();
+    StringX title, notes;
+    Format(title, _T("entry %d"), i);
+    // Long enough to span many blocks, so that skipping them matters
+    for (int j = 0; j < i % 7; j++)
+      notes += _T("Notes that are skipped by the index, but not by ReadEntry. ");
+    ci.SetGroup(i % 2 ? _T("odd") : _T("even.sub"));
+    ci.SetTitle(title);
+    ci.SetUser(i % 3 ? L"user" : L"\x00fc\x0073\x20ac\x0072");
+    ci.SetPassword(_T("password"));
+    ci.SetNotes(notes);
+    core.Execute(AddEntryCommand::Create(&core, ci));
+  }
+  core.SetPassKey(passkey);
+}
+
+void RecordIndexTest::TearDown()
+{
+  pws_os::DeleteAFile(fname.c_str());
+}
+
+void RecordIndexTest::CheckIndex(PWSRecordIndex &index)
+{
+  ASSERT_EQ(core.GetNumEntries(), index.GetNumEntries());
+  for (size_t i = 0; i < index.GetNumEntries(); i++) {
+    const st_IndexEntry &entry = index.GetEntry(i);
+    ItemListIter iter = core.Find(entry.uuid);
+    ASSERT_NE(core.GetEntryEndIter(), iter);
+    const CItemData &ci = iter->second;
+    EXPECT_EQ(ci.GetGroup(), entry.group);
+    EXPECT_EQ(ci.GetTitle(), entry.title);
+    EXPECT_EQ(ci.GetUser(), entry.user);
+
+    size_t j;
+    ASSERT_TRUE(index.Find(entry.uuid, j));
+    EXPECT_EQ(i, j);
+  }
+
+  // Entries decrypted on demand, in any order
+  for (size_t i = index.GetNumEntries(); i-- > 0; ) {
+    CItemData ci;
+    ASSERT_EQ(PWSfile::SUCCESS, index.ReadEntry(i, ci));
+    EXPECT_EQ(core.Find(index.GetEntry(i).uuid)->second, ci);
+  }
+}
+
+// And now the tests...
+
+TEST_F(RecordIndexTest, V3)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+
+  PWSRecordIndex index;
+  ASSERT_EQ(PWSfile::SUCCESS, index.Open(fname, passkey));
+  EXPECT_EQ(PWSfile::V30, index.GetVersion());
+  CheckIndex(index);
+  EXPECT_EQ(PWSfile::SUCCESS, index.WaitForVerify());
+  EXPECT_TRUE(index.IsVerifyDone());
+
+  index.Close();
+  EXPECT_EQ(0, index.GetNumEntries());
+  EXPECT_EQ(PWSfile::WRONG_PASSWORD, index.Open(fname, _T("wrong passkey")));
+}
+
+TEST_F(RecordIndexTest, V4)
+{
+  CItemAtt att;
+  att.CreateUUID();
+  att.SetTitle(L"attachment");
+  ASSERT_EQ(PWSfile::SUCCESS, att.Import(L"data/text1.txt"));
+  CItemData ci;
+  ci.CreateUUID();
+  ci.SetTitle(_T("with attachment"));
+  ci.SetPassword(_T("password"));
+  ci.SetAttUUID(att.GetUUID());
+  core.Execute(AddEntryCommand::Create(&core, ci, pws_os::CUUID::NullUUID(), &att));
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V40));
+
+  PWSRecordIndex index;
+  ASSERT_EQ(PWSfile::SUCCESS, index.Open(fname, passkey));
+  EXPECT_EQ(PWSfile::V40, index.GetVersion());
+  CheckIndex(index);
+  EXPECT_EQ(PWSfile::SUCCESS, index.WaitForVerify());
+}
+
+TEST_F(RecordIndexTest, BadDigest)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+
+  // The digest is the file's last 32 bytes
+  FILE *fd = pws_os::FOpen(fname.c_str(), _T("r+b"));
+  ASSERT_TRUE(fd != NULL);
+  ASSERT_EQ(0, fseek(fd, -1, SEEK_END));
+  const int c = fgetc(fd);
+  ASSERT_EQ(0, fseek(fd, -1, SEEK_END));
+  fputc(c ^ 0x01, fd);
+  fclose(fd);
+
+  // Usable until we know better
+  PWSRecordIndex index;
+  ASSERT_EQ(PWSfile::SUCCESS, index.Open(fname, passkey));
+  EXPECT_EQ(core.GetNumEntries(), index.GetNumEntries());
+  EXPECT_EQ(PWSfile::BAD_DIGEST, index.WaitForVerify());
+}
+
+TEST_F(RecordIndexTest, StretchOnce)
+{
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+
+  // The verifier reuses the keys Open() got, rather than getting its own
+  PWSTrace::Clear();
+  PWSTrace::Enable(true);
+  PWSRecordIndex index;
+  ASSERT_EQ(PWSfile::SUCCESS, index.Open(fname, passkey));
+  EXPECT_EQ(PWSfile::SUCCESS, index.WaitForVerify());
+  PWSTrace::Enable(false);
+  const std::string sTrace = PWSTrace::ChromeTrace();
+  PWSTrace::Clear();
+
+  const std::string what("\"name\":\"StretchKey\"");
+  EXPECT_NE(std::string::npos, sTrace.find(what));
+  EXPECT_EQ(sTrace.find(what), sTrace.rfind(what));
+}
@@ -0,0 +1,154 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// TraceTest.cpp: Unit test for PWSTrace
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWSTrace.h"
+#include "core/PWScore.h"
+#include "os/file.h"
+#include "gtest/gtest.h"
+
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// A fixture for factoring common code across tests
+class TraceTest : public ::testing::Test
+{
+protected:
+  void SetUp() {PWSTrace::Clear(); PWSTrace::Enable(true);}
+  void TearDown() {PWSTrace::Enable(false); PWSTrace::Clear();}
+
+  static size_t Count(const std::string &s, const std::string &what);
+  static void Spans(int n);
+};
+
+size_t TraceTest::Count(const std::string &s, const std::string &what)
+{
+  size_t retval = 0;
+  for (size_t pos = s.find(what); pos != std::string::npos;
+       pos = s.find(what, pos + what.length()))
+    retval++;
+  return retval;
+}
+
+void TraceTest::Spans(int n)
+{
+  for (int i = 0; i < n; i++) {
+    PWS_TRACE_SPAN(span, "Span", "i", NULL);
+    span.SetArg(0, i);
+  }
+}
+
+// And now the tests...
+
+TEST_F(TraceTest, Disabled)
+{
+  PWSTrace::Enable(false);
+  Spans(10);
+  EXPECT_EQ(0U, Count(PWSTrace::ChromeTrace(), "\"name\""));
+}
+
+TEST_F(TraceTest, Nested)
+{
+  {
+    PWS_TRACE_SPAN(outer, "Outer", "entries", "threads");
+    outer.SetArg(0, 42);
+    outer.SetArg(1, 4);
+    {
+      PWS_TRACE_SPAN(inner, "Inner \"quoted\"", NULL, "n");
+      inner.SetArg(1, -1);
+    }
+    PWS_TRACE_SPAN(early, "Early", NULL, NULL);
+    early.End();
+    PWS_TRACE_SPAN(open, "Open", NULL, NULL);
+    const std::string sTrace = PWSTrace::ChromeTrace();
+    EXPECT_EQ(0U, sTrace.find("{\"traceEvents\":["));
+    EXPECT_EQ(2U, Count(sTrace, "\"ph\":\"X\"")); // Inner & Early
+    EXPECT_EQ(2U, Count(sTrace, "\"ph\":\"B\"")); // Outer & Open
+    EXPECT_NE(std::string::npos, sTrace.find("{\"name\":\"Inner \\\"quoted\\\"\""));
+    EXPECT_NE(std::string::npos, sTrace.find("\"args\":{\"n\":-1}"));
+    EXPECT_NE(std::string::npos, sTrace.find("\"ts\":0.000,\"ph\":\"B\""));
+  }
+  const std::string sTrace = PWSTrace::ChromeTrace();
+  EXPECT_EQ(4U, Count(sTrace, "\"ph\":\"X\""));
+  EXPECT_EQ(0U, Count(sTrace, "\"ph\":\"B\""));
+  EXPECT_NE(std::string::npos, sTrace.find("\"args\":{\"entries\":42,\"threads\":4}"));
+  // Spans are exported as they end, Outer's began first
+  EXPECT_NE(std::string::npos,
+            sTrace.find("{\"name\":\"Outer\",\"cat\":\"core\",\"pid\":1,\"tid\":"));
+  EXPECT_LT(sTrace.find("\"Inner"), sTrace.find("\"Early\""));
+  EXPECT_LT(sTrace.find("\"Open\""), sTrace.find("\"Outer\""));
+}
+
+TEST_F(TraceTest, Threads)
+{
+  std::vector<std::thread> vThreads;
+  for (int t = 0; t < 4; t++)
+    vThreads.push_back(std::thread(Spans, 100));
+  Spans(100);
+  for (auto iter = vThreads.begin(); iter != vThreads.end(); iter++)
+    iter->join();
+
+  const std::string sTrace = PWSTrace::ChromeTrace();
+  EXPECT_EQ(500U, Count(sTrace, "\"ph\":\"X\""));
+  std::set<std::string> tids;
+  for (size_t pos = sTrace.find("\"tid\":"); pos != std::string::npos;
+       pos = sTrace.find("\"tid\":", pos + 1))
+    tids.insert(sTrace.substr(pos, sTrace.find(',', pos) - pos));
+  EXPECT_EQ(5U, tids.size());
+}
+
+TEST_F(TraceTest, Wrap)
+{
+  // Only the latest 4096 records are kept
+  Spans(5000);
+  const std::string sTrace = PWSTrace::ChromeTrace();
+  EXPECT_EQ(2048U, Count(sTrace, "\"ph\":\"X\""));
+  EXPECT_EQ(std::string::npos, sTrace.find("\"args\":{\"i\":2951}"));
+  EXPECT_NE(std::string::npos, sTrace.find("\"args\":{\"i\":2952}"));
+  EXPECT_NE(std::string::npos, sTrace.find("\"args\":{\"i\":4999}"));
+
+  PWSTrace::Clear();
+  EXPECT_EQ(0U, Count(PWSTrace::ChromeTrace(), "\"name\""));
+}
+
+TEST_F(TraceTest, ReadFile)
+{
+  const StringX fname(_T("trace.psafe3")), passkey(_T("trace-passkey"));
+  PWScore core;
+  core.SetPassKey(passkey);
+  for (int i = 0; i < 10; i++) {
+    StringX title;
+    Format(title, _T("title %d"), i);
+    CItemData ci;
+    ci.CreateUUID();
+    ci.SetTitle(title);
+    ci.SetPassword(_T("password"));
+    core.Execute(AddEntryCommand::Create(&core, ci));
+  }
+  ASSERT_EQ(PWSfile::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+  core.ClearData();
+  core.ClearCommands();
+  ASSERT_EQ(PWSfile::SUCCESS, core.ReadFile(fname, passkey, true));
+  core.ClearData();
+  pws_os::DeleteAFile(fname.c_str());
+
+  const std::string sTrace = PWSTrace::ChromeTrace();
+  EXPECT_EQ(1U, Count(sTrace, "\"name\":\"WriteFile\""));
+  EXPECT_EQ(2U, Count(sTrace, "\"name\":\"StretchKey\""));
+  EXPECT_EQ(1U, Count(sTrace, "\"name\":\"WriteHeader\""));
+  EXPECT_EQ(1U, Count(sTrace, "\"name\":\"ReadHeader\""));
+  EXPECT_NE(std::string::npos, sTrace.find("\"args\":{\"entries\":10,\"attachments\":0}"));
+  EXPECT_EQ(1U, Count(sTrace, "\"name\":\"Validate\""));
+  EXPECT_EQ(1U, Count(sTrace, "\"name\":\"ReadFile\""));
+}
@@ -0,0 +1,137 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// URLIndexTest.cpp: Unit test for URLIndex and PWScore::FindByURL
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/URLIndex.h"
+#include "core/PWScore.h"
+#include "gtest/gtest.h"
+
+// A fixture for factoring common code across tests
+class URLIndexTest : public ::testing::Test
+{
+protected:
+  pws_os::CUUID AddEntry(const StringX &title, const StringX &url);
+  std::vector<pws_os::CUUID> Find(const StringX &url);
+
+  PWScore core;
+};
+
+pws_os::CUUID URLIndexTest::AddEntry(const StringX &title, const StringX &url)
+{
+  CItemData ci;
+  ci.CreateUUID();
+  ci.SetTitle(title);
+  ci.SetPassword(_T("password"));
+  ci.SetURL(url);
+  core.Execute(AddEntryCommand::Create(&core, ci));
+  return ci.GetUUID();
+}
+
+std::vector<pws_os::CUUID> URLIndexTest::Find(const StringX &url)
+{
+  std::vector<URLIndex::Candidate> vCandidates;
+  core.FindByURL(url, vCandidates);
+  std::vector<pws_os::CUUID> retval;
+  for (auto iter = vCandidates.begin(); iter != vCandidates.end(); iter++)
+    retval.push_back(iter->uuid);
+  return retval;
+}
+
+// And now the tests...
+
+TEST_F(URLIndexTest, Parse)
+{
+  URLIndex::URLParts parts;
+  ASSERT_TRUE(URLIndex::Parse(_T("HTTPS://user:pw@WWW.Example.COM.:8443/a/b/?q=1#frag"), parts));
+  EXPECT_EQ(StringX(_T("https")), parts.scheme);
+  EXPECT_EQ(StringX(_T("example.com")), parts.host);
+  EXPECT_EQ(StringX(_T("example.com")), parts.site);
+  EXPECT_EQ(StringX(_T("/a/b")), parts.path);
+  EXPECT_EQ(8443U, parts.port);
+
+  ASSERT_TRUE(URLIndex::Parse(_T(" [alt]mail.example.co.uk/inbox "), parts));
+  EXPECT_TRUE(parts.scheme.empty());
+  EXPECT_EQ(StringX(_T("mail.example.co.uk")), parts.host);
+  EXPECT_EQ(StringX(_T("example.co.uk")), parts.site);
+  EXPECT_EQ(StringX(_T("/inbox")), parts.path);
+  EXPECT_EQ(0U, parts.port);
+
+  ASSERT_TRUE(URLIndex::Parse(_T("http://192.168.1.1"), parts));
+  EXPECT_EQ(StringX(_T("192.168.1.1")), parts.site);
+  EXPECT_EQ(80U, parts.port);
+  ASSERT_TRUE(URLIndex::Parse(_T("ssh://[::1]:2222"), parts));
+  EXPECT_EQ(StringX(_T("::1")), parts.host);
+  EXPECT_EQ(2222U, parts.port);
+  ASSERT_TRUE(URLIndex::Parse(_T("intranet"), parts));
+  EXPECT_EQ(StringX(_T("intranet")), parts.site);
+  ASSERT_TRUE(URLIndex::Parse(_T("a.b.example.org"), parts));
+  EXPECT_EQ(StringX(_T("example.org")), parts.site);
+
+  EXPECT_FALSE(URLIndex::Parse(_T(""), parts));
+  EXPECT_FALSE(URLIndex::Parse(_T("file:///etc/passwd"), parts));
+  EXPECT_FALSE(URLIndex::Parse(_T("http://example.com:http/"), parts));
+  EXPECT_FALSE(URLIndex::Parse(_T("not a url"), parts));
+}
+
+TEST_F(URLIndexTest, Ranking)
+{
+  const pws_os::CUUID root = AddEntry(_T("root"), _T("https://example.com"));
+  const pws_os::CUUID mail = AddEntry(_T("mail"), _T("mail.example.com"));
+  const pws_os::CUUID admin = AddEntry(_T("admin"), _T("https://www.example.com/admin/"));
+  AddEntry(_T("other"), _T("https://example.org/admin"));
+  AddEntry(_T("none"), _T(""));
+
+  std::vector<pws_os::CUUID> v = Find(_T("https://example.com/admin/users"));
+  ASSERT_EQ(3U, v.size());
+  EXPECT_EQ(admin, v[0]);
+  EXPECT_EQ(root, v[1]);
+  EXPECT_EQ(mail, v[2]);
+
+  v = Find(_T("http://mail.example.com/"));
+  ASSERT_EQ(3U, v.size());
+  EXPECT_EQ(mail, v[0]);
+
+  EXPECT_TRUE(Find(_T("https://example.net")).empty());
+  EXPECT_TRUE(Find(_T("")).empty());
+}
+
+TEST_F(URLIndexTest, Commands)
+{
+  const pws_os::CUUID uuid = AddEntry(_T("entry"), _T("https://old.example.com"));
+  ASSERT_EQ(1U, Find(_T("old.example.com")).size());
+
+  // Change the URL in place, and undo it
+  const CItemData ci = core.Find(uuid)->second;
+  core.Execute(UpdateEntryCommand::Create(&core, ci, CItemData::URL,
+                                          _T("https://new.example.net")));
+  EXPECT_TRUE(Find(_T("old.example.com")).empty());
+  EXPECT_EQ(1U, Find(_T("new.example.net")).size());
+  core.Undo();
+  EXPECT_EQ(1U, Find(_T("old.example.com")).size());
+  EXPECT_TRUE(Find(_T("new.example.net")).empty());
+
+  // Edit the whole entry
+  CItemData new_ci(ci);
+  new_ci.SetURL(_T("[ssh]host.example.net"));
+  core.Execute(EditEntryCommand::Create(&core, ci, new_ci));
+  EXPECT_TRUE(Find(_T("old.example.com")).empty());
+  EXPECT_EQ(1U, Find(_T("host.example.net")).size());
+
+  core.Execute(DeleteEntryCommand::Create(&core, new_ci));
+  EXPECT_TRUE(Find(_T("host.example.net")).empty());
+  core.Undo();
+  EXPECT_EQ(1U, Find(_T("host.example.net")).size());
+
+  core.ClearData();
+  EXPECT_TRUE(Find(_T("host.example.net")).empty());
+  core.ClearCommands();
+}
@@ -0,0 +1,110 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// UTF8ConvTest.cpp: Unit test for conversion between UTF-8 and StringX
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/UTF8Conv.h"
+#include "gtest/gtest.h"
+
+#include <cstring>
+#include <string>
+
+// A fixture for factoring common code across tests
+class UTF8ConvTest : public ::testing::Test
+{
+protected:
+  bool Decodes(const char *bytes, size_t len)
+  {
+    wchar_t wc[16];
+    size_t wcLen;
+    return CUTF8Conv::Decode(reinterpret_cast<const unsigned char *>(bytes),
+                             len, wc, wcLen);
+  }
+
+  CUTF8Conv conv;
+};
+
+// And now the tests...
+
+TEST_F(UTF8ConvTest, RoundTrip)
+{
+  // "aé€𝄞": 1, 2, 3 and 4 byte sequences
+  const unsigned char expected[] = {
+    'a', 0xc3, 0xa9, 0xe2, 0x82, 0xac, 0xf0, 0x9d, 0x84, 0x9e};
+  StringX sx(L"a\x00e9\x20ac");
+  if (sizeof(wchar_t) == 2) {
+    sx += wchar_t(0xd834); sx += wchar_t(0xdd1e);
+  } else
+    sx += wchar_t(0x1d11e);
+
+  const unsigned char *utf8;
+  size_t utf8Len;
+  ASSERT_TRUE(conv.ToUTF8(sx, utf8, utf8Len));
+  ASSERT_EQ(sizeof(expected), utf8Len);
+  EXPECT_EQ(0, memcmp(expected, utf8, utf8Len));
+
+  StringX sx2;
+  ASSERT_TRUE(conv.FromUTF8(expected, sizeof(expected), sx2));
+  EXPECT_EQ(sx, sx2);
+
+  // Data ends at the first NUL, as always
+  const unsigned char withNul[] = {'a', 'b', 0, 'c'};
+  ASSERT_TRUE(conv.FromUTF8(withNul, sizeof(withNul), sx2));
+  EXPECT_EQ(StringX(L"ab"), sx2);
+}
+
+TEST_F(UTF8ConvTest, ASCIIRuns)
+{
+  // Lengths and offsets of non-ASCII characters either side of
+  // the vector widths used for the ASCII fast path
+  for (size_t len = 0; len < 100; len++) {
+    for (size_t pos = 0; pos <= len; pos += 7) {
+      StringX sx;
+      for (size_t i = 0; i < len; i++)
+        sx += wchar_t('0' + i % 64);
+      if (pos < len)
+        sx[pos] = wchar_t(0x00e9);
+
+      const unsigned char *utf8;
+      size_t utf8Len;
+      ASSERT_TRUE(conv.ToUTF8(sx, utf8, utf8Len));
+      EXPECT_EQ(len + (pos < len ? 1 : 0), utf8Len);
+      const std::string s(reinterpret_cast<const char *>(utf8), utf8Len);
+
+      StringX sx2;
+      ASSERT_TRUE(conv.FromUTF8(reinterpret_cast<const unsigned char *>(s.data()),
+                                s.length(), sx2));
+      EXPECT_EQ(sx, sx2) << "len " << len << " pos " << pos;
+    }
+  }
+}
+
+TEST_F(UTF8ConvTest, Malformed)
+{
+  EXPECT_TRUE(Decodes("\x7f", 1));
+  EXPECT_TRUE(Decodes("\xf4\x8f\xbf\xbf", 4)); // U+10FFFF
+  EXPECT_FALSE(Decodes("\x80", 1)); // stray continuation byte
+  EXPECT_FALSE(Decodes("\xc0\x80", 2)); // overlong NUL
+  EXPECT_FALSE(Decodes("\xe0\x80\xaf", 3)); // overlong '/'
+  EXPECT_FALSE(Decodes("\xf0\x8f\xbf\xbf", 4)); // overlong U+FFFF
+  EXPECT_FALSE(Decodes("\xed\xa0\x80", 3)); // surrogate U+D800
+  EXPECT_FALSE(Decodes("\xf4\x90\x80\x80", 4)); // U+110000
+  EXPECT_FALSE(Decodes("\xf5\x80\x80\x80", 4));
+  EXPECT_FALSE(Decodes("\xe2\x82", 2)); // truncated
+  EXPECT_FALSE(Decodes("\xe2\x28\xac", 3)); // bad continuation byte
+
+  // Unpaired surrogate can't be encoded
+  StringX sx(L"ab");
+  sx += wchar_t(0xd800);
+  unsigned char utf8[16];
+  size_t utf8Len;
+  EXPECT_FALSE(CUTF8Conv::Encode(sx.data(), sx.length(), utf8, utf8Len));
+}
@@ -0,0 +1,131 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// ValidateTest.cpp: Unit test for validation of a database as it's read
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWScore.h"
+#include "core/Report.h"
+#include "os/file.h"
+#include "gtest/gtest.h"
+
+#include <set>
+
+// A fixture for factoring common code across tests
+class ValidateTest : public ::testing::Test
+{
+protected:
+  ValidateTest() : fname(_T("validate.psafe3")), passkey(_T("validate-passkey")) {}
+  void TearDown();
+
+  void AddEntry(const StringX &title, const StringX &password,
+                const StringX &pwh = _T(""))
+  {
+    CItemData ci;
+    ci.CreateUUID();
+    ci.SetGroup(_T("group"));
+    ci.SetTitle(title);
+    ci.SetUser(_T("user"));
+    ci.SetPassword(password);
+    if (!pwh.empty())
+      ci.SetPWHistory(pwh);
+    core.Execute(AddEntryCommand::Create(&core, ci));
+  }
+
+  const StringX fname, passkey;
+  PWScore core;
+};
+
+void ValidateTest::TearDown()
+{
+  pws_os::DeleteAFile(fname.c_str());
+}
+
+// And now the tests...
+
+TEST_F(ValidateTest, FixesAndReport)
+{
+  // Enough entries for more than one thread, if available
+  for (int i = 0; i < 1000; i++) {
+    StringX title;
+    Format(title, _T("entry %d"), i);
+    AddEntry(title, _T("password"));
+  }
+  for (int i = 0; i < 5; i++)
+    AddEntry(_T("dup"), _T("password"));
+  AddEntry(_T(""), _T("password"));
+  AddEntry(_T(""), _T("password"));
+  AddEntry(_T("nopassword"), _T(""));
+  AddEntry(_T("bad history"), _T("password"), _T("1ff"));
+  core.SetPassKey(passkey);
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+
+  // Read without validation: as written
+  PWScore core2;
+  ASSERT_EQ(PWScore::SUCCESS, core2.ReadFile(fname, passkey));
+  EXPECT_EQ(1009, core2.GetNumEntries());
+
+  PWScore core3;
+  CReport rpt;
+  ASSERT_EQ(PWScore::OK_WITH_VALIDATION_ERRORS,
+            core3.ReadFile(fname, passkey, true, 0, &rpt));
+  ASSERT_EQ(1009, core3.GetNumEntries());
+
+  // All GTUs now unique, the first "dup" in entry order keeps its title,
+  // and fixed entries are marked as modified
+  std::set<StringX> titles;
+  int numDup = 0, numModified = 0;
+  for (auto iter = core3.GetEntryIter(); iter != core3.GetEntryEndIter(); iter++) {
+    const CItemData &ci = iter->second;
+    EXPECT_TRUE(titles.insert(ci.GetTitle()).second);
+    EXPECT_FALSE(ci.GetPassword().empty());
+    if (ci.GetTitle() == _T("bad history"))
+      EXPECT_TRUE(ci.GetPWHistory().empty());
+    if (ci.GetTitle().find(_T("dup")) == 0) {
+      EXPECT_EQ(numDup == 0, ci.GetTitle() == _T("dup"));
+      numDup++;
+    }
+    if (ci.GetStatus() == CItemData::ES_MODIFIED)
+      numModified++;
+  }
+  EXPECT_EQ(5, numDup);
+  EXPECT_EQ(4 + 2 + 1 + 1, numModified);
+
+  const StringX sxReport = rpt.GetString();
+  EXPECT_NE(StringX::npos, sxReport.find(_T("nopassword")));
+  EXPECT_NE(StringX::npos, sxReport.find(_T("bad history")));
+
+  // Same file, same fixes
+  PWScore core4;
+  CReport rpt2;
+  core4.ReadFile(fname, passkey, true, 0, &rpt2);
+  for (auto iter = core3.GetEntryIter(); iter != core3.GetEntryEndIter(); iter++) {
+    ItemListIter iter4 = core4.Find(iter->first);
+    ASSERT_NE(core4.GetEntryEndIter(), iter4);
+    EXPECT_EQ(iter->second.GetTitle(), iter4->second.GetTitle());
+  }
+}
+
+TEST_F(ValidateTest, NothingToFix)
+{
+  for (int i = 0; i < 600; i++) {
+    StringX title;
+    Format(title, _T("entry %d"), i);
+    AddEntry(title, _T("password"));
+  }
+  core.SetPassKey(passkey);
+  ASSERT_EQ(PWScore::SUCCESS, core.WriteFile(fname, PWSfile::V30));
+
+  PWScore core2;
+  EXPECT_EQ(PWScore::SUCCESS, core2.ReadFile(fname, passkey, true));
+  EXPECT_EQ(600, core2.GetNumEntries());
+  for (auto iter = core2.GetEntryIter(); iter != core2.GetEntryEndIter(); iter++)
+    EXPECT_EQ(CItemData::ES_CLEAN, iter->second.GetStatus());
+}
@@ -0,0 +1,809 @@
+/*
+* Copyright (c) 2003-2016 Rony Shapiro <ronys@pwsafe.org>.
+* All rights reserved. Use of the code is allowed under the
+* Artistic License 2.0 terms, as specified in the LICENSE file
+* distributed with this code, or available from
+* http://www.opensource.org/licenses/artistic-license-2.0.php
+*/
+// pwsbench.cpp: Benchmarks for core operations on synthetic databases
+//
+// Generates a database with the requested number of entries, groups,
+// password history depth and attachments, then times the PWScore APIs
+// that scale with database size. Results are written as JSON or CSV,
+// for tracking regressions over time.
+
+#if defined(WIN32) && !defined(__WX__)
+#include "../ui/Windows/stdafx.h"
+#endif
+
+#include "core/PWScore.h"
+#include "core/PWSCompress.h"
+#include "core/PWSRecordIndex.h"
+#include "core/PWSFilters.h"
+#include "core/PWSTrace.h"
+#include "core/PWHistory.h"
+#include "core/PWPolicy.h"
+#include "core/Report.h"
+#include "core/UTF8Conv.h"
+#include "core/hmac.h"
+#include "core/pbkdf2.h"
+#include "os/file.h"
+#include "os/utf8conv.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+//-----------------------------------------------------------------
+
+struct BenchArgs {
+  BenchArgs()
+    : nEntries(1000), nGroups(100), nHistory(3), nAtts(0), attSize(16384),
+      attContent(RANDOM), bCompress(false),
+      nIterations(3), nLookups(100), nAliases(100), nStretch(1 << 20), seed(1),
+      version(PWSfile::V30),
+      format(JSON), outfile("-") {}
+  unsigned nEntries, nGroups, nHistory, nAtts, attSize;
+  enum {RANDOM, TEXT} attContent;
+  bool bCompress;
+  unsigned nIterations, nLookups, nAliases, nStretch, seed;
+  PWSfile::VERSION version;
+  enum {JSON, CSV} format;
+  string outfile;
+  string tracefile; // empty == don't trace
+  vector<string> scenarios; // empty == all
+};
+
+struct BenchResult {
+  BenchResult() : items(0), bytes(0) {}
+  string scenario;
+  size_t items; // number of entries (or lookups) processed per iteration
+  vector<double> ms; // per iteration
+  ulong64 bytes; // size of the file written, 0 if none
+};
+
+static void usage(const char *pname)
+{
+  cerr << "Usage: " << pname << " [options]" << endl
+       << "\t--entries=N      entries in generated database (1000)" << endl
+       << "\t--groups=N       distinct groups, nested up to 3 deep (100)" << endl
+       << "\t--history=N      password history depth per entry (3)" << endl
+       << "\t--attachments=N  number of attachments, V4 only (0)" << endl
+       << "\t--attsize=N      size of each attachment in bytes (16384)" << endl
+       << "\t--attcontent=random|text  what attachments hold (random)" << endl
+       << "\t--compress       compress attachments" << endl
+       << "\t--iterations=N   times to run each scenario (3)" << endl
+       << "\t--lookups=N      lookups per iteration for Find* (100)" << endl
+       << "\t--aliases=N      aliases resolved per iteration for AddAliases (100)" << endl
+       << "\t--stretch=N      PBKDF2 iterations for StretchKey* (1048576)" << endl
+       << "\t--seed=N         seed for generated content (1)" << endl
+       << "\t--v4             use V4 format (default V3)" << endl
+       << "\t--format=json|csv" << endl
+       << "\t--output=file    '-' for stdout (default)" << endl
+       << "\t--trace=file     save a Chrome trace of the core's phases" << endl
+       << "\t--scenario=a,b   subset of: Generate, WriteFile, ReadFile," << endl
+       << "\t                 OpenIndex, FindByUUID, FindByGTU, FindByURL," << endl
+       << "\t                 FuzzyFind, PassesFiltering," << endl
+       << "\t                 SaveChunked, ReadChunked (V4 only)," << endl
+       << "\t                 Compare, Merge, AddAliases, MakePassword," << endl
+       << "\t                 MakePasswords, StretchKey, StretchKeyGeneric" << endl;
+}
+
+static bool parseUnsigned(const char *arg, const char *name, unsigned &value)
+{
+  const size_t len = strlen(name);
+  if (strncmp(arg, name, len) != 0 || arg[len] != '=')
+    return false;
+  value = unsigned(strtoul(arg + len + 1, NULL, 10));
+  return true;
+}
+
+static bool parseArgs(int argc, char *argv[], BenchArgs &ba)
+{
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (parseUnsigned(arg, "--entries", ba.nEntries) ||
+        parseUnsigned(arg, "--groups", ba.nGroups) ||
+        parseUnsigned(arg, "--history", ba.nHistory) ||
+        parseUnsigned(arg, "--attachments", ba.nAtts) ||
+        parseUnsigned(arg, "--attsize", ba.attSize) ||
+        parseUnsigned(arg, "--iterations", ba.nIterations) ||
+        parseUnsigned(arg, "--lookups", ba.nLookups) ||
+        parseUnsigned(arg, "--aliases", ba.nAliases) ||
+        parseUnsigned(arg, "--stretch", ba.nStretch) ||
+        parseUnsigned(arg, "--seed", ba.seed))
+      continue;
+    if (strcmp(arg, "--v4") == 0) {
+      ba.version = PWSfile::V40;
+    } else if (strcmp(arg, "--attcontent=random") == 0) {
+      ba.attContent = BenchArgs::RANDOM;
+    } else if (strcmp(arg, "--attcontent=text") == 0) {
+      ba.attContent = BenchArgs::TEXT;
+    } else if (strcmp(arg, "--compress") == 0) {
+      ba.bCompress = true;
+    } else if (strcmp(arg, "--format=json") == 0) {
+      ba.format = BenchArgs::JSON;
+    } else if (strcmp(arg, "--format=csv") == 0) {
+      ba.format = BenchArgs::CSV;
+    } else if (strncmp(arg, "--output=", 9) == 0) {
+      ba.outfile = arg + 9;
+    } else if (strncmp(arg, "--trace=", 8) == 0) {
+      ba.tracefile = arg + 8;
+    } else if (strncmp(arg, "--scenario=", 11) == 0) {
+      istringstream is(arg + 11);
+      string s;
+      while (getline(is, s, ','))
+        ba.scenarios.push_back(s);
+    } else
+      return false;
+  }
+  if (ba.nEntries == 0 || ba.nGroups == 0 || ba.nIterations == 0 ||
+      ba.nStretch == 0 ||
+      ba.nHistory > 255)
+    return false;
+  if (ba.nAtts > 0 && ba.version != PWSfile::V40) {
+    cerr << "Attachments require --v4" << endl;
+    return false;
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------
+// Synthetic database generation
+
+class Generator
+{
+public:
+  Generator(const BenchArgs &ba) : m_ba(ba), m_rng(ba.seed) {}
+  void Populate(PWScore &core);
+
+private:
+  StringX RandomString(size_t len);
+  StringX RandomHost(size_t len);
+  StringX GroupName(unsigned n);
+  StringX History(time_t now);
+  void TextContent(vector<unsigned char> &content);
+
+  const BenchArgs &m_ba;
+  mt19937 m_rng;
+};
+
+StringX Generator::RandomString(size_t len)
+{
+  static const TCHAR chars[] = _T("abcdefghijklmnopqrstuvwxyz")
+    _T("ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789!@#$%^&*()-_=+");
+  uniform_int_distribution<size_t> dist(0, (sizeof(chars) / sizeof(chars[0])) - 2);
+  StringX retval;
+  for (size_t i = 0; i < len; i++)
+    retval += chars[dist(m_rng)];
+  return retval;
+}
+
+StringX Generator::RandomHost(size_t len)
+{
+  uniform_int_distribution<int> dist(0, 25);
+  StringX retval;
+  for (size_t i = 0; i < len; i++)
+    retval += static_cast<TCHAR>(_T('a') + dist(m_rng));
+  return retval;
+}
+
+StringX Generator::GroupName(unsigned n)
+{
+  // Spread groups over a hierarchy up to 3 levels deep, as real ones are
+  StringX retval;
+  if (n < 10)
+    Format(retval, _T("Level1-%u"), n);
+  else if (n < 100)
+    Format(retval, _T("Level1-%u.Level2-%u"), n % 10, n / 10);
+  else
+    Format(retval, _T("Level1-%u.Level2-%u.Level3-%u"), n % 10, (n / 10) % 10, n / 100);
+  return retval;
+}
+
+StringX Generator::History(time_t now)
+{
+  const size_t num = m_ba.nHistory;
+  StringX retval = MakePWHistoryHeader(TRUE, num, num);
+  for (size_t i = 0; i < num; i++) {
+    const StringX pw = RandomString(12);
+    StringX entry;
+    Format(entry, _T("%08x%04x"), unsigned(now - (num - i) * 86400), unsigned(pw.length()));
+    retval += entry + pw;
+  }
+  return retval;
+}
+
+void Generator::TextContent(vector<unsigned char> &content)
+{
+  // Something like a configuration file or a list of recovery codes:
+  // repetitive names, random values
+  size_t n = 0;
+  for (unsigned line = 0; n < content.size(); line++) {
+    char buf[64];
+    const int len = snprintf(buf, sizeof(buf), "setting.%u.value = %08x%08x\n",
+                             line % 50, unsigned(m_rng()), unsigned(m_rng()));
+    for (int i = 0; i < len && n < content.size(); i++)
+      content[n++] = static_cast<unsigned char>(buf[i]);
+  }
+}
+
+void Generator::Populate(PWScore &core)
+{
+  const time_t now = time(NULL);
+  vector<unsigned char> content(m_ba.attSize);
+
+  for (unsigned i = 0; i < m_ba.nEntries; i++) {
+    CItemData ci;
+    ci.CreateUUID();
+    ci.SetGroup(GroupName(i % m_ba.nGroups));
+    StringX title;
+    Format(title, _T("Title %u %ls"), i, RandomString(6).c_str());
+    ci.SetTitle(title);
+    ci.SetUser(RandomString(8) + _T("@example.com"));
+    ci.SetPassword(RandomString(16));
+    ci.SetURL(StringX(_T("https://login.")) + RandomHost(10) + _T(".com/login"));
+    if (i % 4 == 0)
+      ci.SetNotes(RandomString(200));
+    ci.SetCTime(now - 365 * 86400);
+    ci.SetPMTime(now - 30 * 86400);
+    if (i % 10 == 0)
+      ci.SetXTime(now + (i % 100) * 86400);
+    if (m_ba.nHistory > 0)
+      ci.SetPWHistory(History(now));
+
+    if (i < m_ba.nAtts) {
+      CItemAtt att;
+      att.CreateUUID();
+      Format(title, _T("Attachment %u"), i);
+      att.SetTitle(title);
+      if (m_ba.attContent == BenchArgs::RANDOM) {
+        for (auto &c : content)
+          c = static_cast<unsigned char>(m_rng());
+      } else
+        TextContent(content);
+      att.SetContent(content.data(), content.size());
+      if (m_ba.bCompress)
+        att.SetCompression(PWSCompress::ZLIB);
+      ci.SetAttUUID(att.GetUUID());
+      core.Execute(AddEntryCommand::Create(&core, ci, pws_os::CUUID::NullUUID(), &att));
+    } else
+      core.Execute(AddEntryCommand::Create(&core, ci));
+  }
+  core.ClearCommands(); // we're not going to undo, no need to keep these
+}
+
+//-----------------------------------------------------------------
+// Scenarios
+
+typedef chrono::steady_clock Clock;
+
+static double Time(const function<void()> &f)
+{
+  const Clock::time_point start = Clock::now();
+  f();
+  return chrono::duration<double, milli>(Clock::now() - start).count();
+}
+
+class Bench
+{
+public:
+  Bench(const BenchArgs &ba) : m_ba(ba), m_fname(_T("pwsbench.dat")),
+    m_fname2(_T("pwsbench2.dat")), m_passkey(_T("pwsbench-passkey")) {}
+  ~Bench();
+  bool Run(vector<BenchResult> &results);
+
+private:
+  bool Wanted(const string &scenario) const;
+  bool Read(PWScore &core, const StringX &fname);
+
+  const BenchArgs &m_ba;
+  const StringX m_fname, m_fname2, m_passkey;
+};
+
+Bench::~Bench()
+{
+  pws_os::DeleteAFile(m_fname.c_str());
+  pws_os::DeleteAFile(m_fname2.c_str());
+}
+
+bool Bench::Wanted(const string &scenario) const
+{
+  return m_ba.scenarios.empty() ||
+    find(m_ba.scenarios.begin(), m_ba.scenarios.end(), scenario) != m_ba.scenarios.end();
+}
+
+bool Bench::Read(PWScore &core, const StringX &fname)
+{
+  core.ClearData();
+  const int status = core.ReadFile(fname, m_passkey);
+  if (status != PWScore::SUCCESS) {
+    cerr << "ReadFile failed: " << status << endl;
+    return false;
+  }
+  return true;
+}
+
+bool Bench::Run(vector<BenchResult> &results)
+{
+  const size_t N = m_ba.nEntries;
+  const unsigned I = m_ba.nIterations;
+  PWScore core;
+  BenchResult r;
+
+  // Generation is always needed, but only reported if asked for
+  r.scenario = "Generate"; r.items = N;
+  for (unsigned i = 0; i < I; i++) {
+    core.ClearData();
+    core.SetPassKey(m_passkey);
+    core.SetReadOnly(false);
+    Generator gen(m_ba);
+    r.ms.push_back(Time([&] {gen.Populate(core);}));
+  }
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  r.scenario = "WriteFile"; r.ms.clear();
+  int status = PWScore::SUCCESS;
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {status = core.WriteFile(m_fname, m_ba.version);}));
+  if (status != PWScore::SUCCESS) {
+    cerr << "WriteFile failed: " << status << endl;
+    return false;
+  }
+  if (Wanted(r.scenario)) {
+    FILE *fd = pws_os::FOpen(m_fname.c_str(), _T("rb"));
+    r.bytes = pws_os::fileLength(fd);
+    fclose(fd);
+    results.push_back(r);
+    r.bytes = 0;
+  }
+
+  // The "other" database for Compare & Merge: same entries,
+  // a tenth of them modified and a tenth added
+  {
+    PWScore other;
+    if (!Read(other, m_fname))
+      return false;
+    vector<CItemData> modified;
+    size_t n = 0;
+    for (auto iter = other.GetEntryIter(); iter != other.GetEntryEndIter(); iter++, n++)
+      if (n % 10 == 0) {
+        CItemData ci(iter->second);
+        ci.SetPassword(ci.GetPassword() + _T("-changed"));
+        modified.push_back(ci);
+      }
+    for (const auto &ci : modified)
+      other.Execute(EditEntryCommand::Create(&other, other.GetEntry(other.Find(ci.GetUUID())), ci));
+    BenchArgs ba2(m_ba);
+    ba2.nEntries = unsigned(N / 10) + 1;
+    ba2.nAtts = 0;
+    ba2.seed = m_ba.seed + 1;
+    Generator(ba2).Populate(other);
+    if (other.WriteFile(m_fname2, m_ba.version) != PWScore::SUCCESS) {
+      cerr << "WriteFile failed for second database" << endl;
+      return false;
+    }
+  }
+
+  r.scenario = "ReadFile"; r.ms.clear();
+  bool bOK = true;
+  for (unsigned i = 0; i < I && bOK; i++) {
+    core.ClearData();
+    r.ms.push_back(Time([&] {bOK = Read(core, m_fname);}));
+  }
+  if (!bOK)
+    return false;
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  // Read-only fast open: time until the entries can be listed. The
+  // digest's checked in the background, and isn't included.
+  r.scenario = "OpenIndex"; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    for (unsigned i = 0; i < I; i++) {
+      PWSRecordIndex index;
+      int istatus = PWSfile::SUCCESS;
+      r.ms.push_back(Time([&] {istatus = index.Open(m_fname, m_passkey);}));
+      if (istatus != PWSfile::SUCCESS || index.GetNumEntries() != core.GetNumEntries() ||
+          index.WaitForVerify() != PWSfile::SUCCESS) {
+        cerr << "OpenIndex failed: " << istatus << endl;
+        return false;
+      }
+    }
+    results.push_back(r);
+  }
+
+  // Chunked V4: a save after changing one entry copies most chunks from
+  // the previous save, and a read decrypts the chunks in parallel
+  if (m_ba.version == PWSfile::V40 &&
+      (Wanted("SaveChunked") || Wanted("ReadChunked"))) {
+    const StringX fname3(_T("pwsbench-chunked.dat"));
+    PWScore chunked;
+    if (!Read(chunked, m_fname))
+      return false;
+    chunked.SetChunkedV4(true);
+    if (chunked.WriteFile(fname3, PWSfile::V40) != PWScore::SUCCESS) {
+      cerr << "WriteFile failed for chunked database" << endl;
+      return false;
+    }
+    r.scenario = "SaveChunked"; r.items = 1; r.ms.clear();
+    for (unsigned i = 0; i < I; i++) {
+      StringX notes;
+      Format(notes, _T("changed %u"), i);
+      const CItemData &ci = chunked.GetEntryIter()->second;
+      chunked.Execute(UpdateEntryCommand::Create(&chunked, ci, CItemData::NOTES, notes));
+      r.ms.push_back(Time([&] {status = chunked.WriteFile(fname3, PWSfile::V40);}));
+    }
+    if (status != PWScore::SUCCESS) {
+      cerr << "WriteFile failed for chunked database: " << status << endl;
+      return false;
+    }
+    if (Wanted(r.scenario))
+      results.push_back(r);
+
+    r.scenario = "ReadChunked"; r.items = N; r.ms.clear();
+    for (unsigned i = 0; i < I && bOK; i++) {
+      r.ms.push_back(Time([&] {bOK = Read(chunked, fname3);}));
+    }
+    pws_os::DeleteAFile(fname3.c_str());
+    if (!bOK)
+      return false;
+    if (Wanted(r.scenario))
+      results.push_back(r);
+  }
+
+  // Lookups: pick existing entries at random
+  vector<const CItemData *> items;
+  for (auto iter = core.GetEntryIter(); iter != core.GetEntryEndIter(); iter++)
+    items.push_back(&iter->second);
+  mt19937 rng(m_ba.seed);
+  uniform_int_distribution<size_t> dist(0, items.size() - 1);
+  vector<const CItemData *> targets;
+  for (unsigned i = 0; i < m_ba.nLookups; i++)
+    targets.push_back(items[dist(rng)]);
+
+  size_t nFound = 0;
+  r.scenario = "FindByUUID"; r.items = targets.size(); r.ms.clear();
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {
+          for (auto pci : targets)
+            nFound += (core.Find(pci->GetUUID()) != core.GetEntryEndIter());
+        }));
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  r.scenario = "FindByGTU"; r.ms.clear();
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {
+          for (auto pci : targets)
+            nFound += (core.Find(pci->GetGroup(), pci->GetTitle(), pci->GetUser()) !=
+                       core.GetEntryEndIter());
+        }));
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  // As a browser would ask: another page on the same site
+  vector<StringX> urls;
+  for (auto pci : targets) {
+    StringX url = pci->GetURL();
+    url.replace(url.rfind(_T('/')), StringX::npos, _T("/account?id=1"));
+    urls.push_back(url);
+  }
+  r.scenario = "FindByURL"; r.ms.clear();
+  vector<URLIndex::Candidate> vCandidates;
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {
+          for (size_t j = 0; j < urls.size(); j++) {
+            core.FindByURL(urls[j], vCandidates);
+            nFound += (!vCandidates.empty() &&
+                       vCandidates[0].uuid == targets[j]->GetUUID());
+          }
+        }));
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  if (nFound != 3 * I * targets.size()) {
+    cerr << "Find failed to find existing entries" << endl;
+    return false;
+  }
+
+  // A site's name with a typo: two letters of the host swapped. Each
+  // search scores every entry, so fewer of them.
+  vector<StringX> typos;
+  for (size_t j = 0; j < targets.size() && j < 10; j++) {
+    StringX host = targets[j]->GetURL().substr(14, 10); // https://login.
+    swap(host[3], host[4]);
+    typos.push_back(host);
+  }
+  r.scenario = "FuzzyFind"; r.items = typos.size(); r.ms.clear();
+  vector<st_FuzzyMatch> vMatches;
+  nFound = 0;
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {
+          for (size_t j = 0; j < typos.size(); j++) {
+            core.FuzzyFind(typos[j], 10, vMatches);
+            nFound += (!vMatches.empty() && vMatches[0].uuid == targets[j]->GetUUID());
+          }
+        }));
+  if (Wanted(r.scenario))
+    results.push_back(r);
+  if (nFound != I * typos.size()) {
+    cerr << "FuzzyFind failed to find existing entries" << endl;
+    return false;
+  }
+
+  // A typical user filter: title contains "1" AND not expiring
+  PWSFilterManager fm;
+  {
+    st_FilterRow fr;
+    fr.bFilterComplete = true;
+    fr.ftype = FT_TITLE;
+    fr.mtype = PWSMatch::MT_STRING;
+    fr.rule = PWSMatch::MR_CONTAINS;
+    fr.fstring = _T("1");
+    fr.ltype = LC_OR;
+    fm.m_currentfilter.vMfldata.push_back(fr);
+    fr.ftype = FT_XTIME;
+    fr.mtype = PWSMatch::MT_DATE;
+    fr.rule = PWSMatch::MR_EQUALS;
+    fr.fdate1 = 0;
+    fr.fstring.clear();
+    fr.ltype = LC_AND;
+    fm.m_currentfilter.vMfldata.push_back(fr);
+    fm.m_currentfilter.num_Mactive = int(fm.m_currentfilter.vMfldata.size());
+    fm.CreateGroups();
+  }
+  r.scenario = "PassesFiltering"; r.items = N; r.ms.clear();
+  size_t nPassed = 0;
+  for (unsigned i = 0; i < I; i++)
+    r.ms.push_back(Time([&] {
+          for (auto pci : items)
+            nPassed += fm.PassesFiltering(*pci, core);
+        }));
+  if (Wanted(r.scenario))
+    results.push_back(r);
+
+  PWScore other;
+  if (!Read(other, m_fname2))
+    return false;
+
+  r.scenario = "Compare"; r.items = N; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    CItemData::FieldBits bsFields;
+    bsFields.set();
+    for (unsigned i = 0; i < I; i++) {
+      CompareData current, comp, conflicts, identical;
+      r.ms.push_back(Time([&] {
+            core.Compare(&other, bsFields, false, false, _T(""), 0, 0,
+                         current, comp, conflicts, identical);
+          }));
+    }
+    results.push_back(r);
+  }
+
+  r.scenario = "Merge"; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    for (unsigned i = 0; i < I; i++) {
+      if (!Read(core, m_fname)) // Merge changes core, so start afresh
+        return false;
+      CReport rpt;
+      r.ms.push_back(Time([&] {
+            core.Merge(&other, false, _T(""), 0, 0, &rpt);
+          }));
+      core.ClearCommands();
+    }
+    results.push_back(r);
+  }
+
+  // Resolving "[[g:t:u]]" alias passwords to their base entries, as when
+  // importing. Each iteration starts afresh, with the same aliases.
+  r.scenario = "AddAliases"; r.items = m_ba.nAliases; r.ms.clear();
+  if (Wanted(r.scenario) && m_ba.nAliases > 0) {
+    for (unsigned i = 0; i < I; i++) {
+      PWScore acore;
+      if (!Read(acore, m_fname))
+        return false;
+      acore.SetReadOnly(false);
+      vector<StringX> aliasPasswords;
+      mt19937 arng(m_ba.seed);
+      for (unsigned n = 0; n < m_ba.nAliases; n++) {
+        ItemListConstIter iter = acore.GetEntryIter();
+        advance(iter, dist(arng));
+        const CItemData &base = iter->second;
+        aliasPasswords.push_back(_T("[[") + base.GetGroup() + _T(":") + base.GetTitle() +
+                                 _T(":") + base.GetUser() + _T("]]"));
+      }
+      UUIDVector vAliases;
+      for (size_t n = 0; n < aliasPasswords.size(); n++) {
+        CItemData ci;
+        ci.CreateUUID();
+        ci.SetGroup(_T("Aliases"));
+        StringX title;
+        Format(title, _T("Alias %u"), unsigned(n));
+        ci.SetTitle(title);
+        ci.SetPassword(aliasPasswords[n]);
+        acore.Execute(AddEntryCommand::Create(&acore, ci));
+        vAliases.push_back(ci.GetUUID());
+      }
+
+      Command *pcmd = AddDependentEntriesCommand::Create(&acore, vAliases, NULL,
+                                                         CItemData::ET_ALIAS,
+                                                         CItemData::PASSWORD);
+      r.ms.push_back(Time([&] {acore.Execute(pcmd);}));
+      for (const auto &uuid : vAliases)
+        if (!acore.Find(uuid)->second.IsAlias()) {
+          cerr << "AddAliases failed to resolve all aliases" << endl;
+          return false;
+        }
+    }
+    results.push_back(r);
+  }
+
+  // Password generation, one at a time vs. in bulk, N passwords
+  // per iteration per the default policy
+  const PWPolicy policy;
+  StringX sxPassword;
+  r.scenario = "MakePassword"; r.items = N; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    for (unsigned i = 0; i < I; i++)
+      r.ms.push_back(Time([&] {
+            for (size_t n = 0; n < N; n++)
+              sxPassword = policy.MakeRandomPassword();
+          }));
+    results.push_back(r);
+  }
+
+  r.scenario = "MakePasswords"; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    vector<StringX> vPasswords;
+    for (unsigned i = 0; i < I; i++)
+      r.ms.push_back(Time([&] {policy.MakeRandomPasswords(N, vPasswords);}));
+    if (vPasswords.size() != N) {
+      cerr << "MakeRandomPasswords returned wrong number of passwords" << endl;
+      return false;
+    }
+    results.push_back(r);
+  }
+
+  // Key stretching as done when a V4 database is opened: PBKDF2 with
+  // HMAC-SHA256, once with precomputed pads, once with the generic loop
+  const unsigned char salt[32] = {0};
+  const unsigned char *pass = reinterpret_cast<const unsigned char *>("pwsbench-passkey");
+  unsigned char Ptag[SHA256::HASHLEN], Ptag2[SHA256::HASHLEN];
+  r.scenario = "StretchKey"; r.items = m_ba.nStretch; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    for (unsigned i = 0; i < I; i++)
+      r.ms.push_back(Time([&] {
+            HMAC_SHA256 hmac(pass, 16);
+            hmac.PBKDF2(salt, sizeof(salt), m_ba.nStretch, Ptag, sizeof(Ptag));
+          }));
+    results.push_back(r);
+  }
+
+  r.scenario = "StretchKeyGeneric"; r.ms.clear();
+  if (Wanted(r.scenario)) {
+    for (unsigned i = 0; i < I; i++)
+      r.ms.push_back(Time([&] {
+            HMAC<SHA256, SHA256::HASHLEN, SHA256::BLOCKSIZE> hmac;
+            unsigned long len = sizeof(Ptag2);
+            pbkdf2(pass, 16, salt, sizeof(salt), m_ba.nStretch, &hmac, Ptag2, &len);
+          }));
+    if (Wanted("StretchKey") && memcmp(Ptag, Ptag2, sizeof(Ptag)) != 0) {
+      cerr << "StretchKey and StretchKeyGeneric disagree" << endl;
+      return false;
+    }
+    results.push_back(r);
+  }
+  return true;
+}
+
+//-----------------------------------------------------------------
+// Output
+
+static void Stats(const vector<double> &ms, double &min, double &mean, double &max)
+{
+  min = *min_element(ms.begin(), ms.end());
+  max = *max_element(ms.begin(), ms.end());
+  mean = 0;
+  for (auto t : ms)
+    mean += t;
+  mean /= ms.size();
+}
+
+static void WriteJSON(ostream &os, const BenchArgs &ba, const vector<BenchResult> &results)
+{
+  os << "{" << endl
+     << "  \"config\": {\"entries\": " << ba.nEntries
+     << ", \"groups\": " << ba.nGroups
+     << ", \"history\": " << ba.nHistory
+     << ", \"attachments\": " << ba.nAtts
+     << ", \"attsize\": " << ba.attSize
+     << ", \"attcontent\": \"" << (ba.attContent == BenchArgs::TEXT ? "text" : "random") << '"'
+     << ", \"compress\": " << (ba.bCompress ? "true" : "false")
+     << ", \"iterations\": " << ba.nIterations
+     << ", \"lookups\": " << ba.nLookups
+     << ", \"aliases\": " << ba.nAliases
+     << ", \"stretch\": " << ba.nStretch
+     << ", \"seed\": " << ba.seed
+     << ", \"format\": " << (ba.version == PWSfile::V40 ? 4 : 3) << "}," << endl
+     << "  \"results\": [" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    double min, mean, max;
+    Stats(r.ms, min, mean, max);
+    os << "    {\"scenario\": \"" << r.scenario << "\", \"items\": " << r.items
+       << ", \"min_ms\": " << min << ", \"mean_ms\": " << mean
+       << ", \"max_ms\": " << max;
+    if (r.bytes != 0)
+      os << ", \"bytes\": " << r.bytes;
+    os << ", \"runs_ms\": [";
+    for (size_t j = 0; j < r.ms.size(); j++)
+      os << (j == 0 ? "" : ", ") << r.ms[j];
+    os << "]}" << (i + 1 < results.size() ? "," : "") << endl;
+  }
+  os << "  ]" << endl << "}" << endl;
+}
+
+static void WriteCSV(ostream &os, const BenchArgs &ba, const vector<BenchResult> &results)
+{
+  os << "scenario,entries,groups,history,attachments,format,items,iterations,"
+     << "min_ms,mean_ms,max_ms,bytes" << endl;
+  for (const auto &r : results) {
+    double min, mean, max;
+    Stats(r.ms, min, mean, max);
+    os << r.scenario << ',' << ba.nEntries << ',' << ba.nGroups << ','
+       << ba.nHistory << ',' << ba.nAtts << ','
+       << (ba.version == PWSfile::V40 ? 4 : 3) << ',' << r.items << ','
+       << r.ms.size() << ',' << min << ',' << mean << ',' << max << ','
+       << r.bytes << endl;
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  BenchArgs ba;
+  if (!parseArgs(argc, argv, ba)) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  vector<BenchResult> results;
+  PWSTrace::Enable(!ba.tracefile.empty());
+  {
+    Bench bench(ba);
+    if (!bench.Run(results))
+      return 2;
+  }
+  if (!ba.tracefile.empty()) {
+    PWSTrace::Enable(false);
+    if (!PWSTrace::WriteChromeTrace(pws_os::towc(ba.tracefile.c_str())))
+      cerr << "Can't write trace to " << ba.tracefile << endl;
+  }
+
+  ofstream ofs;
+  if (ba.outfile != "-") {
+    ofs.open(ba.outfile.c_str());
+    if (!ofs) {
+      cerr << "Can't open " << ba.outfile << endl;
+      return 3;
+    }
+  }
+  ostream &os = (ba.outfile == "-") ? cout : ofs;
+  if (ba.format == BenchArgs::JSON)
+    WriteJSON(os, ba, results);
+  else
+    WriteCSV(os, ba, results);
+  return 0;
+}
@@ -348,15 +348,20 @@ BOOL CAddEdit_PropertySheet::OnCommand(WPARAM wParam, LPARAM lParam)
           m_AEMD.oldKBShortcut = m_AEMD.KBShortcut;
           m_AEMD.pci->SetKBShortcut(m_AEMD.KBShortcut);
 
-          // TODO - What if user has removed the old attachment or changed it? (Rony)
+          // The old attachment may be shared with other entries, so it's
+          // only dropped by this one, and an edit of it is stored apart
+          if (m_AEMD.oldattachment.HasUUID() &&
+              (!m_AEMD.attachment.HasUUID() ||
+               m_AEMD.attachment.GetUUID() != m_AEMD.oldattachment.GetUUID()))
+            m_AEMD.pcore->RemoveAtt(m_AEMD.oldattachment.GetUUID());
           if (m_AEMD.attachment.HasUUID()) {
-            m_AEMD.pci->SetAttUUID(m_AEMD.attachment.GetUUID());
-            m_AEMD.pcore->PutAtt(m_AEMD.attachment);
+            const pws_os::CUUID attuuid = m_AEMD.pcore->PutAtt(m_AEMD.attachment);
+            m_AEMD.pci->SetAttUUID(attuuid);
+            m_AEMD.attachment = m_AEMD.pcore->GetAtt(attuuid);
           } else {
             m_AEMD.pci->ClearAttUUID();
-            if (m_AEMD.oldattachment.HasUUID())
-              m_AEMD.pcore->RemoveAtt(m_AEMD.oldattachment.GetUUID());
           }
+          m_AEMD.oldattachment = m_AEMD.attachment;
         } // m_bIsModified
 
         m_AEMD.pci->SetXTimeInt(m_AEMD.XTimeInt);
@@ -2504,17 +2504,26 @@ void DboxMain::CheckExpireList(const bool bAtOpen)
   // or the user has not set a warning period - they may do so in the next 24 hrs
   KillTimer(TIMER_EXPENT);
   const UINT DAY = 86400000; // 24 hours, in millisecs (24*60*60*1000)
-  SetTimer(TIMER_EXPENT, DAY, NULL);
 
   // Check if we've any expired entries. If so, show the user.
   if (!PWSprefs::GetInstance()->GetPref(PWSprefs::PreExpiryWarn) ||
        m_core.GetExpirySize() == 0) {
+    SetTimer(TIMER_EXPENT, DAY, NULL);
     m_bTellUserExpired = false;
     return;
   }
 
   int idays = PWSprefs::GetInstance()->GetPref(PWSprefs::PreExpiryWarnDays);
-  ExpiredList expiredEntries = m_core.GetExpired(idays);
+  ExpPWEntryList expiredEntries = m_core.GetExpired(idays);
+
+  // If the next entry to come within the warning period does so within
+  // the next 24 hrs, pop the timer then rather than a day later
+  UINT uiElapse = DAY;
+  const time_t tLimit = ExpiredList::GetExpiryLimit(idays);
+  const time_t tNext = m_core.GetNextExpiry(tLimit);
+  if (tNext != time_t(0) && tNext - tLimit < time_t(DAY / 1000))
+    uiElapse = static_cast<UINT>(tNext - tLimit + 1) * 1000;
+  SetTimer(TIMER_EXPENT, uiElapse, NULL);
 
   if (!expiredEntries.empty() && (app.GetSystemTrayState() == LOCKED || IsIconic() == TRUE || bAtOpen))
     m_bTellUserExpired = true;
@@ -2531,7 +2540,7 @@ void DboxMain::TellUserAboutExpiredPasswords()
 
   // Tell user that there are expired passwords
   int idays = PWSprefs::GetInstance()->GetPref(PWSprefs::PreExpiryWarnDays);
-  ExpiredList expiredEntries = m_core.GetExpired(idays);
+  ExpPWEntryList expiredEntries = m_core.GetExpired(idays);
 
   if (m_bTellUserExpired && !expiredEntries.empty()) {
     m_bTellUserExpired = !m_bTellUserExpired;
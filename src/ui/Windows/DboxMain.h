@@ -143,6 +143,9 @@ public:
                  const CItemAtt::AttFieldBits &bsAttFields, 
                  const bool &subgroup_set, const std::wstring &subgroup_name,
                  const int subgroup_object, const int subgroup_function);
+  // FindFuzzy is used by CPWFindToolBar when FindAll finds nothing: indices
+  // are of the entries closest to str, best first. Returns # of finds.
+  size_t FindFuzzy(const CString &str, std::vector<int> &indices);
 
   // Used by ListCtrl KeyDown
   bool IsImageVisible() const {return m_bImageInLV;}
@@ -750,6 +753,8 @@ private:
   virtual void GUISetupDisplayInfo(CItemData &ci);
   virtual void GUIRefreshEntry(const CItemData &ci);
   virtual void UpdateWizard(const std::wstring &s);
+  virtual void DatabaseFileChanged(bool bLockFileOnly);
+  virtual void AsyncSaveCompleted(int status);
 
   static int CALLBACK CompareFunc(LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort);
 
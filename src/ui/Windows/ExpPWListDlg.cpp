@@ -25,7 +25,7 @@
 
 // CExpPWListDlg dialog
 CExpPWListDlg::CExpPWListDlg(CWnd* pParent,
-                             ExpiredList &expPWList,
+                             ExpPWEntryList &expPWList,
                              const CString& a_filespec)
   : CPWDialog(CExpPWListDlg::IDD, pParent), m_expPWList(expPWList)
 {
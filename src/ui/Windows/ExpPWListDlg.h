@@ -14,8 +14,6 @@
 
 // CExpPWListDlg dialog
 
-class ExpiredList;
-
 // Local vector - has the group/title/user and locale version of expiry date
 // Generated from similar vector in core, which doesn't need these.
 struct st_ExpLocalListEntry {
@@ -57,7 +55,7 @@ struct st_ExpLocalListEntry {
 class CExpPWListDlg : public CPWDialog
 {
 public:
-  CExpPWListDlg(CWnd* pParent, ExpiredList &expPWList,
+  CExpPWListDlg(CWnd* pParent, ExpPWEntryList &expPWList,
                 const CString& a_filespec = L"");
   virtual ~CExpPWListDlg();
 
@@ -83,7 +81,7 @@ protected:
 
 private:
   int GetEntryImage(const st_ExpLocalListEntry &elle);
-  ExpiredList &m_expPWList;
+  ExpPWEntryList &m_expPWList;
 
   std::vector<st_ExpLocalListEntry> m_vExpLocalListEntries;
   int m_idays;
@@ -1088,7 +1088,7 @@ int DboxMain::Save(const SaveType savetype)
   CString cs_msg, cs_temp;
   CGeneralMsgBox gmb;
   std::wstring NewName;
-  std::wstring bu_fname; // used to undo backup if save failed
+  std::wstring bu_fname; // name of intermediate backup, if made
 
   const StringX sxCurrFile = m_core.GetCurFile();
   const PWSfile::VERSION current_version = m_core.GetReadFileVersion();
@@ -1185,9 +1185,8 @@ int DboxMain::Save(const SaveType savetype)
   rc = m_core.WriteFile(sxCurrFile, current_version);
 
   if (rc != PWScore::SUCCESS) { // Save failed!
-    // Restore backup, if we have one
-    if (!bu_fname.empty() && !sxCurrFile.empty())
-      pws_os::RenameFile(bu_fname, sxCurrFile.c_str());
+    // No need to restore the backup: WriteFile leaves the
+    // original untouched unless the new file was written completely
     // Show user that we have a problem
     DisplayFileWriteError(rc, sxCurrFile);
     return rc;
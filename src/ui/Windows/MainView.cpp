@@ -234,6 +234,16 @@ void DboxMain::UpdateWizard(const std::wstring &s)
     m_pWZWnd->SetWindowText(s.c_str());
 }
 
+void DboxMain::DatabaseFileChanged(bool)
+{
+  // Not yet supported - see ThisMfcApp.cpp
+}
+
+void DboxMain::AsyncSaveCompleted(int)
+{
+  // Not yet supported - see ThisMfcApp.cpp
+}
+
 //-----------------------------------------------------------------------------
 
 /*
@@ -949,8 +959,8 @@ size_t DboxMain::FindAll(const CString &str, BOOL CaseSensitive,
       if (bsFields.test(CItemData::PWHIST)) {
         size_t pwh_max, err_num;
         PWHistList pwhistlist;
-        CreatePWHistoryList(curitem.GetPWHistory(), pwh_max, err_num,
-                            pwhistlist, PWSUtil::TMC_XML);
+        curitem.GetPWHistoryList(pwh_max, err_num,
+                                 pwhistlist, PWSUtil::TMC_XML);
         PWHistList::iterator iter;
         for (iter = pwhistlist.begin(); iter != pwhistlist.end();
              iter++) {
@@ -1012,6 +1022,26 @@ nextentry:
   return retval;
 }
 
+size_t DboxMain::FindFuzzy(const CString &str, vector<int> &indices)
+{
+  ASSERT(!str.IsEmpty());
+  ASSERT(indices.empty());
+
+  // Allowing for typos, so only the best few are of interest
+  const size_t MaxFuzzyMatches = 50;
+
+  std::vector<st_FuzzyMatch> vMatches;
+  m_core.FuzzyFind(StringX(LPCWSTR(str)), MaxFuzzyMatches, vMatches);
+  for (auto iter = vMatches.begin(); iter != vMatches.end(); iter++) {
+    ItemListConstIter listPos = m_core.Find(iter->uuid);
+    ASSERT(listPos != m_core.GetEntryEndIter());
+    DisplayInfo *pdi = (DisplayInfo *)listPos->second.GetDisplayInfo();
+    ASSERT(pdi != NULL);
+    indices.push_back(pdi->list_index);
+  }
+  return indices.size();
+}
+
 //Checks and sees if everything works and something is selected
 BOOL DboxMain::SelItemOk()
 {
@@ -541,8 +541,12 @@ void CPWFindToolBar::Find()
                                  m_pst_SADV->subgroup_bset,
                                  m_pst_SADV->subgroup_name, m_pst_SADV->subgroup_object, 
                                  m_pst_SADV->subgroup_function);
-    else
+    else {
       m_numFound = app.GetMainDlg()->FindAll(m_search_text, m_cs_search, m_indices);
+      // Nothing found: maybe a typo, so offer the closest entries instead
+      if (m_numFound == 0)
+        m_numFound = app.GetMainDlg()->FindFuzzy(m_search_text, m_indices);
+    }
 
     switch (m_numFound) {
       case 0:
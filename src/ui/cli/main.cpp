@@ -17,8 +17,12 @@
 #include "core/UTF8Conv.h"
 #include "core/Report.h"
 #include "core/XML/XMLDefs.h"
+#include "core/FederatedSearch.h"
+#include "core/PWSRecordIndex.h"
+#include "core/PWSTrace.h"
 
 #include <termios.h>
+#include <poll.h>
 
 using namespace std;
 
@@ -28,6 +32,12 @@ static void echoOn();
 
 static int ImportText(PWScore &core, const StringX &fname);
 static int ImportXML(PWScore &core, const StringX &fname);
+static int Audit(PWScore &core, bool bIncludeHistory);
+static int FindURL(PWScore &core, const StringX &sxURL);
+struct UserArgs;
+static int Search(const UserArgs &ua);
+static int List(const UserArgs &ua);
+static int Batch(const UserArgs &ua);
 static const char *status_text(int status);
 
 //-----------------------------------------------------------------
@@ -37,20 +47,40 @@ static struct termios oldTermioFlags; // to restore tty echo
 static void usage(char *pname)
 {
   cerr << "Usage: " << pname << " safe --imp[=file] --text|--xml" << endl
-       << "\t safe --exp[=file] --text|--xml" << endl;
+       << "\t safe --exp[=file] --text|--xml" << endl
+       << "\t safe --audit[=history]" << endl
+       << "\t safe --search=text [--case] [--also=safe2 ...]" << endl
+       << "\t safe --url=url  (entries for the url's site, best first)" << endl
+       << "\t safe --list  (all entries' group, title & user)" << endl
+       << "\t safe --batch  (passphrase, then commands, on stdin)" << endl
+       << "\t safe --convert=chunked|plain  (V4 safes only)" << endl
+       << "Any of these may add --trace=file to save a trace of the safe's"
+       << " processing, for chrome://tracing" << endl;
 }
 
 
 struct UserArgs {
-  UserArgs() : ImpExp(Unset), Format(Unknown) {}
+  UserArgs() : ImpExp(Unset), Format(Unknown), AuditHistory(false),
+               CaseSensitive(false), Chunked(false) {}
   StringX safe, fname;
-  enum {Unset, Import, Export} ImpExp;
+  enum {Unset, Import, Export, Audit, Search, List, Batch, Convert, URL} ImpExp;
   enum {Unknown, XML, Text} Format;
+  bool AuditHistory;
+  // Search:
+  StringX searchText;
+  std::vector<StringX> otherSafes;
+  bool CaseSensitive;
+  // Convert:
+  bool Chunked;
+  // URL:
+  StringX url;
+  // Trace:
+  StringX traceFile;
 };
 
 bool parseArgs(int argc, char *argv[], UserArgs &ua)
 {
-  if (argc != 4 && argc != 5)
+  if (argc < 3)
     return false;
   CUTF8Conv conv;
   if (!conv.FromUTF8((const unsigned char *)argv[1], strlen(argv[1]),
@@ -66,10 +96,19 @@ bool parseArgs(int argc, char *argv[], UserArgs &ua)
       {"export", optional_argument, 0, 'e'},
       {"text", no_argument, 0, 't'},
       {"xml", no_argument, 0, 'x'},
+      {"audit", optional_argument, 0, 'a'},
+      {"search", required_argument, 0, 's'},
+      {"case", no_argument, 0, 'c'},
+      {"also", required_argument, 0, 'o'},
+      {"list", no_argument, 0, 'l'},
+      {"batch", no_argument, 0, 'b'},
+      {"convert", required_argument, 0, 'v'},
+      {"url", required_argument, 0, 'u'},
+      {"trace", required_argument, 0, 'r'},
       {0, 0, 0, 0}
     };
 
-    int c = getopt_long(argc-1, argv+1, "i::e::tx",
+    int c = getopt_long(argc-1, argv+1, "i::e::txa::s:co:lbv:u:r:",
                         long_options, &option_index);
     if (c == -1)
       break;
@@ -103,6 +142,86 @@ bool parseArgs(int argc, char *argv[], UserArgs &ua)
         }
       }
       break;
+    case 'a':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::Audit;
+      else
+        return false;
+      if (optarg) {
+        if (strcmp(optarg, "history") == 0)
+          ua.AuditHistory = true;
+        else
+          return false;
+      }
+      break;
+    case 's':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::Search;
+      else
+        return false;
+      if (!conv.FromUTF8((const unsigned char *)optarg, strlen(optarg),
+                         ua.searchText)) {
+        cerr << "Could not convert search text " << optarg
+             << " to StringX" << endl;
+        exit(2);
+      }
+      break;
+    case 'c':
+      ua.CaseSensitive = true;
+      break;
+    case 'l':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::List;
+      else
+        return false;
+      break;
+    case 'b':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::Batch;
+      else
+        return false;
+      break;
+    case 'v':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::Convert;
+      else
+        return false;
+      if (strcmp(optarg, "chunked") == 0)
+        ua.Chunked = true;
+      else if (strcmp(optarg, "plain") != 0)
+        return false;
+      break;
+    case 'u':
+      if (ua.ImpExp == UserArgs::Unset)
+        ua.ImpExp = UserArgs::URL;
+      else
+        return false;
+      if (!conv.FromUTF8((const unsigned char *)optarg, strlen(optarg),
+                         ua.url)) {
+        cerr << "Could not convert url " << optarg << " to StringX" << endl;
+        exit(2);
+      }
+      break;
+    case 'r':
+      if (!conv.FromUTF8((const unsigned char *)optarg, strlen(optarg),
+                         ua.traceFile)) {
+        cerr << "Could not convert filename " << optarg
+             << " to StringX" << endl;
+        exit(2);
+      }
+      break;
+    case 'o':
+      {
+        StringX sxSafe;
+        if (!conv.FromUTF8((const unsigned char *)optarg, strlen(optarg),
+                           sxSafe)) {
+          cerr << "Could not convert filename " << optarg
+               << " to StringX" << endl;
+          exit(2);
+        }
+        ua.otherSafes.push_back(sxSafe);
+      }
+      break;
     case 'x':
       if (ua.Format == UserArgs::Unknown)
         ua.Format = UserArgs::XML;
@@ -123,9 +242,38 @@ bool parseArgs(int argc, char *argv[], UserArgs &ua)
     if (ua.fname.empty())
       ua.fname = (ua.Format == UserArgs::XML) ? L"file.xml" : L"file.txt";
   }
+  // Import & export need a format, the others don't
+  const bool bNeedsFormat = (ua.ImpExp == UserArgs::Import ||
+                             ua.ImpExp == UserArgs::Export);
+  if (ua.ImpExp == UserArgs::Unset ||
+      bNeedsFormat == (ua.Format == UserArgs::Unknown))
+    return false;
+  // Only search takes more safes, or cares about case
+  if (ua.ImpExp != UserArgs::Search &&
+      (!ua.otherSafes.empty() || ua.CaseSensitive))
+    return false;
+  // Leftover arguments
+  if (optind != argc - 1)
+    return false;
   return true;
 }
 
+// Traces the core for as long as it's in scope, if asked to
+struct TraceWriter {
+  TraceWriter(const StringX &fname) : m_fname(fname.c_str()) {
+    if (!m_fname.empty())
+      PWSTrace::Enable(true);
+  }
+  ~TraceWriter() {
+    if (m_fname.empty())
+      return;
+    PWSTrace::Enable(false);
+    if (!PWSTrace::WriteChromeTrace(m_fname))
+      wcerr << L"Couldn't write trace to " << m_fname << endl;
+  }
+  stringT m_fname;
+};
+
 int main(int argc, char *argv[])
 {
   UserArgs ua;
@@ -133,6 +281,17 @@ int main(int argc, char *argv[])
     usage(argv[0]);
     return 1;
   }
+  TraceWriter tw(ua.traceFile);
+
+  // Search reads its safes read-only, in parallel
+  if (ua.ImpExp == UserArgs::Search)
+    return Search(ua);
+  // List only decrypts what it shows
+  if (ua.ImpExp == UserArgs::List)
+    return List(ua);
+  // Batch reads everything, including the passphrase, from stdin
+  if (ua.ImpExp == UserArgs::Batch)
+    return Batch(ua);
 
   PWScore core;
   if (!pws_os::FileExists(ua.safe.c_str())) {
@@ -178,7 +337,19 @@ int main(int argc, char *argv[])
     goto done;
   }
 
-  if (ua.ImpExp == UserArgs::Export) {
+  if (ua.ImpExp == UserArgs::Audit) {
+    status = Audit(core, ua.AuditHistory);
+  } else if (ua.ImpExp == UserArgs::URL) {
+    status = FindURL(core, ua.url);
+  } else if (ua.ImpExp == UserArgs::Convert) {
+    if (core.GetReadFileVersion() != PWSfile::V40) {
+      cerr << "Only V4 safes can be converted" << endl;
+      status = PWScore::FAILURE;
+    } else {
+      core.SetChunkedV4(ua.Chunked);
+      status = core.WriteCurFile();
+    }
+  } else if (ua.ImpExp == UserArgs::Export) {
     CItemData::FieldBits all(~0L);
     int N;
     if (ua.Format == UserArgs::XML) {
@@ -440,3 +611,470 @@ ImportXML(PWScore &core, const StringX &fname)
   rpt.EndReport();
   return rc;
 }
+
+static int
+Audit(PWScore &core, bool bIncludeHistory)
+{
+  st_AuditOptions st_ao;
+  st_ao.bIncludeHistory = bIncludeHistory;
+  st_AuditResults st_ar;
+
+  CReport rpt;
+  rpt.StartReport(L"Audit", core.GetCurFile().c_str());
+  core.AuditPasswords(st_ao, st_ar, &rpt);
+  rpt.EndReport();
+  wcout << rpt.GetString() << endl;
+  return PWScore::SUCCESS;
+}
+
+static int
+FindURL(PWScore &core, const StringX &sxURL)
+{
+  std::vector<URLIndex::Candidate> vCandidates;
+  core.FindByURL(sxURL, vCandidates);
+  for (auto iter = vCandidates.begin(); iter != vCandidates.end(); iter++) {
+    const CItemData &ci = core.Find(iter->uuid)->second;
+    wcout << iter->score << L"\t" << ci.GetGroup()
+          << (ci.GetGroup().empty() ? L"" : L".") << ci.GetTitle();
+    if (!ci.GetUser().empty())
+      wcout << L" [" << ci.GetUser() << L"]";
+    wcout << L"\t" << ci.GetURL() << endl;
+  }
+  wcout << vCandidates.size() << (vCandidates.size() == 1 ? L" entry" : L" entries")
+        << L" found" << endl;
+  return PWScore::SUCCESS;
+}
+
+static int
+Search(const UserArgs &ua)
+{
+  std::vector<st_FederatedDB> vDBs;
+  vDBs.push_back(st_FederatedDB(ua.safe, L""));
+  for (auto iter = ua.otherSafes.begin(); iter != ua.otherSafes.end(); iter++)
+    vDBs.push_back(st_FederatedDB(*iter, L""));
+
+  // Ask for all passwords up front, so that all safes can be read at once
+  for (auto iter = vDBs.begin(); iter != vDBs.end(); iter++) {
+    if (!pws_os::FileExists(iter->filename.c_str())) {
+      wcerr << iter->filename << L" - file not found" << endl;
+      return 2;
+    }
+    wstring wpk;
+    wcout << L"Enter Password for " << iter->filename << L": ";
+    echoOff();
+    wcin >> wpk;
+    echoOn();
+    iter->passkey = wpk.c_str();
+  }
+
+  FederatedSearch fs;
+  std::vector<int> vStatus;
+  fs.Open(vDBs, vStatus);
+  for (size_t i = 0; i < vStatus.size(); i++) {
+    if (vStatus[i] != PWScore::SUCCESS)
+      wcerr << vDBs[i].filename << L": ReadFile returned: "
+            << status_text(vStatus[i]) << endl;
+  }
+
+  CItemData::FieldBits bsFields;
+  bsFields.set();
+  size_t numFound = fs.Find(ua.searchText, bsFields, ua.CaseSensitive,
+                            [&fs](const std::vector<st_FederatedMatch> &vMatches) {
+      for (auto iter = vMatches.begin(); iter != vMatches.end(); iter++) {
+        wcout << fs.GetDBName(iter->iDB) << L": " << iter->group
+              << (iter->group.empty() ? L"" : L".") << iter->title;
+        if (!iter->user.empty())
+          wcout << L" [" << iter->user << L"]";
+        wcout << endl;
+      }
+    });
+
+  wcout << numFound << (numFound == 1 ? L" entry" : L" entries")
+        << L" found" << endl;
+  return PWScore::SUCCESS;
+}
+
+static void
+ListEntry(const StringX &group, const StringX &title, const StringX &user)
+{
+  wcout << group << (group.empty() ? L"" : L".") << title;
+  if (!user.empty())
+    wcout << L" [" << user << L"]";
+  wcout << endl;
+}
+
+static int
+List(const UserArgs &ua)
+{
+  if (!pws_os::FileExists(ua.safe.c_str())) {
+    wcerr << ua.safe << L" - file not found" << endl;
+    return 2;
+  }
+  wstring wpk;
+  wcout << L"Enter Password: ";
+  echoOff();
+  wcin >> wpk;
+  echoOn();
+  const StringX pk(wpk.c_str());
+
+  // The index decrypts only what's listed, while checking the file's
+  // integrity in the background. It doesn't do V1/V2 or chunked V4 safes.
+  PWSRecordIndex index;
+  int status = index.Open(ua.safe, pk);
+  if (status == PWSfile::UNSUPPORTED_VERSION) {
+    PWScore core;
+    status = core.ReadFile(ua.safe, pk);
+    if (status != PWScore::SUCCESS) {
+      wcerr << L"ReadFile returned: " << status_text(status) << endl;
+      return status;
+    }
+    for (auto iter = core.GetEntryIter(); iter != core.GetEntryEndIter(); iter++)
+      ListEntry(iter->second.GetGroup(), iter->second.GetTitle(),
+                iter->second.GetUser());
+    return PWScore::SUCCESS;
+  }
+  if (status != PWSfile::SUCCESS) {
+    wcerr << L"Open returned: " << status_text(status) << endl;
+    return status;
+  }
+
+  for (size_t i = 0; i < index.GetNumEntries(); i++) {
+    const st_IndexEntry &entry = index.GetEntry(i);
+    ListEntry(entry.group, entry.title, entry.user);
+  }
+  status = index.WaitForVerify();
+  if (status != PWSfile::SUCCESS)
+    wcerr << L"Integrity check returned: " << status_text(status) << endl;
+  return status;
+}
+
+//-----------------------------------------------------------------
+// Batch mode: the safe is read once, then commands are read from stdin,
+// one per line, with TAB-separated arguments ("\t", "\n" and "\\" escape
+// those characters in values):
+//
+//   get     group title user
+//   search  text
+//   url     url
+//   add     group title user password [field=value ...]
+//   edit    group title user field=value ...
+//   delete  group title user
+//   export  text|xml file
+//   save
+//   quit
+//
+// where field is one of group, title, user, password, url, email, notes,
+// autotype or runcmd. Output lines that start with a TAB are data (one
+// per field for get, one per entry for search and url, the latter best
+// match first); each command's output ends with a line starting "OK" or
+// "ERR".
+//
+// Changes are made via PWScore::Execute, and saved when asked to, when
+// the input runs dry, after every MaxUnsaved changes, and at the end.
+//-----------------------------------------------------------------
+
+namespace {
+  const struct {
+    const char *name;
+    CItemData::FieldType ft;
+  } BatchFields[] = {
+    {"group", CItemData::GROUP}, {"title", CItemData::TITLE},
+    {"user", CItemData::USER}, {"password", CItemData::PASSWORD},
+    {"url", CItemData::URL}, {"email", CItemData::EMAIL},
+    {"notes", CItemData::NOTES}, {"autotype", CItemData::AUTOTYPE},
+    {"runcmd", CItemData::RUNCMD},
+  };
+
+  const int MaxUnsaved = 100;
+
+  string Escape(const StringX &sx)
+  {
+    CUTF8Conv conv;
+    const unsigned char *utf8 = NULL;
+    size_t utf8Len = 0;
+    conv.ToUTF8(sx, utf8, utf8Len);
+    string s;
+    for (size_t i = 0; i < utf8Len; i++) {
+      switch (utf8[i]) {
+      case '\t': s += "\\t"; break;
+      case '\n': s += "\\n"; break;
+      case '\r': s += "\\r"; break;
+      case '\\': s += "\\\\"; break;
+      default: s += char(utf8[i]);
+      }
+    }
+    return s;
+  }
+
+  // Split line at TABs, undoing Escape()
+  bool SplitLine(const string &line, vector<StringX> &vArgs)
+  {
+    CUTF8Conv conv;
+    vArgs.clear();
+    string arg;
+    for (size_t i = 0; i <= line.length(); i++) {
+      if (i == line.length() || line[i] == '\t') {
+        StringX sx;
+        if (!conv.FromUTF8((const unsigned char *)arg.c_str(), arg.length(), sx))
+          return false;
+        vArgs.push_back(sx);
+        arg.clear();
+      } else if (line[i] == '\\' && i + 1 < line.length()) {
+        switch (line[++i]) {
+        case 't': arg += '\t'; break;
+        case 'n': arg += '\n'; break;
+        case 'r': arg += '\r'; break;
+        default: arg += line[i];
+        }
+      } else {
+        arg += line[i];
+      }
+    }
+    return true;
+  }
+
+  bool SetBatchField(CItemData &ci, const StringX &sxArg, bool bNew)
+  {
+    const StringX::size_type eq = sxArg.find(L'=');
+    if (eq == StringX::npos)
+      return false;
+    const StringX sxName = sxArg.substr(0, eq), sxValue = sxArg.substr(eq + 1);
+    for (size_t i = 0; i < NumberOf(BatchFields); i++) {
+      StringX sxField;
+      CUTF8Conv conv;
+      conv.FromUTF8((const unsigned char *)BatchFields[i].name,
+                    strlen(BatchFields[i].name), sxField);
+      if (sxName == sxField) {
+        if (BatchFields[i].ft == CItemData::PASSWORD && !bNew)
+          ci.UpdatePassword(sxValue); // keeps history & modification time
+        else
+          ci.SetFieldValue(BatchFields[i].ft, sxValue);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // True if there's no more input waiting to be read
+  bool InputIdle()
+  {
+    if (cin.rdbuf()->in_avail() > 0)
+      return false;
+    struct pollfd pfd = {fileno(stdin), POLLIN, 0};
+    return poll(&pfd, 1, 0) == 0;
+  }
+}
+
+static int
+BatchCommand(PWScore &core, const vector<StringX> &vArgs, int &numUnsaved)
+{
+  const StringX &cmd = vArgs[0];
+  const size_t nArgs = vArgs.size() - 1;
+
+  if ((cmd == L"get" || cmd == L"delete") && nArgs == 3) {
+    ItemListIter iter = core.Find(vArgs[1], vArgs[2], vArgs[3]);
+    if (iter == core.GetEntryEndIter()) {
+      cout << "ERR no such entry" << endl;
+      return PWScore::FAILURE;
+    }
+    if (cmd == L"get") {
+      const CItemData &ci = iter->second;
+      // An alias' password is its base's
+      const CItemData *pbci = ci.IsAlias() ? core.GetBaseEntry(&ci) : NULL;
+      for (size_t i = 0; i < NumberOf(BatchFields); i++) {
+        const CItemData::FieldType ft = BatchFields[i].ft;
+        const StringX sxValue = (pbci != NULL && ft == CItemData::PASSWORD) ?
+          pbci->GetPassword() : ci.GetFieldValue(ft);
+        if (!sxValue.empty())
+          cout << '\t' << BatchFields[i].name << '\t' << Escape(sxValue) << endl;
+      }
+    } else {
+      core.Execute(DeleteEntryCommand::Create(&core, iter->second));
+      numUnsaved++;
+    }
+    cout << "OK" << endl;
+  } else if (cmd == L"search" && nArgs == 1) {
+    StringX sxFind(vArgs[1]);
+    ToLower(sxFind);
+    int numFound = 0;
+    for (auto iter = core.GetEntryIter(); iter != core.GetEntryEndIter(); iter++) {
+      const CItemData &ci = iter->second;
+      for (size_t i = 0; i < NumberOf(BatchFields); i++) {
+        StringX sxValue = ci.GetFieldValue(BatchFields[i].ft);
+        ToLower(sxValue);
+        if (sxValue.find(sxFind) != StringX::npos) {
+          cout << '\t' << Escape(ci.GetGroup()) << '\t' << Escape(ci.GetTitle())
+               << '\t' << Escape(ci.GetUser()) << endl;
+          numFound++;
+          break;
+        }
+      }
+    }
+    cout << "OK " << numFound << endl;
+  } else if (cmd == L"url" && nArgs == 1) {
+    std::vector<URLIndex::Candidate> vCandidates;
+    core.FindByURL(vArgs[1], vCandidates);
+    for (auto iter = vCandidates.begin(); iter != vCandidates.end(); iter++) {
+      const CItemData &ci = core.Find(iter->uuid)->second;
+      cout << '\t' << Escape(ci.GetGroup()) << '\t' << Escape(ci.GetTitle())
+           << '\t' << Escape(ci.GetUser()) << endl;
+    }
+    cout << "OK " << vCandidates.size() << endl;
+  } else if (cmd == L"add" && nArgs >= 4) {
+    if (core.Find(vArgs[1], vArgs[2], vArgs[3]) != core.GetEntryEndIter()) {
+      cout << "ERR entry exists" << endl;
+      return PWScore::FAILURE;
+    }
+    CItemData ci;
+    ci.CreateUUID();
+    ci.SetGroup(vArgs[1]);
+    ci.SetTitle(vArgs[2]);
+    ci.SetUser(vArgs[3]);
+    ci.SetPassword(vArgs[4]);
+    ci.SetCTime();
+    for (size_t i = 5; i <= nArgs; i++) {
+      if (!SetBatchField(ci, vArgs[i], true)) {
+        cout << "ERR bad field " << Escape(vArgs[i]) << endl;
+        return PWScore::FAILURE;
+      }
+    }
+    core.Execute(AddEntryCommand::Create(&core, ci));
+    numUnsaved++;
+    cout << "OK " << Escape(StringX(ci.GetUUID())) << endl;
+  } else if (cmd == L"edit" && nArgs >= 4) {
+    ItemListIter iter = core.Find(vArgs[1], vArgs[2], vArgs[3]);
+    if (iter == core.GetEntryEndIter()) {
+      cout << "ERR no such entry" << endl;
+      return PWScore::FAILURE;
+    }
+    const CItemData &old_ci = iter->second;
+    CItemData new_ci(old_ci);
+    for (size_t i = 4; i <= nArgs; i++) {
+      if (!SetBatchField(new_ci, vArgs[i], false)) {
+        cout << "ERR bad field " << Escape(vArgs[i]) << endl;
+        return PWScore::FAILURE;
+      }
+    }
+    const StringX sxGroup = new_ci.GetGroup(), sxTitle = new_ci.GetTitle(),
+      sxUser = new_ci.GetUser();
+    ItemListIter other = core.Find(sxGroup, sxTitle, sxUser);
+    if (other != core.GetEntryEndIter() && other != iter) {
+      cout << "ERR entry exists" << endl;
+      return PWScore::FAILURE;
+    }
+    new_ci.SetRMTime();
+    core.Execute(EditEntryCommand::Create(&core, old_ci, new_ci));
+    numUnsaved++;
+    cout << "OK" << endl;
+  } else if (cmd == L"export" && nArgs == 2 &&
+             (vArgs[1] == L"text" || vArgs[1] == L"xml")) {
+    CItemData::FieldBits all(~0L);
+    int N;
+    int status;
+    if (vArgs[1] == L"xml")
+      status = core.WriteXMLFile(vArgs[2], all, L"", 0, 0, L' ', L"", N);
+    else
+      status = core.WritePlaintextFile(vArgs[2], all, L"", 0, 0, L' ', N);
+    if (status != PWScore::SUCCESS) {
+      cout << "ERR " << status_text(status) << endl;
+      return status;
+    }
+    cout << "OK " << N << endl;
+  } else if (cmd == L"save" && nArgs == 0) {
+    const int status = numUnsaved != 0 ? core.WriteCurFile() : PWScore::SUCCESS;
+    if (status != PWScore::SUCCESS) {
+      cout << "ERR " << status_text(status) << endl;
+      return status;
+    }
+    numUnsaved = 0;
+    cout << "OK" << endl;
+  } else {
+    cout << "ERR bad command" << endl;
+    return PWScore::FAILURE;
+  }
+  return PWScore::SUCCESS;
+}
+
+static int
+Batch(const UserArgs &ua)
+{
+  PWScore core;
+  if (!pws_os::FileExists(ua.safe.c_str())) {
+    cerr << "file not found" << endl;
+    return 2;
+  }
+
+  const bool bTTY = isatty(fileno(stdin));
+  if (bTTY) {
+    cerr << "Enter Password: ";
+    echoOff();
+  }
+  string line;
+  getline(cin, line);
+  if (bTTY)
+    echoOn();
+  StringX pk;
+  CUTF8Conv conv;
+  if (!conv.FromUTF8((const unsigned char *)line.c_str(), line.length(), pk)) {
+    cerr << "Could not convert passphrase" << endl;
+    return 2;
+  }
+  trashMemory(&line[0], line.length());
+
+  {
+    const char *user = getlogin() != NULL ? getlogin() : "unknown";
+    StringX locker;
+    if (!conv.FromUTF8((const unsigned char *)user, strlen(user), locker)) {
+      cerr << "Could not convert user " << user << " to StringX" << endl;
+      return 2;
+    }
+    stringT lk(locker.c_str());
+    if (!core.LockFile(ua.safe.c_str(), lk)) {
+      cerr << "Couldn't lock file: locked by " << Escape(locker) << endl;
+      return -1;
+    }
+  }
+
+  core.SetCurFile(ua.safe);
+  int status = core.ReadCurFile(pk);
+  if (status != PWScore::SUCCESS) {
+    cout << "ERR ReadFile returned: " << status_text(status) << endl;
+    core.UnlockFile(ua.safe.c_str());
+    return status;
+  }
+  cout << "OK " << core.GetNumEntries() << endl;
+
+  int numUnsaved = 0;
+  vector<StringX> vArgs;
+  while (getline(cin, line)) {
+    if (!line.empty() && line[line.length() - 1] == '\r')
+      line.resize(line.length() - 1);
+    if (line.empty())
+      continue;
+    if (!SplitLine(line, vArgs)) {
+      cout << "ERR invalid UTF-8" << endl;
+      continue;
+    }
+    if (vArgs[0] == L"quit")
+      break;
+
+    BatchCommand(core, vArgs, numUnsaved);
+
+    // Coalesce saves: write once the pending commands have been done
+    if (numUnsaved != 0 && (numUnsaved >= MaxUnsaved || InputIdle())) {
+      status = core.WriteCurFile();
+      if (status != PWScore::SUCCESS)
+        cerr << "WriteFile returned: " << status_text(status) << endl;
+      else
+        numUnsaved = 0;
+    }
+  }
+
+  status = numUnsaved != 0 ? core.WriteCurFile() : PWScore::SUCCESS;
+  if (status == PWScore::SUCCESS)
+    cout << "OK" << endl;
+  else
+    cout << "ERR " << status_text(status) << endl;
+  core.UnlockFile(ua.safe.c_str());
+  return status;
+}
@@ -122,8 +122,11 @@ void PasswordSafeSearch::OnDoSearchT(Iter begin, Iter end, Accessor afn)
   if (m_criteria->IsDirty() || txtCtrl->IsModified() || m_searchPointer.IsEmpty())  {
       m_searchPointer.Clear();
 
-      if (!m_toolbar->GetToolState(ID_FIND_ADVANCED_OPTIONS))
+      if (!m_toolbar->GetToolState(ID_FIND_ADVANCED_OPTIONS)) {
         FindMatches(tostringx(searchText), m_toolbar->GetToolState(ID_FIND_IGNORE_CASE), m_searchPointer, begin, end, afn);
+        if (m_searchPointer.IsEmpty())
+          FindFuzzyMatches(tostringx(searchText), m_searchPointer);
+      }
       else
         FindMatches(tostringx(searchText), m_toolbar->GetToolState(ID_FIND_IGNORE_CASE), m_searchPointer,
                       m_criteria->GetSelectedFields(), m_criteria->HasSubgroupRestriction(), m_criteria->SubgroupSearchText(),
@@ -535,8 +538,8 @@ void PasswordSafeSearch::FindMatches(const StringX& searchText, bool fCaseSensit
     if (!found && bsFields.test(CItemData::PWHIST)) {
         size_t pwh_max, err_num;
         PWHistList pwhistlist;
-        CreatePWHistoryList(afn(itr).GetPWHistory(), pwh_max, err_num,
-                            pwhistlist, PWSUtil::TMC_XML);
+        afn(itr).GetPWHistoryList(pwh_max, err_num,
+                                  pwhistlist, PWSUtil::TMC_XML);
         for (PWHistList::iterator iter = pwhistlist.begin(); iter != pwhistlist.end(); iter++) {
           PWHistEntry pwshe = *iter;
           found = fCaseSensitive? pwshe.password.find(searchText) != StringX::npos: FindNoCase(searchText, pwshe.password );
@@ -554,6 +557,17 @@ void PasswordSafeSearch::FindMatches(const StringX& searchText, bool fCaseSensit
   }
 }
 
+void PasswordSafeSearch::FindFuzzyMatches(const StringX& searchText, SearchPointer& searchPtr)
+{
+  // Allowing for typos, so only the best few are of interest
+  const size_t MaxFuzzyMatches = 50;
+
+  std::vector<st_FuzzyMatch> vMatches;
+  m_parentFrame->FuzzyFind(searchText, MaxFuzzyMatches, vMatches);
+  for (std::vector<st_FuzzyMatch>::const_iterator iter = vMatches.begin(); iter != vMatches.end(); ++iter)
+    searchPtr.Add(iter->uuid);
+}
+
 /////////////////////////////////////////////////
 // SearchPointer class definition
 SearchPointer& SearchPointer::operator++()
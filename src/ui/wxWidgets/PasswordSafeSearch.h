@@ -152,6 +152,8 @@ private:
                      const CItemData::FieldBits& bsFields, bool fUseSubgroups, const wxString& subgroupText,
                      CItemData::FieldType subgroupObject, PWSMatch::MatchRule subgroupFunction,
                      bool subgroupFunctionCaseSensitive, Iter begin, Iter end, Accessor afn);
+  // Closest entries, best first, for when FindMatches() finds none
+  void FindFuzzyMatches(const StringX& searchText, SearchPointer& searchPtr);
 
   void CreateSearchBar(void);
   void HideSearchToolbar();
@@ -338,8 +338,15 @@ void PasswordSafeFrame::Init()
   bsSupportedFunctions.set(UIInterFace::GUISETUPDISPLAYINFO);
   bsSupportedFunctions.set(UIInterFace::GUIREFRESHENTRY);
   //bsSupportedFunctions.set(UIInterFace::UPDATEWIZARD);
+#if wxCHECK_VERSION(2,9,5)
+  // Needs CallAfter, as it's called from the watcher's thread
+  bsSupportedFunctions.set(UIInterFace::DATABASEFILECHANGED);
+#endif
 
   m_core.SetUIInterFace(this, UIInterFace::NUM_SUPPORTED, bsSupportedFunctions);
+#if wxCHECK_VERSION(2,9,5)
+  m_core.StartWatchingCurFile(); // whichever's open from now on
+#endif
 
   m_RUEList.SetMax(PWSprefs::GetInstance()->PWSprefs::MaxREItems);
 ////@begin PasswordSafeFrame member initialisation
@@ -899,7 +906,7 @@ int PasswordSafeFrame::SaveImmediately()
 
 int PasswordSafeFrame::Save(SaveType st /* = ST_INVALID*/)
 {
-  stringT bu_fname; // used to undo backup if save failed
+  stringT bu_fname; // name of intermediate backup, if made
   PWSprefs *prefs = PWSprefs::GetInstance();
 
   // Save Application related preferences
@@ -975,9 +982,8 @@ int PasswordSafeFrame::Save(SaveType st /* = ST_INVALID*/)
   const int rc = m_core.WriteCurFile();
 
   if (rc != PWScore::SUCCESS) { // Save failed!
-    // Restore backup, if we have one
-    if (!bu_fname.empty() && !m_core.GetCurFile().empty())
-      pws_os::RenameFile(bu_fname, m_core.GetCurFile().c_str());
+    // No need to restore the backup: WriteFile leaves the
+    // original untouched unless the new file was written completely
     // Show user that we have a problem
     DisplayFileWriteError(rc, m_core.GetCurFile());
     return rc;
@@ -2178,6 +2184,46 @@ void PasswordSafeFrame::UpdateWizard(const stringT &)
   // Stub
 }
 
+void PasswordSafeFrame::DatabaseFileChanged(bool bLockFileOnly)
+{
+#if wxCHECK_VERSION(2,9,5)
+  CallAfter(&PasswordSafeFrame::OnDatabaseFileChanged, bLockFileOnly);
+#else
+  UNREFERENCED_PARAMETER(bLockFileOnly);
+#endif
+}
+
+void PasswordSafeFrame::OnDatabaseFileChanged(bool bLockFileOnly)
+{
+  // Someone else opening or closing the database isn't our concern,
+  // nor is a change while locked, as unlocking reads the file anyway
+  if (bLockFileOnly || IsClosed() || m_sysTray->IsLocked())
+    return;
+
+  const wxString cs_title(_("Database changed"));
+  wxString cs_msg;
+  cs_msg << towxstring(m_core.GetCurFile()) << wxT("\n\n")
+         << _("The database has been changed by another program.");
+  if (m_core.HasDBChanged()) {
+    cs_msg << wxT("\n") << _("Saving your changes will overwrite theirs.");
+    wxMessageBox(cs_msg, cs_title, wxOK | wxICON_WARNING, this);
+    return;
+  }
+  cs_msg << wxT("\n") << _("Reload it?");
+  if (wxMessageBox(cs_msg, cs_title, wxYES_NO | wxICON_QUESTION, this) == wxYES) {
+    const StringX passkey = m_core.GetPassKey();
+    if (ReloadDatabase(passkey))
+      RefreshViews();
+    else
+      CleanupAfterReloadFailure(true);
+  }
+}
+
+void PasswordSafeFrame::AsyncSaveCompleted(int)
+{
+  // Stub
+}
+
 /*!
  * wxEVT_COMMAND_MENU_SELECTED event handler for wxID_NEW
  */
@@ -199,6 +199,9 @@ public:
 
     virtual void UpdateWizard(const stringT &s);
 
+    virtual void DatabaseFileChanged(bool bLockFileOnly);
+    virtual void AsyncSaveCompleted(int status);
+
   ////@begin PasswordSafeFrame event handler declarations
 
   /// wxEVT_CLOSE_WINDOW event handler for ID_PASSWORDSAFEFRAME
@@ -416,6 +419,9 @@ public:
 
   ItemListConstIter GetEntryIter() const {return m_core.GetEntryIter();}
   ItemListConstIter GetEntryEndIter() const {return m_core.GetEntryEndIter();}
+  void FuzzyFind(const StringX &sxText, size_t maxResults,
+                 std::vector<st_FuzzyMatch> &vMatches) const
+  {m_core.FuzzyFind(sxText, maxResults, vMatches);}
 
   void Execute(Command *pcmd, PWScore *pcore = NULL);
 
@@ -482,6 +488,7 @@ public:
   void ShowTree(bool show = true);
   void ClearData();
   bool ReloadDatabase(const StringX& password);
+  void OnDatabaseFileChanged(bool bLockFileOnly); // see DatabaseFileChanged
   bool SaveAndClearDatabase();
   void CleanupAfterReloadFailure(bool tellUser);
   Command *Delete(CItemData *pci);
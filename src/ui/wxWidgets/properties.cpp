@@ -113,10 +113,8 @@ void CProperties::Init()
   m_databaseformat = wxString::Format(_T("%d.%02d"),
                                       m_core.GetHeader().m_nCurrentMajorVersion,
                                       m_core.GetHeader().m_nCurrentMinorVersion);
-  std::vector<stringT> aryGroups;
-  m_core.GetAllGroups(aryGroups);
   auto nEmptyGroups = m_core.GetEmptyGroups().size();
-  m_numgroups << aryGroups.size()
+  m_numgroups << m_core.GetGroupTree().GetNumGroups()
               << wxT(" (") << nEmptyGroups << _(" empty)");
 
   m_numentries << m_core.GetNumEntries();